@@ -1,57 +1,263 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 // 
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to flush it to disk.
+// * After changing buffer data, call bwrite to flush it to disk,
+//     or bdwrite to leave it for the flusher to write back later.
+// * To write back delayed writes now, call bflush.
 // * When done with the buffer, call brelse.
+// * To have a block read in the background for later, call bprefetch.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 // 
-// The implementation uses three state flags internally:
+// The implementation uses these state flags internally:
 // * B_BUSY: the block has been returned from bread
 //     and has not been passed back to brelse.  
 // * B_VALID: the buffer data has been initialized
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_LOG: the buffer is part of the open log transaction
+//     (log.c) and must be neither written nor recycled.
+//
+// Buffers are hashed by (dev, sector) into NBUCKET chains, each
+// with its own lock, which guards the chain and the B_BUSY flag of
+// its buffers.  A hit takes only that lock.  A miss also takes
+// bcache.lock, so that one process at a time moves the least
+// recently released idle buffer over to the new block's chain.
+// Idle buffers sit on two lists, clean and dirty, most recently
+// released first, so that buffer is the tail of one of them.
+// bcache.lrulock guards the lists and nests inside the chain locks.
+// The number of buffers is set at boot from the free memory.  The
+// data of a buffer is a BSIZE piece of a page of its own, so a 4KB
+// block is exactly one page.
+//
+// A buffer written with bdwrite stays B_DIRTY in the cache.  The
+// bflush kernel process writes dirty buffers back every BFLUSH_TICKS,
+// sorted by sector so the disk queue can merge them.  Replacement
+// takes clean buffers first and writes a dirty one out itself only
+// when no clean one is idle.
+//
+// Every disk read or write started here is charged to the process
+// that started it, in its inblock or oublock; delayed writes go to
+// the bflush process.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "trace.h"
 
-struct {
+#if BSIZE < 512 || BSIZE > PGSIZE || (BSIZE & (BSIZE - 1))
+#error BSIZE must be a power of two from 512 to PGSIZE
+#endif
+
+#define NBUCKET 127
+#define BFLUSH_BATCH 32     // buffers bflush() gathers and sorts at once
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;
+};
+
+struct lru {
+  struct buf *head;   // most recently released
+  struct buf *tail;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;   // serializes buffer replacement
+  struct buf *all;        // every buffer, through link
+  int nbuf;
+  struct bucket bucket[NBUCKET];
+  struct spinlock lrulock;
+  struct lru clean;       // idle clean buffers
+  struct lru dirty;       // idle dirty buffers
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint sector)
+{
+  return &bcache.bucket[(dev * 31 + sector) % NBUCKET];
+}
+
+// Unlink b from the chain of bk.  Caller must hold bk->lock.
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+// Put b at the front of the chain of bk.  Caller must hold bk->lock.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(bk->head)
+    bk->head->prev = b;
+  bk->head = b;
+}
+
+// Put idle b at the front of the idle list for its state.  Caller
+// must hold the lock of b's chain.  Pinned buffers go on no list.
+static void
+lruput(struct buf *b)
+{
+  struct lru *l;
+
+  if(b->flags & B_LOG)
+    return;
+  l = (b->flags & B_DIRTY) ? &bcache.dirty : &bcache.clean;
+  acquire(&bcache.lrulock);
+  b->lru = l;
+  b->lprev = 0;
+  b->lnext = l->head;
+  if(l->head)
+    l->head->lprev = b;
+  else
+    l->tail = b;
+  l->head = b;
+  release(&bcache.lrulock);
+}
+
+// Take b, which is about to be made busy, off its idle list.  Caller
+// must hold the lock of b's chain.
+static void
+lrudel(struct buf *b)
+{
+  struct lru *l;
+
+  acquire(&bcache.lrulock);
+  if((l = b->lru) != 0){
+    if(b->lprev)
+      b->lprev->lnext = b->lnext;
+    else
+      l->head = b->lnext;
+    if(b->lnext)
+      b->lnext->lprev = b->lprev;
+    else
+      l->tail = b->lprev;
+    b->lru = 0;
+  }
+  release(&bcache.lrulock);
+}
+
+static void bflusher(void*);
+
 void
 binit(void)
 {
   struct buf *b;
+  char *hp, *dp;
+  int i, n, nh, nd;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Carve buffers and their data out of whole pages, headers and
+  // data apart; they start out on no chain.
+  n = kfreepages() / NBUF_SHARE * PGSIZE / (sizeof(struct buf) + BSIZE);
+  if(n < NBUF_MIN)
+    n = NBUF_MIN;
+  hp = dp = 0;
+  nh = nd = 0;
+  while(bcache.nbuf < n){
+    if(nh == 0){
+      if((hp = kalloc()) == 0)
+        break;
+      nh = PGSIZE / sizeof(struct buf);
+    }
+    if(nd == 0){
+      if((dp = kalloc()) == 0)
+        break;
+      nd = PGSIZE / BSIZE;
+    }
+    b = (struct buf*)hp;
+    hp += sizeof(*b);
+    nh--;
+    memset(b, 0, sizeof(*b));
+    b->data = (uchar*)dp;
+    dp += BSIZE;
+    nd--;
     b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->link = bcache.all;
+    bcache.all = b;
+    bcache.nbuf++;
+    lruput(b);
+  }
+  if(bcache.nbuf == 0)
+    panic("binit");
+  if(kproc("bflush", bflusher, 0) < 0)
+    panic("binit: bflush");
+}
+
+// Find the clean idle buffer released longest ago and move it to
+// chain bk.  Caller must hold bcache.lock and bk->lock.  Returns 0
+// if every buffer is busy, or if every idle one is dirty: then the
+// oldest of those is marked busy and stored in *dirty for the caller
+// to write back, and *dirty is 0 otherwise.
+static struct buf*
+brecycle(struct bucket *bk, struct buf **dirty)
+{
+  struct buf *victim;
+  struct bucket *vb;
+
+  *dirty = 0;
+  for(;;){
+    // The tail is taken without the chain lock and checked again
+    // under it below.  Its dev and sector only change under
+    // bcache.lock, which we hold.
+    acquire(&bcache.lrulock);
+    victim = bcache.clean.tail ? bcache.clean.tail : bcache.dirty.tail;
+    release(&bcache.lrulock);
+    if(victim == 0)
+      return 0;
+    if(victim->dev == (uint)-1){
+      // Never used, so on no chain yet.  Only we hand these out.
+      lrudel(victim);
+      bpush(bk, victim);
+      return victim;
+    }
+    vb = bhash(victim->dev, victim->sector);
+    if(vb != bk)
+      acquire(&vb->lock);
+    if(victim->lru == 0){
+      // Made busy since; look again.
+      if(vb != bk)
+        release(&vb->lock);
+      continue;
+    }
+    lrudel(victim);
+    if(victim->flags & B_DIRTY){
+      victim->flags |= B_BUSY;
+      if(vb != bk)
+        release(&vb->lock);
+      *dirty = victim;
+      return 0;
+    }
+    bunlink(vb, victim);
+    if(vb != bk)
+      release(&vb->lock);
+    bpush(bk, victim);
+    return victim;
   }
 }
 
@@ -61,35 +267,62 @@ binit(void)
 static struct buf*
 bget(uint dev, uint sector)
 {
-  struct buf *b;
+  struct bucket *bk;
+  struct buf *b, *dirty;
+  int replacing;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, sector);
+  replacing = 0;
+  acquire(&bk->lock);
 
  loop:
   // Try for cached block.
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head; b; b = b->next){
     if(b->dev == dev && b->sector == sector){
+      if(replacing)
+        release(&bcache.lock);
       if(!(b->flags & B_BUSY)){
         b->flags |= B_BUSY;
-        release(&bcache.lock);
+        lrudel(b);
+        release(&bk->lock);
         return b;
       }
-      sleep(b, &bcache.lock);
+      replacing = 0;
+      sleep(b, &bk->lock);
       goto loop;
     }
   }
+  if(!replacing){
+    // Take bcache.lock before bk->lock, then look again: the block
+    // may have come in while neither was held.
+    release(&bk->lock);
+    acquire(&bcache.lock);
+    acquire(&bk->lock);
+    replacing = 1;
+    goto loop;
+  }
 
   // Allocate fresh block.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
-    }
+  if((b = brecycle(bk, &dirty)) == 0){
+    if(dirty == 0)
+      panic("bget: no buffers");
+    // Write the oldest delayed write back ourselves and look again.
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(proc)
+      proc->oublock++;
+    iderw(dirty);
+    brelse(dirty);
+    acquire(&bk->lock);
+    replacing = 0;
+    goto loop;
   }
-  panic("bget: no buffers");
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = B_BUSY;
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -99,11 +332,61 @@ bread(uint dev, uint sector)
   struct buf *b;
 
   b = bget(dev, sector);
-  if(!(b->flags & B_VALID))
+  if(!(b->flags & B_VALID)){
+    TRACE(TR_BMISS, sector, dev);
+    if(proc)
+      proc->inblock++;
     iderw(b);
+  }
   return b;
 }
 
+// Start reading sector into the cache, but do not wait for it:
+// ideintr() releases the buffer when the data is in.  Does nothing
+// if the block is cached or every buffer is busy.  Never sleeps.
+void
+bprefetch(uint dev, uint sector)
+{
+  struct bucket *bk;
+  struct buf *b, *dirty;
+
+  bk = bhash(dev, sector);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->sector == sector)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  dirty = 0;
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->sector == sector)
+      break;
+  if(b || (b = brecycle(bk, &dirty)) == 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(dirty){
+      // Start it on its way back so a buffer comes free.
+      dirty->flags |= B_ASYNC;
+      if(proc)
+        proc->oublock++;
+      iderw(dirty);
+    }
+    return;
+  }
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = B_BUSY | B_ASYNC;
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(proc)
+    proc->inblock++;
+  iderw(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,28 +394,188 @@ bwrite(struct buf *b)
   if((b->flags & B_BUSY) == 0)
     panic("bwrite");
   b->flags |= B_DIRTY;
+  TRACE(TR_BWRITE, b->sector, b->dev);
+  if(proc)
+    proc->oublock++;
   iderw(b);
 }
 
+// Wait until b, which held sector of dev, is not busy with it.
+static void
+bwait(struct buf *b, uint dev, uint sector)
+{
+  struct bucket *bk;
+
+  bk = bhash(dev, sector);
+  acquire(&bk->lock);
+  while(b->dev == dev && b->sector == sector && (b->flags & B_BUSY))
+    sleep(b, &bk->lock);
+  release(&bk->lock);
+}
+
+// Wait until b, which held sector of dev, has its contents on disk.
+// If b is still dirty once whoever has it busy lets go, write it
+// back, once: that write has all that was there when we came.
+static void
+bsync(struct buf *b, uint dev, uint sector)
+{
+  struct bucket *bk;
+  int wrote;
+
+  bk = bhash(dev, sector);
+  acquire(&bk->lock);
+  wrote = 0;
+  while(b->dev == dev && b->sector == sector){
+    if(b->flags & B_BUSY){
+      sleep(b, &bk->lock);
+      continue;
+    }
+    if(wrote || (b->flags & (B_DIRTY|B_LOG)) != B_DIRTY)
+      break;
+    b->flags |= B_BUSY | B_ASYNC;
+    lrudel(b);
+    release(&bk->lock);
+    if(proc)
+      proc->oublock++;
+    iderw(b);   // ideintr() releases it when written
+    wrote = 1;
+    acquire(&bk->lock);
+  }
+  release(&bk->lock);
+}
+
+// Mark b's contents for writing back later.  Must be locked.
+void
+bdwrite(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bdwrite");
+  b->flags |= B_DIRTY;
+}
+
+// Write back the idle dirty buffers of dev, or of every device if
+// dev is -1.  With wait set, also take the dirty buffers others have
+// busy, and wait until all of them are on disk, writing back those
+// still dirty when let go.  The caller must not hold any buffer of
+// dev busy when it waits.
+void
+bflush(uint dev, int wait)
+{
+  struct {
+    struct buf *b;
+    uint dev;
+    uint sector;
+    int mine;
+  } w[BFLUSH_BATCH], t;
+  struct bucket *bk;
+  struct buf *b, *next;
+  uint d, s;
+  int i, j, n;
+
+  for(next = bcache.all; next; ){
+    // Claim a batch, sorted by (dev, sector).
+    n = 0;
+    for(b = next; b && n < BFLUSH_BATCH; b = b->link){
+      next = b->link;
+      d = b->dev;
+      s = b->sector;
+      if((b->flags & (B_DIRTY|B_LOG)) != B_DIRTY ||
+         (dev != (uint)-1 && d != dev))
+        continue;
+      bk = bhash(d, s);
+      acquire(&bk->lock);
+      if(b->dev != d || b->sector != s ||
+         (b->flags & (B_DIRTY|B_LOG)) != B_DIRTY ||
+         ((b->flags & B_BUSY) && !wait)){
+        release(&bk->lock);
+        continue;
+      }
+      t.b = b;
+      t.dev = d;
+      t.sector = s;
+      t.mine = !(b->flags & B_BUSY);
+      if(t.mine){
+        b->flags |= B_BUSY;
+        lrudel(b);
+      }
+      release(&bk->lock);
+      for(j = n++; j > 0 && (w[j-1].dev > d ||
+                             (w[j-1].dev == d && w[j-1].sector > s)); j--)
+        w[j] = w[j-1];
+      w[j] = t;
+    }
+
+    // ideintr() releases them when written.
+    for(i = 0; i < n; i++){
+      if(w[i].mine){
+        w[i].b->flags |= B_ASYNC;
+        if(proc)
+          proc->oublock++;
+        iderw(w[i].b);
+      }
+    }
+    if(!wait)
+      continue;
+    for(i = 0; i < n; i++)
+      bsync(w[i].b, w[i].dev, w[i].sector);
+  }
+}
+
+// Write the n busy buffers in v to disk and release them.  They are
+// queued together so the disk can merge neighbours; returns when all
+// are written.
+void
+bwritev(struct buf **v, int n)
+{
+  uint dev[BFLUSH_BATCH], sector[BFLUSH_BATCH];
+  int i, m;
+
+  for(; n > 0; v += m, n -= m){
+    m = n < BFLUSH_BATCH ? n : BFLUSH_BATCH;
+    for(i = 0; i < m; i++){
+      if((v[i]->flags & B_BUSY) == 0)
+        panic("bwritev");
+      dev[i] = v[i]->dev;
+      sector[i] = v[i]->sector;
+      v[i]->flags |= B_DIRTY | B_ASYNC;
+      if(proc)
+        proc->oublock++;
+      iderw(v[i]);
+    }
+    for(i = 0; i < m; i++)
+      bwait(v[i], dev[i], sector[i]);
+  }
+}
+
+// Write back delayed writes every BFLUSH_TICKS.
+static void
+bflusher(void *arg)
+{
+  (void)arg;
+  for(;;){
+    ticksleep(BFLUSH_TICKS);
+    bflush(-1, 0);
+  }
+}
+
 // Release the buffer b.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if((b->flags & B_BUSY) == 0)
     panic("brelse");
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->sector);
+  acquire(&bk->lock);
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+  bunlink(bk, b);
+  bpush(bk, b);
 
   b->flags &= ~B_BUSY;
+  lruput(b);
   wakeup(b);
 
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
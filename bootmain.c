@@ -11,6 +11,8 @@
 
 #define SECTSIZE  512
 
+#define MAXSECTS  256   // most sectors one read command can take
+
 void readseg(uchar*, uint, uint);
 
 void
@@ -46,7 +48,7 @@ bootmain(void)
   entry();
 }
 
-void
+static void
 waitdisk(void)
 {
   // Wait for disk ready.
@@ -54,13 +56,15 @@ waitdisk(void)
     ;
 }
 
-// Read a single sector at offset into dst.
-void
-readsect(void *dst, uint offset)
+// Read n sectors, 1 to MAXSECTS, starting at sector offset into dst,
+// with one command.  The disk still hands over the data a sector at
+// a time, each once it is ready.
+static void
+readsect(uchar *dst, uint offset, uint n)
 {
   // Issue command.
   waitdisk();
-  outb(0x1F2, 1);   // count = 1
+  outb(0x1F2, n);   // count; 0 means 256
   outb(0x1F3, offset);
   outb(0x1F4, offset >> 8);
   outb(0x1F5, offset >> 16);
@@ -68,8 +72,10 @@ readsect(void *dst, uint offset)
   outb(0x1F7, 0x20);  // cmd 0x20 - read sectors
 
   // Read data.
-  waitdisk();
-  insl(0x1F0, dst, SECTSIZE/4);
+  for(; n > 0; n--, dst += SECTSIZE){
+    waitdisk();
+    insl(0x1F0, dst, SECTSIZE/4);
+  }
 }
 
 // Read 'count' bytes at 'offset' from kernel into virtual address 'va'.
@@ -77,9 +83,10 @@ readsect(void *dst, uint offset)
 void
 readseg(uchar* va, uint count, uint offset)
 {
-  uchar* eva;
+  uint n, m;
 
-  eva = va + count;
+  // Sectors to read, from the one holding the first byte.
+  n = (offset % SECTSIZE + count + SECTSIZE - 1) / SECTSIZE;
 
   // Round down to sector boundary.
   va -= offset % SECTSIZE;
@@ -87,9 +94,13 @@ readseg(uchar* va, uint count, uint offset)
   // Translate from bytes to sectors; kernel starts at sector 1.
   offset = (offset / SECTSIZE) + 1;
 
-  // If this is too slow, we could read lots of sectors at a time.
-  // We'd write more to memory than asked, but it doesn't matter --
-  // we load in increasing order.
-  for(; va < eva; va += SECTSIZE, offset++)
-    readsect(va, offset);
+  // Read as many sectors as a command allows at a time.  We'd write
+  // more to memory than asked, but it doesn't matter -- we load in
+  // increasing order.
+  for(; n > 0; n -= m){
+    m = n < MAXSECTS ? n : MAXSECTS;
+    readsect(va, offset, m);
+    va += m * SECTSIZE;
+    offset += m;
+  }
 }
@@ -1,13 +1,20 @@
 struct buf {
   int flags;
   uint dev;
-  uint sector;
-  struct buf *prev; // LRU cache list
+  uint sector;       // block number, in BSIZE units
+  struct buf *prev; // hash chain, most recently used first
   struct buf *next;
+  struct buf *link; // list of all buffers
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uint qstamp;      // ticks when queued on disk
+  struct lru *lru;  // idle list b is on, or 0 when busy or pinned
+  struct buf *lprev; // idle list, most recently released first
+  struct buf *lnext;
+  uchar *data;      // BSIZE bytes, aligned to BSIZE
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read ahead: ideintr releases the buffer
+#define B_LOG   0x10 // in the open log transaction: not to be written back
 
@@ -0,0 +1,195 @@
+// Callouts: functions to call at a given clock tick.
+//
+// Pending callouts are kept in a hierarchical timing wheel.  The
+// first level has a slot for each of the next 256 ticks; each higher
+// level has 64 slots, each covering a whole turn of the level below.
+// A callout goes in the lowest level that reaches its tick.  When a
+// level comes round to the start of a turn, the next slot of the
+// level above is emptied into it according to each callout's tick.
+// So arming and stopping a callout take constant time, and a tick
+// only looks at the callouts due then, plus now and then one
+// slot of a higher level.
+//
+// calltick() runs on every clock tick, from the timer interrupt
+// with no locks held, and calls the functions of the callouts that
+// are due.  They run in interrupt context and must not sleep.  A
+// function may arm its own or any other callout.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "callout.h"
+
+#define WBITS0  8
+#define WBITS   6
+#define WSIZE0  (1 << WBITS0)
+#define WSIZE   (1 << WBITS)
+#define NLEVEL  4     // levels above the first
+
+static struct {
+  struct spinlock lock;
+  uint now;                             // next tick to run
+  struct callout *slot0[WSIZE0];
+  struct callout *slot[NLEVEL][WSIZE];
+} wheel;
+
+void
+calloutinit(void)
+{
+  initlock(&wheel.lock, "callout");
+  wheel.now = ticks;
+}
+
+static void
+link(struct callout **head, struct callout *c)
+{
+  if((c->next = *head) != 0)
+    c->next->prev = &c->next;
+  c->prev = head;
+  *head = c;
+}
+
+static void
+unlink(struct callout *c)
+{
+  if((*c->prev = c->next) != 0)
+    c->next->prev = c->prev;
+  c->next = 0;
+  c->prev = 0;
+}
+
+// Put c in the slot for c->when.  Caller must hold wheel.lock.
+static void
+insert(struct callout *c)
+{
+  uint d, when;
+  int i;
+
+  when = c->when;
+  if((int)(when - wheel.now) < 0)
+    when = wheel.now;
+  d = when - wheel.now;
+  if(d < WSIZE0){
+    link(&wheel.slot0[when % WSIZE0], c);
+    return;
+  }
+  for(i = 0; i < NLEVEL - 1; i++)
+    if(d < 1U << (WBITS0 + (i+1)*WBITS))
+      break;
+  link(&wheel.slot[i][(when >> (WBITS0 + i*WBITS)) % WSIZE], c);
+}
+
+// Empty slot s of level i into the levels below.
+// Caller must hold wheel.lock.
+static void
+cascade(int i, int s)
+{
+  struct callout *list, *c;
+
+  list = 0;
+  while((c = wheel.slot[i][s]) != 0){
+    unlink(c);
+    link(&list, c);
+  }
+  while((c = list) != 0){
+    unlink(c);
+    insert(c);
+  }
+}
+
+// Prepare c to call fn(arg).
+void
+callinit(struct callout *c, void (*fn)(void*), void *arg)
+{
+  c->fn = fn;
+  c->arg = arg;
+  c->pending = 0;
+  c->next = 0;
+  c->prev = 0;
+}
+
+// Call c's function at tick when, instead of whenever it was due.
+void
+callat(struct callout *c, uint when)
+{
+  acquire(&wheel.lock);
+  if(c->pending)
+    unlink(c);
+  c->when = when;
+  c->pending = 1;
+  insert(c);
+  release(&wheel.lock);
+}
+
+// Call c's function at tick when, unless it is already due sooner.
+void
+callsooner(struct callout *c, uint when)
+{
+  acquire(&wheel.lock);
+  if(!c->pending || (int)(when - c->when) < 0){
+    if(c->pending)
+      unlink(c);
+    c->when = when;
+    c->pending = 1;
+    insert(c);
+  }
+  release(&wheel.lock);
+}
+
+// Cancel c if it is pending.  Its function may still be running on
+// another CPU.
+void
+callstop(struct callout *c)
+{
+  acquire(&wheel.lock);
+  if(c->pending){
+    unlink(c);
+    c->pending = 0;
+  }
+  release(&wheel.lock);
+}
+
+// Run the callouts due up to the current tick.
+void
+calltick(void)
+{
+  struct callout *due, *c;
+  void (*fn)(void*);
+  void *arg;
+  uint t;
+  int i, s;
+
+  acquire(&wheel.lock);
+  while((int)(ticks - wheel.now) >= 0){
+    t = wheel.now;
+    // At the start of a turn, pull in the next slot of the level
+    // above, and so on up while that is the start of a turn too.
+    if(t % WSIZE0 == 0){
+      for(i = 0; i < NLEVEL; i++){
+        s = (t >> (WBITS0 + i*WBITS)) % WSIZE;
+        cascade(i, s);
+        if(s != 0)
+          break;
+      }
+    }
+    // Take the slot first, so that a callout armed for now from
+    // here on lands in the slot of the next tick.
+    due = 0;
+    while((c = wheel.slot0[t % WSIZE0]) != 0){
+      unlink(c);
+      link(&due, c);
+    }
+    wheel.now++;
+    while((c = due) != 0){
+      unlink(c);
+      c->pending = 0;
+      fn = c->fn;
+      arg = c->arg;
+      release(&wheel.lock);
+      fn(arg);
+      acquire(&wheel.lock);
+    }
+  }
+  release(&wheel.lock);
+}
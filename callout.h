@@ -0,0 +1,9 @@
+// A function to call at a clock tick; see callout.c.
+struct callout {
+  uint when;              // tick it is due
+  int pending;            // armed and not yet run
+  void (*fn)(void*);
+  void *arg;
+  struct callout *next;   // in its wheel slot
+  struct callout **prev;
+};
@@ -1,6 +1,8 @@
 // Console input and output.
 // Input is from the keyboard or serial port.
 // Output is written to the screen and serial port.
+// What the kernel prints is also kept in the kernel log, which
+// kstat(KSTAT_LOG) reads; logprintf() prints to the log alone.
 
 #include "types.h"
 #include "defs.h"
@@ -12,18 +14,33 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
 
 static void consputc(int);
+static void cgacursor(void);
 
 static int panicked = 0;
 
+#define KLOGSIZE 8192
+
 static struct {
   struct spinlock lock;
   int locking;
+  uint nlog;              // bytes ever logged
+  char log[KLOGSIZE];     // the last of them
 } cons;
 
+// Log c, and print it unless only logging.
+static void
+kputc(int c, int print)
+{
+  cons.log[cons.nlog++ % KLOGSIZE] = c;
+  if(print)
+    consputc(c);
+}
+
 static void
-printint(int xx, int base, int sign)
+printint(int xx, int base, int sign, int print)
 {
   static char digits[] = "0123456789abcdef";
   char buf[16];
@@ -44,25 +61,20 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    kputc(buf[i], print);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
-void
-cprintf(char *fmt, ...)
+// Format fmt with the arguments at argp into the log, and print it
+// unless only logging.  Caller holds cons.lock if locking.
+static void
+vprintf(char *fmt, uint *argp, int print)
 {
-  int i, c, locking;
-  uint *argp;
+  int i, c;
   char *s;
 
-  locking = cons.locking;
-  if(locking)
-    acquire(&cons.lock);
-
-  argp = (uint*)(void*)(&fmt + 1);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      kputc(c, print);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -70,33 +82,89 @@ cprintf(char *fmt, ...)
       break;
     switch(c){
     case 'd':
-      printint(*argp++, 10, 1);
+      printint(*argp++, 10, 1, print);
       break;
     case 'x':
     case 'p':
-      printint(*argp++, 16, 0);
+      printint(*argp++, 16, 0, print);
       break;
     case 's':
       if((s = (char*)*argp++) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        kputc(*s, print);
       break;
     case '%':
-      consputc('%');
+      kputc('%', print);
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      kputc('%', print);
+      kputc(c, print);
       break;
     }
   }
+}
+
+// Print to the console. only understands %d, %x, %p, %s.
+void
+cprintf(char *fmt, ...)
+{
+  int locking;
 
+  locking = cons.locking;
+  if(locking)
+    acquire(&cons.lock);
+  vprintf(fmt, (uint*)(void*)(&fmt + 1), 1);
+  cgacursor();
   if(locking)
     release(&cons.lock);
 }
 
+// Like cprintf(), but only to the kernel log, for messages too
+// many or too slow for the console.
+void
+logprintf(char *fmt, ...)
+{
+  int locking;
+
+  locking = cons.locking;
+  if(locking)
+    acquire(&cons.lock);
+  vprintf(fmt, (uint*)(void*)(&fmt + 1), 0);
+  if(locking)
+    release(&cons.lock);
+}
+
+// Copy the end of the kernel log, at most n bytes, into buf.
+// Returns the number of bytes copied.  The copy goes through a
+// buffer on the stack, so a fault on user memory in buf comes with
+// no lock held.
+int
+logread(char *buf, int n)
+{
+  char tmp[128];
+  uint start;
+  int i, k, m;
+
+  acquire(&cons.lock);
+  if((uint)n > cons.nlog)
+    n = cons.nlog;
+  if(n > KLOGSIZE)
+    n = KLOGSIZE;
+  start = cons.nlog - n;
+  release(&cons.lock);
+  for(k = 0; k < n; k += m){
+    m = n - k < (int)sizeof(tmp) ? n - k : (int)sizeof(tmp);
+    acquire(&cons.lock);
+    for(i = 0; i < m; i++)
+      tmp[i] = cons.log[(start + k + i) % KLOGSIZE];
+    release(&cons.lock);
+    memmove(buf + k, tmp, m);
+  }
+  return n;
+}
+
 void
 panic(char *s)
 {
@@ -120,16 +188,23 @@ panic(char *s)
 #define CRTPORT 0x3d4
 static ushort *crt = (ushort*)0xb8000;  // CGA memory
 
+// The cursor position: col + 80*row, or -1 until read from the CRT.
+// Writes move the hardware cursor only once they are done; see
+// cgacursor().
+static int cgapos = -1;
+
 static void
 cgaputc(int c)
 {
   int pos;
   
-  // Cursor position: col + 80*row.
-  outb(CRTPORT, 14);
-  pos = inb(CRTPORT+1) << 8;
-  outb(CRTPORT, 15);
-  pos |= inb(CRTPORT+1);
+  if(cgapos < 0){
+    outb(CRTPORT, 14);
+    cgapos = inb(CRTPORT+1) << 8;
+    outb(CRTPORT, 15);
+    cgapos |= inb(CRTPORT+1);
+  }
+  pos = cgapos;
 
   if(c == '\n')
     pos += 80 - pos%80;
@@ -144,11 +219,30 @@ cgaputc(int c)
     memset(crt+pos, 0, sizeof(crt[0])*(24*80 - pos));
   }
   
+  cgapos = pos;
+  crt[pos] = ' ' | 0x0700;
+}
+
+// Move the hardware cursor to where the output has got to.
+static void
+cgacursor(void)
+{
+  if(cgapos < 0)
+    return;
   outb(CRTPORT, 14);
-  outb(CRTPORT+1, pos>>8);
+  outb(CRTPORT+1, cgapos>>8);
   outb(CRTPORT, 15);
-  outb(CRTPORT+1, pos);
-  crt[pos] = ' ' | 0x0700;
+  outb(CRTPORT+1, cgapos);
+}
+
+static void
+uartout(int c)
+{
+  // panic() gives up the lock and the interrupts.
+  if(cons.locking)
+    uartputc(c);
+  else
+    uartputc_sync(c);
 }
 
 void
@@ -161,9 +255,9 @@ consputc(int c)
   }
 
   if(c == BACKSPACE){
-    uartputc('\b'); uartputc(' '); uartputc('\b');
+    uartout('\b'); uartout(' '); uartout('\b');
   } else
-    uartputc(c);
+    uartout(c);
   cgaputc(c);
 }
 
@@ -215,6 +309,7 @@ consoleintr(int (*getc)(void))
       break;
     }
   }
+  cgacursor();
   release(&input.lock);
 }
 
@@ -258,6 +353,25 @@ consoleread(struct inode *ip, char *dst, int n)
   return (int)(target - (uint)n);
 }
 
+// Writes never wait.
+int
+consolepoll(struct inode *ip, int events)
+{
+  int r;
+
+  (void)ip;
+  r = events & POLLOUT;
+  if(events & POLLIN){
+    acquire(&input.lock);
+    if(input.r != input.w)
+      r |= POLLIN;
+    else
+      pollwait(&input.r);
+    release(&input.lock);
+  }
+  return r;
+}
+
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
@@ -267,6 +381,7 @@ consolewrite(struct inode *ip, char *buf, int n)
   acquire(&cons.lock);
   for(i = 0; i < n; i++)
     consputc(buf[i] & 0xff);
+  cgacursor();
   release(&cons.lock);
   ilock(ip);
 
@@ -281,6 +396,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   picenable(IRQ_KBD);
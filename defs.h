@@ -1,30 +1,58 @@
 struct buf;
 struct context;
+struct diskstat;
+struct fdtable;
 struct file;
 struct inode;
+struct irqstat;
+struct lockstat;
 struct pipe;
 struct proc;
+struct procstat;
+struct profsample;
+struct rusage;
+struct sock;
+struct sockaddr_in;
 struct spinlock;
 struct stat;
+struct superblock;
+struct syscallstat;
+struct trapframe;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bprefetch(uint, uint);
+void            bdwrite(struct buf*);
+void            bflush(uint, int);
+void            bwritev(struct buf**, int);
+
+// callout.c
+struct callout;
+void            calloutinit(void);
+void            callinit(struct callout*, void (*)(void*), void*);
+void            callat(struct callout*, uint);
+void            callsooner(struct callout*, uint);
+void            callstop(struct callout*);
+void            calltick(void);
 
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
+void            logprintf(char*, ...);
+int             logread(char*, int);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
 // net/eth.c
 void            ethinit(void);
-void            ethintr(void);
+void            ethintr(int);
 
 // exec.c
 int             exec(char*, char**);
+void            execinit(void);
 
 // file.c
 struct file*    filealloc(void);
@@ -35,10 +63,22 @@ int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 int             fileioctl(struct file*, int, void*);
+int             filepoll(struct file*, int);
+struct fdtable* fdtalloc(void);
+struct fdtable* fdtcopy(void);
+struct fdtable* fdtshare(struct fdtable*);
+void            fdtclose(struct fdtable*);
+struct file*    fdget(int);
+void            fdrelease(void);
+int             fdalloc(struct file*);
+struct file*    fdremove(int);
+struct inode*   cwdget(void);
+struct inode*   cwdset(struct inode*);
 
 // fs.c
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dcacheforget(struct inode*, char*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(void);
@@ -51,23 +91,39 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readifn(struct inode*, uint, uint, int (*)(void*, char*, int), void*);
+void            readsb(int dev, struct superblock *sb);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futex(int*, int, int);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idestats(struct diskstat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+int             ioapicroute(int irq, int cpu);
+int             ioapicirqcpu(int irq);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+extern uint     phystop;
 char*           kalloc(void);
 void            kfree(char*);
 void            kinit(void);
+int             kfreepages(void);
+char*           kzalloc(void);
+void            kdup(char*);
+int             kunshare(char*);
+int             kshared(char*);
+void            kzfill(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -77,8 +133,17 @@ int             cpunum(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(int);
-void            lapicstartap(uchar, uint);
-void            microdelay(int);
+void            lapicstartaps(uint);
+void            lapictimer(int);
+void            lapicipi(int, int);
+
+// log.c
+void            loginit(void);
+void            initlog(void);
+void            log_write(struct buf*);
+void            log_force(void);
+void            begin_op(void);
+void            end_op(void);
 
 // mp.c
 extern int      ismp;
@@ -90,9 +155,35 @@ void            mpstartthem(void);
 void            picenable(int);
 void            picinit(void);
 
+// net/ip.c
+void            netinit(void);
+
+// net/socket.c
+int             sockalloc(struct file**, int);
+void            sockclose(struct sock*);
+int             sockbind(struct sock*, int);
+int             socksendto(struct sock*, char*, int, struct sockaddr_in*);
+int             sockrecvfrom(struct sock*, char*, int, struct sockaddr_in*);
+int             sockread(struct sock*, char*, int);
+int             sockwrite(struct sock*, char*, int);
+int             socklisten(struct sock*, int);
+int             sockaccept(struct sock*, struct file**, struct sockaddr_in*);
+int             sockconnect(struct sock*, struct sockaddr_in*);
+int             socksetopt(struct sock*, int, int);
+int             sockpoll(struct sock*, int);
+int             socksendfile(struct sock*, struct file*, int);
+
+// pci.c
+uint            pciread(uint, int);
+void            pciwrite(uint, int, uint);
+int             pcifind(int, int, uint*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+int             pipeioctl(struct pipe*, int, void*);
+int             pipepoll(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
@@ -100,8 +191,14 @@ int             pipewrite(struct pipe*, char*, int);
 struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
+int             vfork(void);
+void            vforkdone(void);
+int             clone(void(*)(void*), void*, char*, uint);
+int             join(void**);
+void            setsz(uint);
 int             growproc(int);
 int             kill(int);
+int             kproc(char*, void (*)(void*), void*);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -111,20 +208,53 @@ void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
+void            tickyield(void);
+void            wakeupboost(void*);
+int             wakeupn(void*, int);
+int             setpriority(int, int, int);
+int             getrusage(int, struct rusage*);
+int             procstat(struct procstat*, int);
+void            pollwait(void*);
+void            pollsleep(void);
+void            polldone(void);
+
+// profile.c
+extern int      profmode;
+void            profsample(struct trapframe*);
+int             profset(int);
+int             profcopy(struct profsample*, int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+struct kcache;
+void            kcacheinit(void);
+struct kcache*  kcache_create(char*, uint, void (*)(void*));
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+void*           kmalloc(uint);
+void            kmfree(void*);
+
+// softirq.c
+struct softirq;
+void            softinit(struct softirq*, void (*)(void*), void*);
+void            softraise(struct softirq*);
+int             insoftirq(void);
+void            softirq(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+int             lockstats(struct lockstat*, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
 // string.c
+extern int      memsse;
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
@@ -133,27 +263,51 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, int);
+int             shmat(int);
+int             shmrm(int);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argout(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(struct proc*, uint, int*);
 int             fetchstr(struct proc*, uint, char**);
 void            syscall(void);
+int             syscallstats(struct syscallstat*, int);
+
+// trace.c
+struct tracerec;
+extern uint     tracemask;
+void            traceev(int, uint, uint);
+int             tracecopy(struct tracerec*, int);
 
 // timer.c
+extern char     clockpage[];
 void            timerinit(void);
+void            clockinit(void);
+uint64          nanotime(void);
+void            microdelay(int);
 
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+int             ticksleep(uint);
+void            irqstats(struct irqstat*);
 void            tvinit(void);
 extern struct spinlock tickslock;
 
+// trapasm.S
+void            sysentry(void);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartputc_sync(int);
 
 // vm.c
 void            seginit(void);
@@ -161,15 +315,24 @@ void            kvmalloc(void);
 void            vmenable(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+char*           uva2kaw(pde_t*, char*, int*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
+int             mapuvm(pde_t*, uint, char*, int);
 pde_t*          copyuvm(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+int             zerofault(pde_t*, uint);
+int             killfault(pde_t*, uint);
+int             prepwrite(pde_t*, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            tlbpoll(void);
+void            tlbshootdown(pde_t*);
 int             copyout(pde_t*, uint, void*, uint);
+int             mapshared(pde_t*, uint, char**, int);
+int             mapshm(pde_t*, uint, char**, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -0,0 +1,162 @@
+// dmesg: print the kernel log, or the trace events.
+//
+//   dmesg
+//   dmesg -t
+//   dmesg -e all | none | sub[,sub...]
+//
+// With no argument, prints what is left of the kernel log: what the
+// kernel printed on the console, and the messages it only logs, such
+// as those of ETH_VERBOSE.  -t prints the trace events of all CPUs,
+// oldest first, one per line:
+//   [seconds.micros] cpuN event a=... b=...
+// -e switches tracing on for the subsystems named, out of sched, ide,
+// bio and eth, and off for the others.
+
+#include "types.h"
+#include "user.h"
+#include "param.h"
+#include "kstat.h"
+#include "trace.h"
+
+#define KLOGSIZE 8192    // as in console.c
+
+char logbuf[KLOGSIZE];
+struct tracerec recs[NCPU*NTRACE];
+
+struct {
+  char *name;
+  int mask;
+} subs[] = {
+  { "sched", TRACE_SCHED },
+  { "ide", TRACE_IDE },
+  { "bio", TRACE_BIO },
+  { "eth", TRACE_ETH },
+};
+
+char *evnames[] = {
+[TR_SWITCH] = "switch pid=%d cpu=%d",
+[TR_WAKE] = "wake pid=%d boost=%d",
+[TR_IDEREAD] = "ide-read sector=%d n=%d",
+[TR_IDEWRITE] = "ide-write sector=%d n=%d",
+[TR_IDEDONE] = "ide-done sector=%d n=%d",
+[TR_BMISS] = "bio-miss sector=%d dev=%d",
+[TR_BWRITE] = "bio-write sector=%d dev=%d",
+[TR_ETHRX] = "eth-rx port=0x%x len=%d",
+[TR_ETHTX] = "eth-tx port=0x%x len=%d",
+[TR_ETHDROP] = "eth-drop port=0x%x drops=%d",
+};
+
+void
+usage(void)
+{
+  printf(2, "usage: dmesg [-t | -e all|none|sub[,sub...]]\n");
+  exit();
+}
+
+// ns as seconds and microseconds.  Good for 136 years.
+void
+printns(uint64 ns)
+{
+  uint s, rem, us, d;
+
+  asm("divl %4" : "=a" (s), "=d" (rem)
+      : "a" ((uint)ns), "d" ((uint)(ns >> 32)), "rm" (1000000000));
+  us = rem / 1000;
+  printf(1, "[%d.", s);
+  for(d = 100000; d > 1 && us < d; d /= 10)
+    printf(1, "0");
+  printf(1, "%d] ", us);
+}
+
+void
+showlog(void)
+{
+  int n;
+
+  if((n = kstat(KSTAT_LOG, logbuf, sizeof(logbuf))) < 0){
+    printf(2, "dmesg: cannot read the kernel log\n");
+    exit();
+  }
+  write(1, logbuf, n);
+}
+
+// The records come a CPU at a time, each CPU's in order: merge them.
+void
+showtrace(void)
+{
+  int start[NCPU+1], next[NCPU], n, ncpu, c, best;
+  struct tracerec *r;
+
+  n = kstat(KSTAT_TRACE, recs, sizeof(recs));
+  if(n < 0){
+    printf(2, "dmesg: cannot read trace events\n");
+    exit();
+  }
+  n /= sizeof(recs[0]);
+  ncpu = 0;
+  for(c = 0; c < n; c++)
+    if(c == 0 || recs[c].cpu != recs[c-1].cpu)
+      start[ncpu++] = c;
+  start[ncpu] = n;
+  for(c = 0; c < ncpu; c++)
+    next[c] = start[c];
+  for(;;){
+    best = -1;
+    for(c = 0; c < ncpu; c++)
+      if(next[c] < start[c+1] &&
+         (best < 0 || recs[next[c]].ns < recs[next[best]].ns))
+        best = c;
+    if(best < 0)
+      break;
+    r = &recs[next[best]++];
+    printns(r->ns);
+    printf(1, "cpu%d ", r->cpu);
+    if(r->ev < sizeof(evnames)/sizeof(evnames[0]) && evnames[r->ev])
+      printf(1, evnames[r->ev], r->a, r->b);
+    else
+      printf(1, "event=0x%x a=%d b=%d", r->ev, r->a, r->b);
+    printf(1, "\n");
+  }
+}
+
+// Set the trace mask from a list like "ide,eth".
+void
+settrace(char *list)
+{
+  char word[16], *p;
+  int mask, i, n;
+
+  mask = 0;
+  if(strcmp(list, "all") == 0)
+    mask = TRACE_ALL;
+  else if(strcmp(list, "none") != 0){
+    for(p = list; *p; ){
+      for(n = 0; *p && *p != ',' && n < (int)sizeof(word) - 1; n++)
+        word[n] = *p++;
+      word[n] = 0;
+      if(*p == ',')
+        p++;
+      for(i = 0; i < (int)(sizeof(subs)/sizeof(subs[0])); i++)
+        if(strcmp(subs[i].name, word) == 0)
+          break;
+      if(i == (int)(sizeof(subs)/sizeof(subs[0])))
+        usage();
+      mask |= subs[i].mask;
+    }
+  }
+  trace(mask);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc == 1)
+    showlog();
+  else if(argc == 2 && strcmp(argv[1], "-t") == 0)
+    showtrace();
+  else if(argc == 3 && strcmp(argv[1], "-e") == 0)
+    settrace(argv[2]);
+  else
+    usage();
+  exit();
+}
@@ -1,142 +1,771 @@
-#include "../types.h"
-#include "../defs.h"
-#include "../fs.h"
-#include "../file.h"
-#include "../traps.h"
-#include "ne.h"
-#include "eth.h"
-
-// A single static instance of the network card driver state.
-static ne_t ne;
-
-/*
- * @brief Handles interrupts from the Ethernet card.
- *
- * This function is registered in the trap handler to be called when an
- * interrupt from the NE2000-compatible card is received.
- */
-void ethintr() {
-    ne_interrupt(&ne);
-}
-
-/*
- * @brief Handles device-specific I/O control requests for the Ethernet device.
- *
- * This function processes ioctl requests, which are a mechanism for applications
- * to communicate with the kernel to perform device-specific operations.
- *
- * @param ip The inode of the device, currently unused.
- * @param request The specific ioctl command.
- * @param p A pointer to data related to the request.
- * @return Returns 0 on success, or an error code on failure.
- */
-int ethioctl(struct inode* ip, int request, void* p) {
-    // Unused parameters are explicitly cast to void to prevent compiler warnings.
-    (void)ip;
-    (void)p;
-
+#include "../types.h"
+#include "../defs.h"
+#include "../param.h"
+#include "../mmu.h"
+#include "../proc.h"
+#include "../fs.h"
+#include "../file.h"
+#include "../traps.h"
+#include "../spinlock.h"
+#include "../softirq.h"
+#include "../poll.h"
+#include "../net/net.h"
+#include "../net/inet.h"
+#include "eth.h"
+#include "ne.h"
+#include "loop.h"
+#include "filter.h"
+
+// One driver instance per card found by ethinit(); device minor
+// ETHERNET_NO(k) is card k.
+static ne_t ethdevs[NETH];
+static int neth;
+
+// Where ethinit() looks for cards, and the IRQ each one is wired to.
+// Cards on the same IRQ share it; ethintr() polls all of them.
+static struct {
+    int port;
+    int irq;
+} ethconf[] = {
+    {0x300, IRQ_ETH}, {0xC100, IRQ_ETH}, {0xC200, IRQ_ETH},
+    {0x240, IRQ_ETH}, {0x280, IRQ_ETH}, {0x320, IRQ_ETH1},
+    {0x340, IRQ_ETH1}, {0x360, IRQ_ETH1},
+};
+
+// The card behind device inode ip, or 0 if there is none.
+static ne_t* ethdev(struct inode* ip) {
+    int k;
+
+    for (k = 0; k < neth; k++)
+        if (ip->minor == ETHERNET_NO(k))
+            return &ethdevs[k];
+    return 0;
+}
+
+// Check that the user buffer [p, p+n) lies inside the process image,
+// which the kernel can address directly.
+int ethuser(void* p, uint n) {
+    uint a = (uint)p;
+    return a >= USERBASE && a < proc->sz && a + n <= proc->sz && a + n >= a;
+}
+
+// Queue a frame on behalf of the network stack, without sleeping.
+static int ethxmit(struct netif* nif, uchar* frame, int len) {
+    return ne_enqueue(nif->dev, frame, len);
+}
+
+// Charge r bytes, if r is a size, to the caller as received or sent.
+static int ethrx(int r) {
+    if (r > 0)
+        proc->ethrx += r;
+    return r;
+}
+
+static int ethtx(int r) {
+    if (r > 0)
+        proc->ethtx += r;
+    return r;
+}
+
+// Does a reader have a frame waiting? Steps over frames the stack took.
+// Caller must hold ne->qlock.
+static int ethpending(ne_t* ne) {
+    while (ne->recvq_head != ne->recvq_seen &&
+           ne->recvq[ne->recvq_head % RECVQ_LEN].size == 0)
+        ne->recvq_head++;
+    return ne->recvq_head != ne->recvq_seen;
+}
+
+// Offer newly drained frames to the network stack, which keeps the ones
+// it wants. Called with neither lock held. Slots in [seen, tail) are not
+// visible to readers and are not refilled by ne_drain(), so netinput()
+// reads them unlocked; one caller at a time does so.
+static void ethinput(ne_t* ne) {
+    int i, taken, n;
+
+    acquire(&ne->qlock);
+    if (ne->inputting) {
+        // The other caller rechecks tail before it gives up.
+        release(&ne->qlock);
+        return;
+    }
+    ne->inputting = 1;
+    // DHCP may have brought the interface up or down since last time.
+    ne->lossy = ne->netif != 0 && ne->netif->up;
+    n = 0;
+    while (ne->recvq_seen != ne->recvq_tail) {
+        i = ne->recvq_seen % RECVQ_LEN;
+        release(&ne->qlock);
+        taken = ne->netif != 0 &&
+                netinput(ne->netif, ne->recvq[i].buf, ne->recvq[i].size);
+        acquire(&ne->qlock);
+        // Frames kept only for the stack are not for readers either.
+        if (taken || !ne->recvq[i].match)
+            ne->recvq[i].size = 0;
+        ne->recvq_seen++;
+        n++;
+    }
+    // Free the slots the stack took so that ne_drain() can reuse them.
+    ethpending(ne);
+    ne->inputting = 0;
+    release(&ne->qlock);
+    // Only new frames are news to readers; a wakeup for nothing would
+    // also end the sleep of a poll() that calls here itself.
+    if (n > 0)
+        wakeupboost(ne->recvq);
+}
+
+// Refill recvq from the card. Called with neither lock held.
+static void ethrefill(ne_t* ne) {
+    acquire(&ne->lock);
+    ne_drain(ne);
+    release(&ne->lock);
+    ethinput(ne);
+}
+
+// Service a card that interrupted: drain arrived frames from the card
+// into the kernel receive queue, so card RAM is no longer the only buffer
+// between the wire and the reader, and hand them to the stack. Runs as a
+// softirq, since the PIO copies take a while.
+static void ethsoft(void* arg) {
+    ne_t* ne = arg;
+
+    acquire(&ne->lock);
+    ne_interrupt(ne);
+    release(&ne->lock);
+    // The stack may transmit replies, so run it with no lock held.
+    ethinput(ne);
+}
+
+/*
+ * @brief Handles interrupts from the Ethernet cards on an IRQ line.
+ *
+ * This function is registered in the trap handler to be called when an
+ * interrupt from a NE2000-compatible card is received. Every card wired to
+ * irq is serviced, since cards may share a line. The work is left to
+ * ethsoft(): the card holds its interrupt until ne_interrupt() clears its
+ * status, and the line is edge-triggered, so nothing is lost meanwhile.
+ *
+ * @param irq The IRQ line that fired.
+ */
+void ethintr(int irq) {
+    ne_t* ne;
+
+    for (ne = ethdevs; ne < &ethdevs[neth]; ne++)
+        if (ne->irq == irq)
+            softraise(&ne->soft);
+}
+
+// Wait until the receive queue holds a frame. Called and returns with
+// ne->qlock held. Returns 1 if a frame is queued, 0 if none is and the
+// device is non-blocking, -1 if the process was killed while waiting.
+static int ethrecvwait(ne_t* ne) {
+    while (!ethpending(ne)) {
+        if (proc->killed)
+            return -1;
+        if (ne->nonblock)
+            return 0;
+        sleep(ne->recvq, &ne->qlock);
+    }
+    return 1;
+}
+
+// Hand the oldest queued frame to a reader's buffer p of n bytes and
+// return its size. A frame that does not fit, or p == 0, stays queued,
+// unless reads are partial: then what fits is copied and returned.
+// Called and returns with ne->qlock held and the queue non-empty; the
+// copy itself runs with the lock dropped and the slot marked busy so
+// that ne_drain() and other readers leave it alone.
+static int ethrecvone(ne_t* ne, char* p, int n) {
+    int i, size;
+
+    i = ne->recvq_head % RECVQ_LEN;
+    size = ne->recvq[i].size;
+    if (p == 0 || (size > n && !ne->partial))
+        return size;
+    if (size > n)
+        size = n;
+    ne->recvq[i].busy = 1;
+    ne->recvq_head++;
+    release(&ne->qlock);
+    memmove(p, ne->recvq[i].buf, size);
+    acquire(&ne->qlock);
+    ne->recvq[i].busy = 0;
+    return size;
+}
+
+// Queue one frame made of nseg segments, sleeping while the transmit
+// queue is full. Called with neither lock held. Returns the frame size,
+// or -1 on error.
+static int ethsendv(ne_t* ne, struct eth_frame* seg, int nseg) {
+    int r;
+
+    while ((r = ne_enqueuev(ne, seg, nseg)) == 0) {
+        acquire(&ne->qlock);
+        ne->stats.tx_busy++;
+        while (ne->xmitq_tail - ne->xmitq_head >= XMITQ_LEN && !proc->killed)
+            sleep(ne->xmitq, &ne->qlock);
+        release(&ne->qlock);
+        if (proc->killed)
+            return -1;
+    }
+    return r;
+}
+
+static int ethsend(ne_t* ne, char* p, int n) {
+    struct eth_frame seg;
+
+    seg.buf = p;
+    seg.len = n;
+    return ethsendv(ne, &seg, 1);
+}
+
+// Fetch the batch descriptor at b once, so that a racing thread cannot
+// change it under the kernel, and check its frame array. Returns the
+// number of frames and sets *frames, or returns -1. Frame entries are
+// copied and checked one at a time as they are used.
+static int ethbatchuser(struct eth_batch* b, struct eth_frame** frames) {
+    struct eth_batch k;
+
+    if (!ethuser(b, sizeof(*b)))
+        return -1;
+    memmove(&k, b, sizeof(k));
+    if (k.n < 0 || (uint)k.n > proc->sz / sizeof(struct eth_frame) ||
+        !ethuser(k.frames, k.n * sizeof(struct eth_frame)))
+        return -1;
+    *frames = k.frames;
+    return k.n;
+}
+
+/*
+ * @brief Receives up to b->n frames in one call.
+ *
+ * Waits like ethread() for the first frame, then copies out every queued
+ * frame that fits, setting each entry's len to the frame size. A frame
+ * larger than its buffer ends the batch; its size is stored in that entry's
+ * len and the frame stays queued. A buffer the kernel may not write to
+ * fails the batch, as it would fail read().
+ *
+ * @return The number of frames received, or -1 on error.
+ */
+static int ethrecvbatch(ne_t* ne, struct inode* ip, struct eth_batch* b) {
+    struct eth_frame *frames, f;
+    int k, n, r, size;
+
+    if ((n = ethbatchuser(b, &frames)) < 0 ||
+        prepwrite(proc->pgdir, (uint)frames, n * sizeof(*frames)) < 0)
+        return -1;
+    iunlock(ip);
+    ethrefill(ne);
+    acquire(&ne->qlock);
+    if ((r = ethrecvwait(ne)) <= 0)
+        goto out;
+    r = 0;
+    for (k = 0; k < n; k++) {
+        if (!ethpending(ne)) {
+            // Refill freed slots from the card so a full ring keeps flowing.
+            release(&ne->qlock);
+            ethrefill(ne);
+            acquire(&ne->qlock);
+            if (!ethpending(ne))
+                break;
+        }
+        memmove(&f, &frames[k], sizeof(f));
+        if (f.len < 0 || !ethuser(f.buf, f.len) ||
+            prepwrite(proc->pgdir, (uint)f.buf, f.len) < 0) {
+            if (r == 0)
+                r = -1;
+            break;
+        }
+        size = ethrecvone(ne, f.buf, f.len);
+        if (size > f.len) {
+            frames[k].len = size;
+            break;
+        }
+        frames[k].len = ethrx(size);
+        r++;
+    }
+out:
+    release(&ne->qlock);
+    ethrefill(ne);
+    ilock(ip);
+    return r;
+}
+
+/*
+ * @brief Queues up to b->n frames for transmission in one call.
+ *
+ * Each frame is handed to ne_enqueue(), which fills free card buffers as it
+ * goes. Like ethwrite(), the caller sleeps while the transmit queue is full.
+ *
+ * @return The number of frames queued, or -1 on error.
+ */
+static int ethsendbatch(ne_t* ne, struct inode* ip, struct eth_batch* b) {
+    struct eth_frame *frames, f;
+    int k, n;
+
+    if ((n = ethbatchuser(b, &frames)) < 0)
+        return -1;
+    iunlock(ip);
+    for (k = 0; k < n; k++) {
+        memmove(&f, &frames[k], sizeof(f));
+        if (f.len < 0 || !ethuser(f.buf, f.len))
+            break;
+        if (ethtx(ethsend(ne, f.buf, f.len)) <= 0)
+            break;
+    }
+    ilock(ip);
+    return (k == 0 && n > 0) ? -1 : k;
+}
+
+/*
+ * @brief Transmits one frame gathered from the b->n segments in b->frames.
+ *
+ * The segments are streamed into card memory one after another, so a
+ * sender can keep its headers and payload apart without copying them
+ * together first. Like ethwrite(), the caller sleeps while the transmit
+ * queue is full.
+ *
+ * @return The frame size, or -1 on error.
+ */
+static int ethsendgather(ne_t* ne, struct inode* ip, struct eth_batch* b) {
+    struct eth_frame *frames, seg[ETH_MAXSEG];
+    int k, n, r;
+
+    if ((n = ethbatchuser(b, &frames)) < 0 || n > ETH_MAXSEG)
+        return -1;
+    // Check and send a kernel copy of the segments, which a racing
+    // thread cannot change after the check.
+    memmove(seg, frames, n * sizeof(seg[0]));
+    for (k = 0; k < n; k++)
+        if (seg[k].len < 0 || !ethuser(seg[k].buf, seg[k].len))
+            return -1;
+    iunlock(ip);
+    r = ethtx(ethsendv(ne, seg, n));
+    ilock(ip);
+    return r;
+}
+
+/*
+ * @brief Maps the shared receive ring into the calling process.
+ *
+ * The ring pages are allocated on first use and belong to the driver for
+ * good; they are mapped PTE_S right above the process image, which grows to
+ * cover them. Frames are delivered to the ring from then on.
+ *
+ * @return The user address of the ring, or -1 on error.
+ */
+static int ethmapring(ne_t* ne) {
+    uint va;
+    int i;
+
+    va = PGROUNDUP(proc->sz);
+    if (va + ETH_RING_PAGES * PGSIZE > USERTOP)
+        return -1;
+    acquire(&ne->lock);
+    if (ne->ring == 0) {
+        for (i = 0; i < ETH_RING_PAGES; i++) {
+            if ((ne->ringpage[i] = kalloc()) == 0) {
+                while (--i >= 0)
+                    kfree(ne->ringpage[i]);
+                release(&ne->lock);
+                return -1;
+            }
+            memset(ne->ringpage[i], 0, PGSIZE);
+        }
+        ne->ring = (struct eth_ring*)ne->ringpage[0];
+    }
+    if (mapshared(proc->pgdir, va, ne->ringpage, ETH_RING_PAGES) < 0) {
+        release(&ne->lock);
+        return -1;
+    }
+    // A new reader starts from an empty ring.
+    ne->ring->head = ne->ring->tail = 0;
+    ne->ringon = 1;
+    ne_drain(ne);
+    release(&ne->lock);
+    setsz(va + ETH_RING_PAGES * PGSIZE);
+    switchuvm(proc);
+    return va;
+}
+
+/*
+ * @brief Programs the card's multicast filter from a group list.
+ *
+ * The 8390 has no exact match for group addresses, only a 64-bit hash
+ * filter; each group sets the bit its CRC selects.
+ *
+ * @return 0 on success, or -1 if the list is invalid.
+ */
+static int ethmulticast(ne_t* ne, struct eth_mcast* m) {
+    uchar mar[8];
+    int i, h;
+
+    if (!ethuser(m, sizeof(*m)) || m->n < 0 || m->n > ETH_MCAST_MAX)
+        return -1;
+    memset(mar, 0, sizeof(mar));
+    for (i = 0; i < m->n; i++) {
+        h = ne_mcast_hash(m->addr[i]);
+        mar[h >> 3] |= 1 << (h & 7);
+    }
+    acquire(&ne->lock);
+    memmove(ne->mar, mar, sizeof(mar));
+    ne_set_filter(ne);
+    release(&ne->lock);
+    return 0;
+}
+
+/*
+ * @brief Attaches a receive filter program, or detaches the filter.
+ *
+ * The program is copied from user memory and checked on that kernel
+ * copy, which is what then runs.  An empty program detaches the filter.
+ *
+ * @return 0 on success, or -1 if the program is invalid.
+ */
+static int ethsetfilter(ne_t* ne, struct eth_filter* f) {
+    struct eth_filter k;
+
+    if (!ethuser(f, sizeof(*f)))
+        return -1;
+    memmove(&k, f, sizeof(k));
+    if (k.n != 0 && eth_filter_check(&k) < 0)
+        return -1;
+    acquire(&ne->lock);
+    ne->filter = k;
+    release(&ne->lock);
+    return 0;
+}
+
+/*
+ * @brief Handles device-specific I/O control requests for the Ethernet device.
+ *
+ * This function processes ioctl requests, which are a mechanism for applications
+ * to communicate with the kernel to perform device-specific operations.
+ *
+ * @param ip The inode of the device, unlocked while batch requests sleep.
+ * @param request The specific ioctl command.
+ * @param p A pointer to data related to the request.
+ * @return Returns 0 on success, or an error code on failure.
+ */
+int ethioctl(struct inode* ip, int request, void* p) {
+    struct eth_stats st;
+    ne_t* ne;
+    int n;
+
+    if (ip->minor == ETHERNET_LOOP)
+        return loopioctl(ip, request, p);
+
+    // Verify that the network interface was successfully probed and configured.
+    if ((ne = ethdev(ip)) == 0) {
+        cprintf("eth: Network interface not initialized\n");
+        return -1;
+    }
+
     // A switch statement is used to handle different ioctl requests.
     switch (request) {
         case ETH_IPC_SETUP:
-            // Verify that the network interface is properly initialized and ready.
-            // This checks that the device was successfully probed and configured.
-            if (ne.base == 0) {
-                cprintf("eth: Network interface not initialized\n");
-                return -1;
-            }
-            
             // Additional verification that the device is in a good state
-            if (ne.pages == 0 || ne.recv_startpage == 0) {
+            if (ne->pages == 0 || ne->recv_startpage == 0) {
                 cprintf("eth: Network interface configuration invalid\n");
                 return -1;
             }
             
-            cprintf("eth: Network interface ready (base=0x%x, irq=%d)\n", ne.base, ne.irq);
-            return 0;
-
-        default:
-            // For any unrecognized request, a message can be logged, and an
-            // appropriate error can be returned.
-            cprintf("%s: Received unrecognized ioctl request %d.\n", ne.name, request);
-            return -1; // Or another appropriate error code.
-    }
-
-    return 0; // Success.
-}
-
-/*
- * @brief Reads data from the Ethernet device.
- *
- * This function is part of the file system's device switch table (devsw) and is
- * called when a user application reads from the Ethernet device's file.
- *
- * @param ip The inode of the device, currently unused.
- * @param p The buffer to write the read data to.
- * @param n The number of bytes to read.
- * @return The number of bytes read, or an error code.
- */
-int ethread(struct inode* ip, char* p, int n) {
-    (void)ip; // Unused
-    return ne_pio_read(&ne, (uchar*)p, n);
-}
-
-/*
- * @brief Writes data to the Ethernet device.
- *
- * This function is part of the file system's device switch table (devsw) and is
- * called when a user application writes to the Ethernet device's file.
- *
- * @param ip The inode of the device, currently unused.
- * @param p The buffer containing the data to write.
- * @param n The number of bytes to write.
- * @return The number of bytes written, or an error code.
- */
-int ethwrite(struct inode* ip, char* p, int n) {
-    (void)ip; // Unused
-    return ne_pio_write(&ne, (uchar*)p, n);
-}
-
-/*
- * @brief Initializes the Ethernet network card.
- *
- * This is the primary initialization function for the Ethernet device. It
- * probes for a NE2000-compatible card at various common I/O ports. If found,
- * it registers the device with the system and enables interrupts.
- */
-void ethinit() {
-    char name[] = "eth#";
-    int ports[] = {0x300, 0xC100, 0x240, 0x280, 0x320, 0x340, 0x360};
-
-    // Register the device's functions with the device switch table.
-    devsw[ETHERNET].write = ethwrite;
-    devsw[ETHERNET].read = ethread;
-    devsw[ETHERNET].ioctl = ethioctl;
-
-    // Loop through the list of common I/O ports to find a working card.
-    for (int i = 0; (uint)i < NELEM(ports); ++i) {
-        cprintf("Ethernet: Probing port 0x%x.\n", ports[i]);
-
-        // Reset the device state structure for each probe attempt.
-        memset(&ne, 0, sizeof(ne));
-
-        // Create a unique name for the device, e.g., "eth0", "eth1", etc.
-        name[3] = '0' + i;
-        strncpy(ne.name, name, sizeof(ne.name) - 1);
-
-        ne.irq = IRQ_ETH;
-        ne.base = ports[i];
-
-        // Attempt to probe and initialize the card.
-        if (ne_probe(&ne)) {
-            cprintf("Ethernet: Found card at port 0x%x, initializing...\n", ports[i]);
-            ne_init(&ne);
-
-            // Enable interrupts for the device.
-            picenable(ne.irq);
-            ioapicenable(ne.irq, 0);
-
-            // Break the loop once a card is successfully found and initialized.
-            break;
-        }
-    }
-}
\ No newline at end of file
+            cprintf("eth: Network interface ready (base=0x%x, irq=%d)\n", ne->base, ne->irq);
+            return 0;
+
+        case ETH_NONBLOCK:
+            // The argument is passed by value rather than by pointer.
+            acquire(&ne->qlock);
+            ne->nonblock = (p != 0);
+            release(&ne->qlock);
+            return 0;
+
+        case ETH_GET_STATS:
+            if (!ethuser(p, sizeof(struct eth_stats)))
+                return -1;
+            acquire(&ne->lock);
+            acquire(&ne->qlock);
+            st = ne->stats;
+            release(&ne->qlock);
+            release(&ne->lock);
+            memmove(p, &st, sizeof(st));
+            return 0;
+
+        case ETH_VERBOSE:
+            // The argument is passed by value rather than by pointer.
+            acquire(&ne->lock);
+            ne->verbose = (p != 0);
+            release(&ne->lock);
+            return 0;
+
+        case ETH_RECV_BATCH:
+            return ethrecvbatch(ne, ip, p);
+
+        case ETH_SEND_BATCH:
+            return ethsendbatch(ne, ip, p);
+
+        case ETH_MAP_RING:
+            return ethmapring(ne);
+
+        case ETH_RING_OFF:
+            acquire(&ne->lock);
+            ne->ringon = 0;
+            ne_drain(ne);
+            // Let ETH_RING_WAIT sleepers see the change.
+            wakeup(ne->recvq);
+            release(&ne->lock);
+            return 0;
+
+        case ETH_RING_WAIT:
+            if (!ne->ringon)
+                return -1;
+            iunlock(ip);
+            acquire(&ne->lock);
+            ne_drain(ne);
+            while (ne->ringon && ne_ring_empty(ne) && !proc->killed)
+                sleep(ne->recvq, &ne->lock);
+            release(&ne->lock);
+            ilock(ip);
+            return proc->killed ? -1 : 0;
+
+        case ETH_PROMISC:
+            // The argument is passed by value rather than by pointer.
+            acquire(&ne->lock);
+            if (p != 0)
+                ne->rcr |= RCR_PRO;
+            else
+                ne->rcr &= ~RCR_PRO;
+            ne_set_filter(ne);
+            release(&ne->lock);
+            return 0;
+
+        case ETH_SET_MULTICAST:
+            return ethmulticast(ne, p);
+
+        case ETH_SET_ADDR:
+            if (!ethuser(p, sizeof(struct eth_ifaddr)) || ne->netif == 0)
+                return -1;
+            dhcpstop(ne->netif);
+            netifconfig(ne->netif, ((struct eth_ifaddr*)p)->ip,
+                        ((struct eth_ifaddr*)p)->mask,
+                        ((struct eth_ifaddr*)p)->gw);
+            acquire(&ne->qlock);
+            ne->lossy = ne->netif->up;
+            release(&ne->qlock);
+            return 0;
+
+        case ETH_DHCP:
+            if (ne->netif == 0)
+                return -1;
+            dhcpstart(ne->netif);
+            return 0;
+
+        case ETH_SET_FILTER:
+            return ethsetfilter(ne, p);
+
+        case ETH_SNAPLEN:
+            // The argument is passed by value rather than by pointer.
+            if ((int)p < 0)
+                return -1;
+            acquire(&ne->lock);
+            ne->snaplen = (int)p;
+            acquire(&ne->qlock);
+            ne->partial = (p != 0);
+            release(&ne->qlock);
+            release(&ne->lock);
+            return 0;
+
+        case ETH_SEND_GATHER:
+            return ethsendgather(ne, ip, p);
+
+        case ETH_DROP_FRAME:
+            // Skip the oldest frame without copying it.
+            acquire(&ne->qlock);
+            if ((n = ethpending(ne)) != 0) {
+                n = ne->recvq[ne->recvq_head % RECVQ_LEN].size;
+                ne->recvq_head++;
+            }
+            release(&ne->qlock);
+            ethrefill(ne);
+            return n;
+
+        default:
+            // For any unrecognized request, a message can be logged, and an
+            // appropriate error can be returned.
+            cprintf("%s: Received unrecognized ioctl request %d.\n", ne->name, request);
+            return -1; // Or another appropriate error code.
+    }
+
+    return 0; // Success.
+}
+
+/*
+ * @brief Reads data from the Ethernet device.
+ *
+ * This function is part of the file system's device switch table (devsw) and is
+ * called when a user application reads from the Ethernet device's file. The
+ * oldest frame in the kernel receive queue is copied out; if the buffer is too
+ * small, the frame size is returned and the frame stays queued. When the queue
+ * is empty the caller sleeps until ne_interrupt() queues a frame, unless the
+ * device is in non-blocking mode.
+ *
+ * @param ip The inode of the device, unlocked while the caller sleeps.
+ * @param p The buffer to write the read data to.
+ * @param n The number of bytes to read.
+ * @return The number of bytes read, 0 if no frame is queued in non-blocking
+ *         mode, or -1 on error.
+ */
+int ethread(struct inode* ip, char* p, int n) {
+    int size;
+    ne_t* ne;
+
+    if (ip->minor == ETHERNET_LOOP)
+        return ethrx(loopread(ip, p, n));
+    if ((ne = ethdev(ip)) == 0)
+        return -1;
+
+    // Let writers and ioctls on the same device through while we sleep.
+    iunlock(ip);
+    // Pick up anything the card holds that the interrupt could not queue.
+    ethrefill(ne);
+    acquire(&ne->qlock);
+    if ((size = ethrecvwait(ne)) > 0)
+        size = ethrecvone(ne, p, n);
+    release(&ne->qlock);
+    // A slot may be free again; refill it from the card.
+    ethrefill(ne);
+    ilock(ip);
+    return ethrx(size);
+}
+
+/*
+ * @brief Writes data to the Ethernet device.
+ *
+ * This function is part of the file system's device switch table (devsw) and is
+ * called when a user application writes to the Ethernet device's file. The
+ * frame is queued in kernel memory and handed to the card by ne_kick(), either
+ * right away or from the transmit-complete interrupt. The caller sleeps while
+ * the queue is full.
+ *
+ * @param ip The inode of the device, unlocked while the caller sleeps.
+ * @param p The buffer containing the data to write.
+ * @param n The number of bytes to write.
+ * @return The number of bytes written, or -1 on error.
+ */
+int ethwrite(struct inode* ip, char* p, int n) {
+    int r;
+    ne_t* ne;
+
+    if (ip->minor == ETHERNET_LOOP)
+        return ethtx(loopwrite(ip, p, n));
+    if ((ne = ethdev(ip)) == 0)
+        return -1;
+
+    iunlock(ip);
+    r = ethsend(ne, p, n);
+    ilock(ip);
+    return ethtx(r);
+}
+
+/*
+ * @brief Reports whether a read or a write on the Ethernet device would wait.
+ *
+ * This function is part of the file system's device switch table (devsw) and is
+ * called by poll(). A read is ready when the receive queue holds a frame for
+ * readers and a write when the transmit queue has room. For the events that
+ * are not ready, the queues the interrupt wakes are handed to pollwait().
+ *
+ * @param ip The inode of the device.
+ * @param events The poll.h events asked for.
+ * @return The events of those asked for that are ready.
+ */
+int ethpoll(struct inode* ip, int events) {
+    int r;
+    ne_t* ne;
+
+    if (ip->minor == ETHERNET_LOOP)
+        return looppoll(ip, events);
+    if ((ne = ethdev(ip)) == 0)
+        return POLLERR;
+
+    // As ethread() does, pick up what the interrupt could not queue.
+    if (events & POLLIN)
+        ethrefill(ne);
+    r = 0;
+    acquire(&ne->qlock);
+    if (events & POLLIN) {
+        if (ethpending(ne))
+            r |= POLLIN;
+        else
+            pollwait(ne->recvq);
+    }
+    if (events & POLLOUT) {
+        if (ne->xmitq_tail - ne->xmitq_head < XMITQ_LEN)
+            r |= POLLOUT;
+        else
+            pollwait(ne->xmitq);
+    }
+    release(&ne->qlock);
+    return r;
+}
+
+/*
+ * @brief Initializes the Ethernet network card.
+ *
+ * This is the primary initialization function for the Ethernet device. It
+ * probes for a NE2000-compatible card at various common I/O ports. If found,
+ * it registers the device with the system and enables interrupts.
+ */
+void ethinit() {
+    char name[] = "eth#";
+    ne_t* ne;
+
+    // Register the device's functions with the device switch table.
+    devsw[ETHERNET].write = ethwrite;
+    devsw[ETHERNET].read = ethread;
+    devsw[ETHERNET].ioctl = ethioctl;
+    devsw[ETHERNET].poll = ethpoll;
+
+    // Loop through the list of common I/O ports, keeping every working card.
+    for (int i = 0; (uint)i < NELEM(ethconf) && neth < NETH; ++i) {
+        cprintf("Ethernet: Probing port 0x%x.\n", ethconf[i].port);
+
+        // Reset the device state structure for each probe attempt.
+        ne = &ethdevs[neth];
+        memset(ne, 0, sizeof(*ne));
+
+        // Name the device after its minor number, e.g., "eth0", "eth1", etc.
+        name[3] = '0' + neth;
+        strncpy(ne->name, name, sizeof(ne->name) - 1);
+
+        ne->irq = ethconf[i].irq;
+        ne->base = ethconf[i].port;
+
+        // Attempt to probe and initialize the card.
+        if (ne_probe(ne)) {
+            cprintf("Ethernet: Found %s at port 0x%x, irq %d, initializing...\n",
+                    ne->name, ne->base, ne->irq);
+            initlock(&ne->lock, ne->name);
+            initlock(&ne->qlock, "ethq");
+            softinit(&ne->soft, ethsoft, ne);
+            ne_init(ne);
+            ne->netif = netifadd(ne->name, ne->address, ethxmit, ne);
+            if (ne->netif)
+                dhcpstart(ne->netif);
+
+            // Enable interrupts for the device, spreading cards over
+            // the CPUs other than CPU 0, which takes the clock, the
+            // keyboard and the serial port.  irqaffinity() moves them.
+            picenable(ne->irq);
+            ioapicenable(ne->irq, ncpu > 1 ? cpus[1 + neth % (ncpu-1)].id : 0);
+            neth++;
+        }
+    }
+
+    // Leave no half-probed state behind for the next free slot.
+    if (neth < NETH)
+        memset(&ethdevs[neth], 0, sizeof(ethdevs[neth]));
+
+    loopinit();
+}
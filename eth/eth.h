@@ -6,7 +6,198 @@
  * receive Ethernet frames. The ETH_IPC_SETUP ioctl command prepares the device for
  * inter-process communication (IPC), with implementation details pending the
  * availability of an IPC mechanism. See ethtest.c for usage examples.
+ *
+ * A read blocks until a frame arrives unless the device has been switched to
+ * non-blocking mode with ETH_NONBLOCK, in which case it returns 0 when no
+ * frame is queued.
+ *
+ * The driver keeps per-device counters instead of logging each packet to the
+ * console. ETH_GET_STATS copies them into a struct eth_stats supplied by the
+ * caller; ETH_VERBOSE switches per-packet logging on and off. It goes to
+ * the kernel log, which "dmesg" prints, not to the console.
+ *
+ * ETH_RECV_BATCH and ETH_SEND_BATCH move several frames per system call.
+ * The argument points to a struct eth_batch describing an array of frames;
+ * the ioctl returns the number of frames moved. A batch receive blocks like
+ * read() for the first frame and then takes whatever else is queued.
+ * ETH_SEND_GATHER takes the same struct, but its entries are the pieces of
+ * a single frame, at most ETH_MAXSEG of them, e.g. prebuilt headers and a
+ * payload, which the driver writes to the card one after another instead of
+ * copying them together.
+ *
+ * ETH_MAP_RING maps a receive ring into the caller and returns its address.
+ * From then on the driver copies arriving frames from the card straight into
+ * the ring instead of the read() queue. The reader consumes slots from tail
+ * up to head and advances tail itself, so frames cost no system call;
+ * ETH_RING_WAIT sleeps until the ring is non-empty. ETH_RING_OFF goes back to
+ * read() delivery. The ring stays mapped until the process exits or execs.
+ *
+ * The card accepts frames for its own address and broadcasts only.
+ * ETH_PROMISC turns promiscuous reception on and off, and ETH_SET_MULTICAST
+ * loads the card's multicast hash filter from a list of group addresses;
+ * the filter is approximate, so readers may still see unwanted groups.
+ *
+ * ETH_SET_FILTER attaches a small filter program, a subset of BPF, that the
+ * driver runs against the first ETH_FILTER_PEEK bytes of each frame while
+ * it is still in card memory. Frames the program rejects are left on the
+ * card instead of being copied out for readers, which saves most of the
+ * transfer in promiscuous mode. The network stack still gets the frames
+ * addressed to the interface. Programs run forward only and are checked
+ * when attached; a program with n == 0 detaches the filter. For example,
+ * ARP only:
+ *
+ *     { ETH_F_LDH, 0, 0, 12 },                  // A = EtherType
+ *     { ETH_F_JEQ, 0, 1, ETH_TYPE_ARP },
+ *     { ETH_F_RET, 0, 0, 1 },                   // accept
+ *     { ETH_F_RET, 0, 0, 0 },                   // reject
+ *
+ * Readers that need only the headers set a snap length with ETH_SNAPLEN.
+ * The driver then copies just that prefix of each frame off the card, and
+ * read() with a buffer shorter than a frame returns what fits and consumes
+ * the frame instead of leaving it queued. read(fd, 0, 0) still returns the
+ * size of the next frame without taking it, and ETH_DROP_FRAME discards it
+ * unread. The frames the stack may want are copied whole so that it can use
+ * them.
+ *
+ * At boot the kernel asks for an address by DHCP and keeps renewing the
+ * lease. ETH_SET_ADDR stops that and sets an address by hand; ETH_DHCP
+ * starts it again. Once the interface has an address, the kernel network
+ * stack (see net/socket.h) takes the frames it has a use for before readers
+ * see them. Readers then get only what is left, and if they fall behind the
+ * oldest frames are dropped instead of holding up the stack. The shared
+ * ring bypasses the stack altogether.
+ *
+ * Minor ETHERNET_LOOP is a loopback device, "lo" at 127.0.0.1/8, that turns
+ * every frame sent on it around into its own receive queue. It takes read(),
+ * write(), ETH_NONBLOCK, ETH_GET_STATS and ETH_SET_ADDR and lets the stack
+ * be measured without a card.
  */
 
+#ifndef ETH_ETH_H
+#define ETH_ETH_H
+
 // Prepare IPC; actual implementation depends on the IPC specification.
 #define ETH_IPC_SETUP     1
+// Non-blocking reads if the argument is non-zero, blocking reads otherwise.
+#define ETH_NONBLOCK      2
+// Copy the device counters into the struct eth_stats pointed to by the argument.
+#define ETH_GET_STATS     3
+// Per-packet console logging if the argument is non-zero.
+#define ETH_VERBOSE       4
+// Receive several frames into the struct eth_batch pointed to by the argument.
+#define ETH_RECV_BATCH    5
+// Transmit several frames from the struct eth_batch pointed to by the argument.
+#define ETH_SEND_BATCH    6
+// Map the receive ring and deliver frames to it; returns the ring address.
+#define ETH_MAP_RING      7
+// Deliver frames to read() again.
+#define ETH_RING_OFF      8
+// Sleep until the ring holds a frame.
+#define ETH_RING_WAIT     9
+// Receive every frame on the wire if the argument is non-zero.
+#define ETH_PROMISC       10
+// Accept the multicast groups in the struct eth_mcast pointed to by the argument.
+#define ETH_SET_MULTICAST 11
+// Give the interface the address in the struct eth_ifaddr pointed to by the argument.
+#define ETH_SET_ADDR      12
+// Configure the interface by DHCP, as is done at boot.
+#define ETH_DHCP          13
+// Filter received frames with the struct eth_filter pointed to by the argument.
+#define ETH_SET_FILTER    14
+// Keep only the first n bytes of frames for readers, n being the argument;
+// 0 keeps whole frames.
+#define ETH_SNAPLEN       15
+// Discard the oldest queued frame; returns its size, or 0 if none is queued.
+#define ETH_DROP_FRAME    16
+// Transmit one frame made of the segments in the struct eth_batch pointed to
+// by the argument.
+#define ETH_SEND_GATHER   17
+
+// Device counters, monotonically increasing since boot.
+struct eth_stats {
+  uint tx_ok;       // Frames transmitted without error
+  uint tx_err;      // Frames the card failed to transmit
+  uint tx_busy;     // Writes that found the transmit queue full
+  uint rx_ok;       // Frames queued for readers
+  uint rx_err;      // Receive errors and bad frames discarded
+  uint overflow;    // Card receive ring overflows
+  uint rx_drop;     // Frames dropped because no reader took them
+  uint rx_filtered; // Frames the filter rejected
+};
+
+// Interface address for ETH_SET_ADDR; an all-zero ip takes it down.
+struct eth_ifaddr {
+  uchar ip[4];
+  uchar mask[4];
+  uchar gw[4];      // Default gateway, or all zero
+};
+
+// One frame of a batch request.
+struct eth_frame {
+  void *buf;        // Frame data
+  int len;          // Frame size; on receive, buffer size in and frame size out
+};
+
+struct eth_batch {
+  struct eth_frame *frames;
+  int n;            // Number of entries in frames
+};
+
+// Most segments in one ETH_SEND_GATHER frame.
+#define ETH_MAXSEG        16
+
+#define ETH_MCAST_MAX     16
+
+struct eth_mcast {
+  int n;                          // Number of entries in addr; 0 drops all
+  uchar addr[ETH_MCAST_MAX][6];   // Group MAC addresses
+};
+
+// Filter instructions. A and X are 32-bit registers, initially zero; loads
+// are big-endian and a load past the frame or the peek window rejects it.
+#define ETH_F_LDB         1   // A = byte at k
+#define ETH_F_LDH         2   // A = halfword at k
+#define ETH_F_LDW         3   // A = word at k
+#define ETH_F_LDXIP       4   // X = 4 * (byte at k & 0xF), an IP header length
+#define ETH_F_LDBX        5   // A = byte at X + k
+#define ETH_F_LDHX        6   // A = halfword at X + k
+#define ETH_F_LDLEN       7   // A = frame size
+#define ETH_F_AND         8   // A &= k
+#define ETH_F_JEQ         9   // skip jt instructions if A == k, else jf
+#define ETH_F_JGT         10  // skip jt instructions if A > k, else jf
+#define ETH_F_JSET        11  // skip jt instructions if A & k, else jf
+#define ETH_F_RET         12  // accept the frame if k != 0, else reject it
+
+#define ETH_FILTER_MAX    32  // Instructions per program
+#define ETH_FILTER_PEEK   96  // Bytes of each frame a program can look at
+
+struct eth_filter_insn {
+  ushort code;
+  uchar jt;
+  uchar jf;
+  uint k;
+};
+
+struct eth_filter {
+  int n;                                      // Number of instructions
+  struct eth_filter_insn insn[ETH_FILTER_MAX];
+};
+
+// The receive ring is ETH_RING_PAGES pages cut into ETH_RING_SLOTSZ chunks.
+// The first chunk holds struct eth_ring, each other one a frame.
+#define ETH_RING_PAGES    8
+#define ETH_RING_SLOTSZ   2048
+#define ETH_RING_SLOTS    (ETH_RING_PAGES * 4096 / ETH_RING_SLOTSZ - 1)
+
+struct eth_ring {
+  volatile uint head;                 // Next slot the kernel fills
+  volatile uint tail;                 // Next slot the reader consumes
+  volatile uint len[ETH_RING_SLOTS];  // Frame size of each filled slot
+};
+
+// Frame data of slot s. Slots run from 0 to ETH_RING_SLOTS-1; the ring is
+// empty when head == tail and full when head is one behind tail.
+#define ETH_RING_FRAME(r, s) \
+  ((uchar*)(r) + ((s) + 1) * ETH_RING_SLOTSZ)
+
+#endif /* ETH_ETH_H */
@@ -0,0 +1,144 @@
+#include "../types.h"
+#include "eth.h"
+#include "filter.h"
+
+/*
+ * Filter programs are checked once when attached so that running them
+ * from the interrupt path needs no checks beyond the frame bounds: every
+ * jump goes forward and stays inside the program, which ends in a return,
+ * so a program runs at most ETH_FILTER_MAX instructions.
+ */
+
+// Width of the load done by code, or 0 if it is not a load.
+static int loadwidth(int code) {
+    switch (code) {
+        case ETH_F_LDB:
+        case ETH_F_LDXIP:
+        case ETH_F_LDBX:
+            return 1;
+        case ETH_F_LDH:
+        case ETH_F_LDHX:
+            return 2;
+        case ETH_F_LDW:
+            return 4;
+    }
+    return 0;
+}
+
+// Big-endian value of the w bytes, 1 or 2, at pkt[off], or -1 if they
+// are not all within the first n bytes.
+static int load(uchar* pkt, int n, uint off, int w) {
+    if (off >= (uint)n || (uint)n - off < (uint)w)
+        return -1;
+    if (w == 1)
+        return pkt[off];
+    return pkt[off] << 8 | pkt[off + 1];
+}
+
+/*
+ * @brief Verifies a filter program before it is attached.
+ *
+ * @return 0 if the program may be run, -1 otherwise.
+ */
+int eth_filter_check(struct eth_filter* f) {
+    struct eth_filter_insn* in;
+    int pc;
+
+    if (f->n <= 0 || f->n > ETH_FILTER_MAX ||
+        f->insn[f->n - 1].code != ETH_F_RET)
+        return -1;
+    for (pc = 0; pc < f->n; pc++) {
+        in = &f->insn[pc];
+        switch (in->code) {
+            case ETH_F_LDB:
+            case ETH_F_LDH:
+            case ETH_F_LDW:
+            case ETH_F_LDXIP:
+                if (in->k > ETH_FILTER_PEEK - (uint)loadwidth(in->code))
+                    return -1;
+                break;
+            case ETH_F_LDBX:
+            case ETH_F_LDHX:
+                // X is known only at run time.
+                if (in->k >= ETH_FILTER_PEEK)
+                    return -1;
+                break;
+            case ETH_F_LDLEN:
+            case ETH_F_AND:
+            case ETH_F_RET:
+                break;
+            case ETH_F_JEQ:
+            case ETH_F_JGT:
+            case ETH_F_JSET:
+                if (pc + 1 + in->jt >= f->n || pc + 1 + in->jf >= f->n)
+                    return -1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * @brief Runs a checked filter program over a frame.
+ *
+ * @param pkt The start of the frame.
+ * @param n The number of bytes at pkt, at most ETH_FILTER_PEEK.
+ * @param len The size of the whole frame.
+ * @return Non-zero if the frame is accepted.
+ */
+int eth_filter_run(struct eth_filter* f, uchar* pkt, int n, int len) {
+    struct eth_filter_insn* in;
+    uint a, x;
+    int pc, v, c;
+
+    a = x = 0;
+    for (pc = 0;; pc++) {
+        in = &f->insn[pc];
+        switch (in->code) {
+            case ETH_F_LDB:
+            case ETH_F_LDH:
+                if ((v = load(pkt, n, in->k, loadwidth(in->code))) < 0)
+                    return 0;
+                a = v;
+                break;
+            case ETH_F_LDW:
+                if ((v = load(pkt, n, in->k, 2)) < 0 ||
+                    (c = load(pkt, n, in->k + 2, 2)) < 0)
+                    return 0;
+                a = (uint)v << 16 | c;
+                break;
+            case ETH_F_LDXIP:
+                if ((v = load(pkt, n, in->k, 1)) < 0)
+                    return 0;
+                x = (v & 0xF) * 4;
+                break;
+            case ETH_F_LDBX:
+            case ETH_F_LDHX:
+                if ((v = load(pkt, n, x + in->k, loadwidth(in->code))) < 0)
+                    return 0;
+                a = v;
+                break;
+            case ETH_F_LDLEN:
+                a = len;
+                break;
+            case ETH_F_AND:
+                a &= in->k;
+                break;
+            case ETH_F_JEQ:
+            case ETH_F_JGT:
+            case ETH_F_JSET:
+                if (in->code == ETH_F_JEQ)
+                    c = a == in->k;
+                else if (in->code == ETH_F_JGT)
+                    c = a > in->k;
+                else
+                    c = (a & in->k) != 0;
+                pc += c ? in->jt : in->jf;
+                break;
+            default:
+                return in->k != 0;
+        }
+    }
+}
@@ -0,0 +1,11 @@
+//
+// Receive filter programs, see ETH_SET_FILTER in eth.h.
+//
+
+#ifndef ETH_FILTER_H
+#define ETH_FILTER_H
+
+int eth_filter_check(struct eth_filter* f);
+int eth_filter_run(struct eth_filter* f, uchar* pkt, int n, int len);
+
+#endif /* ETH_FILTER_H */
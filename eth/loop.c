@@ -0,0 +1,278 @@
+#include "../types.h"
+#include "../defs.h"
+#include "../param.h"
+#include "../mmu.h"
+#include "../x86.h"
+#include "../proc.h"
+#include "../fs.h"
+#include "../file.h"
+#include "../spinlock.h"
+#include "../poll.h"
+#include "../net/net.h"
+#include "../net/inet.h"
+#include "eth.h"
+#include "loop.h"
+
+/*
+ * The loopback device turns every transmitted frame straight around into
+ * its own receive queue, so the network stack and the socket and file
+ * layers can be exercised and timed without the NE2000. It is registered
+ * with the stack as "lo" with address 127.0.0.1/8, and raw readers and
+ * writers reach it through the ethernet major with minor ETHERNET_LOOP.
+ *
+ * Frames are offered to the stack as soon as no lock is held: at once
+ * when sent from a system call, otherwise by the loopd kernel process,
+ * since the stack may be sending while it holds its own locks. As with
+ * the cards, frames the stack leaves are kept for readers, and the oldest
+ * is dropped once the queue fills.
+ */
+
+#define LOOPQ_LEN 16
+
+static struct {
+    struct spinlock lock;
+    struct {
+        uchar* buf;         // kmalloc()ed ETH_MAX_SIZE bytes
+        int size;           // 0 once the stack has taken the frame
+    } q[LOOPQ_LEN];
+    // Monotonic counters; modulo LOOPQ_LEN yields element index.
+    // [head, seen) waits for readers, [seen, tail) for the stack.
+    uint head;
+    uint seen;
+    uint tail;
+    int inputting;          // a caller is running netinput()
+    int nonblock;
+    struct netif* netif;
+    struct eth_stats stats;
+} lo;
+
+// Does a reader have a frame waiting? Steps over frames the stack took.
+// Caller must hold lo.lock.
+static int looppending(void) {
+    while (lo.head != lo.seen && lo.q[lo.head % LOOPQ_LEN].size == 0)
+        lo.head++;
+    return lo.head != lo.seen;
+}
+
+// Queue a frame. Returns its size, 0 if the queue is full of frames the
+// stack has not seen yet, or -1 if the size is bad.
+static int loopenqueue(uchar* frame, int len) {
+    int i;
+
+    if (len <= 0 || len > ETH_MAX_SIZE)
+        return -1;
+    acquire(&lo.lock);
+    if (lo.tail - lo.head >= LOOPQ_LEN) {
+        if (!looppending()) {
+            lo.stats.tx_busy++;
+            release(&lo.lock);
+            return 0;
+        }
+        lo.head++;
+        lo.stats.rx_drop++;
+    }
+    i = lo.tail % LOOPQ_LEN;
+    memmove(lo.q[i].buf, frame, len);
+    lo.q[i].size = len;
+    lo.tail++;
+    lo.stats.tx_ok++;
+    lo.stats.rx_ok++;
+    release(&lo.lock);
+    return len;
+}
+
+// Offer queued frames to the stack. Called with no lock held.
+static void loopinput(void) {
+    int i, taken;
+
+    acquire(&lo.lock);
+    if (lo.inputting) {
+        // The other caller rechecks tail before it gives up.
+        release(&lo.lock);
+        return;
+    }
+    lo.inputting = 1;
+    while (lo.seen != lo.tail) {
+        i = lo.seen % LOOPQ_LEN;
+        release(&lo.lock);
+        taken = netinput(lo.netif, lo.q[i].buf, lo.q[i].size);
+        acquire(&lo.lock);
+        if (taken)
+            lo.q[i].size = 0;
+        lo.seen++;
+    }
+    looppending();
+    lo.inputting = 0;
+    release(&lo.lock);
+    wakeup(lo.q);
+}
+
+// Transmit for the stack: queue the frame and see that it comes back in.
+static int loopxmit(struct netif* nif, uchar* frame, int len) {
+    int r;
+
+    (void)nif;
+    if ((r = loopenqueue(frame, len)) <= 0)
+        return r;
+    if (cpu->ncli == 0 && (readeflags() & FL_IF))
+        loopinput();
+    else
+        wakeup(&lo.tail);
+    return r;
+}
+
+// Kernel process that runs the stack on frames sent under a lock.
+static void loopd(void* arg) {
+    (void)arg;
+    for (;;) {
+        acquire(&lo.lock);
+        while (lo.seen == lo.tail)
+            sleep(&lo.tail, &lo.lock);
+        release(&lo.lock);
+        loopinput();
+    }
+}
+
+/*
+ * @brief Reads the oldest frame the stack left, as ethread() does.
+ *
+ * @return The frame size, 0 if none is queued in non-blocking mode, or -1
+ *         on error. A frame larger than n stays queued and its size is
+ *         returned.
+ */
+int loopread(struct inode* ip, char* p, int n) {
+    int i, size;
+
+    iunlock(ip);
+    acquire(&lo.lock);
+    size = 0;
+    while (!looppending()) {
+        if (proc->killed)
+            size = -1;
+        if (proc->killed || lo.nonblock)
+            goto out;
+        sleep(lo.q, &lo.lock);
+    }
+    i = lo.head % LOOPQ_LEN;
+    size = lo.q[i].size;
+    if (size <= n) {
+        memmove(p, lo.q[i].buf, size);
+        lo.head++;
+    }
+out:
+    release(&lo.lock);
+    ilock(ip);
+    return size;
+}
+
+/*
+ * @brief Sends a frame through the loopback, as ethwrite() does.
+ *
+ * @return The number of bytes written, or -1 on error.
+ */
+int loopwrite(struct inode* ip, char* p, int n) {
+    int r;
+
+    iunlock(ip);
+    while ((r = loopenqueue((uchar*)p, n)) == 0) {
+        // Make room by running the stack over what is queued.
+        loopinput();
+        if (proc->killed) {
+            r = -1;
+            break;
+        }
+        yield();
+    }
+    if (r > 0)
+        loopinput();
+    ilock(ip);
+    return r;
+}
+
+/*
+ * @brief Reports whether a read would wait, as ethpoll() does.
+ *
+ * A write that finds the queue full runs the stack to make room rather
+ * than sleeping, so writes are always ready.
+ */
+int looppoll(struct inode* ip, int events) {
+    int r;
+
+    (void)ip;
+    r = events & POLLOUT;
+    if (events & POLLIN) {
+        acquire(&lo.lock);
+        if (looppending())
+            r |= POLLIN;
+        else
+            pollwait(lo.q);
+        release(&lo.lock);
+    }
+    return r;
+}
+
+/*
+ * @brief Handles the ioctls that make sense without a card.
+ *
+ * ETH_NONBLOCK, ETH_GET_STATS and ETH_SET_ADDR behave as on a card; the
+ * rest fail.
+ */
+int loopioctl(struct inode* ip, int request, void* p) {
+    struct eth_stats st;
+    struct eth_ifaddr* ifa;
+
+    (void)ip;
+    switch (request) {
+        case ETH_NONBLOCK:
+            // The argument is passed by value rather than by pointer.
+            acquire(&lo.lock);
+            lo.nonblock = (p != 0);
+            release(&lo.lock);
+            return 0;
+
+        case ETH_GET_STATS:
+            if (!ethuser(p, sizeof(struct eth_stats)))
+                return -1;
+            acquire(&lo.lock);
+            st = lo.stats;
+            release(&lo.lock);
+            memmove(p, &st, sizeof(st));
+            return 0;
+
+        case ETH_SET_ADDR:
+            if (!ethuser(p, sizeof(struct eth_ifaddr)) || lo.netif == 0)
+                return -1;
+            ifa = p;
+            netifconfig(lo.netif, ifa->ip, ifa->mask, ifa->gw);
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * @brief Sets up the loopback device and brings it up as 127.0.0.1/8.
+ */
+void loopinit(void) {
+    static uchar mac[6];
+    static uchar ip[4] = { 127, 0, 0, 1 };
+    static uchar mask[4] = { 255, 0, 0, 0 };
+    static uchar gw[4];
+    int i;
+
+    initlock(&lo.lock, "lo");
+    for (i = 0; i < LOOPQ_LEN; i++) {
+        if ((lo.q[i].buf = kmalloc(ETH_MAX_SIZE)) == 0) {
+            cprintf("lo: out of memory\n");
+            while (--i >= 0)
+                kmfree(lo.q[i].buf);
+            return;
+        }
+    }
+    if ((lo.netif = netifadd("lo", mac, loopxmit, &lo)) == 0 ||
+        kproc("loopd", loopd, 0) < 0) {
+        cprintf("lo: cannot register\n");
+        return;
+    }
+    lo.netif->loopback = 1;
+    netifconfig(lo.netif, ip, mask, gw);
+}
@@ -0,0 +1,18 @@
+//
+// Loopback network device, minor ETHERNET_LOOP of the ethernet major.
+//
+
+#ifndef ETH_LOOP_H
+#define ETH_LOOP_H
+
+// eth.c
+int ethuser(void* p, uint n);
+
+// loop.c
+void loopinit(void);
+int loopread(struct inode* ip, char* p, int n);
+int loopwrite(struct inode* ip, char* p, int n);
+int loopioctl(struct inode* ip, int request, void* p);
+int looppoll(struct inode* ip, int events);
+
+#endif /* ETH_LOOP_H */
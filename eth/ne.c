@@ -1,9 +1,16 @@
-#include "../types.h"
-#include "../x86.h"
-#include "../defs.h"
-#include "../net/net.h"
-#include "ne.h"
-
+#include "../types.h"
+#include "../x86.h"
+#include "../defs.h"
+#include "../mmu.h"
+#include "../spinlock.h"
+#include "../softirq.h"
+#include "../trace.h"
+#include "../net/net.h"
+#include "../net/inet.h"
+#include "eth.h"
+#include "ne.h"
+#include "filter.h"
+
 // Constants for DMA and hardware interaction
 #define PROM_SIGNATURE        0x57
 #define RESET_TIMEOUT_POLL_LIMIT 10000
@@ -15,291 +22,691 @@ struct ne_reg_write {
 };
 
 // Helper function to perform a sequence of register writes
-static void write_sequence(ne_t* ne, const struct ne_reg_write *seq, int len);
-
-// Probe the NIC and retrieve its MAC address.
-int
-ne_probe(ne_t* ne)
-{
-    uchar eprom[32];
-    int reg0;
-    int i;
-    
-    reg0 = inb(ne->base);
-    if (reg0 == 0xFF)
-        return FALSE;
-
-    // Verify that a DP8390 controller is present.
-    {
-        int regd;
-        outb(ne->base + DP_CR, CR_STP | CR_NO_DMA | CR_PS_P1);
-        regd = inb(ne->base + DP_MAR5);
-        outb(ne->base + DP_MAR5, 0xFF);
-        outb(ne->base + DP_CR, CR_NO_DMA | CR_PS_P0);
-        inb(ne->base + DP_CNTR0);
-        if (inb(ne->base + DP_CNTR0) != 0) {
-            outb(ne->base, reg0);
-            outb(ne->base + DP_TCR, regd);
-            cprintf("%s: This is not NEx000.\n", ne->name);
-            return FALSE;
-        }
-    }
-
-    // Reset the board.
-    {
-        int j = 0;
-        outb(ne->base + NE_RESET, inb(ne->base + NE_RESET));
-        while (inb(ne->base + DP_ISR) == 0) {
-            if (j++ > RESET_TIMEOUT_POLL_LIMIT) {
-                cprintf("%s: NIC reset failure\n", ne->name);
-                return FALSE;
-            }
-        }
-        outb(ne->base + DP_ISR, 0xFF);
-    }
-
+static void write_sequence(ne_t* ne, const struct ne_reg_write *seq, int len);
+
+// Probe the NIC and retrieve its MAC address.
+int
+ne_probe(ne_t* ne)
+{
+    uchar eprom[32];
+    int reg0;
+    int i;
+    
+    reg0 = inb(ne->base);
+    if (reg0 == 0xFF)
+        return FALSE;
+
+    // Verify that a DP8390 controller is present.
+    {
+        int regd;
+        outb(ne->base + DP_CR, CR_STP | CR_NO_DMA | CR_PS_P1);
+        regd = inb(ne->base + DP_MAR5);
+        outb(ne->base + DP_MAR5, 0xFF);
+        outb(ne->base + DP_CR, CR_NO_DMA | CR_PS_P0);
+        inb(ne->base + DP_CNTR0);
+        if (inb(ne->base + DP_CNTR0) != 0) {
+            outb(ne->base, reg0);
+            outb(ne->base + DP_TCR, regd);
+            cprintf("%s: This is not NEx000.\n", ne->name);
+            return FALSE;
+        }
+    }
+
+    // Reset the board.
+    {
+        int j = 0;
+        outb(ne->base + NE_RESET, inb(ne->base + NE_RESET));
+        while (inb(ne->base + DP_ISR) == 0) {
+            if (j++ > RESET_TIMEOUT_POLL_LIMIT) {
+                cprintf("%s: NIC reset failure\n", ne->name);
+                return FALSE;
+            }
+        }
+        outb(ne->base + DP_ISR, 0xFF);
+    }
+
     // Read 16 bytes from the PROM (32 bytes on the wire) using the standard
     // initialization sequence described in the datasheet.
     {
-        struct ne_reg_write seq[] = {
-            { DP_CR, CR_NO_DMA | CR_PS_P0 | CR_STP },
-            { DP_DCR, (DCR_BMS | DCR_8BYTES) },
-            { DP_RBCR0, 0x00 }, { DP_RBCR1, 0x00 },
-            { DP_RCR, RCR_MON },
-            { DP_TCR, TCR_INTERNAL },
-            { DP_ISR, 0xFF },
-            { DP_IMR, 0x00 },
-            { DP_RBCR0, 32 }, { DP_RBCR1, 0 },
-            { DP_RSAR0, 0x00 }, { DP_RSAR1, 0x00 },
-            { DP_CR, (CR_PS_P0 | CR_DM_RR | CR_STA) },
-        };
-        write_sequence(ne, seq, NELEM(seq));
-
-        ne->is16bit = TRUE;
-        for (i = 0; i < 32; i += 2) {
-            eprom[i+0] = inb(ne->base + NE_DATA);
-            eprom[i+1] = inb(ne->base + NE_DATA);
-            if (eprom[i+0] != eprom[i+1])
-                ne->is16bit = FALSE;
-        }
-        if (ne->is16bit)
-            for (i = 0; i < 16; ++i)
-                eprom[i] = eprom[i*2];
-        if (eprom[14] != PROM_SIGNATURE || eprom[15] != PROM_SIGNATURE)
-            return FALSE;
-    }
-    
-    for (i = 0; i < 6; ++i)
-        ne->address[i] = eprom[i];
-    
-    return TRUE;
-}
-
+        struct ne_reg_write seq[] = {
+            { DP_CR, CR_NO_DMA | CR_PS_P0 | CR_STP },
+            { DP_DCR, (DCR_BMS | DCR_8BYTES) },
+            { DP_RBCR0, 0x00 }, { DP_RBCR1, 0x00 },
+            { DP_RCR, RCR_MON },
+            { DP_TCR, TCR_INTERNAL },
+            { DP_ISR, 0xFF },
+            { DP_IMR, 0x00 },
+            { DP_RBCR0, 32 }, { DP_RBCR1, 0 },
+            { DP_RSAR0, 0x00 }, { DP_RSAR1, 0x00 },
+            { DP_CR, (CR_PS_P0 | CR_DM_RR | CR_STA) },
+        };
+        write_sequence(ne, seq, NELEM(seq));
+
+        ne->is16bit = TRUE;
+        for (i = 0; i < 32; i += 2) {
+            eprom[i+0] = inb(ne->base + NE_DATA);
+            eprom[i+1] = inb(ne->base + NE_DATA);
+            if (eprom[i+0] != eprom[i+1])
+                ne->is16bit = FALSE;
+        }
+        if (ne->is16bit)
+            for (i = 0; i < 16; ++i)
+                eprom[i] = eprom[i*2];
+        if (eprom[14] != PROM_SIGNATURE || eprom[15] != PROM_SIGNATURE)
+            return FALSE;
+    }
+    
+    for (i = 0; i < 6; ++i)
+        ne->address[i] = eprom[i];
+    
+    return TRUE;
+}
+
 // A helper function to execute a series of register writes.
 static void write_sequence(ne_t* ne, const struct ne_reg_write *seq, int len) {
     for (int i = 0; i < len; ++i) {
         outb(ne->base + seq[i].offset, seq[i].value);
     }
-}
-
-// Initialize the NIC.
-void
-ne_init(ne_t* ne)
-{
-    int i;
-    
-    if (ne->is16bit) {
-        ne->ramsize = NE2000_SIZE;
-        ne->startaddr = NE2000_START;
-        ne->send_startpage = NE2000_START / DP_PAGESIZE;
-    } else {
-        ne->startaddr = NE1000_START;
-        ne->ramsize = NE1000_SIZE;
-        ne->send_startpage = NE1000_START / DP_PAGESIZE;
-    }
-    ne->pages = ne->ramsize / DP_PAGESIZE;
-    ne->send_stoppage = ne->send_startpage + SENDQ_PAGES * SENDQ_LEN - 1;
-    ne->recv_startpage = ne->send_stoppage + 1;
-    ne->recv_stoppage = ne->send_startpage + ne->pages;
-    for (i = 0; i < SENDQ_LEN; ++i) {
-        ne->sendq[i].sendpage = ne->send_startpage + i * SENDQ_PAGES;
-        ne->sendq[i].filled = 0;
-    }
-    ne->sendq_head = 0;
-    ne->sendq_tail = SENDQ_LEN-1;
-
-    cprintf("%s: NE%d000 (%dkB RAM) at 0x%x:%d - ",
-            ne->name,
-            ne->is16bit ? 2 : 1,
-            ne->ramsize/1024,
-            ne->base,
-            ne->irq);
+}
+
+// Initialize the NIC.
+void
+ne_init(ne_t* ne)
+{
+    int i;
+    
+    if (ne->is16bit) {
+        ne->ramsize = NE2000_SIZE;
+        ne->startaddr = NE2000_START;
+        ne->send_startpage = NE2000_START / DP_PAGESIZE;
+    } else {
+        ne->startaddr = NE1000_START;
+        ne->ramsize = NE1000_SIZE;
+        ne->send_startpage = NE1000_START / DP_PAGESIZE;
+    }
+    ne->pages = ne->ramsize / DP_PAGESIZE;
+    ne->send_stoppage = ne->send_startpage + SENDQ_PAGES * SENDQ_LEN - 1;
+    ne->recv_startpage = ne->send_stoppage + 1;
+    ne->recv_stoppage = ne->send_startpage + ne->pages;
+    for (i = 0; i < SENDQ_LEN; ++i) {
+        ne->sendq[i].sendpage = ne->send_startpage + i * SENDQ_PAGES;
+        ne->sendq[i].filled = 0;
+    }
+    ne->sendq_head = 0;
+    ne->sendq_tail = 0;
+    ne->xmitting = FALSE;
+    for (i = 0; i < XMITQ_LEN; ++i) {
+        if ((ne->xmitq[i].buf = kmalloc(ETH_MAX_SIZE)) == 0)
+            panic("ne_init: kmalloc");
+        ne->xmitq[i].size = 0;
+    }
+    ne->xmitq_head = 0;
+    ne->xmitq_tail = 0;
+    for (i = 0; i < RECVQ_LEN; ++i) {
+        if ((ne->recvq[i].buf = kmalloc(ETH_MAX_SIZE)) == 0)
+            panic("ne_init: kmalloc");
+        ne->recvq[i].size = 0;
+    }
+    ne->recvq_head = 0;
+    ne->recvq_tail = 0;
+
+    cprintf("%s: NE%d000 (%dkB RAM) at 0x%x:%d - ",
+            ne->name,
+            ne->is16bit ? 2 : 1,
+            ne->ramsize/1024,
+            ne->base,
+            ne->irq);
     for (i = 0; i < 6; ++i)
         cprintf("%x%s", ne->address[i], i < 5 ? ":" : "\n");
 
+    // Our own address and broadcasts only, until ETH_PROMISC or
+    // ETH_SET_MULTICAST say otherwise.
+    ne->rcr = RCR_AB | RCR_AM;
+    memset(ne->mar, 0, sizeof(ne->mar));
     {
-        struct ne_reg_write seq[] = {
-            { DP_CR, CR_PS_P0 | CR_STP | CR_NO_DMA },
-            { DP_DCR, ((ne->is16bit ? DCR_WORDWIDE : DCR_BYTEWIDE) | DCR_LTLENDIAN | DCR_8BYTES | DCR_BMS) },
-            { DP_RCR, RCR_MON },
-            { DP_RBCR0, 0 }, { DP_RBCR1, 0 },
-            { DP_TCR, TCR_INTERNAL },
-            { DP_PSTART, ne->recv_startpage },
-            { DP_PSTOP, ne->recv_stoppage },
-            { DP_BNRY, ne->recv_startpage },
-            { DP_ISR, 0xFF },
-            { DP_IMR, (IMR_PRXE | IMR_PTXE | IMR_RXEE | IMR_TXEE | IMR_OVWE | IMR_CNTE) },
-            { DP_CR, CR_PS_P1 | CR_NO_DMA },
-            { DP_PAR0, ne->address[0] }, { DP_PAR1, ne->address[1] },
-            { DP_PAR2, ne->address[2] }, { DP_PAR3, ne->address[3] },
-            { DP_PAR4, ne->address[4] }, { DP_PAR5, ne->address[5] },
-            { DP_MAR0, 0xFF }, { DP_MAR1, 0xFF }, { DP_MAR2, 0xFF },
-            { DP_MAR3, 0xFF }, { DP_MAR4, 0xFF }, { DP_MAR5, 0xFF },
-            { DP_MAR6, 0xFF }, { DP_MAR7, 0xFF },
-            { DP_CURR, ne->recv_startpage + 1 },
-            { DP_CR, CR_STA | CR_NO_DMA },
-            { DP_TCR, TCR_NORMAL },
-            { DP_RCR, RCR_PRO },
-        };
-        write_sequence(ne, seq, NELEM(seq));
-    }
-}
-
-// Configure remote DMA for read or write operations.
-void
-ne_rdma_setup(ne_t* ne, int mode, ushort addr, int size)
-{
-    if (mode == CR_DM_RW) {
-        uchar dummy[4];
-        ushort safeloc = ne->startaddr - sizeof(dummy);
-        int oldcrda, newcrda;
-        oldcrda = inb(ne->base + DP_CRDA0);
-        oldcrda |= ((inb(ne->base + DP_CRDA1) << 8) & 0xFF00);
-        ne_getblock(ne, safeloc, sizeof(dummy), dummy);
-        do {
-            newcrda = inb(ne->base + DP_CRDA0);
-            newcrda |= ((inb(ne->base + DP_CRDA1) << 8) & 0xFF00);
-        } while (oldcrda == newcrda);
-    }
-    outb(ne->base + DP_RSAR0, addr & 0xFF);
-    outb(ne->base + DP_RSAR1, (addr >> 8) & 0xFF);
-    outb(ne->base + DP_RBCR0, size & 0xFF);
-    outb(ne->base + DP_RBCR1, (size >> 8) & 0xFF);
-    outb(ne->base + DP_CR, mode | CR_PS_P0 | CR_STA);
-    return;
-}
-
-// Read 'size' bytes from NIC RAM at 'addr' into 'dst'.
-void
-ne_getblock(ne_t* ne, ushort addr, int size, void* dst)
-{
-    ne_rdma_setup(ne, CR_DM_RR, addr, size);
-    if (ne->is16bit)
-        insw(ne->base + NE_DATA, dst, size);
-    else
-        insb(ne->base + NE_DATA, dst, size);
-    return;
-}
-
-// Begin transmitting data.
-void
-ne_start_xmit(ne_t* ne, int page, int size)
-{
-    outb(ne->base + DP_TPSR, page);
-    outb(ne->base + DP_TBCR0, size & 0xFF);
-    outb(ne->base + DP_TBCR1, (size >> 8) & 0xFF);
-    outb(ne->base + DP_CR, CR_PS_P0 | CR_NO_DMA | CR_STA | CR_TXP);
-    return;
-}
-
-// Write a packet of 'size' bytes into local memory and transmit it.
-int
-ne_pio_write(ne_t* ne, uchar* packet, int size)
-{
-    int q = ne->sendq_head % SENDQ_LEN;
-    if (ne->sendq[q].filled || ne->sendq_head > ne->sendq_tail) {
-        cprintf("%s: all transmitting buffers in NIC are busy.\n", ne->name);
-        return 0;
-    }
-    ne_rdma_setup(ne, CR_DM_RW, ne->sendq[q].sendpage * DP_PAGESIZE, size);
-    if (ne->is16bit)
-        outsw(ne->base + NE_DATA, packet, size);
-    else
-        outsb(ne->base + NE_DATA, packet, size);
-
-    // Add a check for ISR_RDC to ensure the DMA write is complete.
-    while ((inb(ne->base + DP_ISR) & ISR_RDC) == 0)
-        ;
-
-    ne->sendq[q].filled = TRUE;
-    ne_start_xmit(ne, ne->sendq[q].sendpage, size);
-    ne->sendq_head++;
-    return size;
-}
-
-// [11] Strage Format
-typedef struct {
-    uchar status;
-    uchar next;
-    uchar rbc0, rbc1;
-} ne_recv_hdr;
-
-// Read the next packet from the ring buffer.
-int
-ne_pio_read(ne_t* ne, uchar* buf, int bufsize)
-{
-    uint pktsize;
-    ne_recv_hdr header;
-    uint curr, bnry, page;
-    outb(ne->base + DP_CR, CR_PS_P1);
-    curr = inb(ne->base + DP_CURR);
-    outb(ne->base + DP_CR, CR_PS_P0 | CR_NO_DMA | CR_STA);
-    bnry = inb(ne->base + DP_BNRY);
-    page = bnry + 1;
+        struct ne_reg_write seq[] = {
+            { DP_CR, CR_PS_P0 | CR_STP | CR_NO_DMA },
+            { DP_DCR, ((ne->is16bit ? DCR_WORDWIDE : DCR_BYTEWIDE) | DCR_LTLENDIAN | DCR_8BYTES | DCR_BMS) },
+            { DP_RCR, RCR_MON },
+            { DP_RBCR0, 0 }, { DP_RBCR1, 0 },
+            { DP_TCR, TCR_INTERNAL },
+            { DP_PSTART, ne->recv_startpage },
+            { DP_PSTOP, ne->recv_stoppage },
+            { DP_BNRY, ne->recv_startpage },
+            { DP_ISR, 0xFF },
+            { DP_IMR, (IMR_PRXE | IMR_PTXE | IMR_RXEE | IMR_TXEE | IMR_OVWE | IMR_CNTE) },
+            { DP_CR, CR_PS_P1 | CR_NO_DMA },
+            { DP_PAR0, ne->address[0] }, { DP_PAR1, ne->address[1] },
+            { DP_PAR2, ne->address[2] }, { DP_PAR3, ne->address[3] },
+            { DP_PAR4, ne->address[4] }, { DP_PAR5, ne->address[5] },
+            { DP_MAR0, ne->mar[0] }, { DP_MAR1, ne->mar[1] },
+            { DP_MAR2, ne->mar[2] }, { DP_MAR3, ne->mar[3] },
+            { DP_MAR4, ne->mar[4] }, { DP_MAR5, ne->mar[5] },
+            { DP_MAR6, ne->mar[6] }, { DP_MAR7, ne->mar[7] },
+            { DP_CURR, ne->recv_startpage + 1 },
+            { DP_CR, CR_STA | CR_NO_DMA },
+            { DP_TCR, TCR_NORMAL },
+            { DP_RCR, ne->rcr },
+        };
+        write_sequence(ne, seq, NELEM(seq));
+    }
+}
+
+// The multicast filter bit for an address: the top six bits of
+// its Ethernet CRC, computed as the 8390 does (DP8390 datasheet,
+// multicast address registers).
+int
+ne_mcast_hash(uchar* addr)
+{
+    uint crc = 0xFFFFFFFF;
+    uchar octet;
+    int i, bit;
+
+    for (i = 0; i < 6; i++) {
+        octet = addr[i];
+        for (bit = 0; bit < 8; bit++, octet >>= 1)
+            crc = (crc << 1) ^ (((crc >> 31) ^ (octet & 1)) ? 0x04C11DB7 : 0);
+    }
+    return crc >> 26;
+}
+
+// Load ne->rcr and ne->mar into the running card.
+// Caller must hold ne->lock.
+void
+ne_set_filter(ne_t* ne)
+{
+    int i;
+
+    outb(ne->base + DP_CR, CR_PS_P1 | CR_NO_DMA | CR_STA);
+    for (i = 0; i < 8; i++)
+        outb(ne->base + DP_MAR0 + i, ne->mar[i]);
+    outb(ne->base + DP_CR, CR_PS_P0 | CR_NO_DMA | CR_STA);
+    outb(ne->base + DP_RCR, ne->rcr);
+}
+
+// Configure remote DMA for read or write operations.
+void
+ne_rdma_setup(ne_t* ne, int mode, ushort addr, int size)
+{
+    if (mode == CR_DM_RW) {
+        uchar dummy[4];
+        ushort safeloc = ne->startaddr - sizeof(dummy);
+        int oldcrda, newcrda;
+        oldcrda = inb(ne->base + DP_CRDA0);
+        oldcrda |= ((inb(ne->base + DP_CRDA1) << 8) & 0xFF00);
+        ne_getblock(ne, safeloc, sizeof(dummy), dummy);
+        do {
+            newcrda = inb(ne->base + DP_CRDA0);
+            newcrda |= ((inb(ne->base + DP_CRDA1) << 8) & 0xFF00);
+        } while (oldcrda == newcrda);
+    }
+    outb(ne->base + DP_RSAR0, addr & 0xFF);
+    outb(ne->base + DP_RSAR1, (addr >> 8) & 0xFF);
+    outb(ne->base + DP_RBCR0, size & 0xFF);
+    outb(ne->base + DP_RBCR1, (size >> 8) & 0xFF);
+    outb(ne->base + DP_CR, mode | CR_PS_P0 | CR_STA);
+    return;
+}
+
+// Read 'size' bytes from NIC RAM at 'addr' into 'dst'.
+// Word-wide cards move whole words; an odd trailing byte goes
+// through a bounce word so that dst is not overrun.
+void
+ne_getblock(ne_t* ne, ushort addr, int size, void* dst)
+{
+    ushort last;
+
+    if (ne->is16bit) {
+        ne_rdma_setup(ne, CR_DM_RR, addr, (size + 1) & ~1);
+        insw(ne->base + NE_DATA, dst, size / 2);
+        if (size & 1) {
+            insw(ne->base + NE_DATA, &last, 1);
+            ((uchar*)dst)[size - 1] = last & 0xFF;
+        }
+    } else {
+        ne_rdma_setup(ne, CR_DM_RR, addr, size);
+        insb(ne->base + NE_DATA, dst, size);
+    }
+    return;
+}
+
+// Begin transmitting data.
+void
+ne_start_xmit(ne_t* ne, int page, int size)
+{
+    outb(ne->base + DP_TPSR, page);
+    outb(ne->base + DP_TBCR0, size & 0xFF);
+    outb(ne->base + DP_TBCR1, (size >> 8) & 0xFF);
+    outb(ne->base + DP_CR, CR_PS_P0 | CR_NO_DMA | CR_STA | CR_TXP);
+    return;
+}
+
+// The transmitter must not start before the remote DMA has
+// finished.  It is only a few bus cycles behind the last out.
+static void
+ne_rdma_wait(ne_t* ne)
+{
+    int i;
+
+    for (i = 0; i < RESET_TIMEOUT_POLL_LIMIT; i++)
+        if (inb(ne->base + DP_ISR) & ISR_RDC)
+            break;
+    outb(ne->base + DP_ISR, ISR_RDC);
+}
+
+// Copy a packet of 'size' bytes into card transmit buffer q.
+// packet must be readable up to an even length.
+void
+ne_pio_write(ne_t* ne, int q, uchar* packet, int size)
+{
+    if (ne->is16bit) {
+        size = (size + 1) & ~1;
+        ne_rdma_setup(ne, CR_DM_RW, ne->sendq[q].sendpage * DP_PAGESIZE, size);
+        outsw(ne->base + NE_DATA, packet, size / 2);
+    } else {
+        ne_rdma_setup(ne, CR_DM_RW, ne->sendq[q].sendpage * DP_PAGESIZE, size);
+        outsb(ne->base + NE_DATA, packet, size);
+    }
+
+    ne_rdma_wait(ne);
+}
+
+// Stream the nseg segments of a frame of size bytes, padded to
+// ETH_MIN_SIZE, into card transmit buffer q within one remote DMA.
+// Segment k is lens[k] bytes at seg[k].buf.  On a word-wide card a
+// word may straddle two segments.
+static void
+ne_pio_writev(ne_t* ne, int q, struct eth_frame* seg, int* lens, int nseg,
+              int size)
+{
+    int k, len, carry, pad;
+    uchar* p;
+
+    pad = size < ETH_MIN_SIZE ? ETH_MIN_SIZE - size : 0;
+    size += pad;
+    if (ne->is16bit)
+        size = (size + 1) & ~1;
+    ne_rdma_setup(ne, CR_DM_RW, ne->sendq[q].sendpage * DP_PAGESIZE, size);
+    carry = -1;
+    for (k = 0; k < nseg; k++) {
+        p = seg[k].buf;
+        len = lens[k];
+        if (!ne->is16bit) {
+            outsb(ne->base + NE_DATA, p, len);
+            continue;
+        }
+        if (carry >= 0 && len > 0) {
+            outw(ne->base + NE_DATA, carry | *p++ << 8);
+            len--;
+            carry = -1;
+        }
+        outsw(ne->base + NE_DATA, p, len / 2);
+        if (len & 1)
+            carry = p[len - 1];
+    }
+    for (; pad > 0; pad--) {
+        if (!ne->is16bit) {
+            outb(ne->base + NE_DATA, 0);
+        } else if (carry >= 0) {
+            outw(ne->base + NE_DATA, carry);
+            carry = -1;
+        } else {
+            carry = 0;
+        }
+    }
+    if (carry >= 0)
+        outw(ne->base + NE_DATA, carry);
+    ne_rdma_wait(ne);
+}
+
+// Queue a packet for transmission and push the queue to the card.
+// Short frames are padded to ETH_MIN_SIZE.  Returns size, 0 if the
+// queue is full, or -1 if the frame is too large.
+// Caller must hold neither lock.  Concurrent writers each reserve a
+// slot and copy into it in parallel; ne_kick() takes slots in order
+// once they are ready.
+int
+ne_enqueue(ne_t* ne, uchar* packet, int size)
+{
+    struct eth_frame seg;
+
+    seg.buf = packet;
+    seg.len = size;
+    return ne_enqueuev(ne, &seg, 1);
+}
+
+// Queue a frame made of nseg segments, as ne_enqueue() does.  When
+// nothing is queued ahead of it and a card buffer is free, the
+// segments go straight into card memory without being gathered first.
+// seg must be in kernel memory, though the data it points to need
+// not be; each length is read from it once, checked, and reused.
+int
+ne_enqueuev(ne_t* ne, struct eth_frame* seg, int nseg)
+{
+    int i, k, q, size, lens[ETH_MAXSEG];
+
+    if (nseg < 0 || nseg > ETH_MAXSEG)
+        return -1;
+    for (k = size = 0; k < nseg; k++) {
+        lens[k] = seg[k].len;
+        if (lens[k] < 0 || lens[k] > ETH_MAX_SIZE)
+            return -1;
+        size += lens[k];
+    }
+    if (size <= 0 || size > ETH_MAX_SIZE)
+        return -1;
+
+    acquire(&ne->lock);
+    acquire(&ne->qlock);
+    if (ne->xmitq_head == ne->xmitq_tail &&
+        ne->sendq_head - ne->sendq_tail < SENDQ_LEN) {
+        release(&ne->qlock);
+        q = ne->sendq_head % SENDQ_LEN;
+        ne_pio_writev(ne, q, seg, lens, nseg, size);
+        ne->sendq[q].size = size < ETH_MIN_SIZE ? ETH_MIN_SIZE : size;
+        ne->sendq[q].filled = TRUE;
+        ne->sendq_head++;
+        ne_kick(ne);
+        release(&ne->lock);
+        return size;
+    }
+    if (ne->xmitq_tail - ne->xmitq_head >= XMITQ_LEN) {
+        release(&ne->qlock);
+        release(&ne->lock);
+        return 0;
+    }
+    i = ne->xmitq_tail++ % XMITQ_LEN;
+    release(&ne->qlock);
+    release(&ne->lock);
+
+    for (k = size = 0; k < nseg; k++) {
+        memmove(ne->xmitq[i].buf + size, seg[k].buf, lens[k]);
+        size += lens[k];
+    }
+    if (size < ETH_MIN_SIZE) {
+        memset(ne->xmitq[i].buf + size, 0, ETH_MIN_SIZE - size);
+        ne->xmitq[i].size = ETH_MIN_SIZE;
+    } else {
+        ne->xmitq[i].size = size;
+    }
+
+    acquire(&ne->qlock);
+    ne->xmitq[i].ready = TRUE;
+    release(&ne->qlock);
+    acquire(&ne->lock);
+    ne_kick(ne);
+    release(&ne->lock);
+    return size;
+}
+
+// Move queued frames into free card buffers and start the
+// transmitter if it is idle.  A second buffer is filled while
+// the first one is on the wire, so the next ne_start_xmit()
+// can be issued straight from the interrupt.
+// Caller must hold ne->lock but not ne->qlock.
+void
+ne_kick(ne_t* ne)
+{
+    int i, q;
+
+    while (ne->sendq_head - ne->sendq_tail < SENDQ_LEN) {
+        acquire(&ne->qlock);
+        i = ne->xmitq_head % XMITQ_LEN;
+        if (ne->xmitq_head == ne->xmitq_tail || !ne->xmitq[i].ready) {
+            release(&ne->qlock);
+            break;
+        }
+        release(&ne->qlock);
+        // Only the holder of ne->lock consumes ready slots.
+        q = ne->sendq_head % SENDQ_LEN;
+        ne_pio_write(ne, q, ne->xmitq[i].buf, ne->xmitq[i].size);
+        ne->sendq[q].size = ne->xmitq[i].size;
+        ne->sendq[q].filled = TRUE;
+        ne->sendq_head++;
+        acquire(&ne->qlock);
+        ne->xmitq[i].ready = FALSE;
+        ne->xmitq_head++;
+        release(&ne->qlock);
+        wakeupboost(ne->xmitq);
+    }
+    if (!ne->xmitting && ne->sendq_head != ne->sendq_tail) {
+        q = ne->sendq_tail % SENDQ_LEN;
+        ne_start_xmit(ne, ne->sendq[q].sendpage, ne->sendq[q].size);
+        ne->xmitting = TRUE;
+        TRACE(TR_ETHTX, ne->base, ne->sendq[q].size);
+    }
+}
+
+// [11] Strage Format
+typedef struct {
+    uchar status;
+    uchar next;
+    uchar rbc0, rbc1;
+} ne_recv_hdr;
+
+// Copy n bytes from offset off into the frame whose header is at
+// page of the card receive ring, following the ring past its end.
+static void
+ne_ring_copy(ne_t* ne, uint page, int off, int n, uchar* dst)
+{
+    uint addr = page * DP_PAGESIZE + sizeof(ne_recv_hdr) + off;
+    int remain;
+
+    if (n <= 0)
+        return;
+    if (addr >= (uint)ne->recv_stoppage * DP_PAGESIZE)
+        addr -= (ne->recv_stoppage - ne->recv_startpage) * DP_PAGESIZE;
+    remain = (uint)ne->recv_stoppage * DP_PAGESIZE - addr;
+    if (remain < n) {
+        ne_getblock(ne, addr, remain, dst);
+        ne_getblock(ne, (uint)ne->recv_startpage * DP_PAGESIZE, n - remain, dst + remain);
+    } else {
+        ne_getblock(ne, addr, n, dst);
+    }
+}
+
+// Might the network stack want a frame starting with eh?
+static int
+ne_stack_wants(ne_t* ne, eth_hdr_t* eh)
+{
+    static uchar bcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    int type = ntohs(eh->length);
+
+    if (ne->netif == 0 || (!ne->netif->up && !ne->netif->dhcp))
+        return 0;
+    if (type != ETH_TYPE_IP4 && type != ETH_TYPE_ARP)
+        return 0;
+    return memcmp(eh->dst, ne->address, 6) == 0 || memcmp(eh->dst, bcast, 6) == 0;
+}
+
+// Read the next packet from the ring buffer and return the number of
+// bytes read. Returns 0 if the ring is empty and -1 if the packet was
+// dropped: the attached filter rejected it, or it was bad, in which case
+// the ring is discarded so that reception can resume. If match is not 0,
+// the stack sees the frames and gets all of the ones it may want, even
+// those the filter rejects; *match says whether readers should see them.
+// Frames only readers get are cut to ne->snaplen bytes, if set.
+int
+ne_pio_read(ne_t* ne, uchar* buf, int bufsize, int* match)
+{
+    uint pktsize;
+    ne_recv_hdr header;
+    uint curr, bnry, page;
+    int npeek, n, ok, stack;
+    outb(ne->base + DP_CR, CR_PS_P1);
+    curr = inb(ne->base + DP_CURR);
+    outb(ne->base + DP_CR, CR_PS_P0 | CR_NO_DMA | CR_STA);
+    bnry = inb(ne->base + DP_BNRY);
+    page = bnry + 1;
     if (page == (uint)ne->recv_stoppage)
-        page = (uint)ne->recv_startpage;
-
-    if (page == curr) {
-        cprintf("%s: no packet to read\n", ne->name);
-        return 0;
-    }
-
-    ne_getblock(ne, page * DP_PAGESIZE, sizeof(header), &header);
-    pktsize = (header.rbc0 | (header.rbc1 << 8)) - sizeof(header);
-    if (pktsize < ETH_MIN_SIZE || pktsize > ETH_MAX_SIZE || (header.status & RSR_PRX) == 0) {
-        cprintf("%s: Bad packet (size: %d, status: 0x%x)\n", ne->name, pktsize, header.status);
-        return -1;
-    }
-
-    if (buf == 0 || pktsize > (uint)bufsize) {
-        return pktsize;
-    } else {
-        int remain = ((uint)ne->recv_stoppage - page) * DP_PAGESIZE;
-        if ((uint)remain < pktsize) {
-            ne_getblock(ne, page * DP_PAGESIZE + sizeof(header), remain, buf);
-            ne_getblock(ne, (uint)ne->recv_startpage * DP_PAGESIZE, pktsize - remain, buf + remain);
-        } else {
-            ne_getblock(ne, page * DP_PAGESIZE + sizeof(header), pktsize, buf);
-        }
-    }
-    bnry = header.next - 1;
-    outb(ne->base + DP_BNRY, bnry < (uint)ne->recv_startpage ? (uint)ne->recv_stoppage - 1 : bnry);
-    return pktsize;
-}
-
-void
-ne_interrupt(ne_t* ne)
-{
-    int isr;
-    while ((isr = inb(ne->base + DP_ISR)) != 0) {
-        outb(ne->base + DP_ISR, isr);
-        if (isr & ISR_PTX) {
-            ne->sendq_tail++;
-            ne->sendq[ne->sendq_tail % SENDQ_LEN].filled = FALSE;
-            cprintf("%s: packet transmitted with no error.\n", ne->name);
-        }
-        if (isr & ISR_PRX) {
-            cprintf("%s: packet received with no error.\n", ne->name);
-        }
-    }
+        page = (uint)ne->recv_startpage;
+
+    if (page == curr)
+        return 0;
+
+    ne_getblock(ne, page * DP_PAGESIZE, sizeof(header), &header);
+    pktsize = (header.rbc0 | (header.rbc1 << 8)) - sizeof(header);
+    if (pktsize < ETH_MIN_SIZE || pktsize > ETH_MAX_SIZE || (header.status & RSR_PRX) == 0) {
+        ne->stats.rx_err++;
+        ne_trace(ne, "%s: Bad packet (size: %d, status: 0x%x)\n", ne->name, pktsize, header.status);
+        // The link to the next frame cannot be trusted; drop everything.
+        bnry = curr - 1;
+        outb(ne->base + DP_BNRY, bnry < (uint)ne->recv_startpage ? (uint)ne->recv_stoppage - 1 : bnry);
+        return -1;
+    }
+
+    if (buf == 0 || pktsize > (uint)bufsize)
+        return pktsize;
+    n = pktsize;
+    if (ne->filter.n > 0 || ne->snaplen > 0) {
+        // Look at the headers before paying for the whole frame.
+        npeek = n < ETH_FILTER_PEEK ? n : ETH_FILTER_PEEK;
+        ne_ring_copy(ne, page, 0, npeek, buf);
+        ok = ne->filter.n == 0 || eth_filter_run(&ne->filter, buf, npeek, pktsize);
+        stack = match != 0 && ne_stack_wants(ne, (eth_hdr_t*)buf);
+        if (!ok && !stack) {
+            ne->stats.rx_filtered++;
+            n = -1;
+        } else if (!stack && ne->snaplen > 0 && ne->snaplen < n) {
+            n = ne->snaplen;
+        }
+        if (n > npeek)
+            ne_ring_copy(ne, page, npeek, n - npeek, buf + npeek);
+    } else {
+        ok = TRUE;
+        ne_ring_copy(ne, page, 0, n, buf);
+    }
+    if (match)
+        *match = ok;
+    bnry = header.next - 1;
+    outb(ne->base + DP_BNRY, bnry < (uint)ne->recv_startpage ? (uint)ne->recv_stoppage - 1 : bnry);
+    return n;
+}
+
+// Slot s of the shared ring, in kernel addresses: the ring pages are
+// not contiguous, so find the page holding chunk s+1.
+static uchar*
+ne_ring_slot(ne_t* ne, uint s)
+{
+    uint off = (s + 1) * ETH_RING_SLOTSZ;
+    return (uchar*)ne->ringpage[off / PGSIZE] + off % PGSIZE;
+}
+
+// Is the shared ring empty? The reader owns tail, so never trust it
+// as an index.
+int
+ne_ring_empty(ne_t* ne)
+{
+    return ne->ring->head == ne->ring->tail % ETH_RING_SLOTS;
+}
+
+// Copy frames from the card straight into the shared ring until it is
+// full; the card ring holds the rest.
+static void
+ne_ring_drain(ne_t* ne)
+{
+    struct eth_ring* r = ne->ring;
+    uint h;
+    int size;
+
+    for (;;) {
+        h = r->head % ETH_RING_SLOTS;
+        if ((h + 1) % ETH_RING_SLOTS == r->tail % ETH_RING_SLOTS)
+            break;
+        size = ne_pio_read(ne, ne_ring_slot(ne, h), ETH_RING_SLOTSZ, 0);
+        if (size == 0)
+            break;
+        if (size < 0)
+            continue;
+        r->len[h] = size;
+        // Publish the slot only after its data and length are in place.
+        __sync_synchronize();
+        r->head = (h + 1) % ETH_RING_SLOTS;
+        ne->stats.rx_ok++;
+        TRACE(TR_ETHRX, ne->base, size);
+        ne_trace(ne, "%s: received %d bytes into ring\n", ne->name, size);
+    }
+}
+
+// Move frames from the card's receive ring into recvq, or into the
+// shared ring once it is mapped, until the card is empty or the
+// queue is full.  Frames that do not fit stay on the card until the
+// reader makes room.
+// Caller must hold ne->lock but not ne->qlock.
+void
+ne_drain(ne_t* ne)
+{
+    int i, size;
+
+    if (ne->ringon) {
+        ne_ring_drain(ne);
+        return;
+    }
+    for (;;) {
+        acquire(&ne->qlock);
+        i = ne->recvq_tail % RECVQ_LEN;
+        if (ne->recvq_tail - ne->recvq_head >= RECVQ_LEN && ne->lossy &&
+            ne->recvq_head != ne->recvq_seen) {
+            // Nobody is reading the raw device; keep the stack fed.
+            ne->recvq_head++;
+            ne->stats.rx_drop++;
+            TRACE(TR_ETHDROP, ne->base, ne->stats.rx_drop);
+        }
+        if (ne->recvq_tail - ne->recvq_head >= RECVQ_LEN ||
+            ne->recvq[i].busy) {
+            release(&ne->qlock);
+            break;
+        }
+        release(&ne->qlock);
+        // Slots from tail on are written only by the holder of ne->lock.
+        size = ne_pio_read(ne, ne->recvq[i].buf, ETH_MAX_SIZE, &ne->recvq[i].match);
+        if (size == 0)
+            break;
+        if (size < 0)
+            continue;
+        acquire(&ne->qlock);
+        ne->recvq[i].size = size;
+        ne->recvq_tail++;
+        release(&ne->qlock);
+        ne->stats.rx_ok++;
+        TRACE(TR_ETHRX, ne->base, size);
+        ne_trace(ne, "%s: received %d bytes\n", ne->name, size);
+    }
+}
+
+// Acknowledge card interrupts, start the next queued transmission,
+// drain received frames into recvq and wake up readers sleeping on it.
+// Caller must hold ne->lock but not ne->qlock.
+void
+ne_interrupt(ne_t* ne)
+{
+    int isr;
+    while ((isr = inb(ne->base + DP_ISR)) != 0) {
+        outb(ne->base + DP_ISR, isr);
+        if ((isr & (ISR_PTX | ISR_TXE)) && ne->xmitting) {
+            // Either way the card buffer is done with.
+            ne->sendq[ne->sendq_tail % SENDQ_LEN].filled = FALSE;
+            ne->sendq_tail++;
+            ne->xmitting = FALSE;
+            if (isr & ISR_PTX) {
+                ne->stats.tx_ok++;
+                ne_trace(ne, "%s: packet transmitted with no error.\n", ne->name);
+            } else {
+                ne->stats.tx_err++;
+                ne_trace(ne, "%s: transmit error (tsr 0x%x)\n", ne->name,
+                         inb(ne->base + DP_TSR));
+            }
+            ne_kick(ne);
+        }
+        if (isr & ISR_RXE)
+            ne->stats.rx_err++;
+        if (isr & ISR_OVW) {
+            ne->stats.overflow++;
+            ne_trace(ne, "%s: receive ring overflow\n", ne->name);
+        }
+        if (isr & (ISR_PRX | ISR_RXE | ISR_OVW)) {
+            ne_drain(ne);
+            wakeupboost(ne->recvq);
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,259 @@
+// ethbench: packet generator and receive-rate benchmark.
+//
+//   ethbench [-d dev] [-r pps] [-t ticks] [-s size] [-R]
+//   ethbench -e [-d dev]
+//
+// Floods dev (default lo) with frames of each size from ETH_MIN_SIZE
+// to ETH_MAX_SIZE, or of one size with -s, for ticks clock ticks each
+// (default 100), at most pps frames a second (default 0, as fast as
+// possible).  Frames that come back are counted and timed.  On lo
+// every frame comes straight back; on a card run "ethbench -e" on
+// another machine to turn frames around and give -R to count only
+// those replies.  Latencies are in clock ticks: with 100 ticks a
+// second, p50=0 means under 10ms.
+//
+// Each size prints one line of name=value pairs, e.g.
+//   size=60 ticks=100 tx=41210 tx_pps=41210 rx=41210 rx_pps=41210
+//   lost=0 lat_p50=0 lat_p90=0 lat_p99=1 lat_max=2
+
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "net/net.h"
+#include "eth/eth.h"
+
+#define ETHBENCH_TYPE  0x88B5   // IEEE local experimental EtherType
+#define ETHBENCH_MAGIC 0x4542454E
+#define NHIST          101      // latency buckets of one tick, the last open
+#define GRACE          20       // ticks to wait for late frames
+
+// Follows the Ethernet header in every frame.
+struct benchhdr {
+  uint magic;
+  uint run;     // sender's pid, so a mixed wire stays apart
+  uint seq;
+  uint stamp;   // uptime() when sent
+  uint reply;   // set by the reflector
+};
+
+uchar txbuf[ETH_MAX_SIZE];
+uchar rxbuf[ETH_MAX_SIZE];
+uint hist[NHIST];
+int fd;
+int run;
+int wantreply;
+uint rx;
+
+int sizes[] = { ETH_MIN_SIZE, 128, 256, 512, 1024, ETH_MAX_SIZE };
+
+void
+usage(void)
+{
+  printf(2, "usage: ethbench [-d dev] [-r pps] [-t ticks] [-s size] [-R]\n"
+            "       ethbench -e [-d dev]\n");
+  exit();
+}
+
+// Fill txbuf with a broadcast test frame of size bytes.
+void
+mkframe(int size)
+{
+  eth_hdr_t *eh;
+  struct benchhdr *bh;
+  int i;
+
+  eh = (eth_hdr_t*)txbuf;
+  memset(eh->dst, 0xFF, sizeof(eh->dst));
+  memset(eh->src, 0, sizeof(eh->src));
+  eh->length = htons(ETHBENCH_TYPE);
+  bh = (struct benchhdr*)(eh + 1);
+  bh->magic = ETHBENCH_MAGIC;
+  bh->run = run;
+  bh->seq = 0;
+  bh->reply = 0;
+  for(i = sizeof(*eh) + sizeof(*bh); i < size; i++)
+    txbuf[i] = i;
+}
+
+// Is the frame in rxbuf one of ours?  Returns its header or 0.
+struct benchhdr*
+ours(int n)
+{
+  eth_hdr_t *eh;
+  struct benchhdr *bh;
+
+  if(n < (int)(sizeof(*eh) + sizeof(*bh)))
+    return 0;
+  eh = (eth_hdr_t*)rxbuf;
+  bh = (struct benchhdr*)(eh + 1);
+  if(ntohs(eh->length) != ETHBENCH_TYPE || bh->magic != ETHBENCH_MAGIC)
+    return 0;
+  return bh;
+}
+
+// Take every queued frame, timing those sent by this run.
+void
+drain(void)
+{
+  struct benchhdr *bh;
+  uint lat;
+  int n;
+
+  while((n = read(fd, rxbuf, sizeof(rxbuf))) > 0){
+    if((bh = ours(n)) == 0 || bh->run != (uint)run ||
+       bh->reply != (uint)wantreply)
+      continue;
+    lat = uptime() - bh->stamp;
+    hist[lat < NHIST ? lat : NHIST - 1]++;
+    rx++;
+  }
+}
+
+// The smallest latency at or above which lie pct percent of frames.
+int
+percentile(int pct)
+{
+  uint want, seen;
+  int i;
+
+  if(rx == 0)
+    return 0;
+  want = (rx * pct + 99) / 100;
+  seen = 0;
+  for(i = 0; i < NHIST - 1; i++){
+    seen += hist[i];
+    if(seen >= want)
+      return i;
+  }
+  return NHIST - 1;
+}
+
+int
+maxlat(void)
+{
+  int i;
+
+  for(i = NHIST - 1; i > 0; i--)
+    if(hist[i])
+      return i;
+  return 0;
+}
+
+void
+bench(int size, int pps, int ticks)
+{
+  struct benchhdr *bh;
+  uint tx, due;
+  int t0, t, r;
+
+  mkframe(size);
+  bh = (struct benchhdr*)(txbuf + sizeof(eth_hdr_t));
+  memset(hist, 0, sizeof(hist));
+  tx = rx = 0;
+  drain();
+
+  t0 = uptime();
+  while((t = uptime() - t0) < ticks){
+    // Keep to the rate by the frames due so far.
+    due = pps > 0 ? (uint)(pps * (t + 1) / 100) : tx + 1;
+    if(tx >= due){
+      drain();
+      sleep(1);
+      continue;
+    }
+    bh->seq = tx;
+    bh->stamp = uptime();
+    if((r = write(fd, txbuf, size)) < 0){
+      printf(2, "ethbench: write failed\n");
+      exit();
+    }
+    if(r > 0)
+      tx++;
+    drain();
+  }
+  t = uptime() - t0;
+  while(rx < tx && uptime() - t0 < t + GRACE){
+    drain();
+    sleep(1);
+  }
+  drain();
+
+  if(t == 0)
+    t = 1;
+  printf(1, "size=%d ticks=%d tx=%d tx_pps=%d rx=%d rx_pps=%d lost=%d "
+         "lat_p50=%d lat_p90=%d lat_p99=%d lat_max=%d\n",
+         size, t, tx, tx * 100 / t, rx, rx * 100 / t, tx - rx,
+         percentile(50), percentile(90), percentile(99), maxlat());
+}
+
+// Send back every request frame on dev, marked as a reply.
+void
+reflect(void)
+{
+  struct benchhdr *bh;
+  int n;
+
+  ioctl(fd, ETH_NONBLOCK, 0);
+  for(;;){
+    if((n = read(fd, rxbuf, sizeof(rxbuf))) < 0){
+      printf(2, "ethbench: read failed\n");
+      exit();
+    }
+    if((bh = ours(n)) == 0 || bh->reply)
+      continue;
+    bh->reply = 1;
+    write(fd, rxbuf, n);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *dev;
+  int i, pps, ticks, size, echo;
+
+  dev = "lo";
+  pps = 0;
+  ticks = 100;
+  size = 0;
+  echo = 0;
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-e") == 0)
+      echo = 1;
+    else if(strcmp(argv[i], "-R") == 0)
+      wantreply = 1;
+    else if(i + 1 == argc)
+      usage();
+    else if(strcmp(argv[i], "-d") == 0)
+      dev = argv[++i];
+    else if(strcmp(argv[i], "-r") == 0)
+      pps = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-t") == 0)
+      ticks = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-s") == 0)
+      size = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if(ticks <= 0 || pps < 0 ||
+     (size != 0 && (size < ETH_MIN_SIZE || size > ETH_MAX_SIZE)))
+    usage();
+
+  if((fd = open(dev, O_RDWR)) < 0){
+    printf(2, "ethbench: cannot open %s\n", dev);
+    exit();
+  }
+  if(echo)
+    reflect();
+
+  run = getpid();
+  ioctl(fd, ETH_NONBLOCK, (void*)1);
+  printf(1, "dev=%s pps=%d ticks=%d hz=100\n", dev, pps, ticks);
+  if(size)
+    bench(size, pps, ticks);
+  else
+    for(i = 0; i < (int)(sizeof(sizes)/sizeof(sizes[0])); i++)
+      bench(sizes[i], pps, ticks);
+  close(fd);
+  exit();
+}
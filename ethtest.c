@@ -52,8 +52,9 @@ getip(int fd)
       0xFF, // stopper
     },
   };
-  uchar* t;
   static uchar buf[ETH_MAX_SIZE];
+  struct eth_frame seg[4];
+  struct eth_batch b;
   int size;
   
   size = sizeof(udphdr) + sizeof(dhcp) - sizeof(dhcp.options) + 13;
@@ -64,22 +65,21 @@ getip(int fd)
   ip4_checksum(&iphdr);
   udp_checksum(&iphdr, &udphdr, (u16_t*)&dhcp);
   
-  t = buf;
-  memmove(t, &ethhdr, sizeof(ethhdr));
-  t += sizeof(ethhdr);
-  memmove(t, &iphdr, sizeof(iphdr));
-  t += sizeof(iphdr);
-  memmove(t, &udphdr, sizeof(udphdr));
-  t += sizeof(udphdr);
-  memmove(t, &dhcp, sizeof(dhcp));
-
-  size += sizeof(ethhdr);
-  printf(1, "write %d byte\n", write(fd, buf, size));
-  //dump(buf, size);
+  // The driver writes the headers to the card one after another.
+  seg[0].buf = &ethhdr;
+  seg[0].len = sizeof(ethhdr);
+  seg[1].buf = &iphdr;
+  seg[1].len = sizeof(iphdr);
+  seg[2].buf = &udphdr;
+  seg[2].len = sizeof(udphdr);
+  seg[3].buf = &dhcp;
+  seg[3].len = size - sizeof(iphdr) - sizeof(udphdr);
+  b.frames = seg;
+  b.n = 4;
+  printf(1, "write %d byte\n", ioctl(fd, ETH_SEND_GATHER, &b));
 
-  while ((size = read(fd, buf, ETH_MAX_SIZE)) == 0)
-    sleep(10);
-  if (size == -1)
+  // read blocks until the reply arrives
+  if ((size = read(fd, buf, ETH_MAX_SIZE)) <= 0)
     return;
     
   printf(1, "receive %d byte\n", size);
@@ -94,21 +94,60 @@ getip(int fd)
   }
 }
 
+void
+ethstats(int fd)
+{
+  struct eth_stats st;
+
+  if (ioctl(fd, ETH_GET_STATS, &st) < 0) {
+    printf(1, "ioctl: cannot get stats\n");
+    return;
+  }
+  printf(1, "tx_ok %d tx_err %d tx_busy %d rx_ok %d rx_err %d overflow %d\n",
+         st.tx_ok, st.tx_err, st.tx_busy, st.rx_ok, st.rx_err, st.overflow);
+}
+
+// Drain whatever frames are queued, four per call.
+void
+ethdrain(int fd)
+{
+  static uchar bufs[4][ETH_MAX_SIZE];
+  struct eth_frame f[4];
+  struct eth_batch b;
+  int i, n, total;
+
+  b.frames = f;
+  b.n = 4;
+  total = 0;
+  ioctl(fd, ETH_NONBLOCK, (void*)1);
+  do {
+    for (i = 0; i < 4; ++i) {
+      f[i].buf = bufs[i];
+      f[i].len = ETH_MAX_SIZE;
+    }
+    if ((n = ioctl(fd, ETH_RECV_BATCH, &b)) > 0)
+      total += n;
+  } while (n > 0);
+  ioctl(fd, ETH_NONBLOCK, 0);
+  printf(1, "drained %d frames\n", total);
+}
+
 void
 ethtest(int fd)
 {
   ioctl(fd, ETH_IPC_SETUP, 0); // ioctl test.
   getip(fd);
+  ethdrain(fd);
+  ethstats(fd);
 }
 
 int
 main(int argc, char** argv)
 {
-  (void)argc;
-  (void)argv;
-  int fd = open("eth", O_RDWR);
+  char *dev = argc > 1 ? argv[1] : "eth";
+  int fd = open(dev, O_RDWR);
   if (fd < 0) {
-    printf(1, "open: cannot open %s\n", "eth");
+    printf(1, "open: cannot open %s\n", dev);
     exit();
   }
   ethtest(fd);
@@ -5,6 +5,134 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NTEXTPAGE 128   // program pages kept for exec()
+
+// Pages of program files, kept so that processes running the same
+// program share its pages instead of each reading a copy.  An entry
+// is found by the file's (dev, inum, gen) and the file offset of
+// the page; writing or truncating the file changes ip->gen, so
+// stale pages are never found again and age out.  The cache holds
+// one reference to each page (see kdup()) and every mapping
+// another, so a page outlives its entry while processes use it.
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint inum;
+    uint gen;
+    uint off;
+    char *page;       // 0 if the entry is free
+    uint lastuse;
+  } ent[NTEXTPAGE];
+  uint clock;
+} tcache;
+
+void
+execinit(void)
+{
+  initlock(&tcache.lock, "tcache");
+}
+
+// The page of ip's contents at off, with a reference taken for the
+// caller, read in if it is not cached.  Caller holds ip locked, so
+// no one else reads in pages of ip meanwhile.  Returns 0 if memory
+// is short or the read fails.
+static char*
+textpage(struct inode *ip, uint off)
+{
+  char *mem, *old;
+  int i, v;
+
+  acquire(&tcache.lock);
+  for(i = 0; i < NTEXTPAGE; i++){
+    if(tcache.ent[i].page && tcache.ent[i].off == off &&
+       tcache.ent[i].inum == ip->inum && tcache.ent[i].dev == ip->dev &&
+       tcache.ent[i].gen == ip->gen){
+      tcache.ent[i].lastuse = ++tcache.clock;
+      mem = tcache.ent[i].page;
+      kdup(mem);
+      release(&tcache.lock);
+      return mem;
+    }
+  }
+  release(&tcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  if(readi(ip, mem, off, PGSIZE) != PGSIZE){
+    kfree(mem);
+    return 0;
+  }
+  ip->text = 1;
+
+  // Take a free entry, or the one used longest ago.
+  acquire(&tcache.lock);
+  v = 0;
+  for(i = 0; i < NTEXTPAGE && tcache.ent[v].page; i++)
+    if(tcache.ent[i].page == 0 ||
+       (int)(tcache.ent[i].lastuse - tcache.ent[v].lastuse) < 0)
+      v = i;
+  old = tcache.ent[v].page;
+  tcache.ent[v].dev = ip->dev;
+  tcache.ent[v].inum = ip->inum;
+  tcache.ent[v].gen = ip->gen;
+  tcache.ent[v].off = off;
+  tcache.ent[v].page = mem;
+  tcache.ent[v].lastuse = ++tcache.clock;
+  kdup(mem);
+  release(&tcache.lock);
+  if(old)
+    kfree(old);
+  return mem;
+}
+
+// Map program segment ph of ip into pgdir.  Pages wholly inside the
+// file part come from the cache, shared read-only, and copy-on-write
+// if the segment is writable.  The page the file part ends in and
+// the zero-filled ones after it are private.
+static int
+loadseg(pde_t *pgdir, struct inode *ip, struct proghdr *ph)
+{
+  uint a, n;
+  char *mem;
+  int perm;
+
+  if(ph->va % PGSIZE != 0 || ph->va + ph->memsz > USERTOP ||
+     ph->va + ph->memsz < ph->va)
+    return -1;
+  perm = PTE_U;
+  if(ph->flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_COW;
+  for(a = 0; a < ph->memsz; a += PGSIZE){
+    if(a + PGSIZE <= ph->filesz){
+      if((mem = textpage(ip, ph->offset + a)) == 0)
+        return -1;
+      if(mapuvm(pgdir, ph->va + a, mem, perm) < 0){
+        kfree(mem);
+        return -1;
+      }
+      continue;
+    }
+    if((mem = kzalloc()) == 0)
+      return -1;
+    if(a < ph->filesz){
+      n = ph->filesz - a;
+      if(readi(ip, mem, ph->offset + a, n) != (int)n){
+        kfree(mem);
+        return -1;
+      }
+    }
+    if(mapuvm(pgdir, ph->va + a, mem, PTE_W|PTE_U) < 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  return 0;
+}
 
 int
 exec(char *path, char **argv)
@@ -17,8 +145,11 @@ exec(char *path, char **argv)
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
 
-  if((ip = namei(path)) == 0)
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   pgdir = 0;
 
@@ -33,20 +164,20 @@ exec(char *path, char **argv)
     goto bad;
 
   // Load program into memory.
-  sz = 0;
+  sz = USERBASE;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != (int)sizeof(ph))
       goto bad;
     if(ph.type != ELF_PROG_LOAD)
       continue;
-    if(ph.memsz < ph.filesz)
+    if(ph.memsz < ph.filesz || ph.va < sz)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.va + ph.memsz)) == 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.va, ip, ph.offset, ph.filesz) < 0)
+    if(loadseg(pgdir, ip, &ph) < 0)
       goto bad;
+    sz = ph.va + ph.memsz;
   }
   iunlockput(ip);
+  end_op();
   ip = 0;
 
   // Allocate a one-page stack at the next page boundary
@@ -89,13 +220,17 @@ exec(char *path, char **argv)
   proc->tf->esp = sp;
   switchuvm(proc);
   freevm(oldpgdir);
+  if(proc->vfork)
+    vforkdone();
 
   return 0;
 
  bad:
   if(pgdir)
     freevm(pgdir);
-  if(ip)
+  if(ip){
     iunlockput(ip);
+    end_op();
+  }
   return -1;
 }
\ No newline at end of file
@@ -2,3 +2,7 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+// ioctl requests on a pipe
+#define PIPE_GETSIZE  1   // bytes the pipe holds
+#define PIPE_SETSIZE  2   // hold at least (int)argp bytes; returns the new size
@@ -2,8 +2,12 @@
 #include "defs.h"
 #include "param.h"
 #include "fs.h"
+#include "stat.h"
 #include "file.h"
 #include "spinlock.h"
+#include "poll.h"
+#include "mmu.h"
+#include "proc.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -11,10 +15,20 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// Descriptor tables, one for each process or group of threads.
+// fdtab.lock guards ref and, while a table is shared, its slots and
+// cwd.  Only a process using a table alone can share it, so such a
+// process goes without the lock.
+struct {
+  struct spinlock lock;
+  struct fdtable tab[NPROC];
+} fdtab;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&fdtab.lock, "fdtab");
 }
 
 // Allocate a file structure.
@@ -67,8 +81,13 @@ fileclose(struct file *f)
   
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
-  else if(ff.type == FD_INODE)
+  else if(ff.type == FD_INODE){
+    begin_op();
     iput(ff.ip);
+    end_op();
+  }
+  else if(ff.type == FD_SOCKET)
+    sockclose(ff.sock);
 }
 
 // Get metadata about file f.
@@ -94,6 +113,8 @@ fileread(struct file *f, char *addr, int n)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
+  if(f->type == FD_SOCKET)
+    return sockread(f->sock, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
@@ -108,24 +129,51 @@ fileread(struct file *f, char *addr, int n)
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  int r, i, n1, max;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
+  if(f->type == FD_SOCKET)
+    return sockwrite(f->sock, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = writei(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    if(f->ip->type == T_DEV){
+      // Devices keep no blocks; do not hold up commits.
+      if((r = writei(f->ip, addr, f->off, n)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      return r;
+    }
     iunlock(f->ip);
-    return r;
+
+    // Write a few blocks at a time, so as not to exceed the maximum
+    // log transaction size: i-node, indirect block, allocation
+    // blocks, and 2 blocks of slop for non-aligned writes.
+    max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    i = 0;
+    while(i < n){
+      n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+      begin_op();
+      ilock(f->ip);
+      if((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      end_op();
+      if(r < 0)
+        return i > 0 ? i : -1;
+      i += r;
+      if(r != n1)
+        break;    // file is full
+    }
+    return i;
   }
   panic("filewrite");
 }
 
-#include "stat.h"
-
 // Write to file f.  Addr is kernel address.
 int
 fileioctl(struct file *f, int request, void* argp)
@@ -133,7 +181,9 @@ fileioctl(struct file *f, int request, void* argp)
   int r;
   struct inode* ip = f->ip;
 
-  if (f->type == FD_PIPE || ip->type != T_DEV)
+  if(f->type == FD_PIPE)
+    return pipeioctl(f->pipe, request, argp);
+  if (f->type != FD_INODE || ip->type != T_DEV)
     return -1;
   if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].ioctl)
     return -1;
@@ -143,5 +193,232 @@ fileioctl(struct file *f, int request, void* argp)
   return r;
 }
 
+// Which of the poll.h events asked for are ready on f.  For those
+// that are not, f's channels are given to pollwait().  Files with
+// nothing to wait for are always ready.
+int
+filepoll(struct file *f, int events)
+{
+  struct inode *ip;
 
+  if(!f->readable)
+    events &= ~POLLIN;
+  if(!f->writable)
+    events &= ~POLLOUT;
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, events);
+  if(f->type == FD_SOCKET)
+    return sockpoll(f->sock, events);
+  if(f->type == FD_INODE){
+    // The device of an open inode does not change, so it need not
+    // be locked, and a device's poll must not sleep anyway.
+    ip = f->ip;
+    if(ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV &&
+       devsw[ip->major].poll)
+      return devsw[ip->major].poll(ip, events);
+  }
+  return events & (POLLIN|POLLOUT);
+}
+
+// Lock t if it is shared.  Returns whether it did, for fdtunlock().
+static int
+fdtlock(struct fdtable *t)
+{
+  if(t->ref == 1)
+    return 0;
+  acquire(&fdtab.lock);
+  return 1;
+}
+
+static void
+fdtunlock(int locked)
+{
+  if(locked)
+    release(&fdtab.lock);
+}
+
+// Allocate an empty descriptor table.
+struct fdtable*
+fdtalloc(void)
+{
+  struct fdtable *t;
+
+  acquire(&fdtab.lock);
+  for(t = fdtab.tab; t < fdtab.tab + NPROC; t++){
+    if(t->ref == 0){
+      t->ref = 1;
+      release(&fdtab.lock);
+      memset(t->ofile, 0, sizeof(t->ofile));
+      t->cwd = 0;
+      return t;
+    }
+  }
+  release(&fdtab.lock);
+  return 0;
+}
+
+// A new table with the open files and directory of the current
+// process, for fork().
+struct fdtable*
+fdtcopy(void)
+{
+  struct fdtable *t, *old;
+  int fd, locked;
+
+  if((t = fdtalloc()) == 0)
+    return 0;
+  old = proc->fdt;
+  locked = fdtlock(old);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(old->ofile[fd])
+      t->ofile[fd] = filedup(old->ofile[fd]);
+  t->cwd = idup(old->cwd);
+  fdtunlock(locked);
+  return t;
+}
+
+// Another reference to t, for clone().
+struct fdtable*
+fdtshare(struct fdtable *t)
+{
+  acquire(&fdtab.lock);
+  t->ref++;
+  release(&fdtab.lock);
+  return t;
+}
+
+// Drop a reference to t, closing its files and directory if it was
+// the last.
+void
+fdtclose(struct fdtable *t)
+{
+  int fd;
 
+  acquire(&fdtab.lock);
+  if(t->ref > 1){
+    t->ref--;
+    release(&fdtab.lock);
+    return;
+  }
+  release(&fdtab.lock);
+
+  for(fd = 0; fd < NOFILE; fd++){
+    if(t->ofile[fd]){
+      fileclose(t->ofile[fd]);
+      t->ofile[fd] = 0;
+    }
+  }
+  begin_op();
+  iput(t->cwd);
+  end_op();
+  t->cwd = 0;
+
+  acquire(&fdtab.lock);
+  t->ref = 0;
+  release(&fdtab.lock);
+}
+
+// The file open as descriptor fd of the current process, or 0.
+// While the table is shared another thread may close fd, so the
+// file is held until fdrelease(), which syscall() calls once the
+// system call is done.
+struct file*
+fdget(int fd)
+{
+  struct fdtable *t;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  t = proc->fdt;
+  if(!fdtlock(t))
+    return t->ofile[fd];
+  if((f = t->ofile[fd]) != 0){
+    if(proc->nfhold < NOFILE)
+      proc->fhold[proc->nfhold++] = filedup(f);
+    else
+      f = 0;
+  }
+  fdtunlock(1);
+  return f;
+}
+
+// Let go of the files fdget() held.
+void
+fdrelease(void)
+{
+  while(proc->nfhold > 0)
+    fileclose(proc->fhold[--proc->nfhold]);
+}
+
+// Allocate a file descriptor for f.
+// Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  struct fdtable *t;
+  int fd, locked;
+
+  t = proc->fdt;
+  locked = fdtlock(t);
+  for(fd = 0; fd < NOFILE; fd++){
+    if(t->ofile[fd] == 0){
+      t->ofile[fd] = f;
+      fdtunlock(locked);
+      return fd;
+    }
+  }
+  fdtunlock(locked);
+  return -1;
+}
+
+// Take the file open as fd out of the descriptor table and return
+// it, or 0 if there is none.  The caller gets the table's reference.
+struct file*
+fdremove(int fd)
+{
+  struct fdtable *t;
+  struct file *f;
+  int locked;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  t = proc->fdt;
+  locked = fdtlock(t);
+  f = t->ofile[fd];
+  t->ofile[fd] = 0;
+  fdtunlock(locked);
+  return f;
+}
+
+// A reference to the current directory.
+struct inode*
+cwdget(void)
+{
+  struct fdtable *t;
+  struct inode *ip;
+  int locked;
+
+  t = proc->fdt;
+  locked = fdtlock(t);
+  ip = idup(t->cwd);
+  fdtunlock(locked);
+  return ip;
+}
+
+// Make ip the current directory, taking over the caller's
+// reference.  Returns the old one, for the caller to iput().
+struct inode*
+cwdset(struct inode *ip)
+{
+  struct fdtable *t;
+  struct inode *old;
+  int locked;
+
+  t = proc->fdt;
+  locked = fdtlock(t);
+  old = t->cwd;
+  t->cwd = ip;
+  fdtunlock(locked);
+  return old;
+}
@@ -1,10 +1,11 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_SOCKET } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct sock *sock;
   uint off;
 };
 
@@ -22,7 +23,20 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint rdnext;        // block where a sequential read would go on
+  uint raend;         // blocks below this have been read ahead
+  uint extbn;         // last run found by bmap: extlen blocks from
+  uint extaddr;       //   file block extbn lie from disk block
+  uint extlen;        //   extaddr on
+
+  uint gen;           // changes when exec()'s cached pages go stale
+  int text;           // exec() may have cached pages of this gen
+
+  struct inode *hnext;  // hash chain
+  struct inode *lprev;  // unreferenced inodes, while ref == 0
+  struct inode *lnext;
 };
 
 #define I_BUSY 0x1
@@ -36,6 +50,9 @@ struct devsw {
   int (*write)(struct inode*, char*, int);
   // traditionally, 3rd argument type is 'char*', but use 'void*' in this time.
   int (*ioctl)(struct inode*, int request, void* argp);
+  // The poll.h events of those asked for that are ready now.  Gives
+  // pollwait() the channels to wake on for the others; must not sleep.
+  int (*poll)(struct inode*, int events);
 };
 
 extern struct devsw devsw[];
@@ -43,4 +60,5 @@ extern struct devsw devsw[];
 #define CONSOLE 1
 #define ETHERNET 2         // Major
 #define ETHERNET_NO(n) n   // Miner >= 0
+#define ETHERNET_LOOP 15   // Minor of the loopback device
 
@@ -4,7 +4,9 @@
 //    + Directories: inode with special contents (list of other inodes!)
 //    + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: superblock, inodes, block in-use bitmap, data blocks,
+// log.  Every block written here goes through log_write() (log.c), so
+// its callers must be inside a begin_op()/end_op() transaction.
 //
 // This file contains the low-level file system manipulation 
 // routines. The (higher-level) system call implementations
@@ -25,7 +27,7 @@
 static void itrunc(struct inode*);
 
 // Read the super block.
-static void
+void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
@@ -43,32 +45,108 @@ bzero(int dev, int bno)
   
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
 // Blocks.  
+//
+// The allocator keeps, for each bitmap block, how many blocks it
+// still has free and the lowest bit that may be free, so that it
+// reads only bitmap blocks with something to give and starts at the
+// right place in them.  The summary is built from the disk when
+// the first block is allocated or freed.  Its entry for a bitmap
+// block changes only while that block is held from bread(), which
+// orders the updates.
+
+#define NBMAP 64    // bitmap blocks the summary covers
+
+static struct {
+  int ready;
+  uint dev;
+  struct superblock sb;
+  uint nbmap;             // bitmap blocks in use
+  uint nfree[NBMAP];      // free blocks under each
+  uint hint[NBMAP];       // no free block below this bit
+} bsum;
+
+// Blocks the bitmap can hand out: all but the log.
+#define BLIMIT  (bsum.sb.size - bsum.sb.nlog)
+
+// Build the summary if it is not yet.  Holding bitmap block 0 keeps
+// a second caller out until the first is done.
+static void
+bsumload(uint dev)
+{
+  struct buf *bp, *bp0;
+  uint i, b, bi;
+
+  if(bsum.ready){
+    if(bsum.dev != dev)
+      panic("balloc: one file system only");
+    return;
+  }
+  readsb(dev, &bsum.sb);
+  bp0 = bread(dev, BBLOCK(0, bsum.sb.ninodes));
+  if(bsum.ready){
+    brelse(bp0);
+    return;
+  }
+  bsum.dev = dev;
+  bsum.nbmap = (BLIMIT + BPB - 1) / BPB;
+  if(bsum.nbmap > NBMAP)
+    panic("balloc: bitmap too big");
+  for(i = 0; i < bsum.nbmap; i++){
+    bp = i == 0 ? bp0 : bread(dev, BBLOCK(i*BPB, bsum.sb.ninodes));
+    bsum.nfree[i] = 0;
+    bsum.hint[i] = BPB;
+    for(bi = 0, b = i*BPB; bi < BPB && b < BLIMIT; bi++, b++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        if(bsum.nfree[i]++ == 0)
+          bsum.hint[i] = bi;
+      }
+    }
+    if(i > 0)
+      brelse(bp);
+  }
+  bsum.ready = 1;
+  brelse(bp0);
+}
 
-// Allocate a disk block.
+// Allocate a zeroed disk block: goal if it is free, else the first
+// free one after it, else the first free one anywhere.  A goal of 0
+// means no preference.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  uint b;     // Block index as unsigned to match superblock fields
-  int bi, m;
+  uint i, k, b, bi, from;
   struct buf *bp;
-  struct superblock sb;
-
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB; bi++){
+  int m;
+
+  bsumload(dev);
+  if(goal >= BLIMIT)
+    goal = 0;
+  // Try the goal's bitmap block from the goal on, then the others
+  // in turn, then the goal's again from its start.
+  for(k = 0; k <= bsum.nbmap; k++){
+    i = (goal/BPB + k) % bsum.nbmap;
+    if(bsum.nfree[i] == 0)
+      continue;
+    from = bsum.hint[i];
+    if(k == 0 && goal % BPB > from)
+      from = goal % BPB;
+    bp = bread(dev, BBLOCK(i*BPB, bsum.sb.ninodes));
+    for(bi = from, b = i*BPB + from; bi < BPB && b < BLIMIT; bi++, b++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
+        log_write(bp);
+        bsum.nfree[i]--;
+        if(bi == bsum.hint[i])
+          bsum.hint[i] = bi + 1;
         brelse(bp);
-        return b + bi;
+        bzero(dev, b);
+        return b;
       }
     }
     brelse(bp);
@@ -81,19 +159,21 @@ static void
 bfree(int dev, uint b)
 {
   struct buf *bp;
-  struct superblock sb;
-  int bi, m;
+  uint i, bi;
+  int m;
 
-  bzero(dev, b);
-
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  bsumload(dev);
+  bp = bread(dev, BBLOCK(b, bsum.sb.ninodes));
+  i = b / BPB;
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;  // Mark block free on disk.
-  bwrite(bp);
+  log_write(bp);
+  bsum.nfree[i]++;
+  if(bi < bsum.hint[i])
+    bsum.hint[i] = bi;
   brelse(bp);
 }
 
@@ -111,7 +191,12 @@ bfree(int dev, uint b)
 // 
 // ip->ref counts the number of pointer references to this cached
 // inode; references are typically kept in struct file and in proc->cwd.
-// When ip->ref falls to zero, the inode is no longer cached.
+// When ip->ref falls to zero, the inode stays cached, on a list of
+// unreferenced inodes kept in the order they were released, until
+// iget() needs the entry for another inode; it takes the one
+// released longest ago.  iget() finds cached inodes through a hash
+// table on (dev, inum).  icache.lock guards ref, the hash chains and
+// the list.  The number of entries is set at boot from free memory.
 // It is an error to use an inode without holding a reference to it.
 //
 // Processes are only allowed to read and write inode
@@ -129,19 +214,128 @@ bfree(int dev, uint b)
 // return pointers to *unlocked* inodes. It is the callers'
 // responsibility to lock them before using them. A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
+//
+// The I_BUSY and I_VALID flags are guarded by one of NIFLOCK
+// locks, picked by the inode's address, and waiting for a busy inode
+// sleeps on that lock rather than on icache.lock.
+
+#define NIHASH  61
+#define NIFLOCK 16
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct spinlock flock[NIFLOCK];
+  struct inode *hash[NIHASH];
+  struct inode *lruhead;    // unreferenced, most recently released first
+  struct inode *lrutail;
+  int ninode;
+  uint gen;                 // last inode generation handed out
 } icache;
 
+// Name cache; see dirlookup().
+#define NDCACHE 256
+#define NDWAY   4     // entries a name may occupy
+
+struct dcent {
+  uint dev;
+  uint dinum;         // directory; 0 if the entry is free
+  char name[DIRSIZ];
+  uint inum;          // 0: the name is known to be absent
+  uint off;           // of its dirent, if inum != 0
+  uint lastuse;
+};
+
+struct {
+  struct spinlock lock;
+  struct dcent ent[NDCACHE];
+  uint clock;
+} dcache;
+
+static struct spinlock*
+iflock(struct inode *ip)
+{
+  return &icache.flock[((uint)ip / sizeof(*ip)) % NIFLOCK];
+}
+
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
+// Take unreferenced ip off the list.  Caller holds icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lruhead = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+}
+
+// Put ip on the list of unreferenced inodes: at the front, or at
+// the back, to be recycled first, if it holds nothing worth keeping.
+// Caller holds icache.lock.
+static void
+lruadd(struct inode *ip, int front)
+{
+  if(front){
+    ip->lprev = 0;
+    ip->lnext = icache.lruhead;
+    if(icache.lruhead)
+      icache.lruhead->lprev = ip;
+    else
+      icache.lrutail = ip;
+    icache.lruhead = ip;
+  } else {
+    ip->lnext = 0;
+    ip->lprev = icache.lrutail;
+    if(icache.lrutail)
+      icache.lrutail->lnext = ip;
+    else
+      icache.lruhead = ip;
+    icache.lrutail = ip;
+  }
+}
+
 void
 iinit(void)
 {
+  struct inode *ip;
+  char *p;
+  int i, n, per;
+
   initlock(&icache.lock, "icache");
+  for(i = 0; i < NIFLOCK; i++)
+    initlock(&icache.flock[i], "inode");
+  initlock(&dcache.lock, "dcache");
+
+  // Carve inodes out of whole pages; they start out on no chain.
+  per = PGSIZE / sizeof(struct inode);
+  n = kfreepages() / NINODE_SHARE * per;
+  if(n < NINODE_MIN)
+    n = NINODE_MIN;
+  while(icache.ninode < n){
+    if((p = kalloc()) == 0)
+      break;
+    for(i = 0; i < per && icache.ninode < n; i++){
+      ip = (struct inode*)p + i;
+      memset(ip, 0, sizeof(*ip));
+      ip->dev = -1;
+      lruadd(ip, 0);
+      icache.ninode++;
+    }
+  }
+  if(icache.ninode == 0)
+    panic("iinit");
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcachepurge(uint dev, uint inum);
 
 // Allocate a new inode with the given type on device dev.
 struct inode*
@@ -159,7 +353,7 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
-      bwrite(bp);    // mark it allocated on the disk
+      log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
     }
@@ -183,7 +377,7 @@ iupdate(struct inode *ip)
   dip->nlink = ip->nlink;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
@@ -192,31 +386,41 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **hp;
 
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
+  // Recycle the unreferenced inode released longest ago.
+  if((ip = icache.lrutail) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
+  lruremove(ip);
+  if(ip->dev != (uint)-1){
+    for(hp = ihash(ip->dev, ip->inum); *hp != ip; hp = &(*hp)->hnext)
+      ;
+    *hp = ip->hnext;
+  }
+  hp = ihash(dev, inum);
+  ip->hnext = *hp;
+  *hp = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->gen = ++icache.gen;
+  ip->text = 0;
+  ip->rdnext = 0;
+  ip->raend = 0;
+  ip->extlen = 0;
   release(&icache.lock);
 
   return ip;
@@ -239,15 +443,17 @@ ilock(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
+  struct spinlock *lk;
 
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquire(&icache.lock);
+  lk = iflock(ip);
+  acquire(lk);
   while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
+    sleep(ip, lk);
   ip->flags |= I_BUSY;
-  release(&icache.lock);
+  release(lk);
 
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
@@ -272,10 +478,10 @@ iunlock(struct inode *ip)
   if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
+  acquire(iflock(ip));
   ip->flags &= ~I_BUSY;
   wakeup(ip);
-  release(&icache.lock);
+  release(iflock(ip));
 }
 
 // Caller holds reference to unlocked ip. Drop reference.
@@ -289,6 +495,8 @@ iput(struct inode *ip)
       panic("iput busy");
     ip->flags |= I_BUSY;
     release(&icache.lock);
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -296,7 +504,8 @@ iput(struct inode *ip)
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruadd(ip, ip->flags & I_VALID);
   release(&icache.lock);
 }
 
@@ -313,40 +522,114 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk. The first NDIRECT blocks
 // are listed in ip->addrs[]. The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// listed in the block ip->addrs[NDIRECT], and the NDINDIRECT after
+// them in the indirect blocks listed in block ip->addrs[NDIRECT+1].
+//
+// bmap remembers in ip the run of blocks around the last one it
+// looked up in an indirect block that are adjacent on the disk as
+// well, and maps blocks in that run without reading the disk.
+
+// Return entry i of indirect block ind, allocating a block for it
+// if there is none, after the one before it.  bn is the file block
+// it maps.
+static uint
+bmapind(struct inode *ip, uint ind, uint i, uint bn)
+{
+  uint addr, *a, n;
+  struct buf *bp;
+
+  bp = bread(ip->dev, ind);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = balloc(ip->dev, i > 0 && a[i-1] ? a[i-1] + 1 : ind + 1);
+    log_write(bp);
+  }
+  for(n = 1; i + n < NINDIRECT && a[i+n] == addr + n; n++)
+    ;
+  ip->extbn = bn;
+  ip->extaddr = addr;
+  ip->extlen = n;
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, as close after
+// the block before it as it can, so files stay contiguous.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, fbn, i;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr =
+        balloc(ip->dev, bn > 0 && ip->addrs[bn-1] ? ip->addrs[bn-1] + 1 : 0);
     return addr;
   }
+  if(bn - ip->extbn < ip->extlen)
+    return ip->extaddr + (bn - ip->extbn);
+  fbn = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, ip->addrs[NDIRECT-1] + 1);
+    return bmapind(ip, addr, bn, fbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Find the indirect block in the doubly-indirect one.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, ip->addrs[NDIRECT] + 1);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      bwrite(bp);
+    i = bn / NINDIRECT;
+    if((addr = a[i]) == 0){
+      a[i] = addr = balloc(ip->dev, i > 0 ? a[i-1] + 1 : bp->sector + 1);
+      log_write(bp);
     }
     brelse(bp);
-    return addr;
+    return bmapind(ip, addr, bn%NINDIRECT, fbn);
   }
 
   panic("bmap: out of range");
 }
 
+// ip's contents are about to change, so pages of it that exec()
+// cached must no longer be found.  Caller holds ip locked.
+static void
+istale(struct inode *ip)
+{
+  if(!ip->text)
+    return;
+  acquire(&icache.lock);
+  ip->gen = ++icache.gen;
+  release(&icache.lock);
+  ip->text = 0;
+}
+
+// Free the blocks listed in indirect block ind, then ind itself.
+static void
+itruncind(struct inode *ip, uint ind)
+{
+  uint j;      // Use unsigned index to iterate over NINDIRECT entries
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, ind);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j])
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, ind);
+}
+
 // Truncate inode (discard contents).
 // Only called after the last dirent referring
 // to this inode has been erased on disk.
@@ -358,6 +641,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  istale(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -366,18 +650,26 @@ itrunc(struct inode *ip)
   }
   
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+    itruncind(ip, ip->addrs[NDIRECT]);
+    ip->addrs[NDIRECT] = 0;
+  }
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        itruncind(ip, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
   }
 
   ip->size = 0;
+  ip->rdnext = 0;
+  ip->raend = 0;
+  ip->extlen = 0;
   iupdate(ip);
 }
 
@@ -392,12 +684,48 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading in the blocks of ip from first up to NREADAHEAD
+// past last, except those already read ahead.  Caller must hold ip.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint end;
+
+  end = min(last + 1 + NREADAHEAD, (ip->size + BSIZE - 1) / BSIZE);
+  if(ip->raend < first)
+    ip->raend = first;
+  for(; ip->raend < end; ip->raend++)
+    bprefetch(ip->dev, bmap(ip, ip->raend));
+}
+
+// Trim a read of n bytes at off to the end of ip, and start reading
+// ahead if it goes on from where the last one ended, as part of a
+// sequential scan.  Returns the bytes to read, or -1.
+static int
+readstart(struct inode *ip, uint off, uint n)
+{
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  if(n == 0)
+    return 0;
+
+  if(off/BSIZE == ip->rdnext)
+    readahead(ip, off/BSIZE + 1, (off + n - 1)/BSIZE);
+  else
+    ip->raend = 0;
+  ip->rdnext = (off + n)/BSIZE;
+  return n;
+}
+
 // Read data from inode.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -405,11 +733,9 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return devsw[ip->major].read(ip, dst, n);
   }
 
-  if(off > ip->size || off + n < off)
-    return -1;
-  if(off + n > ip->size)
-    n = ip->size - off;
-
+  if((r = readstart(ip, off, n)) <= 0)
+    return r;
+  n = r;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -419,6 +745,38 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Like readi(), but hand the data to fn(arg, p, m) where it lies in
+// the buffer cache, at most a block at a time, instead of copying it.
+// fn returns how many of the m bytes it took, and taking fewer
+// stops the read.  Returns the bytes taken, or -1.
+int
+readifn(struct inode *ip, uint off, uint n, int (*fn)(void*, char*, int),
+        void *arg)
+{
+  uint tot, m;
+  struct buf *bp;
+  int r;
+
+  if(ip->type == T_DEV)
+    return -1;
+  if((r = readstart(ip, off, n)) <= 0)
+    return r;
+  n = r;
+  for(tot=0; tot<n; tot+=r, off+=r){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = fn(arg, (char*)bp->data + off%BSIZE, m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? (int)tot : -1;
+    if((uint)r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
@@ -434,14 +792,16 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
-    n = MAXFILE*BSIZE - off;
+  // With 4KB blocks MAXFILE*BSIZE is past 4GB.
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE)
+    n = (uint64)MAXFILE*BSIZE - off;
 
+  istale(ip);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    bwrite(bp);
+    log_write(bp);
     brelse(bp);
   }
 
@@ -460,6 +820,104 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// The name cache remembers, for a (directory, name) pair, the inode
+// dirlookup() found and the offset of its dirent, or that there was
+// none, so that resolving the same path again skips the directory
+// scan.  A name hashes to a set of NDWAY entries, and the least
+// recently used one of the set makes room.  Entries change only
+// with their directory locked: dirlink() enters a new name,
+// sys_unlink() calls dcacheforget(), and iput() drops every entry
+// of a directory it frees before the inode number can be reused.
+
+// The set that name in directory dev/dinum belongs to.
+static struct dcent*
+dcacheset(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.ent[(h % (NDCACHE / NDWAY)) * NDWAY];
+}
+
+// The entry for name in dp, or 0.  Caller holds dcache.lock.
+static struct dcent*
+dcachefind(struct inode *dp, char *name)
+{
+  struct dcent *set, *e;
+
+  set = dcacheset(dp->dev, dp->inum, name);
+  for(e = set; e < set + NDWAY; e++)
+    if(e->dinum == dp->inum && e->dev == dp->dev && namecmp(e->name, name) == 0)
+      return e;
+  return 0;
+}
+
+// Look name up in the cache.  On a hit return 1 and set *inum,
+// to 0 if name is absent, and *off.
+static int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcachefind(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  e->lastuse = ++dcache.clock;
+  *inum = e->inum;
+  *off = e->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in dp is inode inum with its dirent at off,
+// or absent if inum is 0.
+static void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dcent *set, *e, *x;
+
+  acquire(&dcache.lock);
+  if((e = dcachefind(dp, name)) == 0){
+    set = dcacheset(dp->dev, dp->inum, name);
+    e = set;
+    for(x = set; x < set + NDWAY && e->dinum != 0; x++)
+      if(x->dinum == 0 || (int)(x->lastuse - e->lastuse) < 0)
+        e = x;
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  e->off = off;
+  e->lastuse = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Name has been removed from dp.
+void
+dcacheforget(struct inode *dp, char *name)
+{
+  dcacheenter(dp, name, 0, 0);
+}
+
+// Directory dev/inum is being freed: drop its entries.
+static void
+dcachepurge(uint dev, uint inum)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent; e < &dcache.ent[NDCACHE]; e++)
+    if(e->dinum == inum && e->dev == dev)
+      e->dinum = 0;
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 // Caller must have already locked dp.
@@ -473,6 +931,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += BSIZE){
     bp = bread(dp->dev, bmap(dp, off / BSIZE));
     for(de = (struct dirent*)bp->data;
@@ -482,15 +948,18 @@ dirlookup(struct inode *dp, char *name, uint *poff)
         continue;
       if(namecmp(name, de->name) == 0){
         // entry matches path element
+        off += (uchar*)de - bp->data;
         if(poff)
-          *poff = off + (uchar*)de - bp->data;
+          *poff = off;
         inum = de->inum;
         brelse(bp);
+        dcacheenter(dp, name, inum, off);
         return iget(dp->dev, inum);
       }
     }
     brelse(bp);
   }
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -520,7 +989,8 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
-  
+  dcacheenter(dp, name, inum, off);
+
   return 0;
 }
 
@@ -574,7 +1044,7 @@ namex(char *path, int nameiparent, char *name)
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(proc->cwd);
+    ip = cwdget();
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
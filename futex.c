@@ -0,0 +1,113 @@
+// Futexes: sleeping on a word of user memory.
+//
+// A user-space lock takes and releases its word with atomic
+// instructions alone, and calls futex() only when there is a wait.
+// FUTEX_WAIT sleeps if the word still holds the value the caller last
+// saw, and FUTEX_WAKE wakes sleepers on the word.  Both check the word
+// and sleep or wake under futexlock, so a wake that follows a change
+// to the word can never pass a wait that saw the old value.
+//
+// Sleepers on a word share a futex queue, found by the word's key.
+// For a private page the key is the page table and the user address,
+// which the threads sharing the address space agree on and which a
+// fork() making the page copy-on-write again does not change.  A page
+// of a shared memory segment may sit at different addresses in
+// different processes, so there the key is the word's kernel address.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "futex.h"
+
+// A word some process sleeps on.  Each sleeper holds one entry, so
+// NPROC are enough.  The entry is the wait channel.
+struct futexq {
+  pde_t *pgdir;     // page table of a private word, 0 for a shared one
+  uint key;         // user address, or kernel address if shared
+  int nwait;        // sleepers; free at 0
+};
+
+static struct spinlock futexlock;
+static struct futexq futexq[NPROC];
+
+void
+futexinit(void)
+{
+  initlock(&futexlock, "futex");
+}
+
+// The queue of the word with key (pgdir, key), made if alloc is set
+// and there is none.  Caller holds futexlock.
+static struct futexq*
+futexlook(pde_t *pgdir, uint key, int alloc)
+{
+  struct futexq *q, *free;
+
+  free = 0;
+  for(q = futexq; q < &futexq[NPROC]; q++){
+    if(q->nwait == 0){
+      if(free == 0)
+        free = q;
+    } else if(q->pgdir == pgdir && q->key == key)
+      return q;
+  }
+  if(!alloc || free == 0)
+    return 0;
+  free->pgdir = pgdir;
+  free->key = key;
+  return free;
+}
+
+// Returns 0 once woken, or the number of sleepers woken, or -1 if
+// addr is bad, the word did not hold val, or the process was killed.
+int
+futex(int *addr, int op, int val)
+{
+  struct futexq *q;
+  pde_t *pgdir;
+  uint key;
+  int *w, n, shared;
+
+  if((uint)addr % sizeof(int) != 0 || (uint)addr < USERBASE ||
+     (uint)addr + sizeof(int) > proc->sz ||
+     (w = (int*)uva2kaw(proc->pgdir, (char*)addr, &shared)) == 0)
+    return -1;
+  if(shared){
+    pgdir = 0;
+    key = (uint)w;
+  } else {
+    pgdir = proc->pgdir;
+    key = (uint)addr;
+  }
+
+  switch(op){
+  case FUTEX_WAIT:
+    acquire(&futexlock);
+    // Through addr, not w: another thread may have copied the page
+    // since uva2kaw() looked.
+    if(*(volatile int*)addr != val || proc->killed ||
+       (q = futexlook(pgdir, key, 1)) == 0){
+      release(&futexlock);
+      return -1;
+    }
+    q->nwait++;
+    sleep(q, &futexlock);
+    q->nwait--;
+    release(&futexlock);
+    return 0;
+
+  case FUTEX_WAKE:
+    if(val <= 0)
+      return 0;
+    acquire(&futexlock);
+    n = 0;
+    if((q = futexlook(pgdir, key, 0)) != 0)
+      n = wakeupn(q, val);
+    release(&futexlock);
+    return n;
+  }
+  return -1;
+}
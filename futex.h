@@ -0,0 +1,3 @@
+// futex(addr, op, val) operations.
+#define FUTEX_WAIT 0   // sleep if *addr == val
+#define FUTEX_WAKE 1   // wake at most val sleepers on addr
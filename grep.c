@@ -1,37 +1,151 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// A pattern without them is a plain string, looked for with
+// Boyer-Moore-Horspool across all the lines in the buffer at once;
+// only the lines it turns up in are picked out and printed.  Other
+// patterns go through the regexp matcher line by line.
 
 #include "types.h"
 #include "stat.h"
 #include "user.h"
 
-char buf[1024];
+#define BUFSIZE 8192
+
+char buf[BUFSIZE+1];
+char out[BUFSIZE];
+int nout;
 int match(char*, char*);
 
+// For a plain pattern: its length, and how far to move when the
+// text under its last byte is c.
+int literal;
+int patlen;
+int skip[256];
+
+// Is pattern free of operators?  Then get ready to search for it.
+void
+compile(char *pattern)
+{
+  int i;
+
+  patlen = strlen(pattern);
+  if(patlen == 0)
+    return;
+  for(i = 0; i < patlen; i++)
+    if(strchr("^.*$", pattern[i]))
+      return;
+  literal = 1;
+  for(i = 0; i < 256; i++)
+    skip[i] = patlen;
+  for(i = 0; i < patlen - 1; i++)
+    skip[pattern[i] & 0xff] = patlen - 1 - i;
+}
+
+// The first place in [s, e) where the plain pattern starts, or 0.
+char*
+search(char *pattern, char *s, char *e)
+{
+  int i, last;
+
+  last = pattern[patlen-1];
+  while(e - s >= patlen){
+    if(s[patlen-1] == last){
+      for(i = 0; i < patlen - 1 && s[i] == pattern[i]; i++)
+        ;
+      if(i == patlen - 1)
+        return s;
+    }
+    s += skip[s[patlen-1] & 0xff];
+  }
+  return 0;
+}
+
+void
+flush(void)
+{
+  if(nout > 0)
+    write(1, out, nout);
+  nout = 0;
+}
+
+// Print the line [p, q) and a newline.
+void
+emit(char *p, char *q)
+{
+  int n;
+
+  n = q - p;
+  if(nout + n + 1 > (int)sizeof(out))
+    flush();
+  if(n + 1 > (int)sizeof(out)){
+    write(1, p, n);
+    write(1, "\n", 1);
+    return;
+  }
+  memmove(out + nout, p, n);
+  out[nout + n] = '\n';
+  nout += n + 1;
+}
+
+// Print the matching lines of [p, e), which ends at the end of a line.
+void
+lines(char *pattern, char *p, char *e)
+{
+  char *q, *hit;
+
+  if(literal){
+    while((hit = search(pattern, p, e)) != 0){
+      // Back to the start of its line, on to its end.
+      for(q = hit; q > p && q[-1] != '\n'; q--)
+        ;
+      p = q;
+      for(q = hit + patlen; q < e && *q != '\n'; q++)
+        ;
+      emit(p, q);
+      p = q + 1;
+      if(p >= e)
+        break;
+    }
+    return;
+  }
+  while(p < e){
+    for(q = p; q < e && *q != '\n'; q++)
+      ;
+    *q = 0;
+    if(match(pattern, p))
+      emit(p, q);
+    *q = '\n';
+    p = q + 1;
+  }
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m;
-  char *p, *q;
+  char *e;
   
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m)) > 0){
+  while((n = read(fd, buf+m, BUFSIZE-m)) > 0){
     m += n;
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(p == buf)
+    // Take the complete lines; keep the part line for next time.
+    for(e = buf + m; e > buf && e[-1] != '\n'; e--)
+      ;
+    lines(pattern, buf, e);
+    if(e == buf && m == BUFSIZE){
+      // A line longer than the buffer: drop it.
       m = 0;
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+      continue;
     }
+    m -= e - buf;
+    memmove(buf, e, m);
+  }
+  // A last line with no newline.
+  if(m > 0){
+    buf[m] = '\n';
+    lines(pattern, buf, buf + m + 1);
   }
+  flush();
 }
 
 int
@@ -45,6 +159,7 @@ main(int argc, char *argv[])
     exit();
   }
   pattern = argv[1];
+  compile(pattern);
   
   if(argc <= 2){
     grep(pattern, 0);
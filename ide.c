@@ -1,4 +1,16 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code: PCI bus-master DMA when a controller for it
+// is found, PIO otherwise.
+//
+// Requests are served in C-SCAN order: the next one is the lowest
+// sector at or past where the disk head is, wrapping back to the
+// lowest sector on the disk, unless the oldest request has waited
+// IDE_DEADLINE ticks.  Queued requests for the sectors that follow
+// it go along in one READ/WRITE MULTIPLE command.
+//
+// A buf holds one file system block of SPB sectors.  Requests and
+// the C-SCAN position are kept in blocks; only the command sent to
+// the disk counts sectors.  PIO moves a command's data a DRQ block
+// (idemult sectors, or one) per interrupt.
 
 #include "types.h"
 #include "defs.h"
@@ -8,7 +20,11 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "fs.h"
 #include "buf.h"
+#include "kstat.h"
+#include "softirq.h"
+#include "trace.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -17,16 +33,70 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master registers of the primary channel, from the base in
+// BAR4 of the PCI IDE function.
+#define BM_CMD        0     // command: start, direction
+#define BM_STATUS     2     // status: error, interrupt, drive DMA capable
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+#define BM_ST_DMA0    0x20
+#define BM_ST_DMA1    0x40
+
+#define SECTSIZE      512
+#define SPB           (BSIZE/SECTSIZE)  // sectors per block
+
+#define IDE_MAXMULT   8     // sectors moved per READ/WRITE MULTIPLE
+#define IDE_MAXDMA    32    // bufs moved per DMA command; 32 blocks of
+                            // at most 8 sectors fit in one command
+#define IDE_DEADLINE  50    // ticks before the oldest request goes first
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
 // You must hold idelock while manipulating queue.
+// The command in progress covers the first idencur bufs, which
+// hold consecutive blocks of one disk; idepos of its sectors have
+// been moved by PIO.  The rest are in arrival order, oldest first;
+// idenext() picks from them.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idetail;   // last buf in idequeue
+static int idencur;
+static int idepos;
+static uint idedev, idesector; // just past the last command
+static uint idestamp;         // ticks when the command started
+static struct diskstat idestat;
+static struct softirq idesoft; // finishes the command after the interrupt
 
 static int havedisk1;
+static int idemult[2];        // sectors per MULTIPLE block, or 0
+static int idebm;             // bus-master I/O base, or 0 for PIO
+
+// Physical region descriptors: one per buf of a DMA command.  The
+// kernel is mapped at its physical addresses, and the data of a buf
+// is aligned to its size, so it never crosses a page, let alone the
+// 64KB boundary a region must not cross.  256-byte alignment keeps
+// the table within one, too.
+struct prd {
+  uint addr;
+  ushort count;
+  ushort flags;               // PRD_EOT on the last entry
+};
+#define PRD_EOT 0x8000
+static struct prd prdt[IDE_MAXDMA] __attribute__((aligned(256)));
 static void idestart(struct buf*);
+static void idesetmult(int);
+static void idedmainit(void);
+static void idedone(void*);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +117,7 @@ ideinit(void)
   int i;
 
   initlock(&idelock, "ide");
+  softinit(&idesoft, idedone, 0);
   picenable(IRQ_IDE);
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
@@ -62,57 +133,289 @@ ideinit(void)
   
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idesetmult(0);
+  if(havedisk1)
+    idesetmult(1);
+  idedmainit();
+}
+
+// Look for a PCI IDE controller that can master the bus and use it
+// for the primary channel.
+static void
+idedmainit(void)
+{
+  uint bdf, bar;
+
+  if(pcifind(0x01, 0x01, &bdf) < 0)
+    return;
+  if(!((pciread(bdf, 0x08) >> 8) & 0x80))   // programming interface
+    return;
+  bar = pciread(bdf, 0x20);
+  if(!(bar & 1) || (bar & ~3) == 0)
+    return;
+  // Enable I/O decoding and bus mastering.
+  pciwrite(bdf, 0x04, pciread(bdf, 0x04) | 0x05);
+  idebm = bar & ~3;
+  // Mark both drives DMA capable; firmware may not have.  Writing
+  // the interrupt and error bits clears them.
+  outb(idebm + BM_STATUS, BM_ST_DMA0 | BM_ST_DMA1 | BM_ST_INTR | BM_ST_ERR);
+  cprintf("ide: bus-master DMA at 0x%x\n", idebm);
+}
+
+// Ask disk d to move IDE_MAXMULT sectors per interrupt in
+// READ/WRITE MULTIPLE, and note whether it agreed.
+static void
+idesetmult(int d)
+{
+  outb(0x3f6, 2);  // no interrupt
+  outb(0x1f2, IDE_MAXMULT);
+  outb(0x1f6, 0xe0 | (d<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  if(idewait(1) >= 0)
+    idemult[d] = IDE_MAXMULT;
+}
+
+// Is b at or past (dev, sector) in C-SCAN order?
+static int
+ideahead(struct buf *b, uint dev, uint sector)
+{
+  return b->dev > dev || (b->dev == dev && b->sector >= sector);
+}
+
+// Unlink b from where it is after prev (0 if b is first) and put it
+// right after after (0 for the front).  Caller must hold idelock.
+static void
+idemove(struct buf *prev, struct buf *b, struct buf *after)
+{
+  if(prev == after)
+    return;
+  if(prev)
+    prev->qnext = b->qnext;
+  else
+    idequeue = b->qnext;
+  if(idetail == b)
+    idetail = prev;
+  if(after){
+    b->qnext = after->qnext;
+    after->qnext = b;
+  } else {
+    b->qnext = idequeue;
+    idequeue = b;
+  }
+  if(b->qnext == 0)
+    idetail = b;
+}
+
+// Nothing is in flight: move the next request to the front, with
+// the requests that continue it on disk in the same direction right
+// behind it, and set idencur to their number.
+// Caller must hold idelock; the queue must not be empty.
+static void
+idenext(void)
+{
+  struct buf *b, *p, *prev, *bprev, *low, *lowprev, *last;
+  int max, write;
+
+  // The oldest is first; failing its deadline, pick by sector.
+  b = idequeue;
+  bprev = 0;
+  if(ticks - b->qstamp < IDE_DEADLINE){
+    b = low = 0;
+    bprev = lowprev = 0;
+    for(prev = 0, p = idequeue; p; prev = p, p = p->qnext){
+      if(ideahead(p, idedev, idesector) &&
+         (b == 0 || !ideahead(p, b->dev, b->sector))){
+        b = p;
+        bprev = prev;
+      }
+      if(low == 0 || !ideahead(p, low->dev, low->sector)){
+        low = p;
+        lowprev = prev;
+      }
+    }
+    if(b == 0){
+      b = low;
+      bprev = lowprev;
+    }
+  } else {
+    idestat.deadline++;
+  }
+  idemove(bprev, b, 0);
+
+  // Everything not yet in the run lies after its last buf.
+  write = b->flags & B_DIRTY;
+  if(idebm)
+    max = IDE_MAXDMA;
+  else if((max = idemult[b->dev&1] / SPB) < 1)
+    max = 1;
+  last = b;
+  for(idencur = 1; idencur < max; idencur++){
+    for(prev = last, p = last->qnext; p; prev = p, p = p->qnext)
+      if(p->dev == b->dev && p->sector == b->sector + idencur &&
+         (p->flags & B_DIRTY) == write)
+        break;
+    if(p == 0)
+      break;
+    idemove(prev, p, last);
+    last = p;
+  }
+  idedev = b->dev;
+  idesector = b->sector + idencur;
+}
+
+// Move the next DRQ block of the PIO command in flight between the
+// disk and its bufs.  Returns 1 once it has moved all its sectors.
+// Caller must hold idelock.
+static int
+idepio(void)
+{
+  struct buf *b;
+  int i, m, write;
+
+  write = idequeue->flags & B_DIRTY;
+  m = idemult[idequeue->dev&1] ? idemult[idequeue->dev&1] : 1;
+  for(; m > 0 && idepos < idencur * SPB; m--, idepos++){
+    for(b = idequeue, i = 0; i < idepos / SPB; i++)
+      b = b->qnext;
+    if(write)
+      outsl(0x1f0, b->data + (idepos % SPB) * SECTSIZE, SECTSIZE/4);
+    else
+      insl(0x1f0, b->data + (idepos % SPB) * SECTSIZE, SECTSIZE/4);
+  }
+  return idepos == idencur * SPB;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request at the front of the queue, together with the
+// idencur - 1 bufs behind it, as one command.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *p;
+  uint sector;
+  int i, n, write;
+
   if(b == 0)
     panic("idestart");
 
+  write = b->flags & B_DIRTY;
+  n = idencur;
+  idepos = 0;
+  idestamp = ticks;
+  idestat.cmds++;
+  TRACE(write ? TR_IDEWRITE : TR_IDEREAD, b->sector, n);
+
+  if(idebm){
+    for(i = 0, p = b; i < n; i++, p = p->qnext){
+      prdt[i].addr = (uint)p->data;
+      prdt[i].count = BSIZE;
+      prdt[i].flags = i == n-1 ? PRD_EOT : 0;
+    }
+    outl(idebm + BM_PRDT, (uint)prdt);
+    outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_ST_INTR | BM_ST_ERR);
+    outb(idebm + BM_CMD, write ? 0 : BM_CMD_READ);
+  }
+
+  sector = b->sector * SPB;
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  outb(0x1f2, n * SPB);  // number of sectors; 0 means 256
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(idebm){
+    // The disk works alone from here; ideintr() hears when it is done.
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  } else if(write){
+    outb(0x1f7, idemult[b->dev&1] ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    // The first DRQ block goes now, the rest as the disk asks.
+    idewait(0);
+    idepio();
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idemult[b->dev&1] ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler.  The disk keeps its interrupt up until idedone()
+// reads the status, so there is nothing to quiet here.
 void
 ideintr(void)
+{
+  softraise(&idesoft);
+}
+
+// Finish the command the disk interrupted for: copy in the sectors
+// read by PIO, wake their readers and start the next command.  Runs
+// as a softirq, since the copy takes a while.
+static void
+idedone(void *arg)
 {
   struct buf *b;
+  int st;
+
+  (void)arg;
 
-  // Take first buffer off queue.
+  // Take the bufs of the finished command off queue.
   acquire(&idelock);
-  if((b = idequeue) == 0){
+  if(idencur == 0){
     release(&idelock);
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
+  b = idequeue;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
+  // By PIO, a read's next DRQ block is in, or a write's last one is
+  // out; move the next, unless that was the last.  DMA has put all
+  // the data in place already.
+  if(idebm){
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, st | BM_ST_INTR | BM_ST_ERR);
+    if(idewait(1) < 0 || (st & BM_ST_ERR))
+      cprintf("ide: dma error sector %d\n", b->sector * SPB);
+  } else if(idewait(1) >= 0){
+    if(b->flags & B_DIRTY){
+      if(idepos < idencur * SPB){
+        idepio();
+        release(&idelock);
+        return;
+      }
+    } else if(!idepio()){
+      release(&idelock);
+      return;
+    }
+  }
+  idestat.svcticks += ticks - idestamp;
+  TRACE(TR_IDEDONE, b->sector, idencur);
+
+  for(; idencur > 0; idencur--){
+    b = idequeue;
+    idequeue = b->qnext;
+    idestat.reqs++;
+    idestat.depth--;
+    idestat.waitticks += ticks - b->qstamp;
   
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      // Read ahead: nobody is waiting, so release it here.
+      b->flags &= ~B_ASYNC;
+      brelse(b);
+    } else
+      wakeupboost(b);
+  }
+  if(idequeue == 0)
+    idetail = 0;
   
   // Start disk on next buf in queue.
-  if(idequeue != 0)
+  if(idequeue != 0){
+    idenext();
     idestart(idequeue);
+  }
 
   release(&idelock);
 }
@@ -123,8 +426,6 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!(b->flags & B_BUSY))
     panic("iderw: buf not busy");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -136,19 +437,36 @@ iderw(struct buf *b)
 
   // Append b to idequeue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
-    ;
-  *pp = b;
+  b->qstamp = ticks;
+  if(idetail)
+    idetail->qnext = b;
+  else
+    idequeue = b;
+  idetail = b;
+  if(++idestat.depth > idestat.maxdepth)
+    idestat.maxdepth = idestat.depth;
   
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idencur == 0){
+    idenext();
+    idestart(idequeue);
+  }
   
-  // Wait for request to finish.
+  // Wait for request to finish, unless it is read ahead.
   // Assuming will not sleep too long: ignore proc->killed.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+  while(!(b->flags & B_ASYNC) &&
+        (b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
 
   release(&idelock);
 }
+
+// Copy the disk queue counters into st.
+void
+idestats(struct diskstat *st)
+{
+  acquire(&idelock);
+  *st = idestat;
+  release(&idelock);
+}
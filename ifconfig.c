@@ -0,0 +1,54 @@
+// ifconfig: give a network interface its IPv4 address.
+//
+//   ifconfig [dev] ip mask [gateway]
+//   ifconfig [dev] dhcp
+//
+// e.g. "ifconfig 10.0.2.15 255.255.255.0 10.0.2.2" under QEMU's user
+// network.  An address of 0.0.0.0 takes the interface down.  The
+// kernel configures interfaces by DHCP at boot; a fixed address stops
+// that and "dhcp" starts it again.
+
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "eth/eth.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct eth_ifaddr ifa;
+  char *dev;
+  int fd;
+
+  dev = "eth";
+  if(argc > 1 && argv[1][0] == 'e'){
+    dev = argv[1];
+    argc--;
+    argv++;
+  }
+  if(argc == 2 && strcmp(argv[1], "dhcp") == 0){
+    if((fd = open(dev, O_RDWR)) < 0){
+      printf(2, "ifconfig: cannot open %s\n", dev);
+      exit();
+    }
+    if(ioctl(fd, ETH_DHCP, 0) < 0)
+      printf(2, "ifconfig: %s: cannot start DHCP\n", dev);
+    close(fd);
+    exit();
+  }
+  memset(&ifa, 0, sizeof(ifa));
+  if(argc < 3 || argc > 4 || parseip(argv[1], ifa.ip) < 0 ||
+     parseip(argv[2], ifa.mask) < 0 ||
+     (argc == 4 && parseip(argv[3], ifa.gw) < 0)){
+    printf(2, "usage: ifconfig [dev] ip mask [gateway] | ifconfig [dev] dhcp\n");
+    exit();
+  }
+  if((fd = open(dev, O_RDWR)) < 0){
+    printf(2, "ifconfig: cannot open %s\n", dev);
+    exit();
+  }
+  if(ioctl(fd, ETH_SET_ADDR, &ifa) < 0)
+    printf(2, "ifconfig: %s: cannot set address\n", dev);
+  close(fd);
+  exit();
+}
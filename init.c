@@ -7,10 +7,21 @@
 
 char *argv[] = { "sh", 0 };
 
+struct {
+  char *name;
+  int minor;
+} ethdev[] = {
+  { "eth", 0 },
+  { "eth0", 0 },
+  { "eth1", 1 },
+  { "lo", 15 },       // ETHERNET_LOOP
+};
+
 int
 main(void)
 {
   int pid, wpid, fd;
+  uint i;
 
   if(open("console", O_RDWR) < 0){
     mknod("console", 1, 1);
@@ -19,11 +30,14 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
   
-  fd = open("eth", O_RDWR);
-  if (fd < 0)
-    mknod("eth", 2, 0);
-  else
-    close(fd);
+  // "eth" is the first card; "ethN" is card N; "lo" is the loopback.
+  for(i = 0; i < sizeof(ethdev)/sizeof(ethdev[0]); i++){
+    fd = open(ethdev[i].name, O_RDWR);
+    if (fd < 0)
+      mknod(ethdev[i].name, 2, ethdev[i].minor);
+    else
+      close(fd);
+  }
 
   for(;;){
     printf(1, "init: starting sh\n");
@@ -4,7 +4,11 @@
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "traps.h"
+#include "spinlock.h"
 
 #define IOAPIC  0xFEC00000   // Default physical address of IO APIC
 
@@ -24,6 +28,14 @@
 
 volatile struct ioapic *ioapic;
 
+// The redirection entries are written under lock, since irqroute()
+// may move an interrupt while another CPU enables one.  route[irq]
+// is the APIC ID of the CPU that serves irq, or -1 while disabled.
+#define NROUTE 32
+static struct spinlock lock;
+static int route[NROUTE];
+static int maxintr;
+
 // IO APIC MMIO structure: write reg, then read or write data.
 struct ioapic {
   uint reg;
@@ -48,8 +60,11 @@ ioapicwrite(int reg, uint data)
 void
 ioapicinit(void)
 {
-  int i, id, maxintr;
+  int i, id;
 
+  for(i = 0; i < NROUTE; i++)
+    route[i] = -1;
+  initlock(&lock, "ioapic");
   if(!ismp)
     return;
 
@@ -76,6 +91,43 @@ ioapicenable(int irq, int cpunum)
   // Mark interrupt edge-triggered, active high,
   // enabled, and routed to the given cpunum,
   // which happens to be that cpu's APIC ID.
+  acquire(&lock);
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+  if(irq < NROUTE)
+    route[irq] = cpunum;
+  release(&lock);
+}
+
+// Send enabled interrupt irq to the CPU with APIC ID cpunum from now
+// on.  Returns the APIC ID it went to, or -1 if irq is not enabled
+// or there is no such running CPU.
+int
+ioapicroute(int irq, int cpunum)
+{
+  struct cpu *c;
+  int old;
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->id == cpunum && c->booted)
+      break;
+  if(!ismp || irq < 0 || irq >= NROUTE || irq > maxintr || c == cpus+ncpu)
+    return -1;
+  acquire(&lock);
+  if((old = route[irq]) >= 0){
+    ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+    route[irq] = cpunum;
+  }
+  release(&lock);
+  return old;
+}
+
+// The APIC ID of the CPU that serves irq, or -1 if it is disabled or
+// goes through the PIC.
+int
+ioapicirqcpu(int irq)
+{
+  if(!ismp || irq < 0 || irq >= NROUTE)
+    return -1;
+  return route[irq];
 }
@@ -0,0 +1,28 @@
+// irqaff: move a device interrupt to another CPU.
+//
+//   irqaff irq cpu
+//
+// Routes irq to cpu from now on and prints where it went before.
+// "kstat irqs" shows the routes and the interrupts taken on each CPU.
+
+#include "types.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int irq, cpu, old;
+
+  if(argc != 3){
+    printf(2, "usage: irqaff irq cpu\n");
+    exit();
+  }
+  irq = atoi(argv[1]);
+  cpu = atoi(argv[2]);
+  if((old = irqaffinity(irq, cpu)) < 0){
+    printf(2, "irqaff: cannot route irq %d to cpu %d\n", irq, cpu);
+    exit();
+  }
+  printf(1, "irq %d: cpu %d -> cpu %d\n", irq, old, cpu);
+  exit();
+}
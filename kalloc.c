@@ -1,13 +1,32 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and the slabs of slab.c. Allocates 4096-byte pages.
+//
+// Each CPU keeps a short free list of its own, used with interrupts
+// off and no lock.  kalloc() refills it from the shared list, and
+// kfree() gives back to the shared list, KBATCH pages at a time, so
+// kmem.lock is taken about once per KBATCH calls.
+//
+// Each CPU also keeps up to NZPAGE pages already zeroed, filled by
+// kzfill() while the CPU has nothing to run, for kzalloc() to hand
+// out without clearing them again.  Freed pages are filled with
+// junk only in DEBUG builds.
+//
+// A user page that fork() shares copy-on-write between address
+// spaces counts its extra mappings in kref; kfree() of such a page
+// only drops one of them.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 
+#define KBATCH 32     // pages moved between a CPU and kmem at once
+#define KHIGH  (2*KBATCH)  // most pages a CPU keeps
+#define NZPAGE 16     // zeroed pages a CPU keeps
+
 struct run {
   struct run *next;
 };
@@ -15,9 +34,70 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;    // pages on freelist
 } kmem;
 
+// Free pages cached by each CPU; only that CPU touches them.
+struct {
+  struct run *freelist;
+  int nfree;
+  struct run *zlist;    // zeroed
+  int nzero;
+} kcpu[NCPU];
+
+// Mappings of each page beyond the first.  A page with no extra
+// mappings has a single owner, the only one who can change that, so
+// kfree() looks at the count without the lock.
+// The counts sit right after the kernel, one for each page up to
+// phystop.
+struct {
+  struct spinlock lock;
+  ushort *n;
+} kref;
+
 extern char end[]; // first address after kernel loaded from ELF file
+extern uint mbmagic, mbinfo;  // multiboot.S
+uint phystop;      // end of the memory kalloc() hands out
+
+// One entry of the BIOS memory map that bootasm.S collects.
+struct e820 {
+  uint addr[2];   // 64-bit, low word first
+  uint len[2];
+  uint type;      // 1: usable RAM
+} __attribute__((packed));
+
+// Find where the run of RAM the kernel was loaded into ends, from
+// the multiboot loader's information or else the BIOS memory map.
+static uint
+memdetect(void)
+{
+  struct e820 *e, *ee;
+  uint *mb, top;
+
+  top = 0;
+  if(mbmagic == 0x2BADB002){
+    mb = (uint*)mbinfo;
+    if(mb[0] & 1)   // mem_upper: KB above 1MB
+      top = mb[2] >= (PHYSTOP - 0x100000) / 1024 ? PHYSTOP :
+            0x100000 + mb[2] * 1024;
+  } else {
+    e = (struct e820*)(E820MAP + 4);
+    ee = e + *(uint*)E820MAP;
+    for(; e < ee; e++){
+      if(e->type != 1 || e->addr[1] != 0 || e->addr[0] > 0x100000)
+        continue;
+      if(e->len[1] != 0 || e->addr[0] + e->len[0] < e->addr[0])
+        top = PHYSTOP;
+      else if(e->addr[0] + e->len[0] > 0x100000)
+        top = e->addr[0] + e->len[0];
+    }
+  }
+  if(top == 0)
+    top = 0x1000000;  // no map: assume 16MB
+  if(top > PHYSTOP)
+    top = PHYSTOP;
+  return top & ~(PGSIZE-1);
+}
 
 // Initialize free list of physical pages.
 void
@@ -26,8 +106,12 @@ kinit(void)
   char *p;
 
   initlock(&kmem.lock, "kmem");
-  p = (char*)PGROUNDUP((uint)end);
-  for(; p + PGSIZE <= (char*)PHYSTOP; p += PGSIZE)
+  initlock(&kref.lock, "kref");
+  phystop = memdetect();
+  kref.n = (ushort*)PGROUNDUP((uint)end);
+  memset(kref.n, 0, phystop/PGSIZE * sizeof(kref.n[0]));
+  p = (char*)PGROUNDUP((uint)(kref.n + phystop/PGSIZE));
+  for(; p + PGSIZE <= (char*)phystop; p += PGSIZE)
     kfree(p);
 }
 
@@ -38,19 +122,49 @@ kinit(void)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *last;
+  int i;
 
-  if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP) 
+  if((uint)v % PGSIZE || v < end || (uint)v >= phystop)
     panic("kfree");
 
+  i = (uint)v / PGSIZE;
+  if(kref.n[i]){
+    acquire(&kref.lock);
+    if(kref.n[i]){
+      // Still mapped elsewhere.
+      kref.n[i]--;
+      release(&kref.lock);
+      return;
+    }
+    release(&kref.lock);
+  }
+
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  pushcli();
+  r->next = kcpu[cpu->id].freelist;
+  kcpu[cpu->id].freelist = r;
+  if(++kcpu[cpu->id].nfree > KHIGH){
+    // Hand the oldest KBATCH pages back.
+    for(last = r, i = 1; i < KHIGH - KBATCH + 1; i++)
+      last = last->next;
+    r = last->next;
+    last->next = 0;
+    kcpu[cpu->id].nfree -= KBATCH;
+    for(last = r; last->next; last = last->next)
+      ;
+    acquire(&kmem.lock);
+    last->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree += KBATCH;
+    release(&kmem.lock);
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -60,12 +174,113 @@ char*
 kalloc(void)
 {
   struct run *r;
+  int i;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  pushcli();
+  if(kcpu[cpu->id].freelist == 0){
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH && kmem.freelist; i++){
+      r = kmem.freelist;
+      kmem.freelist = r->next;
+      kmem.nfree--;
+      r->next = kcpu[cpu->id].freelist;
+      kcpu[cpu->id].freelist = r;
+      kcpu[cpu->id].nfree++;
+    }
+    release(&kmem.lock);
+  }
+  r = kcpu[cpu->id].freelist;
+  if(r){
+    kcpu[cpu->id].freelist = r->next;
+    kcpu[cpu->id].nfree--;
+  } else if((r = kcpu[cpu->id].zlist) != 0){
+    // Out of memory but for the zeroed pages.
+    kcpu[cpu->id].zlist = r->next;
+    kcpu[cpu->id].nzero--;
+  }
+  popcli();
   return (char*)r;
 }
 
+// Record one more mapping of page v, to be undone by kfree().
+void
+kdup(char *v)
+{
+  acquire(&kref.lock);
+  kref.n[(uint)v / PGSIZE]++;
+  release(&kref.lock);
+}
+
+// Drop one extra reference to page v, as kfree() would, but never
+// free it.  Returns 0 if there was none: the caller held the last.
+int
+kunshare(char *v)
+{
+  int shared;
+
+  acquire(&kref.lock);
+  if((shared = kref.n[(uint)v / PGSIZE] != 0))
+    kref.n[(uint)v / PGSIZE]--;
+  release(&kref.lock);
+  return shared;
+}
+
+// Is page v mapped more than once?  Without the lock this is only
+// a hint, except to a sole owner asking about its own page.
+int
+kshared(char *v)
+{
+  return kref.n[(uint)v / PGSIZE] != 0;
+}
+
+// Allocate one page filled with zeros.
+char*
+kzalloc(void)
+{
+  struct run *r;
+
+  pushcli();
+  r = kcpu[cpu->id].zlist;
+  if(r){
+    kcpu[cpu->id].zlist = r->next;
+    kcpu[cpu->id].nzero--;
+  }
+  popcli();
+  if(r){
+    r->next = 0;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Zero one more page for this CPU's pool, if it is short.
+// The scheduler calls this when it finds nothing to run.
+void
+kzfill(void)
+{
+  struct run *r;
+
+  if(kcpu[cpu->id].nzero >= NZPAGE || (r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  pushcli();
+  r->next = kcpu[cpu->id].zlist;
+  kcpu[cpu->id].zlist = r;
+  kcpu[cpu->id].nzero++;
+  popcli();
+}
+
+// Number of free pages, for sizing caches at boot.
+// The per-CPU counts are read unlocked, so this is only a hint.
+int
+kfreepages(void)
+{
+  int i, n;
+
+  n = kmem.nfree;
+  for(i = 0; i < NCPU; i++)
+    n += kcpu[i].nfree + kcpu[i].nzero;
+  return n;
+}
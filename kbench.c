@@ -0,0 +1,384 @@
+// kbench: time the basic operations of the kernel.
+//
+//   kbench [-t ms] [test...]
+//
+// Runs each test, or those named, for about ms milliseconds
+// (default 500, at most 4000) and times it with nsecs().  The tests:
+//   null     getpid(), the cheapest system call
+//   fork     fork() a child that exits at once, and wait() for it
+//   exec     the same, with the child exec()ing echo
+//   pipelat  a byte to a child and back through two pipes
+//   pipebw   a child writing to a pipe as fast as it can
+//   create   create empty files, then unlink them
+//   write    write a file of FILESIZE bytes from start to end
+//   read     read it back, mostly from the buffer cache
+//   eth      send minimum-size frames to lo and take them back
+//
+// Each test prints one line of name=value pairs, and kbench ends
+// with "kbench done", e.g.
+//   bench=null ops=412000 ns=500012000 ns_op=1213 ops_s=823980
+//   bench=pipebw bytes=73400320 ns=500100000 mb_s=139.9
+// "make bench" runs it in QEMU and keeps these lines in bench.txt.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "net/net.h"
+#include "eth/eth.h"
+
+#define FILESIZE (1024*1024)
+#define NCREATE  100        // files made at a time by create
+#define KBENCH_TYPE 0x88B6  // IEEE local experimental EtherType
+
+char buf[8192];
+uint limit;                 // ns each test runs for
+
+// n*1000000000/ns, provided that fits in 32 bits.
+uint
+persec(uint n, uint ns)
+{
+  uint q, r;
+  uint64 x;
+
+  if(ns == 0)
+    return 0;
+  x = (uint64)n * 1000000000;
+  asm("divl %4" : "=a" (q), "=d" (r)
+      : "a" ((uint)x), "d" ((uint)(x >> 32)), "rm" (ns));
+  return q;
+}
+
+// Nanoseconds since t0; runs are short enough to keep this in a uint.
+uint
+since(uint64 t0)
+{
+  return nsecs() - t0;
+}
+
+void
+report(char *name, uint ops, uint ns)
+{
+  printf(1, "bench=%s ops=%d ns=%d ns_op=%d ops_s=%d\n",
+         name, ops, ns, ops ? ns / ops : 0, persec(ops, ns));
+}
+
+void
+reportbw(char *name, uint bytes, uint ns)
+{
+  uint kb;
+
+  kb = persec(bytes / 1024, ns);
+  printf(1, "bench=%s bytes=%d ns=%d mb_s=%d.%d\n",
+         name, bytes, ns, kb / 1024, kb % 1024 * 10 / 1024);
+}
+
+void
+fail(char *what)
+{
+  printf(2, "kbench: %s failed\n", what);
+  exit();
+}
+
+void
+null(void)
+{
+  uint64 t0;
+  uint n, ns;
+  int i;
+
+  t0 = nsecs();
+  for(n = 0; (ns = since(t0)) < limit; n += 1000)
+    for(i = 0; i < 1000; i++)
+      getpid();
+  report("null", n, ns);
+}
+
+// Fork children that exit at once, or exec argv if not 0.
+void
+forkloop(char *name, char **argv)
+{
+  uint64 t0;
+  uint n, ns;
+  int pid;
+
+  t0 = nsecs();
+  for(n = 0; (ns = since(t0)) < limit; n++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      if(argv){
+        close(1);
+        exec(argv[0], argv);
+      }
+      exit();
+    }
+    if(wait() != pid)
+      fail("wait");
+  }
+  report(name, n, ns);
+}
+
+void
+forkexit(void)
+{
+  forkloop("fork", 0);
+}
+
+void
+forkexec(void)
+{
+  static char *argv[] = { "echo", 0 };
+
+  forkloop("exec", argv);
+}
+
+void
+pipelat(void)
+{
+  int to[2], from[2], pid;
+  uint64 t0;
+  uint n, ns;
+  char c;
+
+  if(pipe(to) < 0 || pipe(from) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(to[1]);
+    close(from[0]);
+    while(read(to[0], &c, 1) == 1)
+      if(write(from[1], &c, 1) != 1)
+        break;
+    exit();
+  }
+  close(to[0]);
+  close(from[1]);
+  c = 0;
+  t0 = nsecs();
+  for(n = 0; (ns = since(t0)) < limit; n++)
+    if(write(to[1], &c, 1) != 1 || read(from[0], &c, 1) != 1)
+      fail("pipe round trip");
+  close(to[1]);
+  close(from[0]);
+  wait();
+  report("pipelat", n, ns);
+}
+
+void
+pipebw(void)
+{
+  int fds[2], pid, r;
+  uint64 t0;
+  uint n, ns;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(fds[0]);
+    while(write(fds[1], buf, sizeof(buf)) > 0)
+      ;
+    exit();
+  }
+  close(fds[1]);
+  t0 = nsecs();
+  for(n = 0; (ns = since(t0)) < limit; n += r)
+    if((r = read(fds[0], buf, sizeof(buf))) <= 0)
+      fail("pipe read");
+  close(fds[0]);
+  wait();
+  reportbw("pipebw", n, ns);
+}
+
+// The name of file i of create.
+void
+kbname(char *name, int i)
+{
+  name[0] = 'k';
+  name[1] = 'b';
+  name[2] = '0' + i / 10;
+  name[3] = '0' + i % 10;
+  name[4] = 0;
+}
+
+void
+create(void)
+{
+  uint64 t0, t1;
+  uint n, cns, uns;
+  char name[5];
+  int i, fd;
+
+  n = cns = uns = 0;
+  while(cns + uns < limit){
+    t0 = nsecs();
+    for(i = 0; i < NCREATE; i++){
+      kbname(name, i);
+      if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+        fail("create");
+      close(fd);
+    }
+    t1 = nsecs();
+    for(i = 0; i < NCREATE; i++){
+      kbname(name, i);
+      if(unlink(name) < 0)
+        fail("unlink");
+    }
+    cns += t1 - t0;
+    uns += since(t1);
+    n += NCREATE;
+  }
+  report("create", n, cns);
+  report("unlink", n, uns);
+}
+
+// Write kbfile from start to end, making it if need be.
+void
+writefile(void)
+{
+  int fd, i;
+
+  memset(buf, 'k', sizeof(buf));
+  if((fd = open("kbfile", O_CREATE|O_RDWR)) < 0)
+    fail("create kbfile");
+  for(i = 0; i < FILESIZE; i += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("write");
+  close(fd);
+}
+
+void
+seqwrite(void)
+{
+  uint64 t0;
+  uint n, ns;
+
+  t0 = nsecs();
+  for(n = 0; (ns = since(t0)) < limit; n += FILESIZE)
+    writefile();
+  reportbw("write", n, ns);
+}
+
+void
+seqread(void)
+{
+  uint64 t0;
+  uint n, ns;
+  int fd, r;
+
+  if((fd = open("kbfile", O_RDONLY)) < 0)
+    writefile();
+  close(fd);
+  t0 = nsecs();
+  for(n = 0; (ns = since(t0)) < limit; ){
+    if((fd = open("kbfile", O_RDONLY)) < 0)
+      fail("open kbfile");
+    while((r = read(fd, buf, sizeof(buf))) > 0)
+      n += r;
+    close(fd);
+    if(r < 0)
+      fail("read");
+  }
+  unlink("kbfile");
+  reportbw("read", n, ns);
+}
+
+void
+eth(void)
+{
+  eth_hdr_t *eh;
+  uint64 t0;
+  uint tx, rx, ns;
+  int fd, r;
+
+  if((fd = open("lo", O_RDWR)) < 0)
+    fail("open lo");
+  ioctl(fd, ETH_NONBLOCK, (void*)1);
+  eh = (eth_hdr_t*)buf;
+  memset(buf, 0, ETH_MIN_SIZE);
+  memset(eh->dst, 0xFF, sizeof(eh->dst));
+  eh->length = htons(KBENCH_TYPE);
+
+  tx = rx = 0;
+  t0 = nsecs();
+  while((ns = since(t0)) < limit){
+    if((r = write(fd, buf, ETH_MIN_SIZE)) < 0)
+      fail("eth write");
+    tx += r > 0;
+    while(read(fd, buf + ETH_MAX_SIZE, ETH_MAX_SIZE) > 0)
+      rx++;
+  }
+  close(fd);
+  printf(1, "bench=eth size=%d tx=%d rx=%d ns=%d tx_pps=%d rx_pps=%d\n",
+         ETH_MIN_SIZE, tx, rx, ns, persec(tx, ns), persec(rx, ns));
+}
+
+struct {
+  char *name;
+  void (*fn)(void);
+} tests[] = {
+  { "null", null },
+  { "fork", forkexit },
+  { "exec", forkexec },
+  { "pipelat", pipelat },
+  { "pipebw", pipebw },
+  { "create", create },
+  { "write", seqwrite },
+  { "read", seqread },
+  { "eth", eth },
+};
+
+#define NTEST (sizeof(tests)/sizeof(tests[0]))
+
+void
+usage(void)
+{
+  uint i;
+
+  printf(2, "usage: kbench [-t ms] [test...]\ntests:");
+  for(i = 0; i < NTEST; i++)
+    printf(2, " %s", tests[i].name);
+  printf(2, "\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint i, j;
+  int a, ms;
+
+  ms = 500;
+  for(a = 1; a < argc && argv[a][0] == '-'; a++){
+    if(strcmp(argv[a], "-t") == 0 && a + 1 < argc)
+      ms = atoi(argv[++a]);
+    else
+      usage();
+  }
+  if(ms <= 0 || ms > 4000)
+    usage();
+  limit = ms * 1000000;
+  for(j = a; j < (uint)argc; j++){
+    for(i = 0; i < NTEST && strcmp(argv[j], tests[i].name) != 0; i++)
+      ;
+    if(i == NTEST)
+      usage();
+  }
+
+  printf(1, "kbench ms=%d bsize=%d filesize=%d\n", ms, BSIZE, FILESIZE);
+  for(i = 0; i < NTEST; i++){
+    if(a < argc){
+      for(j = a; j < (uint)argc && strcmp(argv[j], tests[i].name) != 0; j++)
+        ;
+      if(j == (uint)argc)
+        continue;
+    }
+    tests[i].fn();
+  }
+  printf(1, "kbench done\n");
+  exit();
+}
@@ -0,0 +1,203 @@
+// kstat: print kernel statistics.
+//
+//   kstat [disk] [locks] [syscalls] [irqs]
+//
+// One line of name=value pairs per subsystem, and per lock name for
+// locks, those that spent the most time waiting first.  syscalls and
+// irqs print a line for each system call or IRQ seen so far; an IRQ
+// line gives the CPU it is routed to (-1 for none or the PIC) and
+// how many were taken on each CPU, as cpuN=count.  Cycle
+// percentiles are the upper bounds of histogram buckets, powers of
+// two; "+" marks the last bucket, which has no bound.
+
+#include "types.h"
+#include "user.h"
+#include "kstat.h"
+#include "syscall.h"
+
+void
+disk(void)
+{
+  struct diskstat ds;
+
+  if(kstat(KSTAT_DISK, &ds, sizeof(ds)) != sizeof(ds)){
+    printf(2, "kstat: cannot read disk stats\n");
+    return;
+  }
+  printf(1, "disk reqs=%d cmds=%d depth=%d maxdepth=%d "
+         "wait_ticks=%d svc_ticks=%d deadline=%d\n",
+         ds.reqs, ds.cmds, ds.depth, ds.maxdepth,
+         ds.waitticks, ds.svcticks, ds.deadline);
+}
+
+#define NLOCKSTAT 64
+
+void
+locks(void)
+{
+  static struct lockstat ls[NLOCKSTAT];
+  struct lockstat t;
+  int i, j, n;
+
+  n = kstat(KSTAT_LOCKS, ls, sizeof(ls)) / sizeof(ls[0]);
+  if(n <= 0){
+    printf(2, "kstat: no lock stats; build the kernel with LOCKSTAT=1\n");
+    return;
+  }
+  for(i = 1; i < n; i++){
+    t = ls[i];
+    for(j = i; j > 0 && ls[j-1].spinkc < t.spinkc; j--)
+      ls[j] = ls[j-1];
+    ls[j] = t;
+  }
+  for(i = 0; i < n; i++)
+    printf(1, "lock name=%s acquires=%d contended=%d spin_kcycles=%d "
+           "maxhold_cycles=%d\n", ls[i].name, ls[i].acquires,
+           ls[i].contended, ls[i].spinkc, ls[i].maxhold);
+}
+
+char *sysnames[] = {
+[SYS_fork]   = "fork",
+[SYS_exit]   = "exit",
+[SYS_wait]   = "wait",
+[SYS_pipe]   = "pipe",
+[SYS_read]   = "read",
+[SYS_write]  = "write",
+[SYS_close]  = "close",
+[SYS_kill]   = "kill",
+[SYS_exec]   = "exec",
+[SYS_open]   = "open",
+[SYS_mknod]  = "mknod",
+[SYS_unlink] = "unlink",
+[SYS_fstat]  = "fstat",
+[SYS_link]   = "link",
+[SYS_mkdir]  = "mkdir",
+[SYS_chdir]  = "chdir",
+[SYS_dup]    = "dup",
+[SYS_getpid] = "getpid",
+[SYS_sbrk]   = "sbrk",
+[SYS_sleep]  = "sleep",
+[SYS_uptime] = "uptime",
+[SYS_ioctl]  = "ioctl",
+[SYS_socket] = "socket",
+[SYS_bind]   = "bind",
+[SYS_sendto] = "sendto",
+[SYS_recvfrom] = "recvfrom",
+[SYS_listen] = "listen",
+[SYS_accept] = "accept",
+[SYS_connect] = "connect",
+[SYS_setsockopt] = "setsockopt",
+[SYS_kstat]  = "kstat",
+[SYS_fsync]  = "fsync",
+[SYS_shmget] = "shmget",
+[SYS_shmat]  = "shmat",
+[SYS_shmrm]  = "shmrm",
+[SYS_setpriority] = "setpriority",
+[SYS_clone]  = "clone",
+[SYS_join]   = "join",
+[SYS_futex]  = "futex",
+[SYS_poll]   = "poll",
+[SYS_sendfile] = "sendfile",
+[SYS_irqaffinity] = "irqaffinity",
+[SYS_nanotime] = "nanotime",
+[SYS_trace]  = "trace",
+[SYS_prof]   = "prof",
+[SYS_getrusage] = "getrusage",
+[SYS_vfork]  = "vfork",
+};
+
+#define NSYSSTAT 64
+
+// Average cycles of n events taking kc*1024 cycles, without overflow.
+uint
+avgcycles(uint kc, uint n)
+{
+  if(n == 0)
+    return 0;
+  if(kc < 0x400000)
+    return kc * 1024 / n;
+  return kc / n * 1024;
+}
+
+// Print the bucket of hist below which lie pct percent of n events.
+void
+pcycles(char *label, uint *hist, uint n, int pct)
+{
+  uint want, seen;
+  int i;
+
+  want = (n * pct + 99) / 100;
+  seen = 0;
+  for(i = 0; i < NLATBUCKET - 1; i++){
+    seen += hist[i];
+    if(seen >= want)
+      break;
+  }
+  printf(1, " %s=%d%s", label, 512 << i, i == NLATBUCKET - 1 ? "+" : "");
+}
+
+void
+syscalls(void)
+{
+  static struct syscallstat ss[NSYSSTAT];
+  int i, n;
+
+  n = kstat(KSTAT_SYSCALL, ss, sizeof(ss)) / sizeof(ss[0]);
+  for(i = 0; i < n; i++){
+    if(ss[i].calls == 0)
+      continue;
+    printf(1, "syscall num=%d name=%s calls=%d avg_cycles=%d", i,
+           i < (int)(sizeof(sysnames)/sizeof(sysnames[0])) && sysnames[i] ?
+           sysnames[i] : "?", ss[i].calls,
+           avgcycles(ss[i].kcycles, ss[i].calls));
+    pcycles("p50_cycles", ss[i].hist, ss[i].calls, 50);
+    pcycles("p90_cycles", ss[i].hist, ss[i].calls, 90);
+    pcycles("p99_cycles", ss[i].hist, ss[i].calls, 99);
+    printf(1, "\n");
+  }
+}
+
+void
+irqs(void)
+{
+  static struct irqstat is[NIRQSTAT];
+  int i, c;
+
+  if(kstat(KSTAT_IRQ, is, sizeof(is)) != sizeof(is)){
+    printf(2, "kstat: cannot read irq stats\n");
+    return;
+  }
+  for(i = 0; i < NIRQSTAT; i++){
+    if(is[i].count == 0 && is[i].cpu < 0)
+      continue;
+    printf(1, "irq num=%d cpu=%d count=%d avg_cycles=%d max_cycles=%d", i,
+           is[i].cpu, is[i].count, avgcycles(is[i].kcycles, is[i].count),
+           is[i].maxcycles);
+    for(c = 0; c < NIRQCPU; c++)
+      if(is[i].cpucount[c])
+        printf(1, " cpu%d=%d", c, is[i].cpucount[c]);
+    printf(1, "\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2)
+    disk();
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "disk") == 0)
+      disk();
+    else if(strcmp(argv[i], "locks") == 0)
+      locks();
+    else if(strcmp(argv[i], "syscalls") == 0)
+      syscalls();
+    else if(strcmp(argv[i], "irqs") == 0)
+      irqs();
+    else
+      printf(2, "kstat: unknown statistics %s\n", argv[i]);
+  }
+  exit();
+}
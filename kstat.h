@@ -0,0 +1,80 @@
+// Kernel statistics, read with kstat(which, buf, size).
+
+#define KSTAT_DISK  1   // struct diskstat
+#define KSTAT_LOCKS 2   // struct lockstat[], one per lock name
+#define KSTAT_SYSCALL 3 // struct syscallstat[], by system call number
+#define KSTAT_IRQ   4   // struct irqstat[NIRQSTAT], by IRQ
+#define KSTAT_TRACE 5   // struct tracerec[] of all CPUs; see trace.h
+#define KSTAT_LOG   6   // the end of the kernel log, as text
+#define KSTAT_PROF  7   // struct profsample[] of all CPUs; see profile.h
+#define KSTAT_PROC  8   // struct procstat[], one per process in use
+
+// IDE request queue.  Times are in clock ticks and accumulate.
+struct diskstat {
+  uint reqs;        // requests completed
+  uint cmds;        // disk commands issued; reqs - cmds were merged
+  uint depth;       // requests queued or in progress now
+  uint maxdepth;    // largest depth seen
+  uint waitticks;   // sum over requests of time from queueing to completion
+  uint svcticks;    // sum over commands of time the disk took
+  uint deadline;    // requests served out of order for their deadline
+};
+
+// Spinlocks, counted only in kernels built with LOCKSTAT=1.
+// All locks of one name, such as every "pipe", add up in one entry.
+// Times are in CPU cycles.
+struct lockstat {
+  char name[16];
+  uint acquires;
+  uint contended;   // acquires that had to wait
+  uint spinkc;      // cycles spent waiting, in units of 1024
+  uint maxhold;     // longest time one was held
+};
+
+// Latency histograms have NLATBUCKET buckets of powers of two: bucket
+// 0 counts what took under 512 cycles, bucket i under 512<<i, and the
+// last everything longer.
+#define NLATBUCKET 16
+
+// System calls, from entry to return, time asleep included.
+struct syscallstat {
+  uint calls;
+  uint kcycles;     // total cycles, in units of 1024
+  uint hist[NLATBUCKET];
+};
+
+// Device interrupts, handler time only.
+#define NIRQSTAT 32
+#define NIRQCPU  8    // NCPU
+struct irqstat {
+  uint count;
+  uint kcycles;     // total cycles, in units of 1024
+  uint maxcycles;   // longest one
+  int cpu;          // CPU it is routed to, -1 if none or the PIC
+  uint cpucount[NIRQCPU];   // count taken on each CPU
+};
+
+// What a process has used since it started, as getrusage() and
+// KSTAT_PROC report it.  Ticks are charged to whatever the timer
+// interrupt of each CPU finds running.
+struct rusage {
+  uint utime;       // clock ticks in user space
+  uint stime;       // clock ticks in the kernel
+  uint nvcsw;       // times it gave up the CPU to wait
+  uint nivcsw;      // times it was preempted or yielded
+  uint faults;      // page faults handled
+  uint inblock;     // blocks it read from disk
+  uint oublock;     // blocks it wrote to disk
+  uint ethrx;       // bytes read from eth devices
+  uint ethtx;       // bytes written to eth devices
+};
+
+struct procstat {
+  int pid;
+  int ppid;         // 0 if none
+  char state[8];    // as ^P prints it
+  int cpu;          // CPU it last ran on
+  uint sz;          // bytes of memory
+  char name[16];
+  struct rusage ru;
+};
@@ -23,6 +23,7 @@
   #define DEASSERT   0x00000000
   #define LEVEL      0x00008000    // Level triggered
   #define BCAST      0x00080000    // Send to all APICs, including self.
+  #define OTHERS     0x000C0000    // Send to all APICs, excluding self.
   #define BUSY       0x00001000
   #define FIXED      0x00000000
 #define ICRHI   (0x0310/4)    // Interrupt Command [63:32]
@@ -114,6 +115,28 @@ cpunum(void)
   return 0;
 }
 
+// Stop or restart the periodic timer interrupt of this CPU.  The
+// count goes on while the interrupt is masked.
+void
+lapictimer(int on)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, (on ? 0 : MASKED) | PERIODIC | (T_IRQ0 + IRQ_TIMER));
+}
+
+// Send interrupt vector vec to the CPU with local APIC apicid.
+void
+lapicipi(int apicid, int vec)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vec);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Acknowledge interrupt.
 void
 lapiceoi(void)
@@ -122,21 +145,23 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
-// Spin for a given number of microseconds.
-// On real hardware would want to tune this dynamically.
-void
-microdelay(int us)
+#define IO_RTC  0x70
+
+// Send the interrupt command lo to the APICs named by the
+// destination shorthand in lo, and wait for it to go out.
+static void
+lapicicr(int lo)
 {
-  // Parameter is unused on this platform; cast suppresses warning under -Wextra.
-  (void)us;
+  lapicw(ICRHI, 0);
+  lapicw(ICRLO, lo);
+  while(lapic[ICRLO] & DELIVS)
+    ;
 }
 
-#define IO_RTC  0x70
-
-// Start additional processor running bootstrap code at addr.
-// See Appendix B of MultiProcessor Specification.
+// Start all the other processors at once running bootstrap code
+// at addr.  See Appendix B of MultiProcessor Specification.
 void
-lapicstartap(uchar apicid, uint addr)
+lapicstartaps(uint addr)
 {
   int i;
   void *wrv;
@@ -154,13 +179,12 @@ lapicstartap(uchar apicid, uint addr)
   *(((volatile ushort *)wrv) + 1) = addr >> 4;
 #pragma GCC diagnostic pop
 
-  // "Universal startup algorithm."
-  // Send INIT (level-triggered) interrupt to reset other CPU.
-  lapicw(ICRHI, apicid<<24);
-  lapicw(ICRLO, INIT | LEVEL | ASSERT);
+  // "Universal startup algorithm", broadcast.
+  // Send INIT (level-triggered) interrupt to reset the other CPUs.
+  lapicicr(OTHERS | INIT | LEVEL | ASSERT);
   microdelay(200);
-  lapicw(ICRLO, INIT | LEVEL);
-  microdelay(100);    // should be 10ms, but too slow in Bochs!
+  lapicicr(OTHERS | INIT | LEVEL);
+  microdelay(10000);
   
   // Send startup IPI (twice!) to enter bootstrap code.
   // Regular hardware is supposed to only accept a STARTUP
@@ -168,8 +192,7 @@ lapicstartap(uchar apicid, uint addr)
   // should be ignored, but it is part of the official Intel algorithm.
   // Bochs complains about the second one.  Too bad for Bochs.
   for(i = 0; i < 2; i++){
-    lapicw(ICRHI, apicid<<24);
-    lapicw(ICRLO, STARTUP | (addr>>12));
+    lapicicr(OTHERS | STARTUP | (addr>>12));
     microdelay(200);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,333 @@
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+
+// Simple logging that allows concurrent FS system calls.
+//
+// A log transaction contains the updates of multiple FS system
+// calls.  The logging system only commits when there are
+// no FS system calls active.  Thus there is never
+// any reasoning required about whether a commit might
+// write an uncommitted system call's updates to disk.
+//
+// A system call should call begin_op()/end_op() to mark
+// its start and end.  Usually begin_op() just increments
+// the count of in-progress FS system calls and returns.
+// But if it thinks the log is close to running out, it
+// sleeps until the last outstanding end_op() commits.
+//
+// fs.c calls log_write() instead of bwrite() for every block it
+// changes.  The buffer stays pinned in the cache, unwritten, until
+// the commit has copied it into the log; from then on it is an
+// ordinary dirty buffer that the bio.c flusher writes home when it
+// next runs.
+//
+// The on-disk log is two headers followed by two areas of LOGSIZE
+// blocks, and commits alternate between the areas.  A header holds
+// the home sectors of the blocks in its area and the number of the
+// commit; recovery installs the valid header with the larger number.
+// Before a commit overwrites an area, every block of the commit
+// before it that the new one does not carry again is written home,
+// so the newest header always describes everything not yet home.
+//
+// The log is a physical re-do log containing disk blocks.
+// The on-disk log format:
+//   header 0, header 1, area 0 (LOGSIZE blocks), area 1 (LOGSIZE blocks)
+// Log appends are synchronous, and so is the header write that
+// makes a commit.
+
+// Contents of a header block.
+struct logheader {
+  uint seq;             // commit number
+  int n;                // 0: nothing to recover
+  int sector[LOGSIZE];
+};
+
+struct log {
+  struct spinlock lock;
+  int start;            // first sector of the log
+  int dev;
+  int outstanding;      // how many FS sys calls are executing
+  int committing;       // in commit(), or recovering at boot
+  uint seq;             // number of commit rounds finished
+  int area;             // area the next commit goes to
+  struct logheader lh;  // blocks of the open transaction
+  int nprev;            // blocks of the last commit, perhaps not home
+  int prev[LOGSIZE];
+};
+struct log log;
+
+static void recover_from_log(void);
+static void commit(void);
+
+void
+loginit(void)
+{
+  if(sizeof(struct logheader) > BSIZE)
+    panic("loginit: too big logheader");
+  initlock(&log.lock, "log");
+  // No FS system call may start before recovery is done.
+  log.committing = 1;
+}
+
+// Replay the log.  Must run in a process, since it reads the disk;
+// the first process to be scheduled calls it from forkret().
+void
+initlog(void)
+{
+  struct superblock sb;
+
+  readsb(ROOTDEV, &sb);
+  log.dev = ROOTDEV;
+  log.start = sb.size - sb.nlog;
+  recover_from_log();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Sector of block i of area a.
+static int
+logsector(int a, int i)
+{
+  return log.start + 2 + a*LOGSIZE + i;
+}
+
+static void
+read_head(int a, struct logheader *lh)
+{
+  struct buf *b;
+
+  b = bread(log.dev, log.start + a);
+  memmove(lh, b->data, sizeof(*lh));
+  brelse(b);
+}
+
+// Write lh to the header of area a.
+// This is the true point at which a transaction commits.
+static void
+write_head(int a, struct logheader *lh)
+{
+  struct buf *b;
+
+  b = bread(log.dev, log.start + a);
+  memmove(b->data, lh, sizeof(*lh));
+  bwrite(b);
+  brelse(b);
+}
+
+static void
+recover_from_log(void)
+{
+  struct logheader h[2], empty;
+  struct buf *lbuf, *dbuf;
+  int a, i;
+
+  read_head(0, &h[0]);
+  read_head(1, &h[1]);
+  a = -1;
+  if(h[0].n > 0)
+    a = 0;
+  if(h[1].n > 0 && (a < 0 || (int)(h[1].seq - h[0].seq) > 0))
+    a = 1;
+  if(a >= 0){
+    cprintf("log: recovering %d blocks\n", h[a].n);
+    for(i = 0; i < h[a].n; i++){
+      lbuf = bread(log.dev, logsector(a, i));
+      dbuf = bread(log.dev, h[a].sector[i]);
+      memmove(dbuf->data, lbuf->data, BSIZE);
+      bwrite(dbuf);
+      brelse(lbuf);
+      brelse(dbuf);
+    }
+  }
+  memset(&empty, 0, sizeof(empty));
+  if(h[0].n > 0)
+    write_head(0, &empty);
+  if(h[1].n > 0)
+    write_head(1, &empty);
+}
+
+// Called at the start of each FS system call.
+void
+begin_op(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.committing){
+      sleep(&log, &log.lock);
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+      // This op might exhaust log space; wait for commit.
+      sleep(&log, &log.lock);
+    } else {
+      log.outstanding += 1;
+      release(&log.lock);
+      break;
+    }
+  }
+}
+
+// Called at the end of each FS system call.
+// Commits if this was the last outstanding operation.
+void
+end_op(void)
+{
+  int do_commit;
+
+  do_commit = 0;
+  acquire(&log.lock);
+  log.outstanding -= 1;
+  if(log.committing)
+    panic("log.committing");
+  if(log.outstanding == 0){
+    do_commit = 1;
+    log.committing = 1;
+  } else {
+    // begin_op() may be waiting for log space.
+    wakeup(&log);
+  }
+  release(&log.lock);
+
+  if(do_commit){
+    // Call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+    acquire(&log.lock);
+    log.committing = 0;
+    log.seq++;
+    wakeup(&log);
+    release(&log.lock);
+  }
+}
+
+// Is sector in the open transaction?
+static int
+inlog(int sector)
+{
+  int i;
+
+  for(i = 0; i < log.lh.n; i++)
+    if(log.lh.sector[i] == sector)
+      return 1;
+  return 0;
+}
+
+// Write home the blocks of the last commit that this one does not
+// carry again and the flusher has not written yet, so that its area
+// can be given up.
+static void
+install_prev(void)
+{
+  struct buf *v[LOGSIZE], *b;
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < log.nprev; i++){
+    if(inlog(log.prev[i]))
+      continue;
+    b = bread(log.dev, log.prev[i]);
+    if(b->flags & B_DIRTY)
+      v[n++] = b;
+    else
+      brelse(b);
+  }
+  bwritev(v, n);
+  log.nprev = 0;
+}
+
+// Copy the blocks of the transaction from the cache into the log,
+// as one run of adjacent sectors.
+static void
+write_log(void)
+{
+  struct buf *v[LOGSIZE], *from;
+  int i;
+
+  for(i = 0; i < log.lh.n; i++){
+    v[i] = bread(log.dev, logsector(log.area, i));
+    from = bread(log.dev, log.lh.sector[i]);
+    memmove(v[i]->data, from->data, BSIZE);
+    brelse(from);
+  }
+  bwritev(v, log.lh.n);
+}
+
+static void
+commit(void)
+{
+  struct buf *b;
+  int i;
+
+  if(log.lh.n == 0)
+    return;
+  install_prev();
+  write_log();
+  log.lh.seq = log.seq + 1;
+  write_head(log.area, &log.lh);
+
+  // Committed: unpin the blocks and leave them to the flusher.
+  for(i = 0; i < log.lh.n; i++){
+    b = bread(log.dev, log.lh.sector[i]);
+    b->flags &= ~B_LOG;
+    bdwrite(b);
+    brelse(b);
+    log.prev[i] = log.lh.sector[i];
+  }
+  log.nprev = log.lh.n;
+  log.area ^= 1;
+  log.lh.n = 0;
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Record the block number and pin it in the cache until the
+// transaction commits.  log_write() replaces bwrite(); a typical
+// use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+void
+log_write(struct buf *b)
+{
+  int i;
+
+  if(log.lh.n >= LOGSIZE)
+    panic("too big a transaction");
+  if(log.outstanding < 1)
+    panic("log_write outside of trans");
+  if(b->dev != (uint)log.dev)
+    panic("log_write: not the log's device");
+
+  acquire(&log.lock);
+  for(i = 0; i < log.lh.n; i++){
+    if(log.lh.sector[i] == (int)b->sector)   // log absorption
+      break;
+  }
+  log.lh.sector[i] = b->sector;
+  if(i == log.lh.n)
+    log.lh.n++;
+  b->flags |= B_LOG;
+  release(&log.lock);
+}
+
+// Wait until every FS system call that has finished is committed.
+void
+log_force(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0 || log.committing){
+    target = log.seq + 1;
+    while((int)(log.seq - target) < 0)
+      sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
@@ -47,12 +47,21 @@ mainc(void)
   consoleinit();   // I/O devices & their interrupts
   uartinit();      // serial port
   kvmalloc();      // initialize the kernel page table
+  kcacheinit();    // kernel object caches
   pinit();         // process table
   tvinit();        // trap vectors
+  calloutinit();   // clock callouts
+  clockinit();     // nanosecond clock
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe objects
   iinit();         // inode cache
+  execinit();      // program page cache
+  shminit();       // shared memory segments
+  futexinit();     // futex wait channels
+  loginit();       // file system log; recovery waits for the first process
   ideinit();       // disk
+  netinit();       // network stack
   ethinit();       // ethernet
   if(!ismp)
     timerinit();   // uniprocessor timer
@@ -80,14 +89,22 @@ mpmain(void)
   scheduler();     // start running processes
 }
 
-// Start the non-boot processors.
+// Stacks for the non-boot processors, by local APIC ID.  A CPU
+// that finds no stack here stops in bootother.S.
+static char *apstack[256];
+
+// Start the non-boot processors, all at once.
 static void
 bootothers(void)
 {
   extern uchar _binary_bootother_start[], _binary_bootother_size[];
   uchar *code;
   struct cpu *c;
-  char *stack;
+  uint64 t0;
+
+  if(ncpu == 1)
+    return;
+  t0 = nanotime();
 
   // Write bootstrap code to unused memory at 0x7000.
   // The linker has placed the image of bootother.S in
@@ -98,20 +115,29 @@ bootothers(void)
   for(c = cpus; c < cpus+ncpu; c++){
     if(c == cpus+cpunum())  // We've started already.
       continue;
+    if((apstack[c->id] = kalloc()) == 0)
+      panic("bootothers");
+    apstack[c->id] += KSTACKSIZE;
+  }
 
-    // Tell bootother.S what stack to use and the address of mpmain;
-    // it expects to find these two addresses stored just before
-    // its first instruction.
-    stack = kalloc();
-    *(void**)(code-4) = stack + KSTACKSIZE;
-    *(void (**)(void))(code-8) = mpmain;  // Store entry point with explicit function pointer type
+  // Tell bootother.S where the stacks, mpmain and the local APIC
+  // are; it expects to find these three addresses stored just
+  // before its first instruction.
+  *(volatile uint**)(code-12) = lapic;
+  *(char***)(code-4) = apstack;
+  *(void (**)(void))(code-8) = mpmain;
 
-    lapicstartap(c->id, (uint)code);
+  lapicstartaps((uint)code);
 
-    // Wait for cpu to finish mpmain()
+  // Wait for every cpu to finish mpmain()
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == cpus+cpunum())
+      continue;
     while(c->booted == 0)
       ;
   }
+  cprintf("cpu%d: started %d cpus in %d us\n", cpu->id, ncpu - 1,
+          (uint)(nanotime() - t0) / 1000);
 }
 
 // Blank page.
\ No newline at end of file
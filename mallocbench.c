@@ -0,0 +1,103 @@
+// mallocbench: time malloc() and free().
+//
+//   mallocbench [-n ops]
+//
+// Runs ops (default 200000) operations of each pattern in clock
+// ticks, of which there are 100 a second:
+//   pair    malloc() a block of one size and free() it straight away
+//   churn   keep NLIVE blocks of random small sizes and free and
+//           replace a random one on each operation, as a parser does
+//   big     the same with sizes that go to the coalescing list
+//
+// Each run prints one line of name=value pairs, e.g.
+//   pattern=pair size=16 ops=200000 ticks=3
+
+#include "types.h"
+#include "user.h"
+
+#define NLIVE 512
+
+char *live[NLIVE];
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+usage(void)
+{
+  printf(2, "usage: mallocbench [-n ops]\n");
+  exit();
+}
+
+void
+pair(int size, int ops)
+{
+  int i, t0;
+  char *p;
+
+  t0 = uptime();
+  for(i = 0; i < ops; i++){
+    if((p = malloc(size)) == 0){
+      printf(2, "mallocbench: out of memory\n");
+      exit();
+    }
+    p[0] = i;
+    free(p);
+  }
+  printf(1, "pattern=pair size=%d ops=%d ticks=%d\n", size, ops, uptime() - t0);
+}
+
+// Free and replace random blocks of sizes from min to min+span-1.
+void
+churn(char *name, int min, int span, int ops)
+{
+  int i, k, t0;
+
+  for(k = 0; k < NLIVE; k++)
+    if((live[k] = malloc(min + rand() % span)) == 0)
+      goto oom;
+  t0 = uptime();
+  for(i = 0; i < ops; i++){
+    k = rand() % NLIVE;
+    free(live[k]);
+    if((live[k] = malloc(min + rand() % span)) == 0)
+      goto oom;
+    live[k][0] = i;
+  }
+  printf(1, "pattern=%s size=%d-%d ops=%d ticks=%d\n",
+         name, min, min + span - 1, ops, uptime() - t0);
+  for(k = 0; k < NLIVE; k++)
+    free(live[k]);
+  return;
+
+oom:
+  printf(2, "mallocbench: out of memory\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ops;
+
+  ops = 200000;
+  if(argc == 3 && strcmp(argv[1], "-n") == 0)
+    ops = atoi(argv[2]);
+  else if(argc != 1)
+    usage();
+  if(ops <= 0)
+    usage();
+
+  pair(16, ops);
+  pair(64, ops);
+  pair(200, ops);
+  pair(1000, ops);
+  churn("churn", 8, 248, ops);
+  churn("big", 300, 1700, ops / 10);
+  exit();
+}
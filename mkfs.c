@@ -9,14 +9,26 @@
 #include "types.h"
 #include "fs.h"
 #include "stat.h"
-
-int nblocks = 995;
+#include "param.h"
+
+// Build a file system image.
+//
+// The image is put together in memory and written out at the end,
+// each run of blocks holding data in one write() and each run of
+// zero blocks left as a hole.  The directory entries go first, then
+// each file's data blocks one after the other, followed by the
+// file's indirect blocks, so that each file is one run of sectors
+// on the disk for the read-ahead and multi-sector reads of the
+// kernel.
+
+int nlog = 2 + 2*LOGSIZE;  // two headers and two areas
+int nblocks;               // what is left for data
 int ninodes = 200;
-int size = 1024;
+int size = 10*1024*1024 / BSIZE;  // a 10MB image
 
 int fsfd;
+uchar *img;                // the image, size blocks
 struct superblock sb;
-char zeroes[512];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -24,11 +36,12 @@ uint freeinode = 1;
 
 void balloc(int);
 void wsect(uint, void*);
-void winode(uint, struct dinode*);
-void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
+void *sect(uint);
+struct dinode *dinode(uint);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void ifile(uint inum, int fd);
+void flush(void);
 
 // convert to intel byte order
 ushort
@@ -56,41 +69,46 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
+  int i, fd;
+  char *name;
+  uint rootino, off;
+  uint inums[argc];
   struct dirent de;
-  char buf[512];
-  struct dinode din;
+  char buf[BSIZE];
+  struct dinode *dip;
 
   if(argc < 2){
     fprintf(stderr, "Usage: mkfs fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
     perror(argv[1]);
     exit(1);
   }
+  if((img = calloc(size, BSIZE)) == 0){
+    perror("calloc");
+    exit(1);
+  }
 
-  sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
-  sb.ninodes = xint(ninodes);
-
-  bitblocks = size/(512*8) + 1;
+  bitblocks = size/BPB + 1;
   usedblocks = ninodes / IPB + 3 + bitblocks;
   freeblock = usedblocks;
+  nblocks = size - usedblocks - nlog;
 
-  printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
+  sb.size = xint(size);
+  sb.nblocks = xint(nblocks); // so whole disk is size sectors
+  sb.ninodes = xint(ninodes);
+  sb.nlog = xint(nlog);
 
-  assert(nblocks + usedblocks == size);
+  printf("used %d (bit %d ninode %zu) free %u log %d total %d\n", usedblocks,
+         bitblocks, ninodes/IPB + 1, freeblock, nlog, nblocks+usedblocks+nlog);
 
-  for(i = 0; i < nblocks + usedblocks; i++)
-    wsect(i, zeroes);
+  assert(nblocks + usedblocks + nlog == size);
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -109,183 +127,233 @@ main(int argc, char *argv[])
   strcpy(de.name, "..");
   iappend(rootino, &de, sizeof(de));
 
+  // All the directory entries first, so the root directory is
+  // contiguous too.
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
 
-    if((fd = open(argv[i], 0)) < 0){
-      perror(argv[i]);
-      exit(1);
-    }
-    
     // Skip leading _ in name when writing to file system.
     // The binaries are named _rm, _cat, etc. to keep the
     // build operating system from trying to execute them
     // in place of system binaries like rm and cat.
-    if(argv[i][0] == '_')
-      ++argv[i];
+    name = argv[i];
+    if(name[0] == '_')
+      ++name;
 
-    inum = ialloc(T_FILE);
+    inums[i] = ialloc(T_FILE);
 
     bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
+    de.inum = xshort(inums[i]);
+    strncpy(de.name, name, DIRSIZ);
     de.name[DIRSIZ-1] = '\0';
     iappend(rootino, &de, sizeof(de));
-
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
-
-    close(fd);
   }
 
   // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
+  dip = dinode(rootino);
+  off = xint(dip->size);
   off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dip->size = xint(off);
+
+  for(i = 2; i < argc; i++){
+    if((fd = open(argv[i], 0)) < 0){
+      perror(argv[i]);
+      exit(1);
+    }
+    ifile(inums[i], fd);
+    close(fd);
+  }
 
   balloc(usedblocks);
+  flush();
 
   exit(0);
 }
 
+// The image's copy of sector sec.
+void*
+sect(uint sec)
+{
+  assert(sec < (uint)size);
+  return img + sec * BSIZE;
+}
+
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, 512) != 512){
-    perror("write");
-    exit(1);
-  }
+  memmove(sect(sec), buf, BSIZE);
 }
 
-uint
-i2b(uint inum)
+int
+iszero(uint sec)
 {
-  return (inum / IPB) + 2;
+  uint *p, *e;
+
+  p = sect(sec);
+  for(e = p + BSIZE/sizeof(uint); p < e; p++)
+    if(*p)
+      return 0;
+  return 1;
 }
 
+// Write the image out: each run of sectors that hold data with one
+// write(), skipping over runs of zeroes, which read back as zeroes
+// from the holes left in the file.
 void
-winode(uint inum, struct dinode *ip)
+flush(void)
 {
-  char buf[512];
-  uint bn;
-  struct dinode *dip;
+  uint sec, end;
+  ssize_t n;
 
-  bn = i2b(inum);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
-  wsect(bn, buf);
+  for(sec = 0; sec < (uint)size; sec = end){
+    if(iszero(sec)){
+      end = sec + 1;
+      continue;
+    }
+    for(end = sec + 1; end < (uint)size && !iszero(end); end++)
+      ;
+    n = (end - sec) * BSIZE;
+    if(pwrite(fsfd, sect(sec), n, (off_t)sec * BSIZE) != n){
+      perror("write");
+      exit(1);
+    }
+  }
+  if(ftruncate(fsfd, (off_t)size * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
 }
 
-void
-rinode(uint inum, struct dinode *ip)
+uint
+i2b(uint inum)
 {
-  char buf[512];
-  uint bn;
-  struct dinode *dip;
-
-  bn = i2b(inum);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
+  return (inum / IPB) + 2;
 }
 
-void
-rsect(uint sec, void *buf)
+// The image's copy of inode inum.
+struct dinode*
+dinode(uint inum)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, 512) != 512){
-    perror("read");
-    exit(1);
-  }
+  return (struct dinode*)sect(i2b(inum)) + (inum % IPB);
 }
 
 uint
 ialloc(ushort type)
 {
   uint inum = freeinode++;
-  struct dinode din;
+  struct dinode *dip;
 
-  bzero(&din, sizeof(din));
-  din.type = xshort(type);
-  din.nlink = xshort(1);
-  din.size = xint(0);
-  winode(inum, &din);
+  assert(inum < (uint)ninodes);
+  dip = dinode(inum);
+  bzero(dip, sizeof(*dip));
+  dip->type = xshort(type);
+  dip->nlink = xshort(1);
+  dip->size = xint(0);
   return inum;
 }
 
+// Take the next free data block.
+uint
+newblock(void)
+{
+  assert(freeblock < (uint)(size - nlog));
+  usedblocks++;
+  return freeblock++;
+}
+
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar *bitmap;
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < (int)(bitblocks*BPB));
   for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bitmap = sect(BBLOCK(i, ninodes));
+    bitmap[(i%BPB)/8] |= 0x1 << (i%8);
   }
   printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
-  wsect(ninodes / IPB + 3, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Entry i of the indirect block at *ind, allocating the indirect
+// block as needed.
+uint*
+indirect(uint *ind, uint i)
+{
+  if(xint(*ind) == 0)
+    *ind = xint(newblock());
+  return (uint*)sect(xint(*ind)) + i;
+}
+
+// The address of file block fbn in dip, allocating indirect blocks
+// as needed but not the block itself.
+uint*
+bslot(struct dinode *dip, uint fbn)
+{
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT)
+    return &dip->addrs[fbn];
+  fbn -= NDIRECT;
+  if(fbn < NINDIRECT)
+    return indirect(&dip->addrs[NDIRECT], fbn);
+  fbn -= NINDIRECT;
+  return indirect(indirect(&dip->addrs[NDIRECT+1], fbn / NINDIRECT),
+                  fbn % NINDIRECT);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
-  struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
-  uint x;
-
-  rinode(inum, &din);
+  struct dinode *dip;
+  uint *a;
 
-  off = xint(din.size);
+  dip = dinode(inum);
+  off = xint(dip->size);
   while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
-      }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
-    n1 = min(n, (fbn + 1) * 512 - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
-    wsect(x, buf);
+    fbn = off / BSIZE;
+    a = bslot(dip, fbn);
+    if(xint(*a) == 0)
+      *a = xint(newblock());
+    n1 = min(n, (fbn + 1) * BSIZE - off);
+    bcopy(p, (char*)sect(xint(*a)) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
   }
-  din.size = xint(off);
-  winode(inum, &din);
+  dip->size = xint(off);
+}
+
+// Fill the empty file inum with the contents of fd: its data in one
+// run of blocks, then its indirect blocks.
+void
+ifile(uint inum, int fd)
+{
+  struct dinode *dip;
+  uint fbn, first, nb;
+  off_t n;
+
+  dip = dinode(inum);
+  assert(xint(dip->size) == 0);
+  if((n = lseek(fd, 0, SEEK_END)) < 0){
+    perror("lseek");
+    exit(1);
+  }
+  nb = (n + BSIZE - 1) / BSIZE;
+  assert(nb <= MAXFILE);
+  assert(freeblock + nb <= (uint)(size - nlog));
+  first = freeblock;
+  freeblock += nb;
+  usedblocks += nb;
+  if(pread(fd, sect(first), n, 0) != n){
+    perror("read");
+    exit(1);
+  }
+  for(fbn = 0; fbn < nb; fbn++)
+    *bslot(dip, fbn) = xint(first + fbn);
+  dip->size = xint(n);
 }
@@ -37,6 +37,15 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+// Control Register 4 flags
+#define CR4_PSE		0x00000010	// Page size extension
+#define CR4_OSFXSR	0x00000200	// SSE instructions and fxsave
+
+// Model-specific registers for sysenter
+#define MSR_SYSENTER_CS		0x174
+#define MSR_SYSENTER_ESP	0x175
+#define MSR_SYSENTER_EIP	0x176
+
 // Segment Descriptor
 struct segdesc {
   uint lim_15_0 : 16;  // Low bits of segment limit
@@ -117,6 +126,8 @@ struct segdesc {
 #define PGSIZE		4096		// bytes mapped by a page
 #define PGSHIFT		12		// log2(PGSIZE)
 
+#define PTSIZE		(PGSIZE*NPTENTRIES)	// bytes mapped by a page directory entry
+
 #define PTXSHIFT	12		// offset of PTX in a linear address
 #define PDXSHIFT	22		// offset of PDX in a linear address
 
@@ -133,6 +144,9 @@ struct segdesc {
 #define PTE_D		0x040	// Dirty
 #define PTE_PS		0x080	// Page Size
 #define PTE_MBZ		0x180	// Bits must be zero
+#define PTE_S		0x200	// Shared: page owned elsewhere (software bit)
+#define PTE_COW		0x400	// Copy-on-write (software bit)
+#define PTE_SHM		0x800	// Shared memory segment page (software bit)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)	((uint)(pte) & ~0xFFF)
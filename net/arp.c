@@ -0,0 +1,222 @@
+// Address resolution (RFC 826) and the neighbor cache.
+//
+// The cache is a fixed table of NARPSET sets of NARPWAY entries,
+// indexed by a hash of the IPv4 address.  Entries age out after
+// ARP_TIMEOUT ticks and are then resolved again on next use.
+// Packets sent to a neighbor whose address is still being resolved
+// wait in its entry and are all sent when the reply arrives.
+
+#include "../types.h"
+#include "../defs.h"
+#include "../spinlock.h"
+#include "net.h"
+#include "inet.h"
+
+#define NARPSET       16
+#define NARPWAY       4
+#define ARP_PENDING   4       // packets held per unresolved entry
+#define ARP_TIMEOUT   (60*100)  // ticks a resolved entry stays valid
+#define ARP_RETRY     100     // ticks between requests for one address
+#define ARP_MAXTRY    5       // requests before giving up
+
+enum { ARP_FREE, ARP_WAIT, ARP_DONE };
+
+struct arpent {
+  int state;
+  struct netif *nif;
+  uchar ip[4];
+  uchar mac[6];
+  uint stamp;           // ticks at resolution, or at the last request
+  int tries;            // requests sent while waiting
+  uchar *pend[ARP_PENDING];  // kmalloc()ed frames waiting for mac
+  int pendlen[ARP_PENDING];
+  int npend;
+};
+
+struct {
+  struct spinlock lock;
+  struct arpent ent[NARPSET][NARPWAY];
+} arptab;
+
+void
+arpinit(void)
+{
+  initlock(&arptab.lock, "arp");
+}
+
+static struct arpent*
+arpset(uchar *ip)
+{
+  return arptab.ent[(ip[2] ^ ip[3]) % NARPSET];
+}
+
+// Find the entry for ip on nif, or claim one for it if create is
+// set: a free way, else the stalest.  Frames still pending on an
+// evicted entry are handed back through *drop so that the caller
+// can free them outside the lock.  Caller must hold arptab.lock.
+static struct arpent*
+arplookup(struct netif *nif, uchar *ip, int create, struct arpent *drop)
+{
+  struct arpent *set, *e, *victim;
+
+  set = arpset(ip);
+  victim = 0;
+  for(e = set; e < &set[NARPWAY]; e++){
+    if(e->state != ARP_FREE && e->nif == nif && memcmp(e->ip, ip, 4) == 0)
+      return e;
+    if(victim == 0 || e->state == ARP_FREE ||
+       (victim->state != ARP_FREE && e->stamp - victim->stamp > (uint)0x80000000))
+      victim = e;
+  }
+  if(!create)
+    return 0;
+  e = victim;
+  *drop = *e;
+  memset(e, 0, sizeof(*e));
+  e->nif = nif;
+  memmove(e->ip, ip, 4);
+  return e;
+}
+
+// Free the frames left in an evicted or failed entry.
+static void
+arpfree(struct arpent *e)
+{
+  int i;
+
+  for(i = 0; i < e->npend; i++)
+    kmfree(e->pend[i]);
+}
+
+// Send an ARP packet of type op to tha/tpa (tha 0 for broadcast).
+static void
+arpsend(struct netif *nif, int op, uchar *tha, uchar *tpa)
+{
+  uchar frame[sizeof(eth_hdr_t) + sizeof(arp_hdr_t)];
+  eth_hdr_t *eh;
+  arp_hdr_t *ah;
+
+  eh = (eth_hdr_t*)frame;
+  ah = (arp_hdr_t*)(eh + 1);
+  if(tha)
+    memmove(eh->dst, tha, 6);
+  else
+    memset(eh->dst, 0xFF, 6);
+  memmove(eh->src, nif->mac, 6);
+  eh->length = htons(ETH_TYPE_ARP);
+  ah->htype = htons(ARP_HTYPE_ETH);
+  ah->ptype = htons(ETH_TYPE_IP4);
+  ah->hlen = 6;
+  ah->plen = 4;
+  ah->op = htons(op);
+  memmove(ah->sha, nif->mac, 6);
+  memmove(ah->spa, nif->ip, 4);
+  if(tha)
+    memmove(ah->tha, tha, 6);
+  else
+    memset(ah->tha, 0, 6);
+  memmove(ah->tpa, tpa, 4);
+  nif->xmit(nif, frame, sizeof(frame));
+}
+
+// Send the Ethernet frame in pkt, len bytes, to the neighbor hop.
+// The link header is complete but for the destination address.
+// If hop is not resolved yet the frame is copied into a pending
+// queue and goes out when the reply arrives.  Returns 0 or -1.
+int
+arp_output(struct netif *nif, uchar *hop, uchar *pkt, int len)
+{
+  struct arpent *e, old;
+  uchar *copy;
+  int ask, r;
+
+  old.npend = 0;
+  acquire(&arptab.lock);
+  e = arplookup(nif, hop, 1, &old);
+  if(e->state == ARP_DONE && ticks - e->stamp < ARP_TIMEOUT){
+    memmove(((eth_hdr_t*)pkt)->dst, e->mac, 6);
+    release(&arptab.lock);
+    arpfree(&old);
+    return nif->xmit(nif, pkt, len) > 0 ? 0 : -1;
+  }
+
+  // Unknown or stale: queue the frame and ask, at most once per
+  // ARP_RETRY ticks, until ARP_MAXTRY requests have gone unanswered.
+  if(e->state != ARP_WAIT){
+    e->state = ARP_WAIT;
+    e->tries = 0;
+    e->stamp = ticks - ARP_RETRY;
+  }
+  if(e->tries >= ARP_MAXTRY && ticks - e->stamp >= ARP_RETRY){
+    // Unreachable: drop what waited and start over.
+    old = *e;
+    e->npend = 0;
+    e->tries = 0;
+  }
+  r = -1;
+  if(e->npend < ARP_PENDING && (copy = kmalloc(len)) != 0){
+    memmove(copy, pkt, len);
+    e->pend[e->npend] = copy;
+    e->pendlen[e->npend++] = len;
+    r = 0;
+  }
+  ask = ticks - e->stamp >= ARP_RETRY;
+  if(ask){
+    e->stamp = ticks;
+    e->tries++;
+  }
+  release(&arptab.lock);
+  arpfree(&old);
+  if(ask)
+    arpsend(nif, ARP_OP_REQUEST, 0, hop);
+  return r;
+}
+
+// Handle an ARP packet: learn the sender, answer requests for our
+// address and release frames that waited for the sender's address.
+// Returns 1 if the packet was for us.
+int
+arp_input(struct netif *nif, uchar *pkt, int len)
+{
+  struct arpent *e, old;
+  arp_hdr_t *ah;
+  uchar *pend[ARP_PENDING];
+  int pendlen[ARP_PENDING];
+  int i, n, forus;
+
+  if(len < (int)sizeof(arp_hdr_t))
+    return 0;
+  ah = (arp_hdr_t*)pkt;
+  if(ntohs(ah->htype) != ARP_HTYPE_ETH || ntohs(ah->ptype) != ETH_TYPE_IP4 ||
+     ah->hlen != 6 || ah->plen != 4)
+    return 0;
+  forus = memcmp(ah->tpa, nif->ip, 4) == 0;
+
+  // RFC 826: update the sender if we know it, add it if the
+  // packet is for us.
+  old.npend = 0;
+  n = 0;
+  acquire(&arptab.lock);
+  if((e = arplookup(nif, ah->spa, forus, &old)) != 0){
+    memmove(e->mac, ah->sha, 6);
+    e->state = ARP_DONE;
+    e->stamp = ticks;
+    e->tries = 0;
+    for(n = 0; n < e->npend; n++){
+      pend[n] = e->pend[n];
+      pendlen[n] = e->pendlen[n];
+    }
+    e->npend = 0;
+  }
+  release(&arptab.lock);
+  arpfree(&old);
+
+  for(i = 0; i < n; i++){
+    memmove(((eth_hdr_t*)pend[i])->dst, ah->sha, 6);
+    nif->xmit(nif, pend[i], pendlen[i]);
+    kmfree(pend[i]);
+  }
+  if(forus && ntohs(ah->op) == ARP_OP_REQUEST)
+    arpsend(nif, ARP_OP_REPLY, ah->sha, ah->spa);
+  return forus;
+}
@@ -0,0 +1,423 @@
+// DHCP client (RFC 2131).
+//
+// dhcpstart() begins address configuration on an interface and a
+// callout drives the rest through dhcptimer(): DISCOVER until an offer
+// arrives, REQUEST until it is acknowledged, then renewal with the
+// server at T1, with anyone at T2, and loss of the address when the
+// lease runs out.  Unanswered messages are resent with exponential
+// backoff.  The lease is stored with netifconfig(); no process waits
+// for any of it.
+
+#include "../types.h"
+#include "../defs.h"
+#include "../spinlock.h"
+#include "../callout.h"
+#include "net.h"
+#include "inet.h"
+
+#define DHCP_RETRY     (4*100)   // ticks before the first resend
+#define DHCP_RETRYMAX  (64*100)
+#define DHCP_MAXREQ    4         // REQUESTs before starting over
+#define DHCP_MAXLEASE  (30*24*3600)  // seconds; keeps ticks in range
+
+enum { DHCP_OFF, DHCP_INIT, DHCP_SELECTING, DHCP_REQUESTING, DHCP_BOUND,
+       DHCP_RENEWING, DHCP_REBINDING };
+
+struct dhcpc {
+  struct netif *nif;    // 0 if the slot is free
+  int state;
+  u32_t xid;
+  uint start;           // ticks when the exchange began
+  uint next;            // ticks the next resend is due, 0 if none
+  uint backoff;         // ticks until the resend after that
+  int tries;            // REQUESTs sent for the current offer
+  uchar addr[4];        // offered or leased address
+  uchar server[4];
+  uint t1, t2, expire;  // ticks; 0 for an infinite lease
+};
+
+struct {
+  struct spinlock lock;
+  struct dhcpc c[NNETIF];
+  uchar pkt[NET_HDRSPACE + sizeof(udp_hdr_t) + sizeof(dhcp_t)];
+  struct callout timer;     // runs dhcptimer()
+} dhcptab;
+
+static uchar bcast[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+static uchar zero[4];
+
+static void dhcptimer(void*);
+
+void
+dhcpinit(void)
+{
+  initlock(&dhcptab.lock, "dhcp");
+  callinit(&dhcptab.timer, dhcptimer, 0);
+}
+
+static int
+due(uint t)
+{
+  return t != 0 && (int)(ticks - t) >= 0;
+}
+
+// Have dhcptimer() run when the next timer that any client's state
+// waits for is due.  Caller must hold dhcptab.lock.
+static void
+dhcparm(void)
+{
+  struct dhcpc *c;
+
+  for(c = dhcptab.c; c < &dhcptab.c[NNETIF]; c++){
+    if(c->nif == 0)
+      continue;
+    if(c->next)
+      callsooner(&dhcptab.timer, c->next);
+    if(c->state == DHCP_BOUND && c->t1)
+      callsooner(&dhcptab.timer, c->t1);
+    if(c->state == DHCP_RENEWING && c->t2)
+      callsooner(&dhcptab.timer, c->t2);
+    if(c->state >= DHCP_RENEWING && c->expire)
+      callsooner(&dhcptab.timer, c->expire);
+  }
+}
+
+// The client for nif, or a new one if create is set.
+// Caller must hold dhcptab.lock.
+static struct dhcpc*
+dhcpfind(struct netif *nif, int create)
+{
+  struct dhcpc *c, *free;
+
+  free = 0;
+  for(c = dhcptab.c; c < &dhcptab.c[NNETIF]; c++){
+    if(c->nif == nif)
+      return c;
+    if(c->nif == 0 && free == 0)
+      free = c;
+  }
+  if(!create || free == 0)
+    return 0;
+  memset(free, 0, sizeof(*free));
+  free->nif = nif;
+  return free;
+}
+
+// Send a message of the given type for c.
+static void
+dhcpsend(struct dhcpc *c, int type)
+{
+  struct netif *nif;
+  ip4_hdr_t *ip;
+  udp_hdr_t *udp;
+  dhcp_t *d;
+  uchar *o, hop[4];
+  int bound;
+
+  nif = c->nif;
+  bound = c->state >= DHCP_BOUND;
+  memset(dhcptab.pkt, 0, sizeof(dhcptab.pkt));
+  ip = NET_IP(dhcptab.pkt);
+  udp = (udp_hdr_t*)(dhcptab.pkt + NET_HDRSPACE);
+  d = (dhcp_t*)(udp + 1);
+
+  d->op = DHCP_OP_BOOTREQUEST;
+  d->htype = DHCP_HTYPE_ETH;
+  d->hlen = DHCP_HLEN_ETH;
+  d->xid = htonl(c->xid);
+  d->secs = htons((ticks - c->start) / 100);
+  if(!bound)
+    d->flags = htons(DHCP_FLAGS_BCAST);   // we cannot take unicast yet
+  else
+    memmove(d->ciaddr, nif->ip, 4);
+  memmove(d->chaddr, nif->mac, 6);
+  d->magic = htonl(DHCP_MAGIC);
+
+  o = d->options;
+  *o++ = DHCP_TAG_TYPE; *o++ = 1; *o++ = type;
+  *o++ = DHCP_TAG_CLIENTID; *o++ = 7; *o++ = DHCP_HTYPE_ETH;
+  memmove(o, nif->mac, 6);
+  o += 6;
+  if(type == DHCP_REQUEST && c->state == DHCP_REQUESTING){
+    *o++ = DHCP_TAG_REQIP; *o++ = 4;
+    memmove(o, c->addr, 4);
+    o += 4;
+  }
+  if((type == DHCP_REQUEST && c->state == DHCP_REQUESTING) ||
+     type == DHCP_RELEASE){
+    *o++ = DHCP_TAG_SERVERID; *o++ = 4;
+    memmove(o, c->server, 4);
+    o += 4;
+  }
+  if(type != DHCP_RELEASE){
+    *o++ = DHCP_TAG_REQPAR; *o++ = 3;
+    *o++ = DHCP_TAG_SUBNET; *o++ = DHCP_TAG_ROUTER; *o++ = DHCP_TAG_LEASE;
+  }
+  *o = DHCP_TAG_END;
+
+  // Renewal and release go to the server, the rest to everyone.
+  memmove(ip->src, bound ? nif->ip : zero, 4);
+  if((c->state == DHCP_RENEWING || type == DHCP_RELEASE) &&
+     ip_route(c->server, hop) == nif){
+    memmove(ip->dst, c->server, 4);
+  } else {
+    memmove(ip->dst, bcast, 4);
+    memmove(hop, bcast, 4);
+  }
+  ip->protocol = IP_PROTOCOL_UDP;
+  udp->src = htons(UDP_PORT_BOOTPC);
+  udp->dst = htons(UDP_PORT_BOOTPS);
+  udp->length = htons(sizeof(*udp) + sizeof(*d));
+  udp_checksum(ip, udp, (u16_t*)d);
+  ip_output(nif, hop, dhcptab.pkt, sizeof(*udp) + sizeof(*d), IP_PROTOCOL_UDP);
+}
+
+// Send and schedule the resend with backoff, plus up to a second
+// of jitter so that a rack of machines does not answer in step.
+static void
+dhcpretry(struct dhcpc *c, int type)
+{
+  dhcpsend(c, type);
+  c->next = ticks + c->backoff + (c->xid ^ ticks) % 100;
+  c->backoff *= 2;
+  if(c->backoff > DHCP_RETRYMAX)
+    c->backoff = DHCP_RETRYMAX;
+}
+
+// Begin again with a DISCOVER.
+static void
+dhcpdiscover(struct dhcpc *c)
+{
+  struct netif *nif;
+
+  nif = c->nif;
+  c->xid = ((nif->mac[2] << 24) | (nif->mac[3] << 16) |
+            (nif->mac[4] << 8) | nif->mac[5]) ^ (c->xid + ticks) * 2654435761U;
+  c->state = DHCP_SELECTING;
+  c->start = ticks;
+  c->backoff = DHCP_RETRY;
+  c->t1 = c->t2 = c->expire = 0;
+  dhcpretry(c, DHCP_DISCOVER);
+}
+
+// Configure nif on the interface's behalf at the next tick.
+void
+dhcpstart(struct netif *nif)
+{
+  struct dhcpc *c;
+
+  acquire(&dhcptab.lock);
+  if((c = dhcpfind(nif, 1)) != 0 && c->state == DHCP_OFF){
+    c->state = DHCP_INIT;
+    c->next = ticks + 1;
+    nif->dhcp = 1;
+    dhcparm();
+  }
+  release(&dhcptab.lock);
+}
+
+// Stop configuring nif, giving up any lease.  The caller sets the
+// address it wants afterwards.
+void
+dhcpstop(struct netif *nif)
+{
+  struct dhcpc *c;
+
+  acquire(&dhcptab.lock);
+  if((c = dhcpfind(nif, 0)) != 0){
+    if(c->state >= DHCP_BOUND)
+      dhcpsend(c, DHCP_RELEASE);
+    c->nif = 0;
+    nif->dhcp = 0;
+  }
+  release(&dhcptab.lock);
+}
+
+// Drive every client's retries and lease timers that are due.
+static void
+dhcptimer(void *arg)
+{
+  struct dhcpc *c;
+
+  (void)arg;
+  acquire(&dhcptab.lock);
+  for(c = dhcptab.c; c < &dhcptab.c[NNETIF]; c++){
+    if(c->nif == 0)
+      continue;
+    switch(c->state){
+    case DHCP_INIT:
+      if(due(c->next))
+        dhcpdiscover(c);
+      break;
+    case DHCP_SELECTING:
+      if(due(c->next))
+        dhcpretry(c, DHCP_DISCOVER);
+      break;
+    case DHCP_REQUESTING:
+      if(due(c->next)){
+        if(++c->tries > DHCP_MAXREQ)
+          dhcpdiscover(c);
+        else
+          dhcpretry(c, DHCP_REQUEST);
+      }
+      break;
+    case DHCP_BOUND:
+      if(due(c->t1)){
+        c->state = DHCP_RENEWING;
+        c->backoff = DHCP_RETRY;
+        dhcpretry(c, DHCP_REQUEST);
+      }
+      break;
+    case DHCP_RENEWING:
+    case DHCP_REBINDING:
+      if(due(c->expire)){
+        cprintf("%s: DHCP lease expired\n", c->nif->name);
+        netifconfig(c->nif, zero, zero, zero);
+        dhcpdiscover(c);
+      } else if(c->state == DHCP_RENEWING && due(c->t2)){
+        c->state = DHCP_REBINDING;
+        c->backoff = DHCP_RETRY;
+        dhcpretry(c, DHCP_REQUEST);
+      } else if(due(c->next)){
+        dhcpretry(c, DHCP_REQUEST);
+      }
+      break;
+    }
+  }
+  dhcparm();
+  release(&dhcptab.lock);
+}
+
+static u32_t
+getl(uchar *p)
+{
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Take the lease in ACK d.  Caller must hold dhcptab.lock.
+static void
+dhcpbind(struct dhcpc *c, dhcp_t *d, uchar *mask, uchar *router,
+         u32_t lease, u32_t t1, u32_t t2)
+{
+  struct netif *nif;
+
+  nif = c->nif;
+  memmove(c->addr, d->yiaddr, 4);
+  netifconfig(nif, c->addr, mask, router);
+  c->state = DHCP_BOUND;
+  c->next = 0;
+  if(lease == 0xFFFFFFFF){
+    c->t1 = c->t2 = c->expire = 0;
+  } else {
+    if(lease > DHCP_MAXLEASE)
+      lease = DHCP_MAXLEASE;
+    if(t1 == 0 || t1 >= lease)
+      t1 = lease / 2;
+    if(t2 == 0 || t2 >= lease || t2 < t1)
+      t2 = lease / 8 * 7;
+    c->t1 = ticks + t1 * 100 + 1;
+    c->t2 = ticks + t2 * 100 + 1;
+    c->expire = ticks + lease * 100 + 1;
+  }
+  cprintf("%s: DHCP address %d.%d.%d.%d lease %d s\n", nif->name,
+          c->addr[0], c->addr[1], c->addr[2], c->addr[3], lease);
+}
+
+// Handle a DHCP message of len bytes at pkt arriving on nif.
+// Returns 1 if it answered one of our requests.
+int
+dhcp_input(struct netif *nif, uchar *pkt, int len)
+{
+  struct dhcpc *c;
+  dhcp_t *d;
+  uchar *o, *e, mask[4], router[4], server[4];
+  u32_t lease, t1, t2;
+  int type;
+
+  if(len < (int)(sizeof(dhcp_t) - sizeof(d->options)))
+    return 0;
+  d = (dhcp_t*)pkt;
+  if(d->op != DHCP_OP_BOOTREPLY || d->magic != htonl(DHCP_MAGIC) ||
+     memcmp(d->chaddr, nif->mac, 6) != 0)
+    return 0;
+
+  type = 0;
+  lease = t1 = t2 = 0;
+  memset(mask, 0, 4);
+  memset(router, 0, 4);
+  memset(server, 0, 4);
+  o = d->options;
+  e = pkt + len;
+  while(o < e && *o != DHCP_TAG_END){
+    if(*o == DHCP_TAG_PAD){
+      o++;
+      continue;
+    }
+    if(o + 2 > e || o + 2 + o[1] > e)
+      break;
+    switch(o[0]){
+    case DHCP_TAG_TYPE:
+      if(o[1] >= 1)
+        type = o[2];
+      break;
+    case DHCP_TAG_SUBNET:
+      if(o[1] >= 4)
+        memmove(mask, o + 2, 4);
+      break;
+    case DHCP_TAG_ROUTER:
+      if(o[1] >= 4)
+        memmove(router, o + 2, 4);
+      break;
+    case DHCP_TAG_SERVERID:
+      if(o[1] >= 4)
+        memmove(server, o + 2, 4);
+      break;
+    case DHCP_TAG_LEASE:
+      if(o[1] >= 4)
+        lease = getl(o + 2);
+      break;
+    case DHCP_TAG_T1:
+      if(o[1] >= 4)
+        t1 = getl(o + 2);
+      break;
+    case DHCP_TAG_T2:
+      if(o[1] >= 4)
+        t2 = getl(o + 2);
+      break;
+    }
+    o += 2 + o[1];
+  }
+
+  acquire(&dhcptab.lock);
+  if((c = dhcpfind(nif, 0)) == 0 || ntohl(d->xid) != c->xid){
+    release(&dhcptab.lock);
+    return 0;
+  }
+  switch(type){
+  case DHCP_OFFER:
+    if(c->state == DHCP_SELECTING){
+      memmove(c->addr, d->yiaddr, 4);
+      memmove(c->server, server, 4);
+      c->state = DHCP_REQUESTING;
+      c->tries = 0;
+      c->backoff = DHCP_RETRY;
+      dhcpretry(c, DHCP_REQUEST);
+    }
+    break;
+  case DHCP_ACK:
+    if(c->state == DHCP_REQUESTING || c->state == DHCP_RENEWING ||
+       c->state == DHCP_REBINDING)
+      dhcpbind(c, d, mask, router, lease ? lease : 0xFFFFFFFF, t1, t2);
+    break;
+  case DHCP_NAK:
+    if(c->state >= DHCP_REQUESTING && c->state != DHCP_BOUND){
+      if(c->state != DHCP_REQUESTING)
+        netifconfig(nif, zero, zero, zero);
+      dhcpdiscover(c);
+    }
+    break;
+  }
+  dhcparm();
+  release(&dhcptab.lock);
+  return 1;
+}
@@ -0,0 +1,50 @@
+// ICMP.
+//
+// Echo requests are answered here, in the receive path, so that
+// ping measures the network rather than the scheduler.  The request
+// frame is turned into the reply in place: addresses are swapped,
+// which leaves both checksums unchanged, and the fields that do
+// change are patched incrementally.
+
+#include "../types.h"
+#include "../defs.h"
+#include "net.h"
+#include "inet.h"
+
+// Handle the ICMP message of len bytes at pkt, carried in ip.
+// Returns 1 if it was consumed.
+int
+icmp_input(struct netif *nif, ip4_hdr_t *ip, uchar *pkt, int len)
+{
+  icmp_hdr_t *icmp;
+  eth_hdr_t *eh;
+  u16_t old;
+
+  if(len < (int)sizeof(icmp_hdr_t))
+    return 0;
+  icmp = (icmp_hdr_t*)pkt;
+  if(icmp->type != ICMP_ECHO_REQUEST || icmp->code != 0)
+    return 0;
+  // Broadcast pings are left to raw readers.
+  if(memcmp(ip->dst, nif->ip, 4) != 0)
+    return 0;
+  if(inet_checksum(icmp, len) != 0)
+    return 1;
+
+  old = *(u16_t*)&icmp->type;
+  icmp->type = ICMP_ECHO_REPLY;
+  icmp->checksum = csum_update16(icmp->checksum, old, *(u16_t*)&icmp->type);
+
+  memmove(ip->dst, ip->src, 4);
+  memmove(ip->src, nif->ip, 4);
+  old = *(u16_t*)&ip->ttl;
+  ip->ttl = 64;
+  ip->checksum = csum_update16(ip->checksum, old, *(u16_t*)&ip->ttl);
+
+  // Answer on the link the request came from.
+  eh = (eth_hdr_t*)((uchar*)ip - sizeof(eth_hdr_t));
+  memmove(eh->dst, eh->src, 6);
+  memmove(eh->src, nif->mac, 6);
+  nif->xmit(nif, (uchar*)eh, (pkt - (uchar*)eh) + len);
+  return 1;
+}
@@ -0,0 +1,76 @@
+#ifndef NET_INET_H
+#define NET_INET_H
+
+// Kernel side of the network stack.  Include after ../types.h and net.h.
+
+#define NNETIF        4   // maximum number of network interfaces
+
+struct sockaddr_in;
+struct tcpcb;
+
+// A network interface.  Drivers register one per device with
+// netifadd() and hand every received frame to netinput().
+struct netif {
+  char name[8];
+  int up;                 // has an address; the stack uses it
+  int dhcp;               // DHCP client running; take its replies while down
+  int loopback;           // frames sent come back in; no ARP
+  uchar mac[6];
+  uchar ip[4];
+  uchar mask[4];
+  uchar gw[4];            // default gateway, 0.0.0.0 if none
+  // Queue a frame for transmission without sleeping.
+  // Returns the frame size, 0 if the device queue is full, -1 on error.
+  int (*xmit)(struct netif*, uchar*, int);
+  void *dev;              // driver state
+};
+
+// Outgoing packets are built in a kalloc()ed page with room for the
+// link and IP headers in front of the transport header.
+#define NET_HDRSPACE  (sizeof(eth_hdr_t) + sizeof(ip4_hdr_t))
+#define NET_IP(pkt)   ((ip4_hdr_t*)((uchar*)(pkt) + sizeof(eth_hdr_t)))
+#define NET_MTU       (ETH_MAX_SIZE - sizeof(eth_hdr_t))
+
+// dhcp.c
+void            dhcpinit(void);
+void            dhcpstart(struct netif*);
+void            dhcpstop(struct netif*);
+int             dhcp_input(struct netif*, uchar*, int);
+
+// arp.c
+void            arpinit(void);
+int             arp_output(struct netif*, uchar*, uchar*, int);
+int             arp_input(struct netif*, uchar*, int);
+
+// icmp.c
+int             icmp_input(struct netif*, ip4_hdr_t*, uchar*, int);
+
+// ip.c
+struct netif*   netifadd(char*, uchar*, int (*)(struct netif*, uchar*, int), void*);
+void            netifconfig(struct netif*, uchar*, uchar*, uchar*);
+int             netinput(struct netif*, uchar*, int);
+struct netif*   ip_route(uchar*, uchar*);
+int             ip_output(struct netif*, uchar*, uchar*, int, int);
+
+// socket.c
+void            sockinit(void);
+int             udp_input(struct netif*, ip4_hdr_t*, uchar*, int);
+
+// tcp.c
+void            tcpinit(void);
+int             tcp_input(struct netif*, ip4_hdr_t*, uchar*, int);
+struct tcpcb*   tcballoc(void);
+int             tcpbind(struct tcpcb*, int);
+int             tcplisten(struct tcpcb*, int);
+int             tcpaccept(struct tcpcb*, struct tcpcb**, struct sockaddr_in*);
+int             tcpconnect(struct tcpcb*, struct sockaddr_in*);
+int             tcpread(struct tcpcb*, char*, int, struct sockaddr_in*);
+int             tcpwrite(struct tcpcb*, char*, int);
+int             tcpspace(struct tcpcb*);
+int             tcpqueue(struct tcpcb*, char*, int);
+void            tcppush(struct tcpcb*);
+int             tcpsetopt(struct tcpcb*, int, int);
+int             tcppoll(struct tcpcb*, int);
+void            tcpclose(struct tcpcb*);
+
+#endif /* NET_INET_H */
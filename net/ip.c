@@ -0,0 +1,212 @@
+// Network interfaces and IPv4 input and output.
+//
+// Drivers hand received frames to netinput() from their interrupt
+// path with no driver lock held.  netinput() returns 1 if the stack
+// took the frame and 0 if the driver should keep it for raw readers.
+// Nothing here sleeps.
+
+#include "../types.h"
+#include "../defs.h"
+#include "../spinlock.h"
+#include "net.h"
+#include "inet.h"
+
+// Interfaces are added at boot and never removed.  Addresses are
+// written under nettab.lock and read without it: a packet routed
+// with a stale address while netifconfig() runs is harmless.
+struct {
+  struct spinlock lock;
+  struct netif netif[NNETIF];
+  int n;
+  u16_t ipid;    // IP identification of the next packet
+} nettab;
+
+static uchar bcast[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+
+void
+netinit(void)
+{
+  initlock(&nettab.lock, "net");
+  arpinit();
+  dhcpinit();
+  sockinit();
+  tcpinit();
+}
+
+// Register an interface with hardware address mac.  It carries no
+// traffic until netifconfig() gives it an address.
+struct netif*
+netifadd(char *name, uchar *mac, int (*xmit)(struct netif*, uchar*, int), void *dev)
+{
+  struct netif *nif;
+
+  acquire(&nettab.lock);
+  if(nettab.n == NNETIF){
+    release(&nettab.lock);
+    return 0;
+  }
+  nif = &nettab.netif[nettab.n++];
+  safestrcpy(nif->name, name, sizeof(nif->name));
+  memmove(nif->mac, mac, sizeof(nif->mac));
+  nif->xmit = xmit;
+  nif->dev = dev;
+  release(&nettab.lock);
+  return nif;
+}
+
+// Set the address, netmask and gateway of nif and bring it up.
+// An all-zero address takes it down again.
+void
+netifconfig(struct netif *nif, uchar *ip, uchar *mask, uchar *gw)
+{
+  acquire(&nettab.lock);
+  memmove(nif->ip, ip, 4);
+  memmove(nif->mask, mask, 4);
+  memmove(nif->gw, gw, 4);
+  nif->up = (ip[0] | ip[1] | ip[2] | ip[3]) != 0;
+  release(&nettab.lock);
+}
+
+// Are a and b on the same network under mask?
+static int
+samenet(uchar *a, uchar *b, uchar *mask)
+{
+  int i;
+
+  for(i = 0; i < 4; i++)
+    if((a[i] ^ b[i]) & mask[i])
+      return 0;
+  return 1;
+}
+
+// Is dst a broadcast address on nif?
+static int
+isbcast(struct netif *nif, uchar *dst)
+{
+  int i;
+
+  if(memcmp(dst, bcast, 4) == 0)
+    return 1;
+  for(i = 0; i < 4; i++)
+    if((dst[i] | nif->mask[i]) != 0xFF)
+      return 0;
+  return samenet(dst, nif->ip, nif->mask);
+}
+
+// Pick the interface for a packet to dst and store the next-hop
+// address in hop.  Returns 0 if dst is unreachable.
+struct netif*
+ip_route(uchar *dst, uchar *hop)
+{
+  struct netif *nif;
+
+  for(nif = nettab.netif; nif < &nettab.netif[nettab.n]; nif++){
+    if(!nif->up)
+      continue;
+    if(memcmp(dst, bcast, 4) == 0 || samenet(dst, nif->ip, nif->mask)){
+      memmove(hop, dst, 4);
+      return nif;
+    }
+  }
+  for(nif = nettab.netif; nif < &nettab.netif[nettab.n]; nif++){
+    if(nif->up && (nif->gw[0] | nif->gw[1] | nif->gw[2] | nif->gw[3])){
+      memmove(hop, nif->gw, 4);
+      return nif;
+    }
+  }
+  return 0;
+}
+
+// Send the IP packet in pkt, whose len bytes of payload start at
+// NET_HDRSPACE, to next hop hop on nif.  The caller has filled in
+// the source and destination addresses; the rest of the IP header
+// and the link header are built here.  Returns 0 or -1.
+int
+ip_output(struct netif *nif, uchar *hop, uchar *pkt, int len, int proto)
+{
+  eth_hdr_t *eh;
+  ip4_hdr_t *ip;
+
+  if(len < 0 || len > (int)(NET_MTU - sizeof(ip4_hdr_t)))
+    return -1;
+  ip = NET_IP(pkt);
+  ip->ver_ihl = 0x45;
+  ip->tos = 0;
+  ip->length = htons(sizeof(*ip) + len);
+  acquire(&nettab.lock);
+  ip->id = htons(nettab.ipid++);
+  release(&nettab.lock);
+  ip->flag_fo = 0;
+  ip->ttl = 64;
+  ip->protocol = proto;
+  ip4_checksum(ip);
+
+  eh = (eth_hdr_t*)pkt;
+  memmove(eh->src, nif->mac, sizeof(eh->src));
+  eh->length = htons(ETH_TYPE_IP4);
+  if(nif->loopback){
+    memmove(eh->dst, nif->mac, sizeof(eh->dst));
+    return nif->xmit(nif, pkt, NET_HDRSPACE + len) > 0 ? 0 : -1;
+  }
+  if(isbcast(nif, hop)){
+    memset(eh->dst, 0xFF, sizeof(eh->dst));
+    return nif->xmit(nif, pkt, NET_HDRSPACE + len) > 0 ? 0 : -1;
+  }
+  return arp_output(nif, hop, pkt, NET_HDRSPACE + len);
+}
+
+// Check an IPv4 packet addressed to us and pass it to its protocol.
+static int
+ip_input(struct netif *nif, uchar *pkt, int len)
+{
+  ip4_hdr_t *ip;
+  int hlen, tlen;
+
+  if(len < (int)sizeof(ip4_hdr_t))
+    return 0;
+  ip = (ip4_hdr_t*)pkt;
+  hlen = (ip->ver_ihl & 0xF) * 4;
+  tlen = ntohs(ip->length);
+  if((ip->ver_ihl >> 4) != 4 || hlen < (int)sizeof(*ip) ||
+     tlen < hlen || tlen > len)
+    return 0;
+  if(memcmp(ip->dst, nif->ip, 4) != 0 && !isbcast(nif, ip->dst))
+    return 0;
+  // Fragments are left to raw readers.
+  if(ntohs(ip->flag_fo) & 0x3FFF)
+    return 0;
+  if(inet_checksum(ip, hlen) != 0)
+    return 0;
+
+  switch(ip->protocol){
+  case IP_PROTOCOL_ICMP:
+    return icmp_input(nif, ip, pkt + hlen, tlen - hlen);
+  case IP_PROTOCOL_TCP:
+    return tcp_input(nif, ip, pkt + hlen, tlen - hlen);
+  case IP_PROTOCOL_UDP:
+    return udp_input(nif, ip, pkt + hlen, tlen - hlen);
+  }
+  return 0;
+}
+
+// Offer a received Ethernet frame to the stack.
+// Returns 1 if the stack took it, 0 if the caller keeps it.
+int
+netinput(struct netif *nif, uchar *frame, int len)
+{
+  eth_hdr_t *eh;
+
+  // An interface without an address only listens for DHCP.
+  if((!nif->up && !nif->dhcp) || len < (int)sizeof(eth_hdr_t))
+    return 0;
+  eh = (eth_hdr_t*)frame;
+  switch(ntohs(eh->length)){
+  case ETH_TYPE_IP4:
+    return ip_input(nif, frame + sizeof(*eh), len - sizeof(*eh));
+  case ETH_TYPE_ARP:
+    if(!nif->up)
+      return 0;
+    return arp_input(nif, frame + sizeof(*eh), len - sizeof(*eh));
+  }
+  return 0;
+}
@@ -1,67 +1,151 @@
-#include "net.h"
-
-static u16_t
-checksum(const u16_t* buf, int size)
-{
-  u32_t sum = 0;
-  while (size > 1) {
-    sum += *buf++;
-    size -= 2;
-  }
-  if (size > 0)
-    sum += *(u8_t*)buf;
-  sum = (sum & 0xFFFF) + (sum >> 16);
-  sum = (sum & 0xFFFF) + (sum >> 16);
-  return (u16_t)(~sum);
-}
-
-void
-ip4_checksum(ip4_hdr_t* hdr)
-{
-  hdr->checksum = 0;
-  hdr->checksum = checksum((u16_t*)hdr, (hdr->ver_ihl & 0xF) * 4);
-}
-
-void
-udp_checksum(ip4_hdr_t* ip, udp_hdr_t* udp, u16_t* data)
-{
-  int i;
-  u32_t addr;
-  u32_t sum = 0;
-  int size;
-
-  udp->checksum = 0;
-
-  // pseudo header
-  addr = *(u32_t*)ip->src;
-  sum += (addr >> 16) & 0xFFFF;
-  sum += addr & 0xFFFF;
-  addr = *(u32_t*)ip->dst;
-  sum += (addr >> 16) & 0xFFFF;
-  sum += addr & 0xFFFF;
-  sum += htons(ip->protocol);
-  sum += udp->length;
-
-  // udp header
-  for (i = 0; i < 4; ++i)
-    sum += ((u16_t*)udp)[i];
-
-  // payload
-  size = ntohs(udp->length) - sizeof(*udp);
-  while (size > 1) {
-    sum += *data++;
-    size -= 2;
-  }
-  if (size)
-    sum += *(u8_t*)data;
-
-  sum = (sum & 0xFFFF) + (sum >> 16);
-  sum = (sum & 0xFFFF) + (sum >> 16);
-  udp->checksum = (u16_t)~sum;
-  return;
-}
-
-
-
-
-
+#include "net.h"
+
+// Add size bytes at buf to the one's complement partial sum, as
+// 16-bit words in memory order, without folding the carries.
+// A 32-bit word is the same as two 16-bit words under end-around
+// carry, so the loop adds 32-bit words into a 64-bit accumulator,
+// four at a time, and folds carries only once at the end.
+u32_t
+csum_partial(const void* buf, int size, u32_t sum)
+{
+  const u8_t* p = buf;
+  unsigned long long acc = sum;
+
+  // Reach 4-byte alignment; headers start on even addresses.
+  if (((u32_t)p & 2) && size >= 2) {
+    acc += *(const u16_t*)p;
+    p += 2;
+    size -= 2;
+  }
+  while (size >= 16) {
+    acc += ((const u32_t*)p)[0];
+    acc += ((const u32_t*)p)[1];
+    acc += ((const u32_t*)p)[2];
+    acc += ((const u32_t*)p)[3];
+    p += 16;
+    size -= 16;
+  }
+  while (size >= 4) {
+    acc += *(const u32_t*)p;
+    p += 4;
+    size -= 4;
+  }
+  if (size >= 2) {
+    acc += *(const u16_t*)p;
+    p += 2;
+    size -= 2;
+  }
+  if (size > 0)
+    acc += *p;
+
+  acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+  acc = (acc & 0xFFFFFFFF) + (acc >> 32);
+  return (u32_t)acc;
+}
+
+// Fold a partial sum to 16 bits and complement it.
+u16_t
+csum_fold(u32_t sum)
+{
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return (u16_t)~sum;
+}
+
+// One's complement Internet checksum of size bytes at buf.
+// A buffer that carries its own correct checksum sums to 0.
+u16_t
+inet_checksum(const void* buf, int size)
+{
+  return csum_fold(csum_partial(buf, size, 0));
+}
+
+// RFC 1624 incremental update: the checksum after a 16-bit field
+// covered by check changes from old to new, HC' = ~(~HC + ~m + m').
+// Fields are taken as they lie in memory, in network byte order.
+u16_t
+csum_update16(u16_t check, u16_t old, u16_t new)
+{
+  u32_t sum;
+
+  sum = (u16_t)~check + (u16_t)~old + new;
+  return csum_fold(sum);
+}
+
+// The same for a 32-bit field, such as an IPv4 address.
+u16_t
+csum_update32(u16_t check, const u8_t* old, const u8_t* new)
+{
+  u32_t sum;
+
+  sum = (u16_t)~check;
+  sum += (u16_t)~(old[0] | old[1] << 8) + (u16_t)~(old[2] | old[3] << 8);
+  sum += (u16_t)(new[0] | new[1] << 8) + (u16_t)(new[2] | new[3] << 8);
+  return csum_fold(sum);
+}
+
+void
+ip4_checksum(ip4_hdr_t* hdr)
+{
+  hdr->checksum = 0;
+  hdr->checksum = inet_checksum(hdr, (hdr->ver_ihl & 0xF) * 4);
+}
+
+// Partial sum of the UDP pseudo header, UDP header and payload.
+// src and dst are adjacent in ip4_hdr_t, so they go in as one block
+// of bytes rather than as possibly unaligned 32-bit loads.
+static u32_t
+udp_sum(ip4_hdr_t* ip, udp_hdr_t* udp, const void* data)
+{
+  u32_t sum;
+
+  sum = csum_partial(ip->src, 8, 0);
+  sum += htons(ip->protocol);
+  sum += udp->length;
+  sum = csum_partial(udp, sizeof(*udp), sum);
+  return csum_partial(data, ntohs(udp->length) - sizeof(*udp), sum);
+}
+
+void
+udp_checksum(ip4_hdr_t* ip, udp_hdr_t* udp, u16_t* data)
+{
+  udp->checksum = 0;
+  udp->checksum = csum_fold(udp_sum(ip, udp, data));
+  // Zero means "no checksum" in UDP; send the other zero instead.
+  if (udp->checksum == 0)
+    udp->checksum = 0xFFFF;
+  return;
+}
+
+// Does the datagram carry a correct checksum, or none at all?
+int
+udp_checksum_ok(ip4_hdr_t* ip, udp_hdr_t* udp, const void* data)
+{
+  return udp->checksum == 0 || csum_fold(udp_sum(ip, udp, data)) == 0;
+}
+
+// Partial sum of the TCP pseudo header and the len bytes of
+// segment, header included, at tcp.
+static u32_t
+tcp_sum(ip4_hdr_t* ip, tcp_hdr_t* tcp, int len)
+{
+  u32_t sum;
+
+  sum = csum_partial(ip->src, 8, 0);
+  sum += htons(ip->protocol);
+  sum += htons(len);
+  return csum_partial(tcp, len, sum);
+}
+
+void
+tcp_checksum(ip4_hdr_t* ip, tcp_hdr_t* tcp, int len)
+{
+  tcp->checksum = 0;
+  tcp->checksum = csum_fold(tcp_sum(ip, tcp, len));
+}
+
+int
+tcp_checksum_ok(ip4_hdr_t* ip, tcp_hdr_t* tcp, int len)
+{
+  return csum_fold(tcp_sum(ip, tcp, len)) == 0;
+}
@@ -0,0 +1,431 @@
+// Sockets.
+//
+// A datagram socket owns a queue of received datagrams.  udp_input()
+// demultiplexes arriving datagrams by destination port straight from
+// the driver's receive path, so a service only ever sees its own
+// traffic.  A stream socket holds a TCP connection (tcp.c) and
+// passes every call on to it.
+
+#include "../types.h"
+#include "../defs.h"
+#include "../param.h"
+#include "../mmu.h"
+#include "../proc.h"
+#include "../fs.h"
+#include "../file.h"
+#include "../spinlock.h"
+#include "net.h"
+#include "socket.h"
+#include "inet.h"
+#include "../poll.h"
+
+#define NSOCK           16
+#define SOCKQ_LEN       8       // datagrams queued per socket
+#define PORT_EPHEMERAL  49152   // first port handed out by bind(0)
+
+struct sock {
+  int type;             // SOCK_DGRAM, SOCK_STREAM, or 0 if free
+  struct tcpcb *tcb;    // SOCK_STREAM connection
+  ushort lport;         // SOCK_DGRAM local port, 0 while unbound
+  // Datagrams received for lport
+  struct {
+    uchar *buf;         // kmalloc()ed NET_MTU bytes holding the payload
+    int len;            // payload size
+    uchar addr[4];      // sender
+    ushort port;
+  } rq[SOCKQ_LEN];
+  // Monotonic counters; modulo SOCKQ_LEN yields element index
+  uint rq_head;         // next datagram handed to the reader
+  uint rq_tail;         // next slot filled by udp_input()
+  uint drops;           // datagrams lost to a full queue
+};
+
+struct {
+  struct spinlock lock;
+  struct sock sock[NSOCK];
+  ushort nextport;      // next ephemeral port to try
+} socktab;
+
+void
+sockinit(void)
+{
+  initlock(&socktab.lock, "sock");
+  socktab.nextport = PORT_EPHEMERAL;
+}
+
+// The socket bound to port, or 0.  Caller must hold socktab.lock.
+static struct sock*
+socklookup(ushort port)
+{
+  struct sock *s;
+
+  for(s = socktab.sock; s < &socktab.sock[NSOCK]; s++)
+    if(s->type == SOCK_DGRAM && s->lport == port)
+      return s;
+  return 0;
+}
+
+// Allocate a socket of the given type and a file for it.  A stream
+// socket takes over connection tcb, or gets a new one if tcb is 0.
+static int
+sockalloc1(struct file **f, int type, struct tcpcb *tcb)
+{
+  struct sock *s;
+  int i;
+
+  if(type != SOCK_DGRAM && type != SOCK_STREAM)
+    return -1;
+  if((*f = filealloc()) == 0)
+    return -1;
+  acquire(&socktab.lock);
+  for(s = socktab.sock; s < &socktab.sock[NSOCK]; s++)
+    if(s->type == 0)
+      break;
+  if(s == &socktab.sock[NSOCK]){
+    release(&socktab.lock);
+    fileclose(*f);
+    return -1;
+  }
+  s->type = type;
+  s->lport = 0;
+  s->rq_head = s->rq_tail = 0;
+  s->drops = 0;
+  release(&socktab.lock);
+
+  if(type == SOCK_STREAM){
+    if(tcb == 0 && (tcb = tcballoc()) == 0){
+      acquire(&socktab.lock);
+      s->type = 0;
+      release(&socktab.lock);
+      fileclose(*f);
+      return -1;
+    }
+    s->tcb = tcb;
+  }
+  // Unbound, so udp_input() cannot touch the queue yet.
+  for(i = 0; type == SOCK_DGRAM && i < SOCKQ_LEN; i++){
+    if((s->rq[i].buf = kmalloc(NET_MTU)) == 0){
+      while(--i >= 0)
+        kmfree(s->rq[i].buf);
+      acquire(&socktab.lock);
+      s->type = 0;
+      release(&socktab.lock);
+      fileclose(*f);
+      return -1;
+    }
+  }
+  (*f)->type = FD_SOCKET;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->sock = s;
+  return 0;
+}
+
+int
+sockalloc(struct file **f, int type)
+{
+  return sockalloc1(f, type, 0);
+}
+
+void
+sockclose(struct sock *s)
+{
+  int i;
+
+  if(s->type == SOCK_STREAM){
+    tcpclose(s->tcb);
+    acquire(&socktab.lock);
+    s->type = 0;
+    release(&socktab.lock);
+    return;
+  }
+  // Stop deliveries first; udp_input() holds the lock while copying.
+  acquire(&socktab.lock);
+  s->lport = 0;
+  release(&socktab.lock);
+  for(i = 0; i < SOCKQ_LEN; i++)
+    kmfree(s->rq[i].buf);
+  acquire(&socktab.lock);
+  s->type = 0;
+  release(&socktab.lock);
+}
+
+// Bind s to port, or to a free ephemeral port if port is 0.
+// Caller must hold socktab.lock.
+static int
+sockbind1(struct sock *s, int port)
+{
+  int i;
+
+  if(s->lport != 0 || port < 0 || port > 0xFFFF)
+    return -1;
+  if(port == 0){
+    for(i = PORT_EPHEMERAL; i <= 0xFFFF; i++){
+      port = socktab.nextport++;
+      if(socktab.nextport == 0)
+        socktab.nextport = PORT_EPHEMERAL;
+      if(socklookup(port) == 0)
+        break;
+    }
+    if(i > 0xFFFF)
+      return -1;
+  } else if(socklookup(port) != 0)
+    return -1;
+  s->lport = port;
+  return 0;
+}
+
+int
+sockbind(struct sock *s, int port)
+{
+  int r;
+
+  if(s->type == SOCK_STREAM)
+    return tcpbind(s->tcb, port);
+  acquire(&socktab.lock);
+  r = sockbind1(s, port);
+  release(&socktab.lock);
+  return r;
+}
+
+// Send n bytes at buf to addr as one datagram.  A stream socket
+// ignores addr and writes to its connection.
+int
+socksendto(struct sock *s, char *buf, int n, struct sockaddr_in *addr)
+{
+  struct netif *nif;
+  uchar hop[4], *pkt;
+  ip4_hdr_t *ip;
+  udp_hdr_t *udp;
+
+  if(s->type == SOCK_STREAM)
+    return tcpwrite(s->tcb, buf, n);
+  if(n < 0 || n > (int)(NET_MTU - sizeof(ip4_hdr_t) - sizeof(udp_hdr_t)))
+    return -1;
+  acquire(&socktab.lock);
+  if(s->lport == 0 && sockbind1(s, 0) < 0){
+    release(&socktab.lock);
+    return -1;
+  }
+  release(&socktab.lock);
+  if((nif = ip_route(addr->addr, hop)) == 0)
+    return -1;
+  if((pkt = kmalloc(ETH_MAX_SIZE)) == 0)
+    return -1;
+
+  ip = NET_IP(pkt);
+  memmove(ip->src, nif->ip, 4);
+  memmove(ip->dst, addr->addr, 4);
+  ip->protocol = IP_PROTOCOL_UDP;
+  udp = (udp_hdr_t*)(pkt + NET_HDRSPACE);
+  udp->src = htons(s->lport);
+  udp->dst = htons(addr->port);
+  udp->length = htons(sizeof(*udp) + n);
+  memmove(udp + 1, buf, n);
+  udp_checksum(ip, udp, (u16_t*)(udp + 1));
+
+  if(ip_output(nif, hop, pkt, sizeof(*udp) + n, IP_PROTOCOL_UDP) < 0)
+    n = -1;
+  kmfree(pkt);
+  return n;
+}
+
+// Receive one datagram into buf, truncated to n bytes, and store
+// the sender in addr unless it is 0.  Sleeps until one arrives.
+// The datagram's buffer is swapped for a fresh one under the lock
+// and copied out after it, so that buf and addr, which may fault,
+// are never touched with socktab.lock held.
+int
+sockrecvfrom(struct sock *s, char *buf, int n, struct sockaddr_in *addr)
+{
+  uchar *p, *q, from[4];
+  ushort port;
+  int i;
+
+  if(s->type == SOCK_STREAM)
+    return tcpread(s->tcb, buf, n, addr);
+  if((p = kmalloc(NET_MTU)) == 0)
+    return -1;
+  acquire(&socktab.lock);
+  while(s->rq_head == s->rq_tail){
+    if(proc->killed){
+      release(&socktab.lock);
+      kmfree(p);
+      return -1;
+    }
+    sleep(s, &socktab.lock);
+  }
+  i = s->rq_head % SOCKQ_LEN;
+  if(n > s->rq[i].len)
+    n = s->rq[i].len;
+  memmove(from, s->rq[i].addr, 4);
+  port = s->rq[i].port;
+  q = s->rq[i].buf;
+  s->rq[i].buf = p;
+  p = q;
+  s->rq_head++;
+  release(&socktab.lock);
+  memmove(buf, p, n);
+  if(addr){
+    memmove(addr->addr, from, 4);
+    addr->port = port;
+  }
+  kmfree(p);
+  return n;
+}
+
+int
+sockread(struct sock *s, char *buf, int n)
+{
+  return sockrecvfrom(s, buf, n, 0);
+}
+
+// Datagram sockets need sendto().
+int
+sockwrite(struct sock *s, char *buf, int n)
+{
+  if(s->type != SOCK_STREAM)
+    return -1;
+  return tcpwrite(s->tcb, buf, n);
+}
+
+int
+socklisten(struct sock *s, int backlog)
+{
+  if(s->type != SOCK_STREAM)
+    return -1;
+  return tcplisten(s->tcb, backlog);
+}
+
+// Wait for a connection on listening socket s and make a socket and
+// file for it.
+int
+sockaccept(struct sock *s, struct file **f, struct sockaddr_in *addr)
+{
+  struct tcpcb *tcb;
+
+  if(s->type != SOCK_STREAM || tcpaccept(s->tcb, &tcb, addr) < 0)
+    return -1;
+  if(sockalloc1(f, SOCK_STREAM, tcb) < 0){
+    tcpclose(tcb);
+    return -1;
+  }
+  return 0;
+}
+
+int
+sockconnect(struct sock *s, struct sockaddr_in *addr)
+{
+  if(s->type != SOCK_STREAM)
+    return -1;
+  return tcpconnect(s->tcb, addr);
+}
+
+int
+socksetopt(struct sock *s, int opt, int val)
+{
+  if(s->type != SOCK_STREAM)
+    return -1;
+  return tcpsetopt(s->tcb, opt, val);
+}
+
+static int
+sendblock(void *tcb, char *p, int n)
+{
+  return tcpqueue(tcb, p, n);
+}
+
+// Send n bytes of file f from its offset on stream socket s, taken
+// from the buffer cache straight into the connection's send buffer
+// rather than through a user buffer.  Returns the bytes sent, which
+// are fewer than n at the end of the file, or -1.
+int
+socksendfile(struct sock *s, struct file *f, int n)
+{
+  int tot, m, r;
+
+  if(s->type != SOCK_STREAM || f->type != FD_INODE || !f->readable || n < 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    if((m = tcpspace(s->tcb)) < 0){
+      r = -1;
+      break;
+    }
+    if(m > n - tot)
+      m = n - tot;
+    ilock(f->ip);
+    if((r = readifn(f->ip, f->off, m, sendblock, s->tcb)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    // Send a buffer's worth at a time, in whole segments.
+    tcppush(s->tcb);
+    if(r <= 0)
+      break;
+  }
+  return tot > 0 ? tot : r;
+}
+
+// Readers of a datagram socket sleep on it; sendto() never waits.
+int
+sockpoll(struct sock *s, int events)
+{
+  int r;
+
+  if(s->type == SOCK_STREAM)
+    return tcppoll(s->tcb, events);
+  r = events & POLLOUT;
+  if(events & POLLIN){
+    acquire(&socktab.lock);
+    if(s->rq_head != s->rq_tail)
+      r |= POLLIN;
+    else
+      pollwait(s);
+    release(&socktab.lock);
+  }
+  return r;
+}
+
+// Queue a UDP datagram for the socket bound to its destination port.
+// Returns 0 if no socket wants it, so raw readers still see it.
+int
+udp_input(struct netif *nif, ip4_hdr_t *ip, uchar *pkt, int len)
+{
+  struct sock *s;
+  udp_hdr_t *udp;
+  int i, ulen;
+
+  if(len < (int)sizeof(udp_hdr_t))
+    return 0;
+  udp = (udp_hdr_t*)pkt;
+  ulen = ntohs(udp->length);
+  if(ulen < (int)sizeof(*udp) || ulen > len)
+    return 0;
+  if(ntohs(udp->dst) == UDP_PORT_BOOTPC && udp_checksum_ok(ip, udp, udp + 1) &&
+     dhcp_input(nif, (uchar*)(udp + 1), ulen - sizeof(*udp)))
+    return 1;
+
+  acquire(&socktab.lock);
+  if((s = socklookup(ntohs(udp->dst))) == 0){
+    release(&socktab.lock);
+    return 0;
+  }
+  if(!udp_checksum_ok(ip, udp, udp + 1)){
+    release(&socktab.lock);
+    return 1;
+  }
+  if(s->rq_tail - s->rq_head == SOCKQ_LEN){
+    s->drops++;
+    release(&socktab.lock);
+    return 1;
+  }
+  i = s->rq_tail % SOCKQ_LEN;
+  s->rq[i].len = ulen - sizeof(*udp);
+  memmove(s->rq[i].buf, udp + 1, s->rq[i].len);
+  memmove(s->rq[i].addr, ip->src, 4);
+  s->rq[i].port = ntohs(udp->src);
+  s->rq_tail++;
+  wakeup(s);
+  release(&socktab.lock);
+  return 1;
+}
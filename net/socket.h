@@ -0,0 +1,37 @@
+#ifndef NET_SOCKET_H
+#define NET_SOCKET_H
+
+/*
+ * Socket interface to the kernel network stack.
+ *
+ * socket(SOCK_DGRAM) returns a file descriptor for a UDP endpoint.
+ * bind() gives it a local port, or an ephemeral one for port 0;
+ * sendto() binds an unbound socket implicitly. recvfrom() blocks until
+ * a datagram for the port arrives and truncates it to the buffer size.
+ * read() on a socket is recvfrom() without the sender address.
+ *
+ * socket(SOCK_STREAM) returns a TCP endpoint. A server binds it, calls
+ * listen() and takes connections with accept(), which returns a new
+ * descriptor; a client calls connect(), which waits for the handshake.
+ * Connected sockets are read and written like pipes; read() returns 0
+ * once the peer has closed. setsockopt() with SO_SNDBUF or SO_RCVBUF
+ * sets a buffer size, rounded up to whole pages, before the connection
+ * starts; accepted sockets inherit the listener's sizes.
+ *
+ * The stack only carries traffic for interfaces that have been given an
+ * address with ETH_SET_ADDR (see eth/eth.h).
+ */
+
+#define SOCK_DGRAM    1   // UDP
+#define SOCK_STREAM   2   // TCP
+
+// setsockopt() options
+#define SO_SNDBUF     1   // send buffer bytes, at most 64KB
+#define SO_RCVBUF     2   // receive buffer bytes, at most 64KB
+
+struct sockaddr_in {
+  unsigned char addr[4];  // IPv4 address
+  unsigned short port;    // Port, host byte order
+};
+
+#endif /* NET_SOCKET_H */
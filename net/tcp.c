@@ -0,0 +1,1251 @@
+// TCP.
+//
+// Connections live in a fixed table of control blocks under one
+// lock.  Segments are processed in the receive path as they arrive
+// and answered from there; tcptimer() runs from a callout at the
+// next tick any connection's timer is due, for retransmission,
+// delayed ACKs and TIME_WAIT.  Sockets of type
+// SOCK_STREAM (socket.c) hold a control block and call the tcp*
+// functions below, which sleep on it.
+//
+// The send side keeps a sliding window limited by both the peer's
+// advertised window and a congestion window that grows by slow
+// start and congestion avoidance, with fast retransmit on three
+// duplicate ACKs.  The receive side accepts in-order data only and
+// holds ACKs back for up to TCP_DELACK ticks or until a second
+// segment arrives.  Send and receive buffers are rings of whole
+// pages whose size is set per socket with setsockopt().
+
+#include "../types.h"
+#include "../defs.h"
+#include "../param.h"
+#include "../mmu.h"
+#include "../proc.h"
+#include "../spinlock.h"
+#include "../callout.h"
+#include "net.h"
+#include "socket.h"
+#include "inet.h"
+#include "../poll.h"
+
+#define NTCP          32      // control blocks, including closing ones
+#define TCP_MSS       (NET_MTU - sizeof(ip4_hdr_t) - sizeof(tcp_hdr_t))
+#define TCP_BUFPG     16      // most pages in one buffer
+#define TCP_DEFBUF    (4*PGSIZE)  // default buffer size
+#define TCP_MAXWIN    0xFFFF  // largest window without scaling
+#define TCP_BACKLOG   8       // most connections waiting for accept()
+#define TCP_RTOINIT   100     // ticks before the first retransmission
+#define TCP_RTOMIN    20
+#define TCP_RTOMAX    (60*100)
+#define TCP_MAXRXT    12      // retransmissions before giving up
+#define TCP_DELACK    20      // ticks an ACK may be held back
+#define TCP_MSL       (30*100)  // ticks; TIME_WAIT lasts twice this
+#define TCP_FINWAIT   (60*100)  // ticks a closed FIN_WAIT_2 may linger
+#define PORT_EPHEMERAL  49152
+
+#define SEQ_LT(a, b)  ((int)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int)((a) - (b)) <= 0)
+#define SEQ_GT(a, b)  ((int)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b) ((int)((a) - (b)) >= 0)
+
+enum {
+  TCP_CLOSED, TCP_LISTEN, TCP_SYN_SENT, TCP_SYN_RCVD, TCP_ESTABLISHED,
+  TCP_FIN_WAIT_1, TCP_FIN_WAIT_2, TCP_CLOSING, TCP_TIME_WAIT,
+  TCP_CLOSE_WAIT, TCP_LAST_ACK
+};
+
+// A byte ring over separately allocated pages.
+struct tcpbuf {
+  uchar *pg[TCP_BUFPG];
+  uint size;            // bytes, a multiple of PGSIZE
+  uint off;             // ring offset of the first byte
+  uint len;             // bytes held
+};
+
+struct tcpcb {
+  int used;
+  int state;
+  int orphan;           // closed by its socket; freed once done
+  int err;              // reset or timed out
+  struct tcpcb *parent; // listener, until accept()ed
+  int backlog;          // LISTEN: connections allowed to wait
+  uint sndsz, rcvsz;    // buffer sizes to allocate
+  struct netif *nif;
+  uchar lip[4], rip[4];
+  uchar hop[4];         // next hop toward rip
+  ushort lport, rport;
+
+  // Send side.  Buffered bytes start at sequence snd_una, and a
+  // queued FIN follows them.
+  uint iss;
+  uint snd_una;         // oldest unacknowledged
+  uint snd_nxt;         // next to send
+  uint snd_max;         // highest sent
+  uint snd_wnd;         // peer's window
+  uint cwnd, ssthresh;
+  int dupacks;
+  int finq;             // FIN to follow the buffered data
+  uint mss;
+  struct tcpbuf snd;
+
+  // Receive side
+  uint rcv_nxt;
+  uint rcv_adv;         // right edge of the advertised window
+  int finrcvd;
+  struct tcpbuf rcv;
+
+  // Timers, in ticks; 0 if not running
+  uint rexmt;           // retransmission or window probe
+  uint delack;          // held-back ACK due
+  uint expire;          // end of TIME_WAIT or orphaned FIN_WAIT_2
+  int rxtshift;         // retransmissions of the oldest segment
+  uint rto;
+  int srtt, rttvar;     // scaled by 8 and 4, as in BSD
+  int rtting;           // timing the segment at rtseq
+  uint rtseq, rtstart;
+};
+
+struct {
+  struct spinlock lock;
+  struct tcpcb tcb[NTCP];
+  int nused;
+  ushort nextport;
+  uint iss;
+  uchar pkt[ETH_MAX_SIZE];  // outgoing segment, under lock
+  struct callout timer;     // runs tcptimer()
+} tcptab;
+
+static void tcpoutput(struct tcpcb*, int);
+static void tcptimer(void*);
+
+void
+tcpinit(void)
+{
+  initlock(&tcptab.lock, "tcp");
+  tcptab.nextport = PORT_EPHEMERAL;
+  callinit(&tcptab.timer, tcptimer, 0);
+}
+
+// The tick n ticks from now, for a connection timer; tcptimer() will
+// run by then.  Caller must hold tcptab.lock.
+static uint
+tcpwhen(uint n)
+{
+  uint t;
+
+  t = ticks + n;
+  callsooner(&tcptab.timer, t);
+  return t;
+}
+
+static int
+due(uint t)
+{
+  return t != 0 && (int)(ticks - t) >= 0;
+}
+
+// Copy n bytes between p and the ring b, starting off bytes past
+// its first byte; out copies from the ring to p.
+static void
+bufcopy(struct tcpbuf *b, uint off, uchar *p, uint n, int out)
+{
+  uint o, m;
+
+  while(n > 0){
+    o = (b->off + off) % b->size;
+    m = PGSIZE - o % PGSIZE;
+    if(m > n)
+      m = n;
+    if(out)
+      memmove(p, b->pg[o / PGSIZE] + o % PGSIZE, m);
+    else
+      memmove(b->pg[o / PGSIZE] + o % PGSIZE, p, m);
+    p += m;
+    off += m;
+    n -= m;
+  }
+}
+
+static void
+bufconsume(struct tcpbuf *b, uint n)
+{
+  b->off = (b->off + n) % b->size;
+  b->len -= n;
+}
+
+static void
+buffree(struct tcpbuf *b)
+{
+  uint i;
+
+  for(i = 0; i < b->size / PGSIZE; i++)
+    kfree((char*)b->pg[i]);
+  b->size = 0;
+}
+
+static int
+bufalloc(struct tcpbuf *b, uint size)
+{
+  uint i;
+
+  b->off = b->len = 0;
+  for(i = 0; i < size / PGSIZE; i++){
+    if((b->pg[i] = (uchar*)kalloc()) == 0){
+      b->size = i * PGSIZE;
+      buffree(b);
+      return -1;
+    }
+  }
+  b->size = size;
+  return 0;
+}
+
+static struct tcpcb*
+tcballoc1(void)
+{
+  struct tcpcb *tp;
+
+  for(tp = tcptab.tcb; tp < &tcptab.tcb[NTCP]; tp++){
+    if(!tp->used){
+      memset(tp, 0, sizeof(*tp));
+      tp->used = 1;
+      tp->sndsz = tp->rcvsz = TCP_DEFBUF;
+      tp->mss = TCP_MSS;
+      tp->rto = TCP_RTOINIT;
+      tcptab.nused++;
+      return tp;
+    }
+  }
+  return 0;
+}
+
+static void
+tcbfree(struct tcpcb *tp)
+{
+  buffree(&tp->snd);
+  buffree(&tp->rcv);
+  tp->used = 0;
+  tcptab.nused--;
+}
+
+// Allocate a control block for a new stream socket.
+struct tcpcb*
+tcballoc(void)
+{
+  struct tcpcb *tp;
+
+  acquire(&tcptab.lock);
+  tp = tcballoc1();
+  release(&tcptab.lock);
+  return tp;
+}
+
+// Give tp its buffers and an initial sequence number.
+static int
+tcpstart(struct tcpcb *tp)
+{
+  if(bufalloc(&tp->snd, tp->sndsz) < 0)
+    return -1;
+  if(bufalloc(&tp->rcv, tp->rcvsz) < 0){
+    buffree(&tp->snd);
+    return -1;
+  }
+  tcptab.iss += 64000 + ticks;
+  tp->iss = tp->snd_una = tp->snd_nxt = tp->snd_max = tcptab.iss;
+  tp->cwnd = 2 * tp->mss;
+  tp->ssthresh = TCP_MAXWIN;
+  return 0;
+}
+
+// The window to advertise: free receive buffer space.
+static uint
+tcpwin(struct tcpcb *tp)
+{
+  uint win;
+
+  win = tp->rcv.size - tp->rcv.len;
+  return win > TCP_MAXWIN ? TCP_MAXWIN : win;
+}
+
+// Send one segment: n bytes starting off bytes into the send
+// buffer, at sequence seq.  Returns 0 or -1 if the link refused it.
+static int
+tcpsend(struct tcpcb *tp, uint seq, int flags, uint off, uint n)
+{
+  uchar *pkt, *opt;
+  ip4_hdr_t *ip;
+  tcp_hdr_t *th;
+  uint win;
+  int hlen;
+
+  pkt = tcptab.pkt;
+  ip = NET_IP(pkt);
+  memmove(ip->src, tp->lip, 4);
+  memmove(ip->dst, tp->rip, 4);
+  ip->protocol = IP_PROTOCOL_TCP;
+  th = (tcp_hdr_t*)(pkt + NET_HDRSPACE);
+  th->src = htons(tp->lport);
+  th->dst = htons(tp->rport);
+  th->seq = htonl(seq);
+  th->ack = (flags & TCP_ACK) ? htonl(tp->rcv_nxt) : 0;
+  hlen = sizeof(*th);
+  if(flags & TCP_SYN){
+    opt = (uchar*)(th + 1);
+    opt[0] = TCP_OPT_MSS;
+    opt[1] = 4;
+    opt[2] = TCP_MSS >> 8;
+    opt[3] = TCP_MSS & 0xFF;
+    hlen += 4;
+  }
+  th->off = (hlen / 4) << 4;
+  th->flags = flags;
+  win = tcpwin(tp);
+  th->wnd = htons(win);
+  th->urg = 0;
+  if(n > 0)
+    bufcopy(&tp->snd, off, (uchar*)th + hlen, n, 1);
+  tcp_checksum(ip, th, hlen + n);
+  if(ip_output(tp->nif, tp->hop, pkt, hlen + n, IP_PROTOCOL_TCP) < 0)
+    return -1;
+  if(flags & TCP_ACK){
+    tp->rcv_adv = tp->rcv_nxt + win;
+    tp->delack = 0;
+  }
+  return 0;
+}
+
+static void
+tcpsendack(struct tcpcb *tp)
+{
+  tcpsend(tp, tp->snd_nxt, TCP_ACK, 0, 0);
+}
+
+// Answer a segment that belongs to no connection with a reset.
+static void
+tcpreset(ip4_hdr_t *ip, tcp_hdr_t *th, int dlen)
+{
+  struct tcpcb t;
+
+  if(th->flags & TCP_RST)
+    return;
+  memset(&t, 0, sizeof(t));
+  if((t.nif = ip_route(ip->src, t.hop)) == 0)
+    return;
+  memmove(t.lip, ip->dst, 4);
+  memmove(t.rip, ip->src, 4);
+  t.lport = ntohs(th->dst);
+  t.rport = ntohs(th->src);
+  if(th->flags & TCP_ACK){
+    tcpsend(&t, ntohl(th->ack), TCP_RST, 0, 0);
+  } else {
+    t.rcv_nxt = ntohl(th->seq) + dlen +
+      ((th->flags & TCP_SYN) != 0) + ((th->flags & TCP_FIN) != 0);
+    tcpsend(&t, 0, TCP_RST | TCP_ACK, 0, 0);
+  }
+}
+
+// The connection is gone: wake its socket, or free it if it has none.
+static void
+tcpdrop(struct tcpcb *tp)
+{
+  tp->state = TCP_CLOSED;
+  tp->err = 1;
+  tp->rexmt = tp->delack = tp->expire = 0;
+  wakeup(tp);
+  if(tp->orphan || tp->parent)
+    tcbfree(tp);
+}
+
+// Send what the windows allow.  force sends one byte into a closed
+// window, as a probe.
+static void
+tcpoutput(struct tcpcb *tp, int force)
+{
+  uint win, off, n;
+  int fin;
+
+  switch(tp->state){
+  case TCP_SYN_SENT:
+  case TCP_SYN_RCVD:
+    if(tp->snd_nxt == tp->iss){
+      if(tcpsend(tp, tp->iss, TCP_SYN |
+                 (tp->state == TCP_SYN_RCVD ? TCP_ACK : 0), 0, 0) == 0)
+        tp->snd_nxt = tp->snd_max = tp->iss + 1;
+      if(tp->rexmt == 0)
+        tp->rexmt = tcpwhen(tp->rto);
+    }
+    return;
+  case TCP_ESTABLISHED:
+  case TCP_CLOSE_WAIT:
+  case TCP_FIN_WAIT_1:
+  case TCP_CLOSING:
+  case TCP_LAST_ACK:
+    break;
+  default:
+    return;
+  }
+
+  win = tp->snd_wnd < tp->cwnd ? tp->snd_wnd : tp->cwnd;
+  for(;;){
+    off = tp->snd_nxt - tp->snd_una;
+    if(off > tp->snd.len)
+      break;    // FIN sent
+    if(force && win <= off)
+      win = off + 1;
+    n = tp->snd.len - off;
+    if(n > tp->mss)
+      n = tp->mss;
+    if(off + n > win)
+      n = win > off ? win - off : 0;
+    fin = tp->finq && off + n == tp->snd.len;
+    if(n == 0 && !fin){
+      // Closed window with nothing in flight: probe it later.
+      if(tp->snd.len > off && tp->snd_nxt == tp->snd_una && tp->rexmt == 0)
+        tp->rexmt = tcpwhen(tp->rto);
+      break;
+    }
+    // Hold back a runt while data is in flight (Nagle).
+    if(!fin && n < tp->mss && off > 0 && off + n == tp->snd.len)
+      break;
+    if(tcpsend(tp, tp->snd_nxt, TCP_ACK | (fin ? TCP_FIN : 0) |
+               (off + n == tp->snd.len ? TCP_PSH : 0), off, n) < 0){
+      // Device queue full; an ACK or the timer will try again.
+      if(tp->rexmt == 0)
+        tp->rexmt = tcpwhen(tp->rto);
+      break;
+    }
+    if(!tp->rtting && SEQ_GEQ(tp->snd_nxt, tp->snd_max)){
+      tp->rtting = 1;
+      tp->rtseq = tp->snd_nxt;
+      tp->rtstart = ticks;
+    }
+    tp->snd_nxt += n + fin;
+    if(SEQ_GT(tp->snd_nxt, tp->snd_max))
+      tp->snd_max = tp->snd_nxt;
+    if(tp->rexmt == 0)
+      tp->rexmt = tcpwhen(tp->rto);
+    force = 0;
+    if(fin)
+      break;
+  }
+}
+
+// Fold a round-trip sample into the estimators (Jacobson 1988).
+static void
+tcprtt(struct tcpcb *tp, int rtt)
+{
+  int delta;
+
+  if(tp->srtt == 0){
+    tp->srtt = rtt << 3;
+    tp->rttvar = rtt << 1;
+  } else {
+    delta = rtt - (tp->srtt >> 3);
+    tp->srtt += delta;
+    if(delta < 0)
+      delta = -delta;
+    tp->rttvar += delta - (tp->rttvar >> 2);
+  }
+  tp->rto = (tp->srtt >> 3) + tp->rttvar;
+  if(tp->rto < TCP_RTOMIN)
+    tp->rto = TCP_RTOMIN;
+  if(tp->rto > TCP_RTOMAX)
+    tp->rto = TCP_RTOMAX;
+}
+
+// Process the acknowledgment ack and window wnd.  pure is set if
+// the segment carried nothing else.  Returns 1 if our FIN is acked.
+static int
+tcpack(struct tcpcb *tp, uint ack, uint wnd, int pure)
+{
+  uint acked, n, nxt, flight;
+
+  if(SEQ_LEQ(ack, tp->snd_una)){
+    if(ack == tp->snd_una && pure && wnd == tp->snd_wnd &&
+       tp->snd_max != tp->snd_una){
+      if(++tp->dupacks == 3){
+        // Fast retransmit, then inflate the window by the three
+        // segments that have left the network.
+        flight = tp->snd_max - tp->snd_una;
+        tp->ssthresh = flight / 2 > 2 * tp->mss ? flight / 2 : 2 * tp->mss;
+        nxt = tp->snd_nxt;
+        tp->snd_nxt = tp->snd_una;
+        tp->cwnd = tp->mss;
+        tp->rtting = 0;
+        tcpoutput(tp, 0);
+        tp->cwnd = tp->ssthresh + 3 * tp->mss;
+        if(SEQ_GT(nxt, tp->snd_nxt))
+          tp->snd_nxt = nxt;
+      } else if(tp->dupacks > 3){
+        tp->cwnd += tp->mss;
+      }
+    } else {
+      tp->dupacks = 0;
+    }
+    if(ack == tp->snd_una)
+      tp->snd_wnd = wnd;
+    return 0;
+  }
+
+  if(tp->dupacks >= 3)
+    tp->cwnd = tp->ssthresh;
+  tp->dupacks = 0;
+  if(tp->rtting && SEQ_GT(ack, tp->rtseq)){
+    tcprtt(tp, ticks - tp->rtstart + 1);
+    tp->rtting = 0;
+  }
+  acked = ack - tp->snd_una;
+  if(tp->snd_una == tp->iss)
+    acked--;    // our SYN
+  n = acked < tp->snd.len ? acked : tp->snd.len;
+  bufconsume(&tp->snd, n);
+  tp->snd_una = ack;
+  if(SEQ_LT(tp->snd_nxt, tp->snd_una))
+    tp->snd_nxt = tp->snd_una;
+  tp->snd_wnd = wnd;
+
+  if(tp->cwnd < tp->ssthresh)
+    tp->cwnd += tp->mss;
+  else
+    tp->cwnd += tp->mss * tp->mss / tp->cwnd + 1;
+  if(tp->cwnd > TCP_BUFPG * PGSIZE)
+    tp->cwnd = TCP_BUFPG * PGSIZE;
+
+  tp->rxtshift = 0;
+  tp->rexmt = tp->snd_una == tp->snd_max ? 0 : tcpwhen(tp->rto);
+  wakeup(tp);
+  return tp->finq && acked > n;
+}
+
+// The connection for a segment to lport from rip:rport, or the
+// listener on lport.  Caller must hold tcptab.lock.
+static struct tcpcb*
+tcplookup(ushort lport, uchar *rip, ushort rport)
+{
+  struct tcpcb *tp, *l;
+
+  l = 0;
+  for(tp = tcptab.tcb; tp < &tcptab.tcb[NTCP]; tp++){
+    if(!tp->used || tp->lport != lport)
+      continue;
+    if(tp->state == TCP_LISTEN)
+      l = tp;
+    else if(tp->state != TCP_CLOSED && tp->rport == rport &&
+            memcmp(tp->rip, rip, 4) == 0)
+      return tp;
+  }
+  return l;
+}
+
+// The peer's MSS option, or the RFC 879 default.
+static uint
+tcpmss(tcp_hdr_t *th, int hlen)
+{
+  uchar *p, *e;
+  uint mss;
+
+  mss = 536;
+  p = (uchar*)(th + 1);
+  e = (uchar*)th + hlen;
+  while(p < e && *p != TCP_OPT_END){
+    if(*p == TCP_OPT_NOP){
+      p++;
+      continue;
+    }
+    if(p + 1 >= e || p[1] < 2 || p + p[1] > e)
+      break;
+    if(*p == TCP_OPT_MSS && p[1] == 4)
+      mss = (p[2] << 8) | p[3];
+    p += p[1];
+  }
+  if(mss > TCP_MSS)
+    mss = TCP_MSS;
+  return mss;
+}
+
+// A SYN has arrived for listener l: start a connection for it.
+static void
+tcpsyn(struct tcpcb *l, ip4_hdr_t *ip, tcp_hdr_t *th, int hlen)
+{
+  struct tcpcb *tp;
+  int n;
+
+  n = 0;
+  for(tp = tcptab.tcb; tp < &tcptab.tcb[NTCP]; tp++)
+    if(tp->used && tp->parent == l)
+      n++;
+  if(n >= l->backlog || (tp = tcballoc1()) == 0)
+    return;
+  tp->sndsz = l->sndsz;
+  tp->rcvsz = l->rcvsz;
+  if((tp->nif = ip_route(ip->src, tp->hop)) == 0 || tcpstart(tp) < 0){
+    tcbfree(tp);
+    return;
+  }
+  tp->parent = l;
+  memmove(tp->lip, ip->dst, 4);
+  memmove(tp->rip, ip->src, 4);
+  tp->lport = l->lport;
+  tp->rport = ntohs(th->src);
+  tp->mss = tcpmss(th, hlen);
+  tp->rcv_nxt = ntohl(th->seq) + 1;
+  tp->snd_wnd = ntohs(th->wnd);
+  tp->state = TCP_SYN_RCVD;
+  tcpoutput(tp, 0);
+}
+
+// Handle a segment of len bytes at pkt carried in ip.
+// Returns 0 if no connection or listener wants it, so raw
+// readers still see it, as with UDP.
+int
+tcp_input(struct netif *nif, ip4_hdr_t *ip, uchar *pkt, int len)
+{
+  struct tcpcb *tp;
+  tcp_hdr_t *th;
+  uchar *data;
+  uint seq, ack, wnd, win, d;
+  int hlen, dlen, flags, fin, ok, seglen;
+
+  if(len < (int)sizeof(tcp_hdr_t))
+    return 0;
+  th = (tcp_hdr_t*)pkt;
+  hlen = (th->off >> 4) * 4;
+  if(hlen < (int)sizeof(*th) || hlen > len)
+    return 0;
+  if(memcmp(ip->dst, nif->ip, 4) != 0)
+    return 0;
+
+  acquire(&tcptab.lock);
+  if((tp = tcplookup(ntohs(th->dst), ip->src, ntohs(th->src))) == 0){
+    release(&tcptab.lock);
+    return 0;
+  }
+  if(!tcp_checksum_ok(ip, th, len))
+    goto done;
+  flags = th->flags;
+  seq = ntohl(th->seq);
+  ack = ntohl(th->ack);
+  wnd = ntohs(th->wnd);
+  data = pkt + hlen;
+  dlen = len - hlen;
+
+  switch(tp->state){
+  case TCP_LISTEN:
+    if(flags & TCP_RST)
+      goto done;
+    if(flags & TCP_ACK){
+      tcpreset(ip, th, dlen);
+      goto done;
+    }
+    if(flags & TCP_SYN)
+      tcpsyn(tp, ip, th, hlen);
+    goto done;
+
+  case TCP_SYN_SENT:
+    if((flags & TCP_ACK) &&
+       (SEQ_LEQ(ack, tp->iss) || SEQ_GT(ack, tp->snd_max))){
+      tcpreset(ip, th, dlen);
+      goto done;
+    }
+    if(flags & TCP_RST){
+      if(flags & TCP_ACK)
+        tcpdrop(tp);
+      goto done;
+    }
+    if(!(flags & TCP_SYN))
+      goto done;
+    tp->rcv_nxt = seq + 1;
+    tp->mss = tcpmss(th, hlen);
+    tp->snd_wnd = wnd;
+    if(flags & TCP_ACK){
+      tcpack(tp, ack, wnd, 0);
+      tp->state = TCP_ESTABLISHED;
+      tcpsendack(tp);
+    } else {
+      // Simultaneous open: send our SYN again, with an ACK.
+      tp->state = TCP_SYN_RCVD;
+      tp->snd_nxt = tp->iss;
+      tcpoutput(tp, 0);
+    }
+    goto done;
+  }
+
+  // Synchronized states: is the segment in the window (RFC 793)?
+  win = tcpwin(tp);
+  seglen = dlen + ((flags & TCP_SYN) != 0) + ((flags & TCP_FIN) != 0);
+  if(seglen == 0)
+    ok = win == 0 ? seq == tp->rcv_nxt :
+      SEQ_GEQ(seq, tp->rcv_nxt) && SEQ_LT(seq, tp->rcv_nxt + win);
+  else
+    ok = win != 0 &&
+      ((SEQ_GEQ(seq, tp->rcv_nxt) && SEQ_LT(seq, tp->rcv_nxt + win)) ||
+       (SEQ_GEQ(seq + seglen - 1, tp->rcv_nxt) &&
+        SEQ_LT(seq + seglen - 1, tp->rcv_nxt + win)));
+  if(!ok){
+    // A probe of our closed window, or an old duplicate.
+    if(!(flags & TCP_RST))
+      tcpsendack(tp);
+    goto done;
+  }
+  if(flags & TCP_RST){
+    tcpdrop(tp);
+    goto done;
+  }
+  if(flags & TCP_SYN){
+    tcpsend(tp, tp->snd_nxt, TCP_RST, 0, 0);
+    tcpdrop(tp);
+    goto done;
+  }
+  if(!(flags & TCP_ACK))
+    goto done;
+
+  // Trim what we already have.
+  fin = (flags & TCP_FIN) != 0;
+  if(SEQ_LT(seq, tp->rcv_nxt)){
+    d = tp->rcv_nxt - seq;
+    if(d > (uint)dlen){
+      fin = 0;
+      d = dlen;
+    }
+    data += d;
+    dlen -= d;
+    seq += d;
+  }
+
+  if(tp->state == TCP_SYN_RCVD){
+    if(SEQ_LEQ(ack, tp->snd_una) || SEQ_GT(ack, tp->snd_max)){
+      tcpreset(ip, th, dlen);
+      goto done;
+    }
+    tp->state = TCP_ESTABLISHED;
+    if(tp->parent)
+      wakeup(tp->parent);
+  }
+  if(SEQ_GT(ack, tp->snd_max)){
+    tcpsendack(tp);
+    goto done;
+  }
+  if(tcpack(tp, ack, wnd, dlen == 0 && !fin)){
+    switch(tp->state){
+    case TCP_FIN_WAIT_1:
+      tp->state = TCP_FIN_WAIT_2;
+      tp->expire = tcpwhen(TCP_FINWAIT);
+      break;
+    case TCP_CLOSING:
+      tp->state = TCP_TIME_WAIT;
+      tp->expire = tcpwhen(2 * TCP_MSL);
+      break;
+    case TCP_LAST_ACK:
+      tcbfree(tp);
+      goto done;
+    }
+  }
+
+  if(dlen > 0){
+    switch(tp->state){
+    case TCP_ESTABLISHED:
+    case TCP_FIN_WAIT_1:
+    case TCP_FIN_WAIT_2:
+      break;
+    default:
+      dlen = 0;
+    }
+  }
+  if(dlen > 0 && tp->orphan){
+    // Nobody will read it.
+    tcpsend(tp, tp->snd_nxt, TCP_RST, 0, 0);
+    tcpdrop(tp);
+    goto done;
+  }
+  if(dlen > 0){
+    if(seq == tp->rcv_nxt){
+      d = tp->rcv.size - tp->rcv.len;
+      if(d > (uint)dlen)
+        d = dlen;
+      bufcopy(&tp->rcv, tp->rcv.len, data, d, 0);
+      tp->rcv.len += d;
+      tp->rcv_nxt += d;
+      wakeup(tp);
+      // Acknowledge every second segment at once.
+      if(tp->delack)
+        tcpsendack(tp);
+      else
+        tp->delack = tcpwhen(TCP_DELACK);
+    } else {
+      // Out of order: ask again for the missing data.
+      tcpsendack(tp);
+    }
+  }
+  if(fin && seq + dlen == tp->rcv_nxt){
+    tp->rcv_nxt++;
+    tp->finrcvd = 1;
+    wakeup(tp);
+    switch(tp->state){
+    case TCP_ESTABLISHED:
+      tp->state = TCP_CLOSE_WAIT;
+      break;
+    case TCP_FIN_WAIT_1:
+      tp->state = TCP_CLOSING;
+      break;
+    case TCP_FIN_WAIT_2:
+      tp->state = TCP_TIME_WAIT;
+      tp->expire = tcpwhen(2 * TCP_MSL);
+      break;
+    }
+    tcpsendack(tp);
+  }
+  tcpoutput(tp, 0);
+
+done:
+  release(&tcptab.lock);
+  return 1;
+}
+
+// Run the timers of every connection that are due, and call again
+// when the next of the others is.
+static void
+tcptimer(void *arg)
+{
+  struct tcpcb *tp;
+  uint w;
+
+  (void)arg;
+  acquire(&tcptab.lock);
+  for(tp = tcptab.tcb; tp < &tcptab.tcb[NTCP]; tp++){
+    if(!tp->used)
+      continue;
+    if(due(tp->expire)){
+      tcbfree(tp);
+      continue;
+    }
+    if(due(tp->delack))
+      tcpsendack(tp);
+    if(!due(tp->rexmt))
+      continue;
+    tp->rexmt = 0;
+    if(tp->snd_wnd != 0 && ++tp->rxtshift > TCP_MAXRXT){
+      tcpsend(tp, tp->snd_nxt, TCP_RST, 0, 0);
+      tcpdrop(tp);
+      continue;
+    }
+    tp->rto *= 2;
+    if(tp->rto > TCP_RTOMAX)
+      tp->rto = TCP_RTOMAX;
+    tp->rtting = 0;
+    if(tp->state == TCP_SYN_SENT || tp->state == TCP_SYN_RCVD){
+      tp->snd_nxt = tp->iss;
+    } else {
+      // Go back to the oldest unacknowledged byte.  Unless this is
+      // a window probe, take it as loss and restart slow start.
+      if(tp->snd_wnd != 0){
+        w = tp->snd_max - tp->snd_una;
+        tp->ssthresh = w / 2 > 2 * tp->mss ? w / 2 : 2 * tp->mss;
+        tp->cwnd = tp->mss;
+      }
+      tp->dupacks = 0;
+      tp->snd_nxt = tp->snd_una;
+    }
+    tcpoutput(tp, tp->snd_wnd == 0);
+    if(tp->rexmt == 0 && tp->snd_max != tp->snd_una)
+      tp->rexmt = tcpwhen(tp->rto);
+  }
+  for(tp = tcptab.tcb; tp < &tcptab.tcb[NTCP]; tp++){
+    if(!tp->used)
+      continue;
+    if(tp->rexmt)
+      callsooner(&tcptab.timer, tp->rexmt);
+    if(tp->delack)
+      callsooner(&tcptab.timer, tp->delack);
+    if(tp->expire)
+      callsooner(&tcptab.timer, tp->expire);
+  }
+  release(&tcptab.lock);
+}
+
+// Bind tp to port, or to a free ephemeral port if port is 0.
+// Caller must hold tcptab.lock.
+static int
+tcpbind1(struct tcpcb *tp, int port)
+{
+  struct tcpcb *t;
+  int i;
+
+  if(tp->lport != 0 || port < 0 || port > 0xFFFF)
+    return -1;
+  if(port == 0){
+    for(i = PORT_EPHEMERAL; i <= 0xFFFF; i++){
+      port = tcptab.nextport++;
+      if(tcptab.nextport == 0)
+        tcptab.nextport = PORT_EPHEMERAL;
+      for(t = tcptab.tcb; t < &tcptab.tcb[NTCP]; t++)
+        if(t->used && t->lport == port)
+          break;
+      if(t == &tcptab.tcb[NTCP])
+        break;
+    }
+    if(i > 0xFFFF)
+      return -1;
+  } else {
+    // A connection lingering in TIME_WAIT does not hold its port.
+    for(t = tcptab.tcb; t < &tcptab.tcb[NTCP]; t++)
+      if(t->used && t->lport == port && t->state != TCP_TIME_WAIT)
+        return -1;
+  }
+  tp->lport = port;
+  return 0;
+}
+
+int
+tcpbind(struct tcpcb *tp, int port)
+{
+  int r;
+
+  acquire(&tcptab.lock);
+  r = tcpbind1(tp, port);
+  release(&tcptab.lock);
+  return r;
+}
+
+int
+tcplisten(struct tcpcb *tp, int backlog)
+{
+  acquire(&tcptab.lock);
+  if(tp->state != TCP_CLOSED || tp->err || tp->lport == 0){
+    release(&tcptab.lock);
+    return -1;
+  }
+  if(backlog < 1)
+    backlog = 1;
+  if(backlog > TCP_BACKLOG)
+    backlog = TCP_BACKLOG;
+  tp->backlog = backlog;
+  tp->state = TCP_LISTEN;
+  release(&tcptab.lock);
+  return 0;
+}
+
+static void
+tcppeer(struct tcpcb *tp, struct sockaddr_in *addr)
+{
+  if(addr){
+    memmove(addr->addr, tp->rip, 4);
+    addr->port = tp->rport;
+  }
+}
+
+// An established connection waiting on listener tp, or 0.
+// Caller must hold tcptab.lock.
+static struct tcpcb*
+tcpready(struct tcpcb *tp)
+{
+  struct tcpcb *c;
+
+  for(c = tcptab.tcb; c < &tcptab.tcb[NTCP]; c++)
+    if(c->used && c->parent == tp && c->state != TCP_SYN_RCVD)
+      return c;
+  return 0;
+}
+
+// Wait for a connection on listener tp and store it in *child.
+// The user's addr is filled in after tcptab.lock is released.
+int
+tcpaccept(struct tcpcb *tp, struct tcpcb **child, struct sockaddr_in *addr)
+{
+  struct sockaddr_in peer;
+  struct tcpcb *c;
+
+  acquire(&tcptab.lock);
+  for(;;){
+    if(tp->state != TCP_LISTEN || proc->killed){
+      release(&tcptab.lock);
+      return -1;
+    }
+    if((c = tcpready(tp)) != 0)
+      break;
+    sleep(tp, &tcptab.lock);
+  }
+  c->parent = 0;
+  tcppeer(c, &peer);
+  *child = c;
+  release(&tcptab.lock);
+  if(addr)
+    *addr = peer;
+  return 0;
+}
+
+// Open a connection to addr and wait until it is established.
+int
+tcpconnect(struct tcpcb *tp, struct sockaddr_in *addr)
+{
+  struct netif *nif;
+
+  acquire(&tcptab.lock);
+  if(tp->state != TCP_CLOSED || tp->err ||
+     (nif = ip_route(addr->addr, tp->hop)) == 0 ||
+     (tp->lport == 0 && tcpbind1(tp, 0) < 0) || tcpstart(tp) < 0){
+    release(&tcptab.lock);
+    return -1;
+  }
+  tp->nif = nif;
+  memmove(tp->lip, nif->ip, 4);
+  memmove(tp->rip, addr->addr, 4);
+  tp->rport = addr->port;
+  tp->state = TCP_SYN_SENT;
+  tcpoutput(tp, 0);
+  while(tp->state == TCP_SYN_SENT){
+    if(proc->killed){
+      tp->state = TCP_CLOSED;
+      tp->rexmt = 0;
+      tp->err = 1;
+      break;
+    }
+    sleep(tp, &tcptab.lock);
+  }
+  release(&tcptab.lock);
+  return tp->err ? -1 : 0;
+}
+
+// Read up to n bytes into buf.  Returns 0 at end of stream.  The
+// data goes through a kernel page a piece at a time, so that buf
+// and addr, which may fault, are never touched with tcptab.lock held.
+int
+tcpread(struct tcpcb *tp, char *buf, int n, struct sockaddr_in *addr)
+{
+  struct sockaddr_in peer;
+  char *kbuf;
+  uint win, m;
+  int tot, r;
+
+  if((kbuf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  acquire(&tcptab.lock);
+  for(tot = 0; tot < n; tot += m){
+    while(tp->rcv.len == 0){
+      if(tot > 0)
+        goto out;
+      if(tp->finrcvd || tp->err || tp->rcv.size == 0 || proc->killed){
+        r = tp->finrcvd ? 0 : -1;
+        goto out;
+      }
+      sleep(tp, &tcptab.lock);
+    }
+    m = n - tot;
+    if(m > tp->rcv.len)
+      m = tp->rcv.len;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    bufcopy(&tp->rcv, 0, (uchar*)kbuf, m, 1);
+    bufconsume(&tp->rcv, m);
+    if(tot == 0)
+      tcppeer(tp, &peer);
+    // Tell the peer once the window has opened by a useful amount.
+    win = tcpwin(tp) - (tp->rcv_adv - tp->rcv_nxt);
+    if(!tp->err && (win >= 2 * tp->mss || win >= tp->rcv.size / 2))
+      tcpsendack(tp);
+    release(&tcptab.lock);
+    memmove(buf + tot, kbuf, m);
+    acquire(&tcptab.lock);
+  }
+ out:
+  release(&tcptab.lock);
+  kfree(kbuf);
+  if(tot == 0)
+    return r;
+  if(addr)
+    *addr = peer;
+  return tot;
+}
+
+// Can data still be queued on tp?  Caller must hold tcptab.lock.
+static int
+tcpcansend(struct tcpcb *tp)
+{
+  return !tp->err &&
+    (tp->state == TCP_ESTABLISHED || tp->state == TCP_CLOSE_WAIT);
+}
+
+// Queue n bytes from buf for sending, sleeping while the send
+// buffer is full.  Like tcpread(), buf is copied through a kernel
+// page outside tcptab.lock.
+int
+tcpwrite(struct tcpcb *tp, char *buf, int n)
+{
+  char *kbuf;
+  uint m, k, c;
+  int i;
+
+  if((kbuf = kalloc()) == 0)
+    return -1;
+  for(i = 0; i < n; i += k){
+    k = n - i;
+    if(k > PGSIZE)
+      k = PGSIZE;
+    memmove(kbuf, buf + i, k);
+    acquire(&tcptab.lock);
+    for(c = 0; c < k; c += m){
+      if(!tcpcansend(tp) || proc->killed){
+        release(&tcptab.lock);
+        kfree(kbuf);
+        return i + c > 0 ? (int)(i + c) : -1;
+      }
+      m = tp->snd.size - tp->snd.len;
+      if(m == 0){
+        sleep(tp, &tcptab.lock);
+        continue;
+      }
+      if(m > k - c)
+        m = k - c;
+      bufcopy(&tp->snd, tp->snd.len, (uchar*)kbuf + c, m, 0);
+      tp->snd.len += m;
+      tcpoutput(tp, 0);
+    }
+    release(&tcptab.lock);
+  }
+  kfree(kbuf);
+  return n;
+}
+
+// Wait for room in the send buffer of tp and return how many bytes
+// fit, or -1 if the connection can send no more.
+int
+tcpspace(struct tcpcb *tp)
+{
+  int m;
+
+  acquire(&tcptab.lock);
+  for(;;){
+    if(!tcpcansend(tp) || proc->killed){
+      m = -1;
+      break;
+    }
+    if((m = tp->snd.size - tp->snd.len) > 0)
+      break;
+    sleep(tp, &tcptab.lock);
+  }
+  release(&tcptab.lock);
+  return m;
+}
+
+// Add what fits of n bytes from buf to the send buffer of tp,
+// without waiting and without sending.  Returns how many bytes, or
+// -1 if the connection can send no more.  tcppush() sends them.
+int
+tcpqueue(struct tcpcb *tp, char *buf, int n)
+{
+  uint m;
+
+  acquire(&tcptab.lock);
+  if(!tcpcansend(tp)){
+    release(&tcptab.lock);
+    return -1;
+  }
+  m = tp->snd.size - tp->snd.len;
+  if(m > (uint)n)
+    m = n;
+  bufcopy(&tp->snd, tp->snd.len, (uchar*)buf, m, 0);
+  tp->snd.len += m;
+  release(&tcptab.lock);
+  return m;
+}
+
+// Send what tcpqueue() left, as the windows allow.
+void
+tcppush(struct tcpcb *tp)
+{
+  acquire(&tcptab.lock);
+  tcpoutput(tp, 0);
+  release(&tcptab.lock);
+}
+
+// Which poll.h events are ready on tp: POLLIN when tcpread() or,
+// on a listener, tcpaccept() would not wait, POLLOUT when tcpwrite()
+// would not.  Everything that might change them wakes tp.
+int
+tcppoll(struct tcpcb *tp, int events)
+{
+  int r;
+
+  r = 0;
+  acquire(&tcptab.lock);
+  if(events & POLLIN){
+    if(tp->state == TCP_LISTEN ? tcpready(tp) != 0 :
+       tp->rcv.len > 0 || tp->finrcvd || tp->err || tp->rcv.size == 0)
+      r |= POLLIN;
+  }
+  if(events & POLLOUT){
+    if(tp->err)
+      r |= POLLERR;
+    else if(tp->state == TCP_ESTABLISHED || tp->state == TCP_CLOSE_WAIT){
+      if(tp->snd.len < tp->snd.size)
+        r |= POLLOUT;
+    } else if(tp->state != TCP_SYN_SENT)
+      r |= POLLERR;
+  }
+  if(r == 0)
+    pollwait(tp);
+  release(&tcptab.lock);
+  return r;
+}
+
+// Set a buffer size option before the connection starts.
+int
+tcpsetopt(struct tcpcb *tp, int opt, int val)
+{
+  uint *p;
+
+  if(opt == SO_SNDBUF)
+    p = &tp->sndsz;
+  else if(opt == SO_RCVBUF)
+    p = &tp->rcvsz;
+  else
+    return -1;
+  if(val <= 0 || val > TCP_BUFPG * PGSIZE)
+    return -1;
+  acquire(&tcptab.lock);
+  if(tp->snd.size != 0){
+    release(&tcptab.lock);
+    return -1;
+  }
+  *p = PGROUNDUP(val);
+  release(&tcptab.lock);
+  return 0;
+}
+
+// The socket is closing: send a FIN after the buffered data, or
+// reset if data is left unread.  The control block stays behind
+// until the connection finishes.
+void
+tcpclose(struct tcpcb *tp)
+{
+  struct tcpcb *c;
+
+  acquire(&tcptab.lock);
+  tp->orphan = 1;
+  switch(tp->state){
+  case TCP_LISTEN:
+    for(c = tcptab.tcb; c < &tcptab.tcb[NTCP]; c++){
+      if(c->used && c->parent == tp){
+        tcpsend(c, c->snd_nxt, TCP_RST | TCP_ACK, 0, 0);
+        tcbfree(c);
+      }
+    }
+    tcbfree(tp);
+    break;
+  case TCP_SYN_RCVD:
+  case TCP_ESTABLISHED:
+  case TCP_CLOSE_WAIT:
+    if(tp->state == TCP_SYN_RCVD || tp->rcv.len > 0){
+      tcpsend(tp, tp->snd_nxt, TCP_RST | TCP_ACK, 0, 0);
+      tcpdrop(tp);
+      break;
+    }
+    tp->finq = 1;
+    tp->state = tp->state == TCP_CLOSE_WAIT ? TCP_LAST_ACK : TCP_FIN_WAIT_1;
+    tcpoutput(tp, 0);
+    break;
+  default:
+    tcbfree(tp);
+  }
+  release(&tcptab.lock);
+}
@@ -3,10 +3,21 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define NBUF_MIN     32  // least size of disk block cache
+#define NBUF_SHARE   32  // disk block cache gets 1/NBUF_SHARE of free memory
+#define BFLUSH_TICKS 100  // ticks between write-backs of delayed writes
+#define NINODE_MIN   50  // least size of the i-node cache
+#define NINODE_SHARE 128 // i-node cache gets 1/NINODE_SHARE of free memory
+#define NREADAHEAD    8  // blocks read ahead of a sequential reader
+#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*3)  // max data sectors in one log area
 #define NDEV         10  // maximum major device number
+#define NETH          2  // maximum number of network cards
+#define NSHM         16  // maximum number of shared memory segments
+#define SHMMAXPAGES 256  // largest shared memory segment, in pages
 #define ROOTDEV       1  // device number of file system root disk
-#define USERTOP  0xA0000 // end of user address space
-#define PHYSTOP  0x1000000 // use phys mem up to here as free pool
+#define USERBASE 0x40000000 // start of user address space; see Makefile
+#define USERTOP  0x80000000 // end of user address space
+#define PHYSTOP  USERBASE   // use no phys mem above this, whatever is there
+#define E820MAP  0x6000     // where bootasm.S leaves the BIOS memory map
 #define MAXARG       32  // max exec arguments
@@ -0,0 +1,50 @@
+// PCI configuration space, through configuration mechanism #1.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_ADDR  0xcf8
+#define PCI_DATA  0xcfc
+
+static uint
+pciaddr(uint bdf, int off)
+{
+  return 0x80000000 | bdf << 8 | (off & 0xfc);
+}
+
+// Read the 32-bit configuration register at off of function bdf,
+// which is bus << 8 | device << 3 | function.
+uint
+pciread(uint bdf, int off)
+{
+  outl(PCI_ADDR, pciaddr(bdf, off));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(uint bdf, int off, uint v)
+{
+  outl(PCI_ADDR, pciaddr(bdf, off));
+  outl(PCI_DATA, v);
+}
+
+// Find the first function of the given class and subclass on
+// bus 0 and store it in *bdf.  Returns 0, or -1 if there is none.
+int
+pcifind(int class, int subclass, uint *bdf)
+{
+  uint f, id, cls;
+
+  for(f = 0; f < 32*8; f++){
+    id = pciread(f, 0x00);
+    if((id & 0xffff) == 0xffff)
+      continue;
+    cls = pciread(f, 0x08);
+    if((int)(cls >> 24) == class && (int)((cls >> 16) & 0xff) == subclass){
+      *bdf = f;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -6,18 +6,69 @@
 #include "fs.h"
 #include "file.h"
 #include "spinlock.h"
+#include "fcntl.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of whole pages, one unless the reader or
+// writer asks for more with the PIPE_SETSIZE ioctl.  Reads and writes
+// copy a run of bytes at a time, up to the end of a page.  The number
+// of pages is a power of two so that the byte counts may wrap.
+#define PIPEMAXPAGES 16
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES];
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct kcache *pipecache;
+
+// Runs once per pipe object; the lock stays initialized across uses.
+static void
+pipector(void *v)
+{
+  initlock(&((struct pipe*)v)->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  if((pipecache = kcache_create("pipe", sizeof(struct pipe), pipector)) == 0)
+    panic("pipeinit");
+}
+
+// Where byte number i of the stream goes in p's ring.
+static char*
+pipebuf(struct pipe *p, uint i)
+{
+  i %= p->size;
+  return p->page[i / PGSIZE] + i % PGSIZE;
+}
+
+// Bytes from byte number i to the end of its page, at most n.
+static uint
+piperun(uint i, uint n)
+{
+  uint m;
+
+  m = PGSIZE - i % PGSIZE;
+  return m < n ? m : n;
+}
+
+static void
+pipefree(struct pipe *p)
+{
+  uint i;
+
+  for(i = 0; i < p->size / PGSIZE; i++)
+    kfree(p->page[i]);
+  kcache_free(pipecache, p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -27,13 +78,16 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kcache_alloc(pipecache)) == 0)
     goto bad;
+  p->size = 0;
+  if((p->page[0] = kalloc()) == 0)
+    goto bad;
+  p->size = PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
-  initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -46,7 +100,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -67,19 +121,106 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// Give p a ring of at least n bytes, at most PIPEMAXPAGES pages,
+// keeping what is in it.  Returns the new size, or -1 if there is
+// no memory or the data would not fit.
+static int
+pipesetsize(struct pipe *p, int n)
+{
+  char *page[PIPEMAXPAGES];
+  uint npages, i, m, len;
+
+  if(n <= 0 || n > PIPEMAXPAGES*PGSIZE)
+    return -1;
+  for(npages = 1; npages*PGSIZE < (uint)n; npages *= 2)
+    ;
+  for(i = 0; i < npages; i++){
+    if((page[i] = kalloc()) == 0){
+      while(i > 0)
+        kfree(page[--i]);
+      return -1;
+    }
+  }
+
+  acquire(&p->lock);
+  len = p->nwrite - p->nread;
+  if(len > npages*PGSIZE){
+    release(&p->lock);
+    for(i = 0; i < npages; i++)
+      kfree(page[i]);
+    return -1;
+  }
+  // Move the data to the start of the new ring.
+  for(i = 0; i < len; i += m){
+    m = piperun(p->nread + i, len - i);
+    m = piperun(i, m);
+    memmove(page[i / PGSIZE] + i % PGSIZE, pipebuf(p, p->nread + i), m);
+  }
+  for(i = 0; i < p->size / PGSIZE; i++)
+    kfree(p->page[i]);
+  memmove(p->page, page, npages * sizeof(page[0]));
+  p->size = npages*PGSIZE;
+  p->nread = 0;
+  p->nwrite = len;
+  wakeup(&p->nwrite);   // there may be room now
+  release(&p->lock);
+  return p->size;
+}
+
+int
+pipeioctl(struct pipe *p, int request, void *argp)
+{
+  switch(request){
+  case PIPE_GETSIZE:
+    return p->size;
+  case PIPE_SETSIZE:
+    return pipesetsize(p, (int)argp);
+  }
+  return -1;
+}
+
+// Readers sleep on nread and writers on nwrite.
+int
+pipepoll(struct pipe *p, int events)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(events & POLLIN){
+    if(p->nread != p->nwrite)
+      r |= POLLIN;
+    else if(!p->writeopen)
+      r |= POLLHUP;
+    else
+      pollwait(&p->nread);
+  }
+  if(events & POLLOUT){
+    if(!p->readopen)
+      r |= POLLERR;
+    else if(p->nwrite != p->nread + p->size)
+      r |= POLLOUT;
+    else
+      pollwait(&p->nwrite);
+  }
+  release(&p->lock);
+  return r;
+}
+
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || proc->killed){
         release(&p->lock);
         return -1;
@@ -87,7 +228,11 @@ pipewrite(struct pipe *p, char *addr, int n)
       wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = piperun(p->nwrite, p->nread + p->size - p->nwrite);
+    if(m > (uint)(n - i))
+      m = n - i;
+    memmove(pipebuf(p, p->nwrite), addr + i, m);
+    p->nwrite += m;
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
@@ -98,6 +243,7 @@ int
 piperead(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -107,10 +253,12 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = piperun(p->nread, p->nwrite - p->nread);
+    if(m > (uint)(n - i))
+      m = n - i;
+    memmove(addr + i, pipebuf(p, p->nread), m);
+    p->nread += m;
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
@@ -0,0 +1,12 @@
+// poll() events, asked for in events and reported in revents.
+#define POLLIN   0x01   // a read would not block
+#define POLLOUT  0x04   // a write would not block
+#define POLLERR  0x08   // a write would fail
+#define POLLHUP  0x10   // the writer has gone; reads return 0
+#define POLLNVAL 0x20   // fd is not open
+
+struct pollfd {
+  int fd;
+  short events;
+  short revents;
+};
@@ -2,14 +2,82 @@
 #include "stat.h"
 #include "user.h"
 
+// Output to the first NPBUF fds is buffered, and goes out when the
+// buffer fills, at each newline if the fd is a device such as the
+// console, and on printflush(), fork(), exec(), exit() and close()
+// (see ulib.c).  Output to other fds goes out at the end of each
+// printf().  Output written with write() is not ordered with what
+// printf() still holds.
+#define NPBUF     8
+#define PBUFSIZE  256
+
+#define PB_UNKNOWN 0    // not looked at since the fd was opened
+#define PB_LINE    1    // device: flush at each newline
+#define PB_FULL    2    // file or pipe: flush when full
+
+struct pbuf {
+  uint lock;            // mutexlock(), for threads
+  int mode;
+  int n;
+  char buf[PBUFSIZE];
+};
+
+static struct pbuf pbuf[NPBUF];
+
+extern void (*ulibflush)(int);
+
 static void
-putc(int fd, char c)
+pflush(int fd, struct pbuf *b)
 {
-  write(fd, &c, 1);
+  if(b->n > 0)
+    write(fd, b->buf, b->n);
+  b->n = 0;
+}
+
+static void
+putc(int fd, struct pbuf *b, char c)
+{
+  b->buf[b->n++] = c;
+  if(b->n == PBUFSIZE || (c == '\n' && b->mode == PB_LINE))
+    pflush(fd, b);
+}
+
+// Flush what printf() holds for fd, or for every fd if fd is -1.
+void
+printflush(int fd)
+{
+  int i;
+
+  for(i = 0; i < NPBUF; i++){
+    if(fd >= 0 && i != fd)
+      continue;
+    mutexlock(&pbuf[i].lock);
+    pflush(i, &pbuf[i]);
+    mutexunlock(&pbuf[i].lock);
+  }
 }
 
+// ulib.c calls here before fork(), exec(), exit() and close().
+// After a close the fd may come back as some other file.
 static void
-printint(int fd, int xx, int base, int sgn)
+flushclose(int fd)
+{
+  printflush(fd);
+  if(fd >= 0 && fd < NPBUF)
+    pbuf[fd].mode = PB_UNKNOWN;
+}
+
+// Pad to width with spaces, before what fills n places, or after it
+// if width is negative.
+static void
+pad(int fd, struct pbuf *b, int n, int width)
+{
+  for(; n < width; n++)
+    putc(fd, b, ' ');
+}
+
+static void
+printint(int fd, struct pbuf *b, int xx, int base, int sgn, int width)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -31,55 +99,96 @@ printint(int fd, int xx, int base, int sgn)
   if(neg)
     buf[i++] = '-';
 
-  while(--i >= 0)
-    putc(fd, buf[i]);
+  pad(fd, b, i, width);
+  width = -width;
+  for(neg = i; --i >= 0; )
+    putc(fd, b, buf[i]);
+  pad(fd, b, neg, width);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
+// Print to the given fd. Only understands %d, %x, %p, %s and %c,
+// each with an optional width, as in %5d, or %-8s to pad on the right.
 void
 printf(int fd, char *fmt, ...)
 {
+  struct pbuf *b, local;
+  struct stat st;
   char *s;
-  int c, i, state;
+  int c, i, n, state, width, left;
   uint *ap;
 
-  state = 0;
+  if(fd >= 0 && fd < NPBUF){
+    b = &pbuf[fd];
+    mutexlock(&b->lock);
+    if(b->mode == PB_UNKNOWN){
+      ulibflush = flushclose;
+      b->mode = PB_FULL;
+      if(fstat(fd, &st) == 0 && st.type == T_DEV)
+        b->mode = PB_LINE;
+    }
+  } else {
+    b = &local;
+    b->mode = PB_FULL;
+    b->n = 0;
+  }
+
+  state = width = left = 0;
   ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
     if(state == 0){
       if(c == '%'){
         state = '%';
+        width = left = 0;
       } else {
-        putc(fd, c);
+        putc(fd, b, c);
       }
     } else if(state == '%'){
+      if(c == '-' && width == 0 && !left){
+        left = 1;
+        continue;
+      } else if(c >= '0' && c <= '9'){
+        width = width*10 + c - '0';
+        continue;
+      }
+      if(left)
+        width = -width;
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(fd, b, *ap, 10, 1, width);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(fd, b, *ap, 16, 0, width);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
         ap++;
         if(s == 0)
           s = "(null)";
+        n = strlen(s);
+        pad(fd, b, n, width);
         while(*s != 0){
-          putc(fd, *s);
+          putc(fd, b, *s);
           s++;
         }
+        pad(fd, b, n, -width);
       } else if(c == 'c'){
-        putc(fd, *ap);
+        pad(fd, b, 1, width);
+        putc(fd, b, *ap);
+        pad(fd, b, 1, -width);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(fd, b, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(fd, b, '%');
+        putc(fd, b, c);
       }
       state = 0;
     }
   }
+
+  if(b == &local)
+    pflush(fd, b);
+  else
+    mutexunlock(&b->lock);
 }
@@ -3,12 +3,61 @@
 #include "param.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sched.h"
+#include "trace.h"
+#include "kstat.h"
+
+// Each CPU has a queue of the RUNNABLE processes that last ran on
+// it, so scheduler() picks the next one without scanning the table.
+// A CPU with an empty queue takes work from the longest queue.
+// The queues are guarded by ptable.lock, like every state change.
+//
+// A queue has NPRIO levels, and the first process of the first
+// non-empty level runs next.  Real-time processes sit at the fixed
+// level setpriority() gave them, above all others.  Time-sharing
+// processes form a multi-level feedback queue below: one starts at
+// the level of its nice value, drops a level each time the clock
+// takes the CPU from it, and goes back to its first level when an
+// interrupt handler wakes it, and every PRIO_BOOST ticks so that
+// none starves.
+//
+// A SLEEPING process is on the wait queue that its channel hashes
+// to, so wakeup() looks only at processes that might be waiting on
+// the channel.  poll() puts a process on the queues of several
+// channels with pollwait() before it goes to sleep in pollsleep(),
+// and a wakeup on any of them takes it off all of them.  A wakeup
+// that comes while the process is still looking at its files leaves
+// it woken, so that pollsleep() does not sleep at all.
+//
+// Every process is on the hash chain of its pid, or on the free list
+// while UNUSED, and on the list of its parent's children, so
+// allocproc(), wait(), exit() and kill() never scan the table.
+#define NWAITQ 64
+#define WAITQ(chan) (&ptable.waitq[((uint)(chan) >> 3) % NWAITQ])
+#define NPIDHASH 64
+#define PIDHASH(pid) (&ptable.pidhash[(uint)(pid) % NPIDHASH])
+
+#define NTSPRIO    8    // time-sharing levels
+#define NPRIO      (NRTPRIO + NTSPRIO)
+#define PRIO_BOOST 100  // ticks between raising all time-sharing processes
+
+struct runq {
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;
+};
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct runq runq[NCPU];
+  struct waiter *waitq[NWAITQ];
+  struct proc *pidhash[NPIDHASH];
+  struct proc *free;    // UNUSED processes
+  uint boosted;         // ticks at the last raise
 } ptable;
 
 static struct proc *initproc;
@@ -17,15 +66,275 @@ int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static int wakeup1(void *chan, int boost, int n);
+static void idle(void);
 
 void
 pinit(void)
 {
+  struct proc *p;
+
   initlock(&ptable.lock, "ptable");
+  for(p = &ptable.proc[NPROC-1]; p >= ptable.proc; p--){
+    p->rqnext = ptable.free;
+    ptable.free = p;
+  }
+}
+
+// The process with pid, or 0.  The ptable lock must be held.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = *PIDHASH(pid); p; p = p->pidnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Mark p UNUSED and put it back on the free list.
+// The ptable lock must be held.
+static void
+putproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = PIDHASH(p->pid); *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  p->pidnext = 0;
+  p->state = UNUSED;
+  p->pid = 0;
+  p->rqnext = ptable.free;
+  ptable.free = p;
+}
+
+// Make p, which must be new, a child of the current process.
+// The ptable lock must be held.
+static void
+addchild(struct proc *p)
+{
+  p->parent = proc;
+  p->sibling = proc->children;
+  proc->children = p;
+}
+
+// The level p starts at and returns to.
+static int
+toplevel(struct proc *p)
+{
+  if(p->class == SCHED_RT)
+    return p->level;
+  return NRTPRIO + p->level;
+}
+
+// Put p at the end of its level of q.  The ptable lock must be held.
+static void
+rqadd(struct runq *q, struct proc *p)
+{
+  p->rqnext = 0;
+  if(q->tail[p->prio])
+    q->tail[p->prio]->rqnext = p;
+  else
+    q->head[p->prio] = p;
+  q->tail[p->prio] = p;
+  q->n++;
+}
+
+// Run queue q has gained work: see that a CPU will look at it.  If
+// q's CPU is idle, wake it with an IPI; if it is busy and q holds
+// more than it will take next, wake an idle CPU to take some.
+// The ptable lock must be held.
+static void
+kick(struct runq *q)
+{
+  struct cpu *c;
+
+  c = &cpus[q - ptable.runq];
+  if(!c->idle){
+    if(q->n < 2)
+      return;
+    for(c = cpus; c < cpus+ncpu; c++)
+      if(c->idle)
+        break;
+    if(c == cpus+ncpu)
+      return;
+  }
+  c->idle = 0;
+  if(c != cpu)
+    lapicipi(c->id, T_IRQ0 + IRQ_WAKE);
+}
+
+// Mark p RUNNABLE and queue it on the CPU it last ran on.
+// The ptable lock must be held.
+static void
+makerunnable(struct proc *p)
+{
+  p->state = RUNNABLE;
+  rqadd(&ptable.runq[p->cpu], p);
+  kick(&ptable.runq[p->cpu]);
+}
+
+// Take RUNNABLE p off its run queue.  The ptable lock must be held.
+static void
+rqremove(struct proc *p)
+{
+  struct runq *q;
+  struct proc **pp, *prev;
+
+  for(q = ptable.runq; q < &ptable.runq[NCPU]; q++){
+    prev = 0;
+    for(pp = &q->head[p->prio]; *pp; prev = *pp, pp = &(*pp)->rqnext){
+      if(*pp == p){
+        *pp = p->rqnext;
+        if(q->tail[p->prio] == p)
+          q->tail[p->prio] = prev;
+        q->n--;
+        p->rqnext = 0;
+        return;
+      }
+    }
+  }
+}
+
+// Raise every time-sharing process to its first level.
+// The ptable lock must be held.
+static void
+prioboost(void)
+{
+  struct runq *q;
+  struct proc *p, *list;
+  int i;
+
+  for(q = ptable.runq; q < &ptable.runq[NCPU]; q++){
+    for(i = NRTPRIO + 1; i < NPRIO; i++){
+      list = q->head[i];
+      q->head[i] = q->tail[i] = 0;
+      while((p = list) != 0){
+        list = p->rqnext;
+        q->n--;
+        p->prio = toplevel(p);
+        rqadd(q, p);
+      }
+    }
+  }
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED)
+      p->prio = toplevel(p);
+  ptable.boosted = ticks;
+}
+
+// Put the current process on the wait queue of chan, unless it is
+// there already.  Returns -1 if it waits on NWAIT channels already.
+// The ptable lock must be held.
+static int
+waitadd(void *chan)
+{
+  struct waiter *w;
+
+  for(w = proc->wait; w < &proc->wait[proc->nwait]; w++)
+    if(w->chan == chan)
+      return 0;
+  if(proc->nwait == NWAIT)
+    return -1;
+  w->chan = chan;
+  w->p = proc;
+  w->next = *WAITQ(chan);
+  *WAITQ(chan) = w;
+  proc->nwait++;
+  return 0;
+}
+
+// Take p off all its wait queues.  The ptable lock must be held.
+static void
+unsleep(struct proc *p)
+{
+  struct waiter *w, **pp;
+
+  for(w = p->wait; w < &p->wait[p->nwait]; w++){
+    for(pp = WAITQ(w->chan); *pp; pp = &(*pp)->next){
+      if(*pp == w){
+        *pp = w->next;
+        break;
+      }
+    }
+    w->next = 0;
+  }
+  p->nwait = 0;
+}
+
+// Take p off its wait queues and let it run: at once if it sleeps,
+// or else instead of its next pollsleep().  Raise it to its first
+// level if boost is set.  The ptable lock must be held.
+static void
+wake(struct proc *p, int boost)
+{
+  unsleep(p);
+  if(p->state != SLEEPING){
+    p->woken = 1;
+    return;
+  }
+  if(boost)
+    p->prio = toplevel(p);
+  TRACE(TR_WAKE, p->pid, boost);
+  makerunnable(p);
+}
+
+// Take the first process of the first level off q.
+// The ptable lock must be held.
+static struct proc*
+rqtake(struct runq *q)
+{
+  struct proc *p;
+  int i;
+
+  for(i = 0; i < NPRIO; i++){
+    if((p = q->head[i]) == 0)
+      continue;
+    if((q->head[i] = p->rqnext) == 0)
+      q->tail[i] = 0;
+    q->n--;
+    p->rqnext = 0;
+    return p;
+  }
+  return 0;
+}
+
+// The next process for this CPU to run: the first on its own queue
+// or, if that is empty, the first on the longest other queue.
+// The ptable lock must be held.
+static struct proc*
+pickproc(void)
+{
+  struct runq *q, *busiest;
+
+  if(ticks - ptable.boosted >= PRIO_BOOST)
+    prioboost();
+  if((q = &ptable.runq[cpu->id])->n > 0)
+    return rqtake(q);
+  busiest = 0;
+  for(q = ptable.runq; q < &ptable.runq[NCPU]; q++)
+    if(q->n > 0 && (busiest == 0 || q->n > busiest->n))
+      busiest = q;
+  if(busiest == 0)
+    return 0;
+  return rqtake(busiest);
 }
 
-// Look in the process table for an UNUSED proc.
+// Give back p, fresh from allocproc(), which never ran.
+static void
+unalloc(struct proc *p)
+{
+  if(p->kstack)
+    kfree(p->kstack);
+  p->kstack = 0;
+  acquire(&ptable.lock);
+  putproc(p);
+  release(&ptable.lock);
+}
+
+// Take an UNUSED proc off the free list.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
@@ -36,20 +345,34 @@ allocproc(void)
   char *sp;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-  release(&ptable.lock);
-  return 0;
-
-found:
+  if((p = ptable.free) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  ptable.free = p->rqnext;
+  p->rqnext = 0;
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->pidnext = *PIDHASH(p->pid);
+  *PIDHASH(p->pid) = p;
+  p->parent = 0;
+  p->children = 0;
+  p->sibling = 0;
+  p->cpu = cpu->id;
+  p->class = SCHED_TS;
+  p->level = 0;
+  p->prio = toplevel(p);
+  p->utime = p->stime = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->faults = 0;
+  p->inblock = p->oublock = 0;
+  p->ethrx = p->ethtx = 0;
+  p->vfork = 0;
   release(&ptable.lock);
 
   // Allocate kernel stack if possible.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    unalloc(p);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -83,20 +406,79 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
+  p->sz = USERBASE + PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
   p->tf->es = p->tf->ds;
   p->tf->ss = p->tf->ds;
   p->tf->eflags = FL_IF;
-  p->tf->esp = PGSIZE;
-  p->tf->eip = 0;  // beginning of initcode.S
+  p->tf->esp = USERBASE + PGSIZE;
+  p->tf->eip = USERBASE;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->fdt = fdtalloc()) == 0)
+    panic("userinit: out of descriptor tables");
+  p->fdt->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  acquire(&ptable.lock);
+  makerunnable(p);
+  release(&ptable.lock);
+}
+
+static void
+kprocmain(void (*fn)(void*), void *arg)
+{
+  fn(arg);
+  panic("kproc returned");
+}
+
+// Start a kernel process running fn(arg).  It has no user memory
+// and never leaves the kernel, so fn must not return.
+int
+kproc(char *name, void (*fn)(void*), void *arg)
+{
+  struct proc *p;
+  uint *sp;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  if((p->pgdir = setupkvm()) == 0){
+    unalloc(p);
+    return -1;
+  }
+  // Have forkret return into kprocmain(fn, arg) instead of trapret.
+  // The trap frame above the context is not needed.
+  sp = (uint*)(p->context + 1);
+  sp[0] = (uint)kprocmain;
+  sp[1] = 0;    // kprocmain never returns
+  sp[2] = (uint)fn;
+  sp[3] = (uint)arg;
+  safestrcpy(p->name, name, sizeof(p->name));
+  acquire(&ptable.lock);
+  makerunnable(p);
+  release(&ptable.lock);
+  return p->pid;
+}
+
+// Set the size of the current process's memory, and of the
+// threads sharing it.  The ptable lock must be held.
+static void
+setsz1(uint sz)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->pgdir == proc->pgdir)
+      p->sz = sz;
+}
+
+void
+setsz(uint sz)
+{
+  acquire(&ptable.lock);
+  setsz1(sz);
+  release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
@@ -106,17 +488,31 @@ growproc(int n)
 {
   uint sz;
   
+  acquire(&ptable.lock);
   sz = proc->sz;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    // Pages are left unmapped until first touched; see zerofault().
+    if(sz + n > USERTOP || sz + n < sz)
+      goto bad;
+    // User space is far larger than memory: refuse what could
+    // never be filled in, so malloc() fails rather than faults.
+    if((uint)n / PGSIZE > (uint)kfreepages())
+      goto bad;
+    sz += n;
   } else if(n < 0){
+    if(sz + n < USERBASE || sz + n > sz)
+      goto bad;
     if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
-      return -1;
+      goto bad;
   }
-  proc->sz = sz;
+  setsz1(sz);
+  release(&ptable.lock);
   switchuvm(proc);
   return 0;
+
+bad:
+  release(&ptable.lock);
+  return -1;
 }
 
 // Create a new process copying p as the parent.
@@ -125,7 +521,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
 
   // Allocate process.
@@ -134,26 +530,128 @@ fork(void)
 
   // Copy process state from p.
   if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    unalloc(np);
     return -1;
   }
   np->sz = proc->sz;
-  np->parent = proc;
+  np->class = proc->class;
+  np->level = proc->level;
+  np->prio = toplevel(np);
   *np->tf = *proc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(proc->ofile[i])
-      np->ofile[i] = filedup(proc->ofile[i]);
-  np->cwd = idup(proc->cwd);
+  if((np->fdt = fdtcopy()) == 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    unalloc(np);
+    return -1;
+  }
   
   pid = np->pid;
-  np->state = RUNNABLE;
   safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  addchild(np);
+  makerunnable(np);
+  release(&ptable.lock);
+  return pid;
+}
+
+// Create a child process that borrows the memory of the current one
+// until it calls exec() or exit(), while the current one waits.  It
+// skips the copy of the page table that fork() makes.  The child
+// runs on its parent's stack; usys.S keeps the return address in a
+// register for that.  Returns the child's pid, as fork() does.
+int
+vfork(void)
+{
+  int pid;
+  struct proc *np;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  if((np->fdt = fdtcopy()) == 0){
+    unalloc(np);
+    return -1;
+  }
+
+  kdup((char*)proc->pgdir);
+  np->pgdir = proc->pgdir;
+  np->sz = proc->sz;
+  np->class = proc->class;
+  np->level = proc->level;
+  np->prio = toplevel(np);
+  *np->tf = *proc->tf;
+  np->tf->eax = 0;
+  np->vfork = 1;
+
+  pid = np->pid;
+  safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  addchild(np);
+  makerunnable(np);
+  // np cannot be freed meanwhile: only this process can reap it.
+  while(np->vfork && !proc->killed)
+    sleep(np, &ptable.lock);
+  release(&ptable.lock);
+  return pid;
+}
+
+// The current process, a vfork() child, no longer uses its parent's
+// memory: let the parent go on.
+void
+vforkdone(void)
+{
+  acquire(&ptable.lock);
+  if(proc->vfork){
+    proc->vfork = 0;
+    wakeup1(proc, 0, NPROC);
+  }
+  release(&ptable.lock);
+}
+
+// Create a thread: a process sharing the memory of the current one,
+// which calls fn(arg) on the user stack [stack, stack+size).  fn must
+// not return, but call exit().  The thread shares the descriptor
+// table and current directory too.  Returns its pid, for join().
+int
+clone(void (*fn)(void*), void *arg, char *stack, uint size)
+{
+  int pid;
+  struct proc *np;
+  uint sp;
+
+  if(size < 2*sizeof(uint) || (np = allocproc()) == 0)
+    return -1;
+
+  // The page table counts its users; see freevm().
+  kdup((char*)proc->pgdir);
+  np->pgdir = proc->pgdir;
+  np->sz = proc->sz;
+  np->class = proc->class;
+  np->level = proc->level;
+  np->prio = toplevel(np);
+  np->ustack = stack;
+  *np->tf = *proc->tf;
+
+  // Push arg and a return address that faults.  The memory is
+  // shared and this page table is loaded.
+  sp = ((uint)stack + size) & ~3;
+  sp -= 2*sizeof(uint);
+  ((uint*)sp)[0] = 0xFFFFFFFF;
+  ((uint*)sp)[1] = (uint)arg;
+  np->tf->esp = sp;
+  np->tf->eip = (uint)fn;
+
+  np->fdt = fdtshare(proc->fdt);
+  
+  pid = np->pid;
+  safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  addchild(np);
+  makerunnable(np);
+  release(&ptable.lock);
   return pid;
 }
 
@@ -164,34 +662,36 @@ void
 exit(void)
 {
   struct proc *p;
-  int fd;
 
   if(proc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd]){
-      fileclose(proc->ofile[fd]);
-      proc->ofile[fd] = 0;
-    }
-  }
-
-  iput(proc->cwd);
-  proc->cwd = 0;
+  // Close all open files, unless other threads still use them.
+  fdrelease();
+  fdtclose(proc->fdt);
+  proc->fdt = 0;
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
-  wakeup1(proc->parent);
+  // Parent might be sleeping in wait(), or in vfork().
+  wakeup1(proc->parent, 0, NPROC);
+  if(proc->vfork){
+    proc->vfork = 0;
+    wakeup1(proc, 0, NPROC);
+  }
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == proc){
+  if(proc->children){
+    for(p = proc->children; ; p = p->sibling){
       p->parent = initproc;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup1(initproc, 0, NPROC);
+      if(p->sibling == 0)
+        break;
     }
+    p->sibling = initproc->children;
+    initproc->children = proc->children;
+    proc->children = 0;
   }
 
   // Jump into the scheduler, never to return.
@@ -200,33 +700,46 @@ exit(void)
   panic("zombie exit");
 }
 
+// Free zombie p, which the caller has taken off its parent's list
+// of children.  The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  kfree(p->kstack);
+  p->kstack = 0;
+  freevm(p->pgdir);
+  p->pgdir = 0;
+  p->parent = 0;
+  p->sibling = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->ustack = 0;
+  putproc(p);
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads are left to join(); a vfork() child that exited without
+// exec() shares the page table too, but is no thread.
 int
 wait(void)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids, pid;
 
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for zombie children.
+    // Scan through the children looking for zombies.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != proc)
+    for(pp = &proc->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->pgdir == proc->pgdir && p->ustack)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
+        *pp = p->sibling;
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->state = UNUSED;
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -243,6 +756,39 @@ wait(void)
   }
 }
 
+// Wait for a thread made by clone() to exit and return its pid,
+// with the stack it was given in *stack.
+// Return -1 if this process has no threads.
+int
+join(void **stack)
+{
+  struct proc *p, **pp;
+  int havekids, pid;
+
+  acquire(&ptable.lock);
+  for(;;){
+    havekids = 0;
+    for(pp = &proc->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->pgdir != proc->pgdir || !p->ustack)
+        continue;
+      havekids = 1;
+      if(p->state == ZOMBIE){
+        *pp = p->sibling;
+        pid = p->pid;
+        *stack = p->ustack;
+        freeproc(p);
+        release(&ptable.lock);
+        return pid;
+      }
+    }
+    if(!havekids || proc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(proc, &ptable.lock);
+  }
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns. It loops, doing:
@@ -254,35 +800,63 @@ void
 scheduler(void)
 {
   struct proc *p;
+  int ran;
 
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
+    // Run what is queued for this CPU, or take work from another.
+    ran = 0;
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
+    cpu->idle = 0;
+    while((p = pickproc()) != 0){
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       proc = p;
+      p->cpu = cpu->id;
       switchuvm(p);
       p->state = RUNNING;
+      TRACE(TR_SWITCH, p->pid, cpu->id);
       swtch(&cpu->scheduler, proc->context);
       switchkvm();
+      ran = 1;
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       proc = 0;
     }
+    // Nothing is runnable.  From here on a CPU that queues work
+    // for this one sends an IPI, and clears idle.
+    cpu->idle = 1;
     release(&ptable.lock);
 
+    // Idle: get pages ready for kzalloc(), then wait for an interrupt.
+    if(!ran)
+      kzfill();
+    idle();
   }
 }
 
+// Halt until an interrupt, unless kick() has been here since
+// scheduler() set cpu->idle.  Only CPU 0 keeps the clock, so the
+// others stop their timer while they halt.
+static void
+idle(void)
+{
+  cli();
+  if(cpu->idle){
+    if(cpu->id != 0)
+      lapictimer(0);
+    stihlt();
+    cli();
+    if(cpu->id != 0)
+      lapictimer(1);
+  }
+  sti();
+}
+
 // Enter scheduler.  Must hold only ptable.lock
 // and have changed proc->state.
 void
@@ -298,6 +872,10 @@ sched(void)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
+  if(proc->state == RUNNABLE)
+    proc->nivcsw++;
+  else
+    proc->nvcsw++;
   intena = cpu->intena;
   swtch(&proc->context, cpu->scheduler);
   cpu->intena = intena;
@@ -308,7 +886,20 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  proc->state = RUNNABLE;
+  makerunnable(proc);
+  sched();
+  release(&ptable.lock);
+}
+
+// The clock took the CPU from the current process.  A time-sharing
+// one has used up its time at this level and drops to the next.
+void
+tickyield(void)
+{
+  acquire(&ptable.lock);
+  if(proc->class == SCHED_TS && proc->prio < NPRIO - 1)
+    proc->prio++;
+  makerunnable(proc);
   sched();
   release(&ptable.lock);
 }
@@ -318,8 +909,22 @@ yield(void)
 void
 forkret(void)
 {
+  static int first = 1;
+  int recover;
+
   // Still holding ptable.lock from scheduler.
+  recover = first;
+  first = 0;
   release(&ptable.lock);
+
+  if(recover){
+    // Time to user space, counted from clockinit(); boot is well
+    // inside the 4 seconds a 32-bit count of nanoseconds holds.
+    cprintf("first process at %d us\n", (uint)nanotime() / 1000);
+    // Replaying the log reads the disk, so it needs a process
+    // to sleep in; FS system calls wait for it in begin_op().
+    initlog();
+  }
   
   // Return to "caller", actually trapret (see allocproc).
 }
@@ -335,6 +940,11 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
+  // A process looking at its files for poll() must not sleep
+  // on anything else.
+  if(proc->nwait)
+    panic("sleep while polling");
+
   // Must acquire ptable.lock in order to
   // change p->state and then call sched.
   // Once we hold ptable.lock, we can be
@@ -346,14 +956,11 @@ sleep(void *chan, struct spinlock *lk)
     release(lk);
   }
 
-  // Go to sleep.
-  proc->chan = chan;
+  // Go to sleep.  The wakeup takes us off the queue.
+  waitadd(chan);
   proc->state = SLEEPING;
   sched();
 
-  // Tidy up.
-  proc->chan = 0;
-
   // Reacquire original lock.
   if(lk != &ptable.lock){  //DOC: sleeplock2
     release(&ptable.lock);
@@ -361,16 +968,29 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
-// Wake up all processes sleeping on chan.
+// Wake up at most n processes sleeping on chan, raising them to
+// their first level if boost is set, and return how many woke.
 // The ptable lock must be held.
-static void
-wakeup1(void *chan)
+static int
+wakeup1(void *chan, int boost, int n)
 {
-  struct proc *p;
+  struct waiter *w, **pp;
+  int woken;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  woken = 0;
+  pp = WAITQ(chan);
+  while(woken < n && (w = *pp) != 0){
+    if(w->chan != chan){
+      pp = &w->next;
+      continue;
+    }
+    // wake() may take entries other than w off this queue, pp's
+    // among them, so start again from the head.
+    wake(w->p, boost);
+    woken++;
+    pp = WAITQ(chan);
+  }
+  return woken;
 }
 
 // Wake up all processes sleeping on chan.
@@ -378,10 +998,103 @@ void
 wakeup(void *chan)
 {
   acquire(&ptable.lock);
-  wakeup1(chan);
+  wakeup1(chan, 0, NPROC);
   release(&ptable.lock);
 }
 
+// Wake up at most n processes sleeping on chan and return how
+// many woke.
+int
+wakeupn(void *chan, int n)
+{
+  int woken;
+
+  acquire(&ptable.lock);
+  woken = wakeup1(chan, 0, n);
+  release(&ptable.lock);
+  return woken;
+}
+
+// Wake up all processes sleeping on chan for an I/O completion.
+// Interrupt handlers use this, so that processes waiting on
+// devices run before those using up their time.
+void
+wakeupboost(void *chan)
+{
+  acquire(&ptable.lock);
+  wakeup1(chan, 1, NPROC);
+  release(&ptable.lock);
+}
+
+// Have the next pollsleep() of the current process end with a
+// wakeup on chan.  May be called with other locks held, but the
+// caller must not sleep before pollsleep() or polldone().
+void
+pollwait(void *chan)
+{
+  acquire(&ptable.lock);
+  // With no room, let pollsleep() return at once; poll() looks
+  // again.
+  if(waitadd(chan) < 0)
+    proc->woken = 1;
+  release(&ptable.lock);
+}
+
+// Sleep until a wakeup on one of the channels given to pollwait()
+// since the last pollsleep() or polldone(), unless one came already.
+void
+pollsleep(void)
+{
+  acquire(&ptable.lock);
+  if(!proc->woken && proc->nwait > 0){
+    proc->state = SLEEPING;
+    sched();
+  }
+  unsleep(proc);
+  proc->woken = 0;
+  release(&ptable.lock);
+}
+
+// Forget the channels given to pollwait() without sleeping.
+void
+polldone(void)
+{
+  acquire(&ptable.lock);
+  unsleep(proc);
+  proc->woken = 0;
+  release(&ptable.lock);
+}
+
+// Put process pid, or the current one if pid is 0, in class at
+// level.  Returns 0, or -1 if there is no such process or level.
+int
+setpriority(int pid, int class, int level)
+{
+  struct proc *p;
+
+  if(class == SCHED_RT ? level < 0 || level >= NRTPRIO :
+     class != SCHED_TS || level < 0 || level >= NNICE)
+    return -1;
+  acquire(&ptable.lock);
+  if((p = pid ? findproc(pid) : proc) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  if(p->state == RUNNABLE){
+    rqremove(p);
+    p->class = class;
+    p->level = level;
+    p->prio = toplevel(p);
+    rqadd(&ptable.runq[p->cpu], p);
+  } else {
+    p->class = class;
+    p->level = level;
+    p->prio = toplevel(p);
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -391,47 +1104,112 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
   }
+  p->killed = 1;
+  // Wake process from sleep, or from the poll() it is about to
+  // sleep in, if necessary.
+  if(p->state == SLEEPING || p->nwait)
+    wake(p, 0);
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 // Print a process listing to console.  For debugging.
+static char *states[] = {
+[UNUSED]   = "unused",
+[EMBRYO]   = "embryo",
+[SLEEPING] = "sleep ",
+[RUNNABLE] = "runble",
+[RUNNING]  = "run   ",
+[ZOMBIE]   = "zombie"
+};
+
+static char*
+statename(struct proc *p)
+{
+  if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+    return states[p->state];
+  return "???";
+}
+
+static void
+rusage(struct proc *p, struct rusage *ru)
+{
+  ru->utime = p->utime;
+  ru->stime = p->stime;
+  ru->nvcsw = p->nvcsw;
+  ru->nivcsw = p->nivcsw;
+  ru->faults = p->faults;
+  ru->inblock = p->inblock;
+  ru->oublock = p->oublock;
+  ru->ethrx = p->ethrx;
+  ru->ethtx = p->ethtx;
+}
+
+// Copy what process pid, or the caller if pid is 0, has used into
+// ru.  Returns 0, or -1 if there is no such process.
+int
+getrusage(int pid, struct rusage *ru)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  if((p = pid ? findproc(pid) : proc) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  rusage(p, ru);
+  release(&ptable.lock);
+  return 0;
+}
+
+// Describe up to max of the processes in use in ps, which may be
+// user memory, in table order.  Returns how many it described.
+int
+procstat(struct procstat *ps, int max)
+{
+  struct procstat s;
+  struct proc *p;
+  int n;
+
+  n = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && n < max; p++){
+    acquire(&ptable.lock);
+    if(p->state == UNUSED){
+      release(&ptable.lock);
+      continue;
+    }
+    s.pid = p->pid;
+    s.ppid = p->parent ? p->parent->pid : 0;
+    safestrcpy(s.state, statename(p), sizeof(s.state));
+    s.cpu = p->cpu;
+    s.sz = p->sz;
+    safestrcpy(s.name, p->name, sizeof(s.name));
+    rusage(p, &s.ru);
+    release(&ptable.lock);
+    // Copied with the lock dropped: a write to ps may fault.
+    memmove(&ps[n++], &s, sizeof(s));
+  }
+  return n;
+}
+
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]   = "unused",
-  [EMBRYO]   = "embryo",
-  [SLEEPING] = "sleep ",
-  [RUNNABLE] = "runble",
-  [RUNNING]  = "run   ",
-  [ZOMBIE]   = "zombie"
-  };
   int i;
   struct proc *p;
-  char *state;
   uint pc[10];
   
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s u=%d s=%d", p->pid, statename(p), p->name,
+            p->utime, p->stime);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
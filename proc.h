@@ -2,12 +2,17 @@
 // Also known to bootasm.S and trapasm.S
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
-#define SEG_KCPU  3  // kernel per-cpu data
-#define SEG_UCODE 4  // user code
-#define SEG_UDATA 5  // user data+stack
+// sysexit wants user code and data right after kernel code and data.
+#define SEG_UCODE 3  // user code
+#define SEG_UDATA 4  // user data+stack
+#define SEG_KCPU  5  // kernel per-cpu data
 #define SEG_TSS   6  // this process's task state
 #define NSEGS     7
 
+// Words in the stack that sysenter starts on.  It only needs room
+// for a debug trap on sysentry's first instruction.
+#define SYSSTACK  128
+
 // Per-CPU state
 struct cpu {
   uchar id;                    // Local APIC ID; index into cpus[] below
@@ -15,8 +20,13 @@ struct cpu {
   struct taskstate ts;         // Used by x86 to find stack for interrupt
   struct segdesc gdt[NSEGS];   // x86 global descriptor table
   volatile uint booted;        // Has the CPU started?
+  volatile int idle;           // In scheduler() with nothing to run
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  uint sysstack[SYSSTACK];     // sysenter starts here; see sysentry
+  pde_t *pgdir;                // User page table loaded, or 0
+  volatile uint tlbreq;        // TLB flushes asked for; see tlbshootdown()
+  volatile uint tlbdone;       // The last of them done
   
   // Cpu-local storage variables; see below
   struct cpu *cpu;
@@ -57,6 +67,25 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// Channels a process may wait on at once: two for each file poll()
+// looks at, and one for its timeout.
+#define NWAIT (2*NOFILE+1)
+
+// A process's place on the wait queue of one channel.
+struct waiter {
+  void *chan;
+  struct proc *p;
+  struct waiter *next;         // On the wait queue chan hashes to
+};
+
+// Open files and current directory.  fork() gives the child a copy
+// and clone() shares the caller's with the thread; see file.c.
+struct fdtable {
+  int ref;                     // Processes using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -65,13 +94,32 @@ struct proc {
   enum procstate state;        // Process state
   volatile int pid;            // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of parent
+  struct proc *pidnext;        // On the pid hash chain while not UNUSED
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
-  void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct fdtable *fdt;         // Open files and directory, shared by threads
+  struct file *fhold[NOFILE];  // Held for this system call; see fdget()
+  int nfhold;                  // Entries of fhold in use
   char name[16];               // Process name (debugging)
+  int cpu;                     // CPU it last ran on, whose run queue it joins
+  struct proc *rqnext;         // On a run queue while RUNNABLE, or
+                               // the free list while UNUSED
+  struct waiter wait[NWAIT];   // Channels a wakeup on which wakes it
+  int nwait;                   // Entries of wait in use
+  int woken;                   // A wakeup came before pollsleep()
+  int class;                   // SCHED_TS or SCHED_RT; see sched.h
+  int level;                   // Nice value or real-time priority
+  int prio;                    // Run queue level now, 0 first
+  void *ustack;                // Thread: user stack given to clone()
+  int vfork;                   // Parent waits in vfork() while it is set
+  uint utime, stime;           // Clock ticks in user space, in the kernel
+  uint nvcsw, nivcsw;          // Context switches: to wait, preempted
+  uint faults;                 // Page faults handled
+  uint inblock, oublock;       // Blocks read and written; see bio.c
+  uint ethrx, ethtx;           // Bytes read and written on eth devices
 };
 
 // Process memory is laid out contiguously, low addresses first:
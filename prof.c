@@ -0,0 +1,282 @@
+// prof: where the kernel spends its time.
+//
+//   prof [-s] [-a] [-n top] command [arg...]
+//   prof -r [-s] [-a] [-n top]
+//
+// Runs command with the kernel's sampling profiler on and then
+// prints, by kernel function, where the timer interrupt of each CPU
+// found it, most samples first.  -r reports on the samples left from
+// the last run instead of starting one.  -s also has the kernel
+// follow the call chain of each sample, which takes a kernel built
+// with PROFSTACK=1, and adds a column of the samples with the
+// function anywhere on the stack.  -a lists the hottest addresses
+// too, to be looked up in kernel.asm.  Names come from /kernel.sym,
+// which the Makefile puts in the file system.  The kernel keeps the
+// last 1024 samples of each CPU: at 100 a second, about ten seconds.
+//
+//   samples=412 kernel=301 user=111
+//     self  pct   incl  function
+//      120   29      -  acquire
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "kstat.h"
+#include "profile.h"
+
+#define NTOP 20
+
+struct profsample samples[NCPU*NPROF];
+int nsamples;
+
+char *symtext;      // contents of kernel.sym
+uint *symaddr;      // by address
+char **symname;
+int nsym;
+uint *self, *incl;  // samples by symbol
+
+void
+usage(void)
+{
+  printf(2, "usage: prof [-s] [-a] [-n top] command [arg...]\n"
+            "       prof -r [-s] [-a] [-n top]\n");
+  exit();
+}
+
+uint
+hex(char *s)
+{
+  uint x;
+
+  for(x = 0; ; s++){
+    if(*s >= '0' && *s <= '9')
+      x = x*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      x = x*16 + *s - 'a' + 10;
+    else
+      return x;
+  }
+}
+
+// Read kernel.sym, lines of "address name", and sort it by address.
+void
+loadsyms(void)
+{
+  struct stat st;
+  char *p, *e, *name;
+  uint a;
+  int fd, i, j, gap;
+
+  if((fd = open("kernel.sym", O_RDONLY)) < 0 ||
+     fstat(fd, &st) < 0 ||
+     (symtext = malloc(st.size + 1)) == 0 ||
+     read(fd, symtext, st.size) != (int)st.size){
+    printf(2, "prof: cannot read kernel.sym\n");
+    exit();
+  }
+  close(fd);
+  symtext[st.size] = 0;
+  for(nsym = 0, p = symtext; *p; p++)
+    nsym += *p == '\n';
+  symaddr = malloc(nsym * sizeof(symaddr[0]));
+  symname = malloc(nsym * sizeof(symname[0]));
+  self = malloc(nsym * sizeof(self[0]));
+  incl = malloc(nsym * sizeof(incl[0]));
+  if(symaddr == 0 || symname == 0 || self == 0 || incl == 0){
+    printf(2, "prof: out of memory\n");
+    exit();
+  }
+
+  nsym = 0;
+  for(p = symtext; *p; p = e + 1){
+    if((e = strchr(p, '\n')) == 0)
+      break;
+    *e = 0;
+    if((name = strchr(p, ' ')) == 0 || (a = hex(p)) == 0)
+      continue;
+    symaddr[nsym] = a;
+    symname[nsym] = name + 1;
+    nsym++;
+  }
+
+  // Shell sort.
+  for(gap = nsym/2; gap > 0; gap /= 2)
+    for(i = gap; i < nsym; i++)
+      for(j = i - gap; j >= 0 && symaddr[j] > symaddr[j+gap]; j -= gap){
+        a = symaddr[j];
+        symaddr[j] = symaddr[j+gap];
+        symaddr[j+gap] = a;
+        name = symname[j];
+        symname[j] = symname[j+gap];
+        symname[j+gap] = name;
+      }
+}
+
+// The symbol pc is in: the last at or below it, or -1.
+int
+lookup(uint pc)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = nsym;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(symaddr[mid] <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+// The index of the n largest of v[0..m), largest first, into top.
+// Returns how many there are, at most n, leaving out zeroes.
+int
+pick(uint *v, int m, int *top, int n)
+{
+  int i, j, k;
+
+  k = 0;
+  for(i = 0; i < m; i++){
+    if(v[i] == 0 || (k == n && v[i] <= v[top[k-1]]))
+      continue;
+    if(k < n)
+      k++;
+    for(j = k - 1; j > 0 && v[top[j-1]] < v[i]; j--)
+      top[j] = top[j-1];
+    top[j] = i;
+  }
+  return k;
+}
+
+void
+report(int stack, int addrs, int ntop)
+{
+  struct profsample *s;
+  uint user, seen[NPROFPC], *pcs, *pcn;
+  int top[NTOP*4], i, j, k, n, sym;
+
+  memset(self, 0, nsym * sizeof(self[0]));
+  memset(incl, 0, nsym * sizeof(incl[0]));
+  user = 0;
+  for(s = samples; s < samples + nsamples; s++){
+    if(s->user){
+      user++;
+      continue;
+    }
+    if((sym = lookup(s->pc[0])) >= 0)
+      self[sym]++;
+    // Count each function once per sample, however deep it recurs.
+    for(n = 0, i = 0; i < NPROFPC && s->pc[i]; i++){
+      if((sym = lookup(s->pc[i])) < 0)
+        continue;
+      for(j = 0; j < n && seen[j] != (uint)sym; j++)
+        ;
+      if(j == n){
+        seen[n++] = sym;
+        incl[sym]++;
+      }
+    }
+  }
+
+  printf(1, "samples=%d kernel=%d user=%d\n", nsamples,
+         nsamples - user, user);
+  if(nsamples == 0)
+    return;
+  printf(1, "  self  pct   incl  function\n");
+  n = pick(stack ? incl : self, nsym, top, ntop);
+  for(i = 0; i < n; i++){
+    k = top[i];
+    printf(1, "%6d  %3d  ", self[k], self[k] * 100 / nsamples);
+    if(stack)
+      printf(1, "%5d", incl[k]);
+    else
+      printf(1, "    -");
+    printf(1, "  %s\n", symname[k]);
+  }
+
+  if(!addrs)
+    return;
+  // The hottest pcs, counted in place of their symbols.
+  pcs = malloc(nsamples * sizeof(pcs[0]));
+  pcn = malloc(nsamples * sizeof(pcn[0]));
+  if(pcs == 0 || pcn == 0){
+    printf(2, "prof: out of memory\n");
+    return;
+  }
+  for(k = 0, s = samples; s < samples + nsamples; s++){
+    if(s->user)
+      continue;
+    for(j = 0; j < k && pcs[j] != s->pc[0]; j++)
+      ;
+    if(j == k){
+      pcs[k] = s->pc[0];
+      pcn[k++] = 0;
+    }
+    pcn[j]++;
+  }
+  printf(1, "  self  address   function\n");
+  n = pick(pcn, k, top, ntop);
+  for(i = 0; i < n; i++){
+    sym = lookup(pcs[top[i]]);
+    printf(1, "%6d  %x  %s+0x%x\n", pcn[top[i]], pcs[top[i]],
+           sym >= 0 ? symname[sym] : "?",
+           pcs[top[i]] - (sym >= 0 ? symaddr[sym] : 0));
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, stack, addrs, last, ntop, n, pid, w;
+
+  stack = addrs = last = 0;
+  ntop = NTOP;
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-s") == 0)
+      stack = 1;
+    else if(strcmp(argv[i], "-a") == 0)
+      addrs = 1;
+    else if(strcmp(argv[i], "-r") == 0)
+      last = 1;
+    else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      ntop = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if(ntop <= 0 || ntop > NTOP*4 || last != (i == argc))
+    usage();
+  loadsyms();
+
+  if(!last){
+    if(prof(stack ? PROF_STACK : PROF_PC) < 0){
+      printf(2, "prof: the kernel cannot follow call chains; "
+                "build it with PROFSTACK=1\n");
+      exit();
+    }
+    if((pid = fork()) < 0){
+      prof(PROF_OFF);
+      printf(2, "prof: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[i], argv + i);
+      printf(2, "prof: exec %s failed\n", argv[i]);
+      exit();
+    }
+    while((w = wait()) >= 0 && w != pid)
+      ;
+    prof(PROF_OFF);
+  }
+
+  if((n = kstat(KSTAT_PROF, samples, sizeof(samples))) < 0){
+    printf(2, "prof: kstat failed\n");
+    exit();
+  }
+  nsamples = n / sizeof(samples[0]);
+  report(stack, addrs, ntop);
+  exit();
+}
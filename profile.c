@@ -0,0 +1,115 @@
+// Sampling profiler.
+//
+// While profmode is on, every timer interrupt of every CPU records
+// the pc it interrupted, and with PROF_STACK the return addresses of
+// the frames below it.  Each CPU writes its own ring with interrupts
+// off, and readers check seq, as in trace.c.
+//
+// The kernel is normally built without frame pointers, so the call
+// chain can only be followed in kernels built with PROFSTACK=1.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "profile.h"
+
+int profmode;
+
+static struct {
+  uint n;           // samples ever taken
+  struct profsample s[NPROF];
+} proflog[NCPU];
+
+// Record a sample of the trap frame tf.  Called from the timer
+// interrupt, with interrupts off.
+void
+profsample(struct trapframe *tf)
+{
+  struct profsample *s;
+  uint n;
+  int i;
+
+  n = proflog[cpu->id].n;
+  s = &proflog[cpu->id].s[n % NPROF];
+  s->seq = 0;
+  __sync_synchronize();
+  s->cpu = cpu->id;
+  s->user = (tf->cs&3) == DPL_USER;
+  s->pc[0] = tf->eip;
+  i = 1;
+#ifdef PROFSTACK
+  if(profmode == PROF_STACK && !s->user){
+    uint *ebp, lo;
+
+    // Follow the saved frame pointers up the kernel stack that tf
+    // is on, and never off it.
+    lo = (uint)PGROUNDDOWN(tf);
+    ebp = (uint*)tf->ebp;
+    while(i < NPROFPC && (uint)ebp >= lo &&
+          (uint)(ebp + 2) <= lo + KSTACKSIZE){
+      s->pc[i++] = ebp[1];
+      if(ebp[0] <= (uint)ebp)
+        break;
+      ebp = (uint*)ebp[0];
+    }
+  }
+#endif
+  for(; i < NPROFPC; i++)
+    s->pc[i] = 0;
+  __sync_synchronize();
+  s->seq = n + 1;
+  proflog[cpu->id].n = n + 1;
+}
+
+// Switch the profiler to mode, unless mode is negative.  Turning it
+// on from off empties the rings.  Returns the mode before, or -1 if
+// mode is not one this kernel can do.
+int
+profset(int mode)
+{
+  int old, c;
+
+  old = profmode;
+  if(mode < 0)
+    return old;
+  if(mode > PROF_STACK)
+    return -1;
+#ifndef PROFSTACK
+  if(mode == PROF_STACK)
+    return -1;
+#endif
+  if(old == PROF_OFF && mode != PROF_OFF){
+    for(c = 0; c < ncpu; c++)
+      proflog[c].n = 0;
+    __sync_synchronize();
+  }
+  profmode = mode;
+  return old;
+}
+
+// Copy the samples still in the rings into buf, which has room for
+// max of them: each CPU's oldest first, one CPU after another.
+// Returns the number copied.
+int
+profcopy(struct profsample *buf, int max)
+{
+  struct profsample *s;
+  uint i, n;
+  int c, k;
+
+  k = 0;
+  for(c = 0; c < ncpu; c++){
+    n = proflog[c].n;
+    for(i = n > NPROF ? n - NPROF : 0; i < n && k < max; i++){
+      s = &proflog[c].s[i % NPROF];
+      buf[k] = *s;
+      __sync_synchronize();
+      if(buf[k].seq == i + 1 && s->seq == i + 1)
+        k++;
+    }
+  }
+  return k;
+}
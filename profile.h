@@ -0,0 +1,17 @@
+// Samples of the kernel profiler, taken on each CPU's timer interrupt
+// while prof() has it on, kept in a ring per CPU and read with
+// kstat(KSTAT_PROF); see profile.c.
+
+#define PROF_OFF    0
+#define PROF_PC     1     // sample the interrupted pc
+#define PROF_STACK  2     // and its callers; PROFSTACK=1 kernels only
+
+#define NPROF       1024  // samples kept by each CPU
+#define NPROFPC     6     // the pc and up to 5 callers
+
+struct profsample {
+  uint seq;         // 1 + its place in its CPU's ring, 0 while written
+  ushort cpu;
+  ushort user;      // taken in user space: pc[0] is a user address
+  uint pc[NPROFPC]; // innermost first, 0 after the last
+};
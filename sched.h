@@ -0,0 +1,6 @@
+// Scheduling classes, for setpriority(pid, class, level).
+#define SCHED_TS   0   // time-sharing; level is a nice value
+#define SCHED_RT   1   // real-time; level is a fixed priority
+
+#define NRTPRIO    4   // real-time priorities, 0 first
+#define NNICE      4   // nice values, 0 first
@@ -1,4 +1,11 @@
 // Shell.
+//
+// Simple commands, those without ( ), ; or &, run in a child made
+// with vfork(), which skips copying the shell's page table, and a
+// pipeline of them takes one vfork() per stage.  cd and echo run in
+// the shell itself unless redirected.  Everything else runcmd() runs
+// in a forked child.  The shell parses each line itself, so syntax
+// errors are reported rather than fatal.
 
 #include "types.h"
 #include "user.h"
@@ -52,6 +59,8 @@ struct backcmd {
 static int fork1(void);  // Fork but panics on failure.
 static void panic(char*);
 static struct cmd *parsecmd(char*);
+static void freecmd(struct cmd*);
+static int builtin(struct execcmd*);
 
 static void runcmd(struct cmd *cmd) __attribute__((noreturn));
 
@@ -76,7 +85,7 @@ runcmd(struct cmd *cmd)
 
   case EXEC:
     ecmd = (struct execcmd*)cmd;
-    if(ecmd->argv[0] == 0)
+    if(ecmd->argv[0] == 0 || builtin(ecmd))
       exit();
     exec(ecmd->argv[0], ecmd->argv);
     printf(2, "exec %s failed\n", ecmd->argv[0]);
@@ -144,10 +153,187 @@ getcmd(char *buf, int nbuf)
   return 0;
 }
 
+// Write a, b and c to stderr with write() alone, which a vfork()
+// child may call.
+static void
+msg(char *a, char *b, char *c)
+{
+  write(2, a, strlen(a));
+  write(2, b, strlen(b));
+  write(2, c, strlen(c));
+}
+
+static void
+echo(char **argv)
+{
+  char line[128];
+  int i, n, k;
+
+  n = 0;
+  for(i = 1; argv[i]; i++){
+    k = strlen(argv[i]);
+    if(n + k + 1 > (int)sizeof(line)){
+      write(1, line, n);
+      n = 0;
+    }
+    memmove(line + n, argv[i], k);
+    n += k;
+    line[n++] = argv[i+1] ? ' ' : '\n';
+  }
+  if(n > 0)
+    write(1, line, n);
+}
+
+// Run ecmd if it is a builtin and return 1, else return 0.  Uses
+// nothing that a vfork() child may not.
+static int
+builtin(struct execcmd *ecmd)
+{
+  char *dir;
+
+  if(strcmp(ecmd->argv[0], "cd") == 0){
+    // Changes only the directory of the process it runs in.
+    dir = ecmd->argv[1] ? ecmd->argv[1] : "/";
+    if(chdir(dir) < 0)
+      msg("cannot cd ", dir, "\n");
+    return 1;
+  }
+  if(strcmp(ecmd->argv[0], "echo") == 0){
+    echo(ecmd->argv);
+    return 1;
+  }
+  return 0;
+}
+
+// The command under any redirections of cmd, if that is an EXEC.
+static struct execcmd*
+simple(struct cmd *cmd)
+{
+  while(cmd->type == REDIR)
+    cmd = ((struct redircmd*)cmd)->cmd;
+  return cmd->type == EXEC ? (struct execcmd*)cmd : 0;
+}
+
+// The child of spawn(): set up its fds and exec simple command cmd.
+// It runs in the shell's memory until it execs, so it does nothing
+// but system calls, through the stubs that leave the shell's printf()
+// buffers alone, and builtin().  It has its own frame, below those
+// that the shell goes on using.
+static void __attribute__((noinline, noreturn))
+vchild(struct cmd *cmd, int in, int out, int shut)
+{
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+
+  if(in >= 0){
+    _close(0);
+    dup(in);
+    _close(in);
+  }
+  if(out >= 0){
+    _close(1);
+    dup(out);
+    _close(out);
+  }
+  if(shut >= 0)
+    _close(shut);
+  for(; cmd->type == REDIR; cmd = rcmd->cmd){
+    rcmd = (struct redircmd*)cmd;
+    _close(rcmd->fd);
+    if(open(rcmd->file, rcmd->mode) < 0){
+      msg("open ", rcmd->file, " failed\n");
+      _exit();
+    }
+  }
+  ecmd = (struct execcmd*)cmd;
+  if(ecmd->argv[0] == 0 || builtin(ecmd))
+    _exit();
+  _exec(ecmd->argv[0], ecmd->argv);
+  msg("exec ", ecmd->argv[0], " failed\n");
+  _exit();
+}
+
+// Start simple command cmd with vfork(), its stdin from fd in and
+// its stdout to fd out unless they are -1, and fd shut closed.
+// Returns the child's pid, or -1.
+static int
+spawn(struct cmd *cmd, int in, int out, int shut)
+{
+  int pid;
+
+  if((pid = vfork()) == 0)
+    vchild(cmd, in, out, shut);
+  if(pid < 0)
+    printf(2, "vfork failed\n");
+  return pid;
+}
+
+// Run cmd, a pipeline, with a vfork() for each stage and no shell
+// in between, if every stage is simple.  Returns 0 if it ran it,
+// -1 if it must be left to runcmd().
+static int
+runpipe(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+  struct cmd *c;
+  int p[2], in, n;
+
+  for(c = cmd; c->type == PIPE; c = pcmd->right){
+    pcmd = (struct pipecmd*)c;
+    if(simple(pcmd->left) == 0)
+      return -1;
+  }
+  if(simple(c) == 0)
+    return -1;
+
+  in = -1;
+  n = 0;
+  for(c = cmd; c->type == PIPE; c = pcmd->right){
+    pcmd = (struct pipecmd*)c;
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      break;
+    }
+    if(spawn(pcmd->left, in, p[1], p[0]) > 0)
+      n++;
+    if(in >= 0)
+      close(in);
+    close(p[1]);
+    in = p[0];
+  }
+  if(c->type != PIPE && spawn(c, in, -1, -1) > 0)
+    n++;
+  if(in >= 0)
+    close(in);
+  while(n-- > 0)
+    wait();
+  return 0;
+}
+
+static void
+run(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+
+  if((ecmd = simple(cmd)) != 0){
+    if(cmd->type == EXEC && (ecmd->argv[0] == 0 || builtin(ecmd)))
+      return;
+    if(spawn(cmd, -1, -1, -1) > 0)
+      wait();
+    return;
+  }
+  if(cmd->type == PIPE && runpipe(cmd) == 0)
+    return;
+  if(fork1() == 0)
+    runcmd(cmd);
+  wait();
+}
+
 int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
   
   // Assumes three file descriptors open.
@@ -160,17 +346,9 @@ main(void)
   
   // Read and run input commands.
   while(getcmd(buf, sizeof(buf)) >= 0){
-    if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
-      // Clumsy but will have to do for now.
-      // Chdir has no effect on the parent if run in the child.
-      buf[strlen(buf)-1] = 0;  // chop \n
-      if(chdir(buf+3) < 0)
-        printf(2, "cannot cd %s\n", buf+3);
-      continue;
-    }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) != 0)
+      run(cmd);
+    freecmd(cmd);
   }
   exit();
 }
@@ -262,6 +440,16 @@ backcmd(struct cmd *subcmd)
 // Parsing
 
 char whitespace[] = " \t\r\n\v";
+static int parseerr;
+
+// Report the first syntax error of a line.
+static void
+synerr(char *s)
+{
+  if(!parseerr)
+    printf(2, "%s\n", s);
+  parseerr = 1;
+}
 char symbols[] = "<|>&;()";
 
 static int
@@ -332,12 +520,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    synerr("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -381,8 +574,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      synerr("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -407,8 +602,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    synerr("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -433,13 +630,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      synerr("syntax");
+      break;
+    }
+    if(argc >= MAXARGS - 1){
+      synerr("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -492,4 +693,41 @@ nulterminate(struct cmd *cmd)
     break;
   }
   return cmd;
-}
\ No newline at end of file
+}
+
+static void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,119 @@
+// Shared memory segments.
+//
+// shmget() finds or makes a segment of zeroed pages, shmat() maps
+// all of it into the calling process right above its image, and
+// shmrm() takes it out of the table.  The table holds a reference to
+// each page and every mapping holds another (see mapshm()), so the
+// pages go back to kalloc() when the segment has been removed and
+// the last process to attach it has exited or shrunk below it.
+// Fork keeps the mappings shared.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;              // 0 if private
+  int npages;           // 0 if the slot is free
+  char *pages[SHMMAXPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Return the id of the segment with key, making one of at least size
+// bytes if there is none.  Key 0 always makes a new segment.
+int
+shmget(int key, int size)
+{
+  struct shmseg *s, *free;
+  int i, n;
+
+  if(size <= 0 || size > SHMMAXPAGES*PGSIZE)
+    return -1;
+  n = PGROUNDUP(size) / PGSIZE;
+  acquire(&shmtab.lock);
+  free = 0;
+  for(s = shmtab.seg; s < &shmtab.seg[NSHM]; s++){
+    if(s->npages == 0){
+      if(free == 0)
+        free = s;
+    } else if(key != 0 && s->key == key){
+      release(&shmtab.lock);
+      return s->npages*PGSIZE >= size ? s - shmtab.seg : -1;
+    }
+  }
+  if(free == 0){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s = free;
+  for(i = 0; i < n; i++){
+    if((s->pages[i] = kzalloc()) == 0){
+      while(--i >= 0)
+        kfree(s->pages[i]);
+      release(&shmtab.lock);
+      return -1;
+    }
+  }
+  s->key = key;
+  s->npages = n;
+  release(&shmtab.lock);
+  return s - shmtab.seg;
+}
+
+// Map segment id into the current process.  Returns its address.
+int
+shmat(int id)
+{
+  struct shmseg *s;
+  uint va;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtab.seg[id];
+  va = PGROUNDUP(proc->sz);
+  acquire(&shmtab.lock);
+  if(s->npages == 0 || va + s->npages*PGSIZE > USERTOP ||
+     mapshm(proc->pgdir, va, s->pages, s->npages) < 0){
+    release(&shmtab.lock);
+    return -1;
+  }
+  setsz(va + s->npages*PGSIZE);
+  release(&shmtab.lock);
+  switchuvm(proc);
+  return va;
+}
+
+// Remove segment id.  Processes that attached it keep their mappings.
+int
+shmrm(int id)
+{
+  struct shmseg *s;
+  int i;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shmtab.seg[id];
+  acquire(&shmtab.lock);
+  if(s->npages == 0){
+    release(&shmtab.lock);
+    return -1;
+  }
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  s->npages = 0;
+  release(&shmtab.lock);
+  return 0;
+}
@@ -0,0 +1,238 @@
+// Object caches for small kernel objects.
+//
+// kalloc() hands out whole pages.  A cache cuts pages (slabs) into
+// objects of one size and keeps the free ones, so a 600-byte pipe or
+// a 1514-byte packet buffer no longer takes a page of its own.
+//
+// Each slab starts with a struct slab, found from any of its objects
+// by rounding down to the page, and the free objects of a slab are
+// linked through a word just past each object.  A cache may have a
+// constructor, run once on each object when its slab is made; freed
+// objects must be handed back in the constructed state, so the next
+// kcache_alloc() can skip it.
+//
+// Each CPU keeps a magazine of up to KMAG free objects per cache,
+// used with interrupts off and no lock.  An empty magazine is refilled
+// and a full one emptied KMAG/2 objects at a time under the cache's
+// lock.  A slab whose objects are all free goes back to kalloc() if
+// the cache has other free objects.
+//
+// kmalloc() and kmfree() serve sizes up to 2032 bytes from a set of
+// caches of fixed size classes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NKCACHE 16    // most caches
+#define KMAG    16    // objects in a CPU's magazine
+
+struct slab {
+  struct kcache *c;
+  struct slab *next;    // on c->slabs while it has free objects
+  char *free;           // first free object
+  int inuse;            // objects out of the slab, magazines included
+};
+
+struct kcache {
+  char *name;
+  uint size;            // bytes of each object
+  uint stride;          // bytes between objects
+  int perslab;          // objects in a slab
+  void (*ctor)(void*);
+  struct spinlock lock;
+  struct slab *slabs;   // slabs with free objects
+  struct {
+    int n;
+    void *obj[KMAG];
+  } mag[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kcache cache[NKCACHE];
+  int n;
+} kcaches;
+
+// kmalloc() size classes.  The largest are a little under a power
+// of two so that the slab header still leaves room for them.
+static uint ksizes[] = { 32, 64, 128, 256, 512, 1012, 2032 };
+static struct kcache *kmcache[NELEM(ksizes)];
+
+// The link to the next free object, just past obj.
+static char**
+kcnext(struct kcache *c, char *obj)
+{
+  return (char**)(obj + c->size);
+}
+
+void
+kcacheinit(void)
+{
+  static char *names[] = { "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k" };
+  uint i;
+
+  initlock(&kcaches.lock, "kcaches");
+  for(i = 0; i < NELEM(ksizes); i++)
+    if((kmcache[i] = kcache_create(names[i], ksizes[i], 0)) == 0)
+      panic("kcacheinit");
+}
+
+// Make a cache of objects of size bytes, each passed to ctor (if
+// not 0) before first use.
+struct kcache*
+kcache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kcache *c;
+  uint stride;
+
+  stride = (size + sizeof(char*) + 7) & ~7;
+  if(size == 0 || sizeof(struct slab) + stride > PGSIZE)
+    return 0;
+  acquire(&kcaches.lock);
+  if(kcaches.n == NKCACHE){
+    release(&kcaches.lock);
+    return 0;
+  }
+  c = &kcaches.cache[kcaches.n++];
+  release(&kcaches.lock);
+  c->name = name;
+  c->size = size;
+  c->stride = stride;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / stride;
+  c->ctor = ctor;
+  initlock(&c->lock, name);
+  return c;
+}
+
+// Make a new slab for c and put it on c->slabs.
+// Caller must hold c->lock.
+static struct slab*
+kcgrow(struct kcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->c = c;
+  s->inuse = 0;
+  s->free = 0;
+  obj = (char*)(s + 1) + (c->perslab - 1) * c->stride;
+  for(i = 0; i < c->perslab; i++, obj -= c->stride){
+    if(c->ctor)
+      c->ctor(obj);
+    *kcnext(c, obj) = s->free;
+    s->free = obj;
+  }
+  s->next = c->slabs;
+  c->slabs = s;
+  return s;
+}
+
+// Take one object from the slabs of c.  Caller must hold c->lock.
+static void*
+kctake(struct kcache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = c->slabs) == 0 && (s = kcgrow(c)) == 0)
+    return 0;
+  obj = s->free;
+  s->free = *kcnext(c, obj);
+  s->inuse++;
+  if(s->free == 0)
+    c->slabs = s->next;
+  return obj;
+}
+
+// Give obj back to its slab.  Caller must hold c->lock.
+static void
+kcput(struct kcache *c, char *obj)
+{
+  struct slab *s, **pp;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->c != c)
+    panic("kcache_free");
+  if(s->free == 0){
+    s->next = c->slabs;
+    c->slabs = s;
+  }
+  *kcnext(c, obj) = s->free;
+  s->free = obj;
+  if(--s->inuse > 0 || (c->slabs == s && s->next == 0))
+    return;
+  // All free, and the cache has other slabs with room.
+  for(pp = &c->slabs; *pp != s; pp = &(*pp)->next)
+    ;
+  *pp = s->next;
+  kfree((char*)s);
+}
+
+void*
+kcache_alloc(struct kcache *c)
+{
+  void *obj;
+  int id;
+
+  pushcli();
+  id = cpu->id;
+  if(c->mag[id].n == 0){
+    acquire(&c->lock);
+    while(c->mag[id].n < KMAG/2 && (obj = kctake(c)) != 0)
+      c->mag[id].obj[c->mag[id].n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(c->mag[id].n > 0)
+    obj = c->mag[id].obj[--c->mag[id].n];
+  popcli();
+  return obj;
+}
+
+void
+kcache_free(struct kcache *c, void *obj)
+{
+  int id;
+
+  pushcli();
+  id = cpu->id;
+  if(c->mag[id].n == KMAG){
+    acquire(&c->lock);
+    while(c->mag[id].n > KMAG/2)
+      kcput(c, c->mag[id].obj[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  popcli();
+}
+
+// Allocate n bytes, at most the largest size class.  Returns 0 if
+// there is no memory.
+void*
+kmalloc(uint n)
+{
+  uint i;
+
+  for(i = 0; i < NELEM(ksizes); i++)
+    if(n <= ksizes[i])
+      return kcache_alloc(kmcache[i]);
+  panic("kmalloc: too big");
+}
+
+// Free memory from kmalloc().
+void
+kmfree(void *p)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)p);
+  kcache_free(s->c, p);
+}
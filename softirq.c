@@ -0,0 +1,92 @@
+// Soft interrupts: the part of a device interrupt that can wait.
+//
+// A hard interrupt handler runs with interrupts off, so whatever it
+// does delays the clock and the keyboard on that CPU.  A handler
+// that has slow work, such as copying sectors or frames by PIO,
+// only quiets the device and raises a softirq; trap() runs the
+// raised softirqs of the CPU on the way out of the interrupt, with
+// interrupts on again, so a hard interrupt that comes meanwhile is
+// taken at once.  Its own softirqs go on the queue being run.
+//
+// A softirq is queued on the CPU that raised it, at most once until
+// it runs; raising it again before then does nothing.  Once started
+// it may be raised and run on another CPU while its function is
+// still going, so functions lock what they share.  They must not
+// sleep.  While a CPU runs softirqs the clock does not preempt the
+// process whose kernel stack they run on.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "softirq.h"
+
+// Each CPU's raised softirqs, used with interrupts off.
+static struct {
+  struct softirq *head;
+  struct softirq **tail;
+  int running;            // in softirq()
+} softq[NCPU];
+
+// Prepare s to call fn(arg).
+void
+softinit(struct softirq *s, void (*fn)(void*), void *arg)
+{
+  s->fn = fn;
+  s->arg = arg;
+  s->pending = 0;
+  s->next = 0;
+}
+
+// Run s on this CPU when the interrupt ends, unless it is pending.
+void
+softraise(struct softirq *s)
+{
+  int id;
+
+  if(xchg(&s->pending, 1) != 0)
+    return;
+  pushcli();
+  id = cpu->id;
+  if(softq[id].tail == 0)
+    softq[id].tail = &softq[id].head;
+  s->next = 0;
+  *softq[id].tail = s;
+  softq[id].tail = &s->next;
+  popcli();
+}
+
+// Is this CPU running softirqs?  Called with interrupts off.
+int
+insoftirq(void)
+{
+  return softq[cpu->id].running;
+}
+
+// Run the softirqs raised on this CPU, with interrupts on.  Called
+// from trap() with interrupts off and no locks held; does nothing if
+// the interrupt came while this CPU was running them already.
+void
+softirq(void)
+{
+  struct softirq *s;
+  int id;
+
+  id = cpu->id;
+  if(softq[id].running || softq[id].head == 0)
+    return;
+  softq[id].running = 1;
+  while((s = softq[id].head) != 0){
+    if((softq[id].head = s->next) == 0)
+      softq[id].tail = &softq[id].head;
+    s->next = 0;
+    // Raised again from here on, it runs again.
+    xchg(&s->pending, 0);
+    sti();
+    s->fn(s->arg);
+    cli();
+  }
+  softq[id].running = 0;
+}
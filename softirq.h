@@ -0,0 +1,7 @@
+// Work a device interrupt leaves for later; see softirq.c.
+struct softirq {
+  uint pending;           // raised and not yet run
+  void (*fn)(void*);
+  void *arg;
+  struct softirq *next;   // in its CPU's queue
+};
@@ -1,4 +1,13 @@
 // Mutual exclusion spin locks.
+//
+// These are ticket locks: acquire() takes the next ticket and waits
+// until the owner field comes round to it, so CPUs get the lock in
+// the order they asked for it, and waiting CPUs only read the lock
+// until it is handed over.
+//
+// In a kernel built with LOCKSTAT, each lock counts its acquires, the
+// cycles spent waiting for it and the longest it was held, summed
+// over all locks of the same name; see lockstats().
 
 #include "types.h"
 #include "defs.h"
@@ -7,31 +16,106 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "kstat.h"
+
+#ifdef LOCKSTAT
+#define NLOCKCLASS 64
+
+struct lockclass {
+  char *name;
+  uint acquires;
+  uint contended;
+  uint64 spin;
+  uint maxhold;
+};
+
+// Locks are made while others are in use, so the table has a lock of
+// its own, a bare flag outside the statistics.
+static struct {
+  uint busy;
+  struct lockclass class[NLOCKCLASS];
+  int n;
+} lockclasses;
+
+// The entry for locks named name, or 0 if the table is full.
+static struct lockclass*
+lockclass(char *name)
+{
+  struct lockclass *c;
+
+  pushcli();
+  while(xchg(&lockclasses.busy, 1) != 0)
+    pause();
+  for(c = lockclasses.class; c < &lockclasses.class[lockclasses.n]; c++)
+    if(strncmp(c->name, name, sizeof(((struct lockstat*)0)->name)) == 0)
+      goto out;
+  c = 0;
+  if(lockclasses.n < NLOCKCLASS){
+    c = &lockclasses.class[lockclasses.n++];
+    c->name = name;
+  }
+out:
+  xchg(&lockclasses.busy, 0);
+  popcli();
+  return c;
+}
+#endif
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+#ifdef LOCKSTAT
+  lk->class = lockclass(name);
+#endif
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
+// Spinning with interrupts off, the CPU still carries out TLB
+// flushes other CPUs ask for, which may hold the lock meanwhile.
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+#ifdef LOCKSTAT
+  uint64 t0;
+#endif
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
+  // The xadd is atomic.
   // It also serializes, so that reads after acquire are not
-  // reordered before it. 
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // reordered before it.
+  ticket = xadd(&lk->next, 1);
+#ifdef LOCKSTAT
+  if(lk->owner != ticket){
+    t0 = rdtsc();
+    while(lk->owner != ticket){
+      tlbpoll();
+      pause();
+    }
+    if(lk->class){
+      lk->class->contended++;
+      lk->class->spin += rdtsc() - t0;
+    }
+  }
+  if(lk->class)
+    lk->class->acquires++;
+  lk->tacquired = rdtsc();
+#else
+  while(lk->owner != ticket){
+    tlbpoll();
+    pause();
+  }
+#endif
 
   // Record info about lock acquisition for debugging.
   lk->cpu = cpu;
@@ -42,22 +126,33 @@ acquire(struct spinlock *lk)
 void
 release(struct spinlock *lk)
 {
+#ifdef LOCKSTAT
+  uint hold;
+#endif
+
   if(!holding(lk))
     panic("release");
 
+#ifdef LOCKSTAT
+  hold = rdtsc() - lk->tacquired;
+  if(lk->class && hold > lk->class->maxhold)
+    lk->class->maxhold = hold;
+#endif
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
+  // Hand the lock to the next ticket.  Only the holder writes owner.
   // The xchg serializes, so that reads before release are 
   // not reordered after it.  The 1996 PentiumPro manual (Volume 3,
   // 7.2) says reads can be carried out speculatively and in
   // any order, which implies we need to serialize here.
   // But the 2007 Intel 64 Architecture Memory Ordering White
   // Paper says that Intel 64 and IA-32 will not move a load
-  // after a store. So lock->locked = 0 would work here.
+  // after a store. So lock->owner++ would work here.
   // The xchg being asm volatile ensures gcc emits it after
   // the above assignments (and after the critical section).
-  xchg(&lk->locked, 0);
+  xchg(&lk->owner, lk->owner + 1);
 
   popcli();
 }
@@ -84,7 +179,32 @@ getcallerpcs(void *v, uint pcs[])
 int
 holding(struct spinlock *lock)
 {
-  return lock->locked && lock->cpu == cpu;
+  return lock->owner != lock->next && lock->cpu == cpu;
+}
+
+// Copy the statistics of up to n lock names to st.
+// Returns how many there are; 0 without LOCKSTAT.
+int
+lockstats(struct lockstat *st, int n)
+{
+#ifdef LOCKSTAT
+  struct lockclass *c;
+  int i;
+
+  for(i = 0; i < n && i < lockclasses.n; i++){
+    c = &lockclasses.class[i];
+    safestrcpy(st[i].name, c->name, sizeof(st[i].name));
+    st[i].acquires = c->acquires;
+    st[i].contended = c->contended;
+    st[i].spinkc = c->spin >> 10;
+    st[i].maxhold = c->maxhold;
+  }
+  return i;
+#else
+  (void)st;
+  (void)n;
+  return 0;
+#endif
 }
 
 
@@ -113,4 +233,3 @@ popcli(void)
   if(cpu->ncli == 0 && cpu->intena)
     sti();
 }
-
@@ -1,11 +1,16 @@
 // Mutual exclusion lock.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;            // Next ticket to hand out.
+  volatile uint owner;  // Ticket of the holder; free if owner == next.
   
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+#ifdef LOCKSTAT
+  struct lockclass *class;  // Statistics, shared by locks of one name.
+  uint64 tacquired;         // rdtsc() when it was taken.
+#endif
 };
 
@@ -1,10 +1,60 @@
 #include "types.h"
+#include "defs.h"
 #include "x86.h"
 
+// The bulk routines work a word at a time with the string
+// instructions, and memmove() copies runs of SSESIZE bytes or more
+// through the SSE registers if seginit() found SSE2.  The kernel
+// does not save the FPU state of processes, so those copies save the
+// registers they use and put them back, with interrupts off so that
+// no interrupt handler copies in between.
+
+#define SSESIZE 512
+
+int memsse;   // memmove() may use SSE2
+
+// Copy n bytes, a multiple of 64, upwards with xmm0-xmm3.
+static void
+ssemove(char *d, const char *s, uint n)
+{
+  uchar save[64+15], *x;
+
+  x = (uchar*)(((uint)save + 15) & ~15);
+  pushcli();
+  asm volatile("movdqa %%xmm0,(%0); movdqa %%xmm1,16(%0);"
+               "movdqa %%xmm2,32(%0); movdqa %%xmm3,48(%0)"
+               : : "r" (x) : "memory");
+  asm volatile("1: movdqu (%1),%%xmm0; movdqu 16(%1),%%xmm1;"
+               "movdqu 32(%1),%%xmm2; movdqu 48(%1),%%xmm3;"
+               "movdqu %%xmm0,(%0); movdqu %%xmm1,16(%0);"
+               "movdqu %%xmm2,32(%0); movdqu %%xmm3,48(%0);"
+               "addl $64,%0; addl $64,%1; subl $64,%2; jnz 1b"
+               : "+r" (d), "+r" (s), "+r" (n) : : "memory", "cc");
+  asm volatile("movdqa (%0),%%xmm0; movdqa 16(%0),%%xmm1;"
+               "movdqa 32(%0),%%xmm2; movdqa 48(%0),%%xmm3"
+               : : "r" (x) : "memory");
+  popcli();
+}
+
 void*
 memset(void *dst, int c, uint n)
 {
-  stosb(dst, c, n);
+  char *d;
+  uint k;
+
+  d = dst;
+  if(n >= 16){
+    // Align dst, then store words.
+    k = -(uint)d & 3;
+    stosb(d, c, k);
+    d += k;
+    n -= k;
+    c &= 0xFF;
+    stosl(d, c * 0x01010101, n / 4);
+    d += n & ~3;
+    n &= 3;
+  }
+  stosb(d, c, n);
   return dst;
 }
 
@@ -15,6 +65,11 @@ memcmp(const void *v1, const void *v2, uint n)
   
   s1 = v1;
   s2 = v2;
+  // Skip the equal words; the bytes find which differs.
+  while(n >= 4 && *(uint*)s1 == *(uint*)s2){
+    s1 += 4, s2 += 4;
+    n -= 4;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -29,18 +84,48 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  uint k;
 
   s = src;
   d = dst;
   if(s < d && s + n > d){
+    // dst overlaps the end of src: copy from the top down.
     s += n;
     d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else
-    while(n-- > 0)
-      *d++ = *s++;
-
+    if(((uint)s | (uint)d | n) % 4 == 0){
+      d -= 4;
+      s -= 4;
+      n /= 4;
+      asm volatile("std; rep movsl; cld" :
+                   "+D" (d), "+S" (s), "+c" (n) : : "memory", "cc");
+    } else {
+      d--;
+      s--;
+      asm volatile("std; rep movsb; cld" :
+                   "+D" (d), "+S" (s), "+c" (n) : : "memory", "cc");
+    }
+    return dst;
+  }
+  // Upwards is safe even when src overlaps the end of dst.
+  if(n >= 16){
+    k = -(uint)d & 3;
+    movsb(d, s, k);
+    d += k;
+    s += k;
+    n -= k;
+    if(n >= SSESIZE && memsse){
+      k = n & ~63;
+      ssemove(d, s, k);
+      d += k;
+      s += k;
+      n -= k;
+    }
+    movsl(d, s, n / 4);
+    d += n & ~3;
+    s += n & ~3;
+    n &= 3;
+  }
+  movsb(d, s, n);
   return dst;
 }
 
@@ -5,6 +5,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "kstat.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -16,7 +17,7 @@
 int
 fetchint(struct proc *p, uint addr, int *ip)
 {
-  if(addr >= p->sz || addr+4 > p->sz)
+  if(addr < USERBASE || addr >= p->sz || addr+4 > p->sz)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -30,7 +31,7 @@ fetchstr(struct proc *p, uint addr, char **pp)
 {
   char *s, *ep;
 
-  if(addr >= p->sz)
+  if(addr < USERBASE || addr >= p->sz)
     return -1;
   *pp = (char*)addr;
   ep = (char*)p->sz;
@@ -57,16 +58,30 @@ argptr(int n, char **pp, int size)
   
   if(argint(n, &i) < 0)
     return -1;
-  if((uint)i >= proc->sz || (uint)i+size > proc->sz)
+  if((uint)i < USERBASE || (uint)i >= proc->sz || (uint)i+size > proc->sz)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Like argptr(), for a block the kernel writes to: it must not be
+// read-only, and copy-on-write pages in it are copied now.
+int
+argout(int n, char **pp, int size)
+{
+  if(argptr(n, pp, size) < 0 || prepwrite(proc->pgdir, (uint)*pp, size) < 0)
+    return -1;
+  return 0;
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// The string can still change after this check: another thread may
+// write to it or shrink the memory under it, and a shared memory
+// segment may be written from another process.  The kernel then
+// reads what is there, starting below proc->sz.  A page that has
+// gone faults, and killfault() maps a zeroed page there, which ends
+// the string, and kills the caller.
 int
 argstr(int n, char **pp)
 {
@@ -98,6 +113,31 @@ extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_ioctl(void);
+extern int sys_socket(void);
+extern int sys_bind(void);
+extern int sys_sendto(void);
+extern int sys_recvfrom(void);
+extern int sys_listen(void);
+extern int sys_accept(void);
+extern int sys_connect(void);
+extern int sys_setsockopt(void);
+extern int sys_kstat(void);
+extern int sys_fsync(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmrm(void);
+extern int sys_setpriority(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex(void);
+extern int sys_poll(void);
+extern int sys_sendfile(void);
+extern int sys_irqaffinity(void);
+extern int sys_nanotime(void);
+extern int sys_trace(void);
+extern int sys_prof(void);
+extern int sys_getrusage(void);
+extern int sys_vfork(void);
 
 static int (*syscalls[])(void) = {
 [SYS_chdir]  = sys_chdir,
@@ -122,17 +162,93 @@ static int (*syscalls[])(void) = {
 [SYS_write]  = sys_write,
 [SYS_uptime] = sys_uptime,
 [SYS_ioctl]  = sys_ioctl,
+[SYS_socket] = sys_socket,
+[SYS_bind]   = sys_bind,
+[SYS_sendto] = sys_sendto,
+[SYS_recvfrom] = sys_recvfrom,
+[SYS_listen] = sys_listen,
+[SYS_accept] = sys_accept,
+[SYS_connect] = sys_connect,
+[SYS_setsockopt] = sys_setsockopt,
+[SYS_kstat]  = sys_kstat,
+[SYS_fsync]  = sys_fsync,
+[SYS_shmget] = sys_shmget,
+[SYS_shmat]  = sys_shmat,
+[SYS_shmrm]  = sys_shmrm,
+[SYS_setpriority] = sys_setpriority,
+[SYS_clone]  = sys_clone,
+[SYS_join]   = sys_join,
+[SYS_futex]  = sys_futex,
+[SYS_poll]   = sys_poll,
+[SYS_sendfile] = sys_sendfile,
+[SYS_irqaffinity] = sys_irqaffinity,
+[SYS_nanotime] = sys_nanotime,
+[SYS_trace]  = sys_trace,
+[SYS_prof]   = sys_prof,
+[SYS_getrusage] = sys_getrusage,
+[SYS_vfork]  = sys_vfork,
 };
 
+// Counts and cycles of each system call, kept by each CPU for the
+// calls that finish on it.
+static struct {
+  uint calls;
+  uint64 cycles;
+  uint hist[NLATBUCKET];
+} sysstat[NCPU][NELEM(syscalls)];
+
+// Bucket of a histogram with NLATBUCKET buckets for t cycles.
+static int
+latbucket(uint64 t)
+{
+  int i;
+
+  t >>= 9;
+  for(i = 0; t && i < NLATBUCKET - 1; i++)
+    t >>= 1;
+  return i;
+}
+
+// Sum up the counts of all CPUs for the first n system calls into
+// st.  Returns how many there are.
+int
+syscallstats(struct syscallstat *st, int n)
+{
+  int c, i, j;
+
+  if(n > (int)NELEM(syscalls))
+    n = NELEM(syscalls);
+  for(i = 0; i < n; i++){
+    memset(&st[i], 0, sizeof(st[i]));
+    for(c = 0; c < ncpu; c++){
+      st[i].calls += sysstat[c][i].calls;
+      st[i].kcycles += sysstat[c][i].cycles >> 10;
+      for(j = 0; j < NLATBUCKET; j++)
+        st[i].hist[j] += sysstat[c][i].hist[j];
+    }
+  }
+  return n;
+}
+
 void
 syscall(void)
 {
   int num;
+  uint64 t0, t;
   
   num = proc->tf->eax;
-  if(num >= 0 && (uint)num < NELEM(syscalls) && syscalls[num])
+  if(num >= 0 && (uint)num < NELEM(syscalls) && syscalls[num]){
+    t0 = rdtsc();
     proc->tf->eax = syscalls[num]();
-  else {
+    fdrelease();
+    // The call may have slept and woken on another CPU.
+    pushcli();
+    t = rdtsc() - t0;
+    sysstat[cpu->id][num].calls++;
+    sysstat[cpu->id][num].cycles += t;
+    sysstat[cpu->id][num].hist[latbucket(t)]++;
+    popcli();
+  } else {
     cprintf("%d %s: unknown sys call %d\n",
             proc->pid, proc->name, num);
     proc->tf->eax = -1;
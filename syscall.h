@@ -21,4 +21,29 @@
 #define SYS_sleep  20
 #define SYS_uptime 21
 #define SYS_ioctl  22
+#define SYS_socket 23
+#define SYS_bind   24
+#define SYS_sendto 25
+#define SYS_recvfrom 26
+#define SYS_listen 27
+#define SYS_accept 28
+#define SYS_connect 29
+#define SYS_setsockopt 30
+#define SYS_kstat  31
+#define SYS_fsync  32
+#define SYS_shmget 33
+#define SYS_shmat  34
+#define SYS_shmrm  35
+#define SYS_setpriority 36
+#define SYS_clone  37
+#define SYS_join   38
+#define SYS_futex  39
+#define SYS_poll   40
+#define SYS_sendfile 41
+#define SYS_irqaffinity 42
+#define SYS_nanotime 43
+#define SYS_trace  44
+#define SYS_prof   45
+#define SYS_getrusage 46
+#define SYS_vfork  47
 
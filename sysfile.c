@@ -7,6 +7,9 @@
 #include "fs.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "callout.h"
+#include "net/socket.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -18,7 +21,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=proc->ofile[fd]) == 0)
+  if((f = fdget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -27,22 +30,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd] == 0){
-      proc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 int
 sys_dup(void)
 {
@@ -64,7 +51,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argout(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -87,9 +74,8 @@ sys_close(void)
   int fd;
   struct file *f;
   
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || (f = fdremove(fd)) == 0)
     return -1;
-  proc->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -100,11 +86,26 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
   
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argout(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
 
+// Make the writes to fd's file durable.  They are in the log once
+// committed; writing back what the commits left in the cache also
+// does it for every other file on the disk.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_force();
+  bflush(f->ip->dev, 1);
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -114,11 +115,16 @@ sys_link(void)
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
-  if((ip = namei(old)) == 0)
+
+  begin_op();
+  if((ip = namei(old)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   ip->nlink++;
@@ -134,6 +140,7 @@ sys_link(void)
   }
   iunlockput(dp);
   iput(ip);
+  end_op();
   return 0;
 
 bad:
@@ -141,6 +148,7 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return -1;
 }
 
@@ -170,33 +178,33 @@ sys_unlink(void)
 
   if(argstr(0, &path) < 0)
     return -1;
-  if((dp = nameiparent(path, name)) == 0)
+
+  begin_op();
+  if((dp = nameiparent(path, name)) == 0){
+    end_op();
     return -1;
+  }
   ilock(dp);
 
   // Cannot unlink "." or "..".
-  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
-    iunlockput(dp);
-    return -1;
-  }
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    goto bad;
 
-  if((ip = dirlookup(dp, name, &off)) == 0){
-    iunlockput(dp);
-    return -1;
-  }
+  if((ip = dirlookup(dp, name, &off)) == 0)
+    goto bad;
   ilock(ip);
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
   if(ip->type == T_DIR && !isdirempty(ip)){
     iunlockput(ip);
-    iunlockput(dp);
-    return -1;
+    goto bad;
   }
 
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -206,7 +214,13 @@ sys_unlink(void)
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return 0;
+
+bad:
+  iunlockput(dp);
+  end_op();
+  return -1;
 }
 
 static struct inode*
@@ -263,15 +277,22 @@ sys_open(void)
 
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
+
+  begin_op();
   if(omode & O_CREATE){
-    if((ip = create(path, T_FILE, 0, 0)) == 0)
+    if((ip = create(path, T_FILE, 0, 0)) == 0){
+      end_op();
       return -1;
+    }
   } else {
-    if((ip = namei(path)) == 0)
+    if((ip = namei(path)) == 0){
+      end_op();
       return -1;
+    }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      end_op();
       return -1;
     }
   }
@@ -280,9 +301,11 @@ sys_open(void)
     if(f)
       fileclose(f);
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
+  end_op();
 
   f->type = FD_INODE;
   f->ip = ip;
@@ -298,9 +321,13 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -312,12 +339,16 @@ sys_mknod(void)
   int len;
   int major, minor;
   
+  begin_op();
   if((len=argstr(0, &path)) < 0 ||
       argint(1, &major) < 0 ||
       argint(2, &minor) < 0 ||
-      (ip = create(path, T_DEV, major, minor)) == 0)
+      (ip = create(path, T_DEV, major, minor)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -327,16 +358,20 @@ sys_chdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
-  iput(proc->cwd);
-  proc->cwd = ip;
+  iput(cwdset(ip));
+  end_op();
   return 0;
 }
 
@@ -373,14 +408,14 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argout(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      proc->ofile[fd0] = 0;
+      fdremove(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -400,4 +435,198 @@ sys_ioctl(void)
   if(argfd(0, 0, &f) < 0 || argint(1, &req) < 0 || argint(2, (int*)&p) < 0)
     return -1;
   return fileioctl(f, req, p);
-}
\ No newline at end of file
+}
+
+static void
+pollwake(void *chan)
+{
+  wakeup(chan);
+}
+
+// Wait until one of the nfds files in fds is ready for the events
+// it asks for, or for timeout ticks if timeout is not negative.
+// Returns how many files have revents set, so 0 on timeout.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f;
+  struct callout c;
+  int nfds, timeout, i, n;
+  uint end;
+
+  if(argint(1, &nfds) < 0 || argint(2, &timeout) < 0 ||
+     nfds < 0 || nfds > NOFILE ||
+     argout(0, (char**)&fds, nfds*sizeof(*fds)) < 0)
+    return -1;
+  callinit(&c, pollwake, &c);
+  end = ticks + timeout;
+  if(timeout > 0)
+    callat(&c, end);
+  for(;;){
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if((f = fdget(fds[i].fd)) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, fds[i].events) &
+                         (fds[i].events | POLLERR | POLLHUP);
+      if(fds[i].revents)
+        n++;
+    }
+    fdrelease();
+    if(n > 0 || timeout == 0 || proc->killed)
+      break;
+    if(timeout > 0){
+      // The callout may have gone off before it could wake us.
+      pollwait(&c);
+      if((int)(ticks - end) >= 0)
+        break;
+    }
+    pollsleep();
+  }
+  polldone();
+  callstop(&c);
+  if(proc->killed)
+    return -1;
+  return n;
+}
+
+int
+sys_socket(void)
+{
+  struct file *f;
+  int type, fd;
+
+  if(argint(0, &type) < 0)
+    return -1;
+  if(sockalloc(&f, type) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// Fetch the nth argument as a socket file.
+static int
+argsock(int n, struct file **pf)
+{
+  if(argfd(n, 0, pf) < 0 || (*pf)->type != FD_SOCKET)
+    return -1;
+  return 0;
+}
+
+int
+sys_bind(void)
+{
+  struct file *f;
+  int port;
+
+  if(argsock(0, &f) < 0 || argint(1, &port) < 0)
+    return -1;
+  return sockbind(f->sock, port);
+}
+
+int
+sys_sendto(void)
+{
+  struct file *f;
+  struct sockaddr_in *addr;
+  char *p;
+  int n;
+
+  if(argsock(0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argptr(3, (char**)&addr, sizeof(*addr)) < 0)
+    return -1;
+  return socksendto(f->sock, p, n, addr);
+}
+
+int
+sys_recvfrom(void)
+{
+  struct file *f;
+  struct sockaddr_in *addr;
+  char *p;
+  int n, a;
+
+  if(argsock(0, &f) < 0 || argint(2, &n) < 0 || argout(1, &p, n) < 0 ||
+     argint(3, &a) < 0)
+    return -1;
+  // The sender address is optional.
+  addr = 0;
+  if(a != 0 && argout(3, (char**)&addr, sizeof(*addr)) < 0)
+    return -1;
+  return sockrecvfrom(f->sock, p, n, addr);
+}
+
+int
+sys_listen(void)
+{
+  struct file *f;
+  int backlog;
+
+  if(argsock(0, &f) < 0 || argint(1, &backlog) < 0)
+    return -1;
+  return socklisten(f->sock, backlog);
+}
+
+int
+sys_accept(void)
+{
+  struct file *f, *nf;
+  struct sockaddr_in *addr;
+  int a, fd;
+
+  if(argsock(0, &f) < 0 || argint(1, &a) < 0)
+    return -1;
+  // The peer address is optional.
+  addr = 0;
+  if(a != 0 && argout(1, (char**)&addr, sizeof(*addr)) < 0)
+    return -1;
+  if(sockaccept(f->sock, &nf, addr) < 0)
+    return -1;
+  if((fd = fdalloc(nf)) < 0){
+    fileclose(nf);
+    return -1;
+  }
+  return fd;
+}
+
+int
+sys_connect(void)
+{
+  struct file *f;
+  struct sockaddr_in *addr;
+
+  if(argsock(0, &f) < 0 || argptr(1, (char**)&addr, sizeof(*addr)) < 0)
+    return -1;
+  return sockconnect(f->sock, addr);
+}
+
+int
+sys_setsockopt(void)
+{
+  struct file *f;
+  int opt, val;
+
+  if(argsock(0, &f) < 0 || argint(1, &opt) < 0 || argint(2, &val) < 0)
+    return -1;
+  return socksetopt(f->sock, opt, val);
+}
+
+// sendfile(sock, fd, n): send n bytes of fd from its offset on sock.
+int
+sys_sendfile(void)
+{
+  struct file *s, *f;
+  int n;
+
+  if(argsock(0, &s) < 0 || argfd(1, 0, &f) < 0 || argint(2, &n) < 0)
+    return -1;
+  return socksendfile(s->sock, f, n);
+}
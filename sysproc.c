@@ -4,6 +4,9 @@
 #include "param.h"
 #include "mmu.h"
 #include "proc.h"
+#include "kstat.h"
+#include "trace.h"
+#include "profile.h"
 
 int
 sys_fork(void)
@@ -11,6 +14,12 @@ sys_fork(void)
   return fork();
 }
 
+int
+sys_vfork(void)
+{
+  return vfork();
+}
+
 int
 sys_exit(void)
 {
@@ -58,21 +67,12 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
   
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < (uint)n){
-    if(proc->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return 0;
+  return ticksleep(n);
 }
 
 // return how many clock tick interrupts have occurred
@@ -87,3 +87,195 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Store the nanoseconds since boot in *ns.  Processes read the same
+// clock from the clock page without a system call; see nsecs().
+int
+sys_nanotime(void)
+{
+  uint64 *ns;
+
+  if(argout(0, (char**)&ns, sizeof(*ns)) < 0)
+    return -1;
+  *ns = nanotime();
+  return 0;
+}
+
+// Copy kernel statistics of kind which into buf, at most n bytes.
+// Returns the number of bytes copied.
+int
+sys_kstat(void)
+{
+  struct diskstat ds;
+  char *buf;
+  int which, n;
+
+  if(argint(0, &which) < 0 || argint(2, &n) < 0 || n < 0 ||
+     argout(1, &buf, n) < 0)
+    return -1;
+  switch(which){
+  case KSTAT_DISK:
+    idestats(&ds);
+    if(n > (int)sizeof(ds))
+      n = sizeof(ds);
+    memmove(buf, &ds, n);
+    return n;
+  case KSTAT_LOCKS:
+    return lockstats((struct lockstat*)buf, n / sizeof(struct lockstat)) *
+           sizeof(struct lockstat);
+  case KSTAT_SYSCALL:
+    return syscallstats((struct syscallstat*)buf,
+                        n / sizeof(struct syscallstat)) *
+           sizeof(struct syscallstat);
+  case KSTAT_IRQ:
+    if(n < (int)(NIRQSTAT * sizeof(struct irqstat)))
+      return -1;
+    irqstats((struct irqstat*)buf);
+    return NIRQSTAT * sizeof(struct irqstat);
+  case KSTAT_TRACE:
+    return tracecopy((struct tracerec*)buf, n / sizeof(struct tracerec)) *
+           sizeof(struct tracerec);
+  case KSTAT_LOG:
+    return logread(buf, n);
+  case KSTAT_PROF:
+    return profcopy((struct profsample*)buf,
+                    n / sizeof(struct profsample)) *
+           sizeof(struct profsample);
+  case KSTAT_PROC:
+    return procstat((struct procstat*)buf, n / sizeof(struct procstat)) *
+           sizeof(struct procstat);
+  }
+  return -1;
+}
+
+// Route device interrupt irq to CPU cpu.  Returns the CPU it went
+// to before, or -1.
+int
+sys_irqaffinity(void)
+{
+  int irq, c;
+
+  if(argint(0, &irq) < 0 || argint(1, &c) < 0)
+    return -1;
+  return ioapicroute(irq, c);
+}
+
+// Switch on the trace subsystems in mask, and off the others, unless
+// mask is negative.  Returns the mask before.
+int
+sys_trace(void)
+{
+  int mask, old;
+
+  if(argint(0, &mask) < 0)
+    return -1;
+  old = tracemask;
+  if(mask >= 0)
+    tracemask = mask & TRACE_ALL;
+  return old;
+}
+
+// Switch the profiler to mode; see profset().  Returns the mode
+// before, or -1.
+int
+sys_prof(void)
+{
+  int mode;
+
+  if(argint(0, &mode) < 0)
+    return -1;
+  return profset(mode);
+}
+
+// Copy what process pid, or the caller if pid is 0, has used so far
+// into the struct rusage at arg 1.  Returns 0 or -1.
+int
+sys_getrusage(void)
+{
+  struct rusage ru;
+  char *p;
+  int pid;
+
+  if(argint(0, &pid) < 0 || argout(1, &p, sizeof(ru)) < 0 ||
+     getrusage(pid, &ru) < 0)
+    return -1;
+  memmove(p, &ru, sizeof(ru));
+  return 0;
+}
+
+// Find or make the shared memory segment with a key.
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int
+sys_shmrm(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmrm(id);
+}
+
+int
+sys_setpriority(void)
+{
+  int pid, class, level;
+
+  if(argint(0, &pid) < 0 || argint(1, &class) < 0 || argint(2, &level) < 0)
+    return -1;
+  return setpriority(pid, class, level);
+}
+
+int
+sys_clone(void)
+{
+  int fn, arg, size;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(3, &size) < 0 ||
+     size <= 0 || argout(2, &stack, size) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, stack, size);
+}
+
+int
+sys_join(void)
+{
+  char *p;
+  void *stack;
+  int pid;
+
+  if(argout(0, &p, sizeof(void*)) < 0)
+    return -1;
+  if((pid = join(&stack)) >= 0)
+    *(void**)p = stack;
+  return pid;
+}
+
+int
+sys_futex(void)
+{
+  int addr, op, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  return futex((int*)addr, op, val);
+}
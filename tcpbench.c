@@ -0,0 +1,138 @@
+// tcpbench: measure bulk TCP throughput.
+//
+//   tcpbench -s [port]              receive and discard, report each
+//                                   connection's rate
+//   tcpbench ip port [kb [bufkb]]   send kb kilobytes (default 1024)
+//                                   with bufkb-kilobyte socket buffers
+//   tcpbench -f file ip port        send file with sendfile()
+//
+// Either end may be another host, e.g. "nc -l 5001 >/dev/null" or
+// "head -c 1000000 /dev/zero | nc 10.0.2.15 5001".
+
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "net/socket.h"
+
+char buf[8192];
+
+void
+report(char *what, int bytes, int t)
+{
+  if(t == 0)
+    t = 1;
+  printf(1, "tcpbench: %s %d bytes in %d ticks, %d KB/s\n",
+         what, bytes, t, bytes / 1024 * 100 / t);
+}
+
+void
+server(int port)
+{
+  struct sockaddr_in from;
+  int fd, c, n, total, t0;
+
+  if((fd = socket(SOCK_STREAM)) < 0 || bind(fd, port) < 0 ||
+     listen(fd, 1) < 0){
+    printf(2, "tcpbench: cannot listen on port %d\n", port);
+    exit();
+  }
+  for(;;){
+    if((c = accept(fd, &from)) < 0){
+      printf(2, "tcpbench: accept failed\n");
+      break;
+    }
+    t0 = uptime();
+    total = 0;
+    while((n = read(c, buf, sizeof(buf))) > 0)
+      total += n;
+    report("received", total, uptime() - t0);
+    close(c);
+  }
+  close(fd);
+}
+
+void
+client(struct sockaddr_in *to, int kb, int bufkb)
+{
+  int fd, n, left, t0;
+
+  if((fd = socket(SOCK_STREAM)) < 0){
+    printf(2, "tcpbench: socket failed\n");
+    exit();
+  }
+  if(bufkb > 0 && (setsockopt(fd, SO_SNDBUF, bufkb*1024) < 0 ||
+                   setsockopt(fd, SO_RCVBUF, bufkb*1024) < 0)){
+    printf(2, "tcpbench: bad buffer size %d KB\n", bufkb);
+    exit();
+  }
+  if(connect(fd, to) < 0){
+    printf(2, "tcpbench: cannot connect\n");
+    exit();
+  }
+  memset(buf, 'x', sizeof(buf));
+  t0 = uptime();
+  for(left = kb*1024; left > 0; left -= n){
+    n = left < (int)sizeof(buf) ? left : (int)sizeof(buf);
+    if((n = write(fd, buf, n)) <= 0){
+      printf(2, "tcpbench: connection lost\n");
+      break;
+    }
+  }
+  report("sent", kb*1024 - left, uptime() - t0);
+  close(fd);
+}
+
+// Send the whole of file straight from the buffer cache.
+void
+sendfrom(struct sockaddr_in *to, char *file)
+{
+  int fd, s, n, total, t0;
+
+  if((fd = open(file, O_RDONLY)) < 0){
+    printf(2, "tcpbench: cannot open %s\n", file);
+    exit();
+  }
+  if((s = socket(SOCK_STREAM)) < 0 || connect(s, to) < 0){
+    printf(2, "tcpbench: cannot connect\n");
+    exit();
+  }
+  t0 = uptime();
+  for(total = 0; (n = sendfile(s, fd, 65536)) > 0; total += n)
+    ;
+  if(n < 0)
+    printf(2, "tcpbench: connection lost\n");
+  report("sent", total, uptime() - t0);
+  close(s);
+  close(fd);
+}
+
+void
+usage(void)
+{
+  printf(2, "usage: tcpbench -s [port] | tcpbench ip port [kb [bufkb]] |\n"
+            "       tcpbench -f file ip port\n");
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sockaddr_in to;
+
+  if(argc >= 2 && strcmp(argv[1], "-s") == 0){
+    server(argc > 2 ? atoi(argv[2]) : 5001);
+    exit();
+  }
+  if(argc >= 2 && strcmp(argv[1], "-f") == 0){
+    if(argc != 5 || parseip(argv[3], to.addr) < 0)
+      usage();
+    to.port = atoi(argv[4]);
+    sendfrom(&to, argv[2]);
+    exit();
+  }
+  if(argc < 3 || argc > 5 || parseip(argv[1], to.addr) < 0)
+    usage();
+  to.port = atoi(argv[2]);
+  client(&to, argc > 3 ? atoi(argv[3]) : 1024, argc > 4 ? atoi(argv[4]) : 0);
+  exit();
+}
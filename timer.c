@@ -1,11 +1,15 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
-// Only used on uniprocessors;
+// Counter 0 is the clock tick only on uniprocessors;
 // SMP machines use the local APIC timer.
+// Counter 2 times the TSC once at boot for the nanosecond clock.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
 #include "traps.h"
 #include "x86.h"
+#include "vclock.h"
 
 #define IO_TIMER1       0x040           // 8253 Timer #1
 
@@ -18,9 +22,23 @@
 
 #define TIMER_MODE      (IO_TIMER1 + 3) // timer mode port
 #define TIMER_SEL0      0x00    // select counter 0
+#define TIMER_SEL2      0x80    // select counter 2
+#define TIMER_INTTC     0x00    // mode 0, interrupt on terminal count
 #define TIMER_RATEGEN   0x04    // mode 2, rate generator
 #define TIMER_16BIT     0x30    // r/w counter 16 bits, LSB first
 
+#define TIMER_CNTR2     (IO_TIMER1 + 2) // counter 2 data port
+#define PORTB           0x61            // counter 2 gate and output
+#define PORTB_GATE2     0x01
+#define PORTB_SPKR      0x02
+#define PORTB_OUT2      0x20
+
+#define CALIBRATE_HZ    20      // time the TSC over 1/20 second
+
+// The clock page.  The kernel writes it once, at boot, through its
+// own mapping; processes see it read-only at VCLOCK.
+char clockpage[PGSIZE] __attribute__((aligned(PGSIZE)));
+
 void
 timerinit(void)
 {
@@ -30,3 +48,89 @@ timerinit(void)
   outb(IO_TIMER1, TIMER_DIV(100) / 256);
   picenable(IRQ_TIMER);
 }
+
+// TSC cycles a second, counted while PIT counter 2 runs down
+// 1/CALIBRATE_HZ second.  Returns 0 if the counter never finishes.
+static uint
+tschz(void)
+{
+  uint64 t0, t1;
+  uint n;
+
+  outb(PORTB, (inb(PORTB) & ~PORTB_SPKR) | PORTB_GATE2);
+  outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+  outb(TIMER_CNTR2, TIMER_DIV(CALIBRATE_HZ) % 256);
+  outb(TIMER_CNTR2, TIMER_DIV(CALIBRATE_HZ) / 256);
+  t0 = rdtsc();
+  for(n = 0; !(inb(PORTB) & PORTB_OUT2); n++)
+    if(n == 1<<24)
+      return 0;
+  t1 = rdtsc();
+  return (t1 - t0) * CALIBRATE_HZ;
+}
+
+// Measure the TSC and fill in the clock page.  The TSCs of all CPUs
+// are taken to run at one constant rate, in step.
+void
+clockinit(void)
+{
+  struct vclock *vc;
+  uint64 r;
+  uint i;
+
+  vc = (struct vclock*)clockpage;
+  vc->tsc0 = rdtsc();
+  if((vc->hz = tschz()) == 0){
+    cprintf("clock: cannot time the TSC\n");
+    return;
+  }
+  // The largest shift that keeps mult to 32 bits.
+  for(vc->shift = 32; vc->shift > 0; vc->shift--)
+    if((1000000000ULL << vc->shift) >> 32 < vc->hz)
+      break;
+  // mult = 10^9 * 2^shift / hz, a bit at a time.
+  vc->mult = 1000000000 / vc->hz;
+  r = 1000000000 % vc->hz;
+  for(i = 0; i < vc->shift; i++){
+    vc->mult <<= 1;
+    r <<= 1;
+    if(r >= vc->hz){
+      r -= vc->hz;
+      vc->mult |= 1;
+    }
+  }
+  cprintf("clock: TSC at %d MHz\n", vc->hz / 1000000);
+}
+
+// Spin for at least us microseconds.  Until the TSC has been timed,
+// or if it could not be, count reads of the ISA diagnostic port
+// instead, which take about a microsecond each.
+void
+microdelay(int us)
+{
+  struct vclock *vc;
+  uint64 end;
+
+  vc = (struct vclock*)clockpage;
+  if(vc->hz == 0){
+    for(; us > 0; us--)
+      inb(0x80);
+    return;
+  }
+  end = rdtsc() + (uint64)us * (vc->hz / 1000000);
+  while(rdtsc() < end)
+    pause();
+}
+
+// Nanoseconds since boot, or from the clock ticks if the TSC could
+// not be timed.
+uint64
+nanotime(void)
+{
+  struct vclock *vc;
+
+  vc = (struct vclock*)clockpage;
+  if(vc->hz == 0)
+    return (uint64)ticks * 10000000;
+  return vclockns(vc, rdtsc());
+}
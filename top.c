@@ -0,0 +1,120 @@
+// top: which processes are using the machine.
+//
+//   top [-d ticks] [-n count]
+//
+// Every ticks clock ticks (default 100, a second) prints each
+// process with what it used since the last round, the busiest
+// first, count times (default 5; 0 for ever).  cpu is the percent of
+// one CPU it had in the round; the other columns are totals since
+// it started, from kstat(KSTAT_PROC):
+//   user, sys    clock ticks in user space and in the kernel
+//   csw, icsw    times it went to sleep, and was preempted
+//   flt          page faults
+//   inblk, oublk disk blocks read and written
+//   ethrx, ethtx bytes read and written on eth devices
+//
+//   ticks=100 procs=4
+//     pid  ppid state  cpu  user   sys    csw   icsw   flt inblk oublk   ethrx   ethtx name
+//       5     2 run     97   310     2      1     31    12     0     0       0       0 spin
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "kstat.h"
+
+struct procstat ps[2][NPROC];
+int np[2];
+uint used[NPROC];   // ticks in the round, by index into the current ps
+
+void
+usage(void)
+{
+  printf(2, "usage: top [-d ticks] [-n count]\n");
+  exit();
+}
+
+// Take a snapshot into ps[k].
+void
+snap(int k)
+{
+  int n;
+
+  if((n = kstat(KSTAT_PROC, ps[k], sizeof(ps[k]))) < 0){
+    printf(2, "top: kstat failed\n");
+    exit();
+  }
+  np[k] = n / sizeof(ps[k][0]);
+}
+
+// Print snapshot cur against prev, taken ticks before.
+void
+show(int cur, int prev, int ticks)
+{
+  struct procstat *p, *q;
+  int order[NPROC], i, j, k;
+
+  for(i = 0; i < np[cur]; i++){
+    p = &ps[cur][i];
+    used[i] = p->ru.utime + p->ru.stime;
+    for(j = 0; j < np[prev]; j++){
+      q = &ps[prev][j];
+      if(q->pid == p->pid){
+        used[i] -= q->ru.utime + q->ru.stime;
+        break;
+      }
+    }
+    // Insertion sort, busiest first.
+    for(k = i; k > 0 && used[order[k-1]] < used[i]; k--)
+      order[k] = order[k-1];
+    order[k] = i;
+  }
+
+  printf(1, "ticks=%d procs=%d\n", ticks, np[cur]);
+  printf(1, "  pid  ppid state  cpu  user   sys    csw   icsw   flt "
+            "inblk oublk   ethrx   ethtx name\n");
+  for(i = 0; i < np[cur]; i++){
+    p = &ps[cur][order[i]];
+    printf(1, "%5d %5d %-6s %4d %5d %5d %6d %6d %5d %5d %5d %7d %7d %s\n",
+           p->pid, p->ppid, p->state, used[order[i]] * 100 / ticks,
+           p->ru.utime, p->ru.stime, p->ru.nvcsw, p->ru.nivcsw,
+           p->ru.faults, p->ru.inblock, p->ru.oublock,
+           p->ru.ethrx, p->ru.ethtx, p->name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, delay, count, cur, t0, t;
+
+  delay = 100;
+  count = 5;
+  for(i = 1; i < argc; i++){
+    if(i + 1 == argc)
+      usage();
+    else if(strcmp(argv[i], "-d") == 0)
+      delay = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-n") == 0)
+      count = atoi(argv[++i]);
+    else
+      usage();
+  }
+  if(delay <= 0 || count < 0)
+    usage();
+
+  cur = 0;
+  t0 = uptime();
+  snap(cur);
+  for(i = 0; count == 0 || i < count; i++){
+    sleep(delay);
+    cur ^= 1;
+    t = uptime();
+    snap(cur);
+    if(i > 0)
+      printf(1, "\n");
+    show(cur, cur ^ 1, t > t0 ? t - t0 : 1);
+    t0 = t;
+  }
+  exit();
+}
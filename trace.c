@@ -0,0 +1,68 @@
+// Trace events.
+//
+// Each CPU writes its own ring of records with interrupts off and no
+// lock, so a tracepoint costs a clock read and a few stores and can
+// stay on in the hot paths.  A reader copies the rings as they are,
+// also without a lock, and drops any record overwritten or half
+// written meanwhile: seq is cleared before a record is filled in and
+// set last.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "trace.h"
+
+uint tracemask = TRACE_ALL;
+
+static struct {
+  uint n;           // records ever written
+  struct tracerec rec[NTRACE];
+} tracelog[NCPU];
+
+void
+traceev(int ev, uint a, uint b)
+{
+  struct tracerec *r;
+  uint n;
+
+  pushcli();
+  n = tracelog[cpu->id].n;
+  r = &tracelog[cpu->id].rec[n % NTRACE];
+  r->seq = 0;
+  __sync_synchronize();
+  r->ev = ev;
+  r->cpu = cpu->id;
+  r->ns = nanotime();
+  r->a = a;
+  r->b = b;
+  __sync_synchronize();
+  r->seq = n + 1;
+  tracelog[cpu->id].n = n + 1;
+  popcli();
+}
+
+// Copy the records still in the rings into buf, which has room for
+// max of them: each CPU's oldest first, one CPU after another.
+// Returns the number copied.
+int
+tracecopy(struct tracerec *buf, int max)
+{
+  struct tracerec *r;
+  uint i, n;
+  int c, k;
+
+  k = 0;
+  for(c = 0; c < ncpu; c++){
+    n = tracelog[c].n;
+    for(i = n > NTRACE ? n - NTRACE : 0; i < n && k < max; i++){
+      r = &tracelog[c].rec[i % NTRACE];
+      buf[k] = *r;
+      __sync_synchronize();
+      if(buf[k].seq == i + 1 && r->seq == i + 1)
+        k++;
+    }
+  }
+  return k;
+}
@@ -0,0 +1,36 @@
+// Trace events, kept by each CPU in a ring of binary records and
+// read with kstat(KSTAT_TRACE); see trace.c.  The top nibble of an
+// event is its subsystem, which trace() switches on and off.
+
+#define TRACE_SCHED   0x01
+#define TRACE_IDE     0x02
+#define TRACE_BIO     0x04
+#define TRACE_ETH     0x08
+#define TRACE_ALL     0x0F
+
+                          // a, b
+#define TR_SWITCH   0x00  // pid, cpu it runs on
+#define TR_WAKE     0x01  // pid, priority boost
+#define TR_IDEREAD  0x10  // sector, sectors
+#define TR_IDEWRITE 0x11  // sector, sectors
+#define TR_IDEDONE  0x12  // sector, sectors
+#define TR_BMISS    0x20  // sector, dev
+#define TR_BWRITE   0x21  // sector, dev
+#define TR_ETHRX    0x30  // card's I/O port, bytes
+#define TR_ETHTX    0x31  // card's I/O port, bytes
+#define TR_ETHDROP  0x32  // card's I/O port, frames dropped so far
+
+#define NTRACE 256        // records kept by each CPU
+
+struct tracerec {
+  uint seq;         // 1 + its place in its CPU's log, 0 while written
+  ushort ev;
+  ushort cpu;
+  uint64 ns;        // nanotime() when it happened
+  uint a;
+  uint b;
+};
+
+// In the kernel: record event ev, if its subsystem is on.
+#define TRACE(ev, a, b) \
+  do { if(tracemask & (1 << ((ev) >> 4))) traceev((ev), (a), (b)); } while(0)
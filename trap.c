@@ -6,6 +6,8 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "callout.h"
+#include "kstat.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -13,6 +15,13 @@ extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
 
+// Counts and handler cycles of each IRQ, kept by each CPU.
+static struct {
+  uint count;
+  uint64 cycles;
+  uint maxcycles;
+} irqstat[NCPU][NIRQSTAT];
+
 void
 tvinit(void)
 {
@@ -25,6 +34,43 @@ tvinit(void)
   initlock(&tickslock, "time");
 }
 
+// Taking tickslock first means the sleeper is asleep by the time
+// of the wakeup.
+static void
+tickwake(void *chan)
+{
+  acquire(&tickslock);
+  wakeup(chan);
+  release(&tickslock);
+}
+
+// Sleep for n clock ticks.  Returns -1 if the process is killed
+// first, 0 otherwise.  A callout wakes the sleeper at its deadline,
+// so no tick wakes anyone early.
+int
+ticksleep(uint n)
+{
+  struct callout c;
+  uint t0;
+  int r;
+
+  callinit(&c, tickwake, &c);
+  r = 0;
+  acquire(&tickslock);
+  t0 = ticks;
+  while(ticks - t0 < n){
+    if(proc->killed){
+      r = -1;
+      break;
+    }
+    callat(&c, t0 + n);
+    sleep(&c, &tickslock);
+  }
+  release(&tickslock);
+  callstop(&c);
+  return r;
+}
+
 void
 idtinit(void)
 {
@@ -45,15 +91,23 @@ handle_syscall(struct trapframe *tf)
 
 // Dispatch hardware device interrupts.  Returns 1 if the trap was handled.
 static int
-handle_device_interrupt(struct trapframe *tf)
+dispatch_irq(struct trapframe *tf)
 {
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    if(profmode)
+      profsample(tf);
+    if(proc){
+      if((tf->cs&3) == DPL_USER)
+        proc->utime++;
+      else
+        proc->stime++;
+    }
     if(cpu->id == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
       release(&tickslock);
+      calltick();
     }
     lapiceoi();
     return 1;
@@ -64,6 +118,14 @@ handle_device_interrupt(struct trapframe *tf)
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     return 1;
+  case T_IRQ0 + IRQ_WAKE:
+    // Only here to end a hlt in scheduler(); see kick().
+    lapiceoi();
+    return 1;
+  case T_IRQ0 + IRQ_TLB:
+    tlbpoll();
+    lapiceoi();
+    return 1;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
     lapiceoi();
@@ -73,7 +135,8 @@ handle_device_interrupt(struct trapframe *tf)
     lapiceoi();
     return 1;
   case T_IRQ0 + IRQ_ETH:
-    ethintr();
+  case T_IRQ0 + IRQ_ETH1:
+    ethintr(tf->trapno - T_IRQ0);
     lapiceoi();
     return 1;
   case T_IRQ0 + 7:
@@ -87,6 +150,110 @@ handle_device_interrupt(struct trapframe *tf)
   }
 }
 
+// Dispatch a device interrupt and count it.
+static int
+handle_device_interrupt(struct trapframe *tf)
+{
+  uint64 t0;
+  uint irq, t;
+
+  t0 = rdtsc();
+  if(!dispatch_irq(tf))
+    return 0;
+  t = rdtsc() - t0;
+  irq = tf->trapno - T_IRQ0;
+  if(irq < NIRQSTAT){
+    irqstat[cpu->id][irq].count++;
+    irqstat[cpu->id][irq].cycles += t;
+    if(t > irqstat[cpu->id][irq].maxcycles)
+      irqstat[cpu->id][irq].maxcycles = t;
+  }
+  return 1;
+}
+
+// Sum up the IRQ counts of all CPUs into st[NIRQSTAT], keeping
+// each CPU's count too.
+void
+irqstats(struct irqstat *st)
+{
+  int c, i;
+
+  for(i = 0; i < NIRQSTAT; i++){
+    memset(&st[i], 0, sizeof(st[i]));
+    st[i].cpu = ioapicirqcpu(i);
+    for(c = 0; c < ncpu; c++){
+      if(c < NIRQCPU)
+        st[i].cpucount[c] = irqstat[c][i].count;
+      st[i].count += irqstat[c][i].count;
+      st[i].kcycles += irqstat[c][i].cycles >> 10;
+      if(irqstat[c][i].maxcycles > st[i].maxcycles)
+        st[i].maxcycles = irqstat[c][i].maxcycles;
+    }
+  }
+}
+
+// Handle a page fault on a heap page not mapped yet, or from a
+// write to a copy-on-write page, in user space or from the kernel
+// copying to or from the user.  Returns 1 if the faulting
+// instruction can be restarted.  A fault in user space that cannot
+// be handled is left to handle_unexpected_trap(); one in a system
+// call kills the process, but lets the call finish first.
+static int
+handle_page_fault(struct trapframe *tf)
+{
+  uint va;
+
+  va = rcr2();
+  if(proc == 0 || va < USERBASE || va >= USERTOP)
+    return 0;
+  if(va < proc->sz){
+    if(!(tf->err & 1)){   // page not present
+      if(zerofault(proc->pgdir, va) == 0){
+        proc->faults++;
+        return 1;
+      }
+    } else if((tf->err & 2) && cowfault(proc->pgdir, va) == 0){
+      proc->faults++;     // a write to a copy-on-write page
+      return 1;
+    }
+  }
+  if((tf->cs&3) == DPL_USER || killfault(proc->pgdir, va) < 0)
+    return 0;
+  cprintf("pid %d %s: system call fault on cpu %d eip 0x%x addr 0x%x--kill proc\n",
+          proc->pid, proc->name, cpu->id, tf->eip, va);
+  proc->killed = 1;
+  return 1;
+}
+
+// A CPU without sysenter faults on it with an invalid opcode.
+// Carry it out as a system call.  Returns 1 if it was one.
+static int
+handle_sysenter(struct trapframe *tf)
+{
+  uchar *pc;
+
+  pc = (uchar*)tf->eip;
+  if(proc == 0 || (tf->cs&3) != DPL_USER || tf->eip < USERBASE ||
+     tf->eip + 2 > proc->sz || pc[0] != 0x0F || pc[1] != 0x34)
+    return 0;
+  tf->eip = tf->edx;
+  tf->esp = tf->ecx;
+  handle_syscall(tf);
+  return 1;
+}
+
+// sysenter leaves TF set, so a user single-stepping into it takes a
+// debug trap on sysentry, in the kernel on cpu->sysstack.  Clear TF
+// and let sysentry go on.  Returns 1 if that was the trap.
+static int
+handle_sysenter_step(struct trapframe *tf)
+{
+  if((tf->cs&3) != 0 || tf->eip != (uint)sysentry)
+    return 0;
+  tf->eflags &= ~FL_TF;
+  return 1;
+}
+
 // Manage traps that are neither system calls nor known device interrupts.
 static void
 handle_unexpected_trap(struct trapframe *tf)
@@ -107,13 +274,24 @@ handle_unexpected_trap(struct trapframe *tf)
 void
 trap(struct trapframe *tf)
 {
+  if(tf->trapno == T_DEBUG && handle_sysenter_step(tf))
+    return;
+
   if(tf->trapno == T_SYSCALL){
     handle_syscall(tf);
     return;
   }
 
-  if(!handle_device_interrupt(tf))
+  if(tf->trapno == T_PGFLT){
+    if(!handle_page_fault(tf))
+      handle_unexpected_trap(tf);
+  } else if(tf->trapno == T_ILLOP){
+    if(!handle_sysenter(tf))
+      handle_unexpected_trap(tf);
+  } else if(!handle_device_interrupt(tf))
     handle_unexpected_trap(tf);
+  else
+    softirq();
 
   // Force process exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
@@ -123,8 +301,11 @@ trap(struct trapframe *tf)
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
-  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+  // Softirqs this CPU is running on the process's stack must finish
+  // first.
+  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER &&
+     !insoftirq())
+    tickyield();
 
   // Check if the process has been killed since we yielded
   if(proc && proc->killed && (tf->cs&3) == DPL_USER)
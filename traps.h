@@ -33,7 +33,10 @@
 #define IRQ_KBD          1
 #define IRQ_COM1         4
 #define IRQ_ETH         11      // In QEMU, IRQ is 11 !!!
+#define IRQ_ETH1        10      // Second card, e.g. ne2k_isa,irq=10
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_WAKE        20      // IPI that ends an idle CPU's hlt
+#define IRQ_TLB         21      // IPI that flushes the TLB; see tlbshootdown()
 #define IRQ_SPURIOUS    31
 
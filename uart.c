@@ -1,4 +1,8 @@
 // Intel 8250 serial port (UART).
+//
+// Output goes into a ring and returns; the UART takes it from there
+// a FIFO-load at a time, refilled from its transmit-empty interrupt.
+// Only a writer that finds the ring full waits for the wire.
 
 #include "types.h"
 #include "defs.h"
@@ -13,15 +17,29 @@
 
 #define COM1    0x3f8
 
+#define TXBUF   4096        // bytes of output waiting for the UART
+
 static int uart;    // is there a uart?
 
+static struct {
+  struct spinlock lock;
+  char buf[TXBUF];
+  uint r;           // next byte for the UART
+  uint w;           // next free byte
+  int fifo;         // bytes the transmitter takes at once
+  int intr;         // transmit-empty interrupt enabled
+} tx;
+
 void
 uartinit(void)
 {
   char *p;
 
-  // Turn off the FIFO
-  outb(COM1+2, 0);
+  initlock(&tx.lock, "uart");
+  tx.fifo = 1;
+
+  // Turn on and clear the FIFOs, if there are any.
+  outb(COM1+2, 0x07);
   
   // 9600 baud, 8 data bits, 1 stop bit, parity off.
   outb(COM1+3, 0x80);    // Unlock divisor
@@ -37,8 +55,10 @@ uartinit(void)
   uart = 1;
 
   // Acknowledge pre-existing interrupt conditions;
-  // enable interrupts.
-  inb(COM1+2);
+  // enable interrupts.  A 16550 says in its top bits that
+  // the FIFOs are on.
+  if((inb(COM1+2) & 0xC0) == 0xC0)
+    tx.fifo = 16;
   inb(COM1+0);
   picenable(IRQ_COM1);
   ioapicenable(IRQ_COM1, 0);
@@ -48,15 +68,73 @@ uartinit(void)
     uartputc(*p);
 }
 
+// Wait, but not forever, until the transmitter is empty.
+static void
+uartwait(void)
+{
+  int i;
+
+  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
+    microdelay(10);
+}
+
+// Hand the transmitter as much of the ring as it takes.
+// Caller must hold tx.lock and have seen the transmitter empty.
+static void
+uartsend(void)
+{
+  int i;
+
+  for(i = 0; i < tx.fifo && tx.r != tx.w; i++)
+    outb(COM1+0, tx.buf[tx.r++ % TXBUF]);
+}
+
+// Refill the transmitter if it is empty, and ask for its interrupt
+// while there is more to send.  Caller must hold tx.lock.
+static void
+uartstart(void)
+{
+  int want;
+
+  if(inb(COM1+5) & 0x20)
+    uartsend();
+  want = tx.r != tx.w;
+  if(want != tx.intr){
+    tx.intr = want;
+    outb(COM1+1, want ? 0x03 : 0x01);
+  }
+}
+
+// Queue c for output.
 void
 uartputc(int c)
 {
-  int i;
+  if(!uart)
+    return;
+  acquire(&tx.lock);
+  while(tx.w - tx.r == TXBUF){
+    uartwait();
+    uartsend();
+  }
+  tx.buf[tx.w++ % TXBUF] = c;
+  // With the interrupt on, the UART is busy and will come back.
+  if(!tx.intr)
+    uartstart();
+  release(&tx.lock);
+}
 
+// Send c straight out after what is queued, without the lock and
+// without interrupts, for panic().
+void
+uartputc_sync(int c)
+{
   if(!uart)
     return;
-  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
-    microdelay(10);
+  while(tx.r != tx.w){
+    uartwait();
+    uartsend();
+  }
+  uartwait();
   outb(COM1+0, c);
 }
 
@@ -74,4 +152,9 @@ void
 uartintr(void)
 {
   consoleintr(uartgetc);
+  if(!uart)
+    return;
+  acquire(&tx.lock);
+  uartstart();
+  release(&tx.lock);
 }
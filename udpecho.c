@@ -0,0 +1,34 @@
+// udpecho: send every UDP datagram on a port back to its sender.
+//
+//   udpecho [port]
+
+#include "types.h"
+#include "user.h"
+#include "net/socket.h"
+
+char buf[2048];
+
+int
+main(int argc, char *argv[])
+{
+  struct sockaddr_in from;
+  int fd, n, port;
+
+  port = argc > 1 ? atoi(argv[1]) : 7;
+  if((fd = socket(SOCK_DGRAM)) < 0){
+    printf(2, "udpecho: socket failed\n");
+    exit();
+  }
+  if(bind(fd, port) < 0){
+    printf(2, "udpecho: cannot bind port %d\n", port);
+    exit();
+  }
+  for(;;){
+    if((n = recvfrom(fd, buf, sizeof(buf), &from)) < 0)
+      break;
+    if(sendto(fd, buf, n, &from) < 0)
+      printf(2, "udpecho: sendto failed\n");
+  }
+  close(fd);
+  exit();
+}
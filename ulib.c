@@ -3,6 +3,45 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "futex.h"
+#include "vclock.h"
+
+// printf() buffers its output and sets this, so that the buffers
+// are flushed before the process forks, execs or exits, or before one
+// of its files is closed.  An fd of -1 means all of them.
+void (*ulibflush)(int fd);
+
+int
+fork(void)
+{
+  if(ulibflush)
+    ulibflush(-1);
+  return _fork();
+}
+
+int
+exit(void)
+{
+  if(ulibflush)
+    ulibflush(-1);
+  _exit();
+}
+
+int
+close(int fd)
+{
+  if(ulibflush)
+    ulibflush(fd);
+  return _close(fd);
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(ulibflush)
+    ulibflush(-1);
+  return _exec(path, argv);
+}
 
 char*
 strcpy(char *s, char *t)
@@ -55,6 +94,9 @@ gets(char *buf, int max)
   int i, cc;
   char c;
 
+  // A prompt printed without a newline is still buffered.
+  if(ulibflush)
+    ulibflush(-1);
   for(i=0; i+1 < max; ){
     cc = read(0, &c, 1);
     if(cc < 1)
@@ -92,6 +134,24 @@ atoi(const char *s)
   return n;
 }
 
+// Parse a dotted quad into a; returns 0 or -1.
+int
+parseip(char *s, uchar *a)
+{
+  int i, v;
+
+  for(i = 0; i < 4; i++){
+    if(*s < '0' || *s > '9')
+      return -1;
+    for(v = 0; *s >= '0' && *s <= '9'; s++)
+      v = v*10 + *s - '0';
+    if(v > 255 || (i < 3 && *s++ != '.'))
+      return -1;
+    a[i] = v;
+  }
+  return *s == 0 ? 0 : -1;
+}
+
 void*
 memmove(void *vdst, void *vsrc, int n)
 {
@@ -103,3 +163,38 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// A mutex is a word: 0 free, 1 held, 2 held with threads perhaps
+// waiting in futex().  Taking a free one or giving back one nobody
+// waits for needs no system call.
+void
+mutexlock(uint *m)
+{
+  if(xchg(m, 1) == 0)
+    return;
+  while(xchg(m, 2) != 0)
+    futex((int*)m, FUTEX_WAIT, 2);
+}
+
+void
+mutexunlock(uint *m)
+{
+  if(xchg(m, 0) == 2)
+    futex((int*)m, FUTEX_WAKE, 1);
+}
+
+// Nanoseconds since boot, from the clock page the kernel maps into
+// every process, or from the kernel if it could not time the TSC.
+uint64
+nsecs(void)
+{
+  volatile struct vclock *vc;
+  uint64 ns;
+
+  vc = (struct vclock*)VCLOCK;
+  if(vc->hz == 0){
+    nanotime(&ns);
+    return ns;
+  }
+  return vclockns(vc, rdtsc());
+}
@@ -5,6 +5,12 @@
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+//
+// Blocks of up to NBIN units (headers included) are small: they are
+// cut from arenas taken from the K&R list, and a freed one goes on
+// the bin for its size, never coalesced, to be handed out again as
+// is.  So small malloc() and free() never walk a list.  Larger
+// blocks use the K&R list, which coalesces.
 
 typedef long Align;
 
@@ -18,8 +24,14 @@ union header {
 
 typedef union header Header;
 
+#define NBIN   32   // largest small block, in units
+#define NARENA 512  // units taken from the list for small blocks at once
+
 static Header base;
 static Header *freep;
+static Header *bin[NBIN+1];   // free small blocks of each size
+static Header *arena;         // rest of the arena, for new small blocks
+static uint narena;           // units left in it
 
 void
 free(void *ap)
@@ -27,6 +39,11 @@ free(void *ap)
   Header *bp, *p;
 
   bp = (Header*)ap - 1;
+  if(bp->s.size <= NBIN){
+    bp->s.ptr = bin[bp->s.size];
+    bin[bp->s.size] = bp;
+    return;
+  }
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -60,13 +77,11 @@ morecore(uint nu)
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+bigmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -88,3 +103,46 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Cut a small block of nunits from the arena, starting a new arena
+// if this one is too short.  What was left of the old one goes on
+// its bin.
+static void*
+smallmalloc(uint nunits)
+{
+  Header *p;
+
+  if(narena < nunits){
+    if(narena > 0){
+      arena->s.size = narena;
+      free((void*)(arena + 1));
+    }
+    narena = 0;
+    if((p = bigmalloc(NARENA)) == 0)
+      return 0;
+    arena = p;
+    narena = NARENA - 1;  // less the header bigmalloc() left before p
+  }
+  p = arena;
+  arena += nunits;
+  narena -= nunits;
+  p->s.size = nunits;
+  return (void*)(p + 1);
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits <= NBIN){
+    if((p = bin[nunits]) != 0){
+      bin[nunits] = p->s.ptr;
+      return (void*)(p + 1);
+    }
+    return smallmalloc(nunits);
+  }
+  return bigmalloc(nunits);
+}
@@ -1,15 +1,16 @@
 struct stat;
+struct sockaddr_in;
 
 // system calls
-int fork(void);
-int exit(void) __attribute__((noreturn));
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
 int wait(void);
 int pipe(int*);
 int write(int, void*, int);
 int read(int, void*, int);
-int close(int);
+int _close(int);
 int kill(int);
-int exec(char*, char**);
+int _exec(char*, char**);
 int open(char*, int);
 int mknod(char*, short, short);
 int unlink(char*);
@@ -23,17 +24,53 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int ioctl(int, int, void*);
+int socket(int);
+int bind(int, int);
+int sendto(int, void*, int, struct sockaddr_in*);
+int recvfrom(int, void*, int, struct sockaddr_in*);
+int listen(int, int);
+int accept(int, struct sockaddr_in*);
+int connect(int, struct sockaddr_in*);
+int setsockopt(int, int, int);
+int kstat(int, void*, int);
+int fsync(int);
+int shmget(int, int);
+char* shmat(int);
+int shmrm(int);
+int setpriority(int, int, int);
+int clone(void(*)(void*), void*, void*, uint);
+int join(void**);
+int futex(int*, int, int);
+struct pollfd;
+int poll(struct pollfd*, int, int);
+int sendfile(int, int, int);
+int irqaffinity(int, int);
+int nanotime(uint64*);
+int trace(int);
+int prof(int);
+struct rusage;
+int getrusage(int, struct rusage*);
+int vfork(void);
 
 // ulib.c
+int fork(void);
+int exit(void) __attribute__((noreturn));
+int close(int);
+int exec(char*, char**);
 int stat(char*, struct stat*);
 char* strcpy(char*, char*);
 void *memmove(void*, void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void printf(int, char*, ...);
+void printflush(int);
 char* gets(char*, int max);
 uint strlen(char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int parseip(char*, uchar*);
+void mutexlock(uint*);
+void mutexunlock(uint*);
+uint64 nsecs(void);
@@ -5,6 +5,13 @@
 #include "fcntl.h"
 #include "syscall.h"
 #include "traps.h"
+#include "param.h"
+#include "sched.h"
+#include "futex.h"
+#include "poll.h"
+#include "kstat.h"
+#include "trace.h"
+#include "profile.h"
 
 char buf[2048];
 char name[3];
@@ -82,6 +89,52 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// fsync of a written file succeeds and the data reads back;
+// fsync of a pipe fails.
+static void
+fsynctest(void)
+{
+  int fd, p[2];
+
+  printf(stdout, "fsync test\n");
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat fsyncf failed!\n");
+    exit();
+  }
+  memset(buf, 'f', 512);
+  if(write(fd, buf, 512) != 512 || fsync(fd) != 0){
+    printf(stdout, "error: write/fsync fsyncf failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("fsyncf", O_RDONLY);
+  memset(buf, 0, 512);
+  if(fd < 0 || read(fd, buf, 512) != 512 || buf[0] != 'f' || buf[511] != 'f'){
+    printf(stdout, "error: read fsyncf failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("fsyncf");
+
+  if(pipe(p) != 0){
+    printf(stdout, "error: pipe failed\n");
+    exit();
+  }
+  if(fsync(p[0]) != -1){
+    printf(stdout, "error: fsync of a pipe succeeded\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+  printf(stdout, "fsync test ok\n");
+}
+
+// 512-byte writes in the big file: as big as a file gets with
+// 512-byte blocks, and 6MB, well into the doubly-indirect blocks,
+// with larger ones.
+#define NBIG (BSIZE == 512 ? MAXFILE : 6*1024*1024/512)
+
 static void
 writetest1(void)
 {
@@ -95,7 +148,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; (uint)i < MAXFILE; i++){
+  for(i = 0; (uint)i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -115,7 +168,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == NBIG - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -250,6 +303,633 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// grow a pipe with data in it, fill it past the old size without a
+// reader, and read everything back in order
+void
+pipesize(void)
+{
+  int fds[2], i, n, seq, total;
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(ioctl(fds[0], PIPE_GETSIZE, 0) != 4096){
+    printf(1, "pipesize: default size wrong\n");
+    exit();
+  }
+  seq = 0;
+  for(n = 0; n < 2; n++){
+    for(i = 0; i < 1500; i++)
+      buf[i] = seq++;
+    if(write(fds[1], buf, 1500) != 1500){
+      printf(1, "pipesize: write failed\n");
+      exit();
+    }
+  }
+  if(ioctl(fds[1], PIPE_SETSIZE, (void*)3) != 4096 ||
+     ioctl(fds[1], PIPE_SETSIZE, (void*)12000) != 16384){
+    printf(1, "pipesize: setsize wrong\n");
+    exit();
+  }
+  for(n = 0; n < 8; n++){
+    for(i = 0; i < 1500; i++)
+      buf[i] = seq++;
+    if(write(fds[1], buf, 1500) != 1500){
+      printf(1, "pipesize: write failed\n");
+      exit();
+    }
+  }
+  if(ioctl(fds[1], PIPE_SETSIZE, (void*)4096) != -1){
+    printf(1, "pipesize: shrank below its data\n");
+    exit();
+  }
+  close(fds[1]);
+  seq = 0;
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf(1, "pipesize: wrong data\n");
+        exit();
+      }
+    }
+    total += n;
+  }
+  if(total != 10 * 1500){
+    printf(1, "pipesize: total %d\n", total);
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "pipesize ok\n");
+}
+
+// a shared memory segment attached before and after fork
+static void
+shmtest(void)
+{
+  char *oldbrk, *a, *b;
+  int id, pid, i;
+
+  printf(1, "shm test\n");
+  oldbrk = sbrk(0);
+  if((id = shmget(0x53484D, 3*4096)) < 0 || (a = shmat(id)) == (char*)-1){
+    printf(1, "shmget/shmat failed\n");
+    exit();
+  }
+  a[0] = 'p';
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // one mapping inherited, one made here
+    if(shmget(0x53484D, 4096) != id || (b = shmat(id)) == (char*)-1){
+      printf(1, "shm child attach failed\n");
+      exit();
+    }
+    if(b[0] != 'p'){
+      printf(1, "shm child sees %d\n", b[0]);
+      exit();
+    }
+    for(i = 0; i < 3*4096; i++)
+      b[i] = i;
+    a[1] = 'c';
+    exit();
+  }
+  wait();
+  for(i = 2; i < 3*4096; i++){
+    if(a[i] != (char)i){
+      printf(1, "shm byte %d is %d\n", i, a[i]);
+      exit();
+    }
+  }
+  if(a[1] != 'c'){
+    printf(1, "shm fork mapping not shared\n");
+    exit();
+  }
+  if(shmget(0x53484D, 4*4096) != -1){
+    printf(1, "shmget grew a segment\n");
+    exit();
+  }
+  if(shmrm(id) != 0 || shmrm(id) != -1){
+    printf(1, "shmrm failed\n");
+    exit();
+  }
+  // the pages outlive the segment while mapped
+  a[0] = 'x';
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(1, "shm ok\n");
+}
+
+// setpriority checks its arguments and reaches other processes
+void
+priotest(void)
+{
+  int pid, fds[2];
+  char c;
+
+  printf(1, "priority test\n");
+  if(setpriority(0, SCHED_RT, NRTPRIO) != -1 ||
+     setpriority(0, SCHED_TS, -1) != -1 ||
+     setpriority(0, 2, 0) != -1 ||
+     setpriority(-1, SCHED_TS, 0) != -1){
+    printf(1, "setpriority took bad arguments\n");
+    exit();
+  }
+  if(setpriority(0, SCHED_TS, NNICE-1) != 0){
+    printf(1, "setpriority nice failed\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[1]);
+    // inherited nice value; blocks until the parent writes
+    if(setpriority(0, SCHED_RT, 0) != 0 || read(fds[0], &c, 1) != 1)
+      printf(1, "priority child failed\n");
+    exit();
+  }
+  close(fds[0]);
+  if(setpriority(pid, SCHED_RT, NRTPRIO-1) != 0){
+    printf(1, "setpriority of child failed\n");
+    exit();
+  }
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait();
+  setpriority(0, SCHED_TS, 0);
+  printf(1, "priority ok\n");
+}
+
+#define NTHREAD 4
+volatile int threadout[NTHREAD];
+char *volatile threadmem;
+volatile int threadfd = -1;
+
+void
+threadmain(void *arg)
+{
+  int i;
+
+  i = (int)arg;
+  threadout[i] = i + 100;
+  if(i == NTHREAD - 1){
+    // memory grown by one thread is there for the others
+    threadmem = sbrk(4096);
+    threadmem[0] = 't';
+    // and so are descriptors opened by one
+    threadfd = open("threadfd", O_CREATE|O_RDWR);
+  }
+  exit();
+}
+
+void
+threadtest(void)
+{
+  void *stacks[NTHREAD], *stack;
+  int i, j, pid, pids[NTHREAD];
+
+  printf(1, "thread test\n");
+  for(i = 0; i < NTHREAD; i++){
+    stacks[i] = malloc(4096);
+    if((pids[i] = clone(threadmain, (void*)i, stacks[i], 4096)) < 0){
+      printf(1, "clone failed\n");
+      exit();
+    }
+  }
+  if(wait() != -1){
+    printf(1, "wait reaped a thread\n");
+    exit();
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if((pid = join(&stack)) < 0){
+      printf(1, "join failed\n");
+      exit();
+    }
+    for(j = 0; j < NTHREAD; j++)
+      if(pids[j] == pid && stacks[j] == stack)
+        break;
+    if(j == NTHREAD){
+      printf(1, "join returned pid %d stack %x\n", pid, stack);
+      exit();
+    }
+  }
+  if(join(&stack) != -1){
+    printf(1, "join with no threads\n");
+    exit();
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(threadout[i] != i + 100){
+      printf(1, "thread %d did not run\n", i);
+      exit();
+    }
+    free(stacks[i]);
+  }
+  if(threadmem == 0 || threadmem[0] != 't'){
+    printf(1, "thread sbrk not shared\n");
+    exit();
+  }
+  if(threadfd < 0 || write(threadfd, "t", 1) != 1 || close(threadfd) < 0){
+    printf(1, "thread descriptors not shared\n");
+    exit();
+  }
+  unlink("threadfd");
+  printf(1, "thread ok\n");
+}
+
+uint futexmu;
+volatile int futexcount;
+
+void
+futexmain(void *arg)
+{
+  int i;
+
+  (void)arg;
+  for(i = 0; i < 1000; i++){
+    mutexlock(&futexmu);
+    futexcount++;
+    if(i % 250 == 0)
+      sleep(1);   // make the others wait in futex()
+    mutexunlock(&futexmu);
+  }
+  exit();
+}
+
+void
+futextest(void)
+{
+  void *stacks[NTHREAD], *stack;
+  int i, word;
+
+  printf(1, "futex test\n");
+  word = 1;
+  if(futex(&word, FUTEX_WAIT, 0) != -1 || futex(&word, FUTEX_WAKE, 1) != 0 ||
+     futex((int*)1, FUTEX_WAKE, 1) != -1){
+    printf(1, "futex took bad arguments\n");
+    exit();
+  }
+  for(i = 0; i < NTHREAD; i++){
+    stacks[i] = malloc(4096);
+    if(clone(futexmain, 0, stacks[i], 4096) < 0){
+      printf(1, "clone failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREAD; i++)
+    if(join(&stack) < 0){
+      printf(1, "join failed\n");
+      exit();
+    }
+  for(i = 0; i < NTHREAD; i++)
+    free(stacks[i]);
+  if(futexcount != NTHREAD*1000 || futexmu != 0){
+    printf(1, "futex count %d lock %d\n", futexcount, futexmu);
+    exit();
+  }
+  printf(1, "futex ok\n");
+}
+
+uint forkmu;
+volatile int forkgot;
+
+void
+forkwaiter(void *arg)
+{
+  (void)arg;
+  mutexlock(&forkmu);
+  forkgot = 1;
+  mutexunlock(&forkmu);
+  exit();
+}
+
+// a thread waits on a mutex while another forks, which makes the
+// mutex's page copy-on-write again, and then unlocks it: the unlock
+// copies the page, and must still wake the waiter
+void
+futexforktest(void)
+{
+  void *stack;
+  int pid;
+
+  printf(1, "futex fork test\n");
+  mutexlock(&forkmu);
+  stack = malloc(4096);
+  if(clone(forkwaiter, 0, stack, 4096) < 0){
+    printf(1, "clone failed\n");
+    exit();
+  }
+  while(forkmu != 2)
+    sleep(1);
+  sleep(5);   // let the waiter get into futex()
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0)
+    exit();
+  mutexunlock(&forkmu);
+  if(join(&stack) < 0 || wait() != pid){
+    printf(1, "join or wait failed\n");
+    exit();
+  }
+  free(stack);
+  if(!forkgot || forkmu != 0){
+    printf(1, "futex fork got %d lock %d\n", forkgot, forkmu);
+    exit();
+  }
+  printf(1, "futex fork ok\n");
+}
+
+// poll two pipes: nothing ready, a timeout, a write from a child
+// ending a wait forever, a hangup and a bad fd
+void
+polltest(void)
+{
+  struct pollfd pfd[3];
+  int a[2], b[2], pid;
+
+  printf(1, "poll test\n");
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = b[1];
+  pfd[2].events = POLLOUT;
+  if(poll(pfd, 2, 0) != 0 || poll(pfd, 2, 3) != 0 ||
+     poll(pfd, 3, -1) != 1 || pfd[2].revents != POLLOUT){
+    printf(1, "poll: ready too soon\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    sleep(5);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents != 0 ||
+     pfd[1].revents != POLLIN){
+    printf(1, "poll: missed the write\n");
+    exit();
+  }
+  wait();
+  close(a[1]);
+  pfd[2].fd = 99;
+  if(poll(pfd, 3, 0) != 3 || pfd[0].revents != POLLHUP ||
+     pfd[2].revents != POLLNVAL){
+    printf(1, "poll: missed the hangup\n");
+    exit();
+  }
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+  printf(1, "poll ok\n");
+}
+
+// Interrupts can be moved between CPUs, and bad routes are refused.
+void
+irqafftest(void)
+{
+  static struct irqstat is[NIRQSTAT];
+  int old;
+
+  printf(1, "irqaff test\n");
+  if(irqaffinity(-1, 0) >= 0 || irqaffinity(NIRQSTAT, 0) >= 0 ||
+     irqaffinity(IRQ_IDE, NCPU) >= 0){
+    printf(1, "irqaff: bad route taken\n");
+    exit();
+  }
+  // Without an I/O APIC there is nothing to route.
+  if((old = irqaffinity(IRQ_IDE, 0)) < 0){
+    printf(1, "irqaff ok (no ioapic)\n");
+    return;
+  }
+  if(kstat(KSTAT_IRQ, is, sizeof(is)) != sizeof(is) || is[IRQ_IDE].cpu != 0){
+    printf(1, "irqaff: route not seen\n");
+    exit();
+  }
+  if(irqaffinity(IRQ_IDE, old) != 0){
+    printf(1, "irqaff: cannot move back\n");
+    exit();
+  }
+  printf(1, "irqaff ok\n");
+}
+
+// The clock page and nanotime() tell the same time, which runs
+// forward at the rate of the clock ticks.
+void
+clocktest(void)
+{
+  uint64 a, b, c;
+  uint t0, t;
+
+  printf(1, "clock test\n");
+  a = nsecs();
+  if(nanotime(&b) != 0 || nanotime((uint64*)0) >= 0){
+    printf(1, "clock: nanotime failed\n");
+    exit();
+  }
+  c = nsecs();
+  if(b < a || c < b){
+    printf(1, "clock: went backward\n");
+    exit();
+  }
+  t0 = uptime();
+  a = nsecs();
+  sleep(20);
+  b = nsecs();
+  t = uptime() - t0;
+  // Within a tick either way of what the ticks say.
+  if(b - a < (uint64)(t - 1) * 10000000 || b - a > (uint64)(t + 1) * 10000000){
+    printf(1, "clock: out of step with %d ticks\n", t);
+    exit();
+  }
+  printf(1, "clock ok\n");
+}
+
+// The kernel log has the boot messages, and a process that sleeps
+// shows up in the scheduler's trace events unless they are off.
+void
+tracetest(void)
+{
+  static struct tracerec recs[NCPU*NTRACE];
+  static char log[64];
+  int i, n, old, pid;
+
+  printf(1, "trace test\n");
+  if(kstat(KSTAT_LOG, log, sizeof(log)) != sizeof(log)){
+    printf(1, "trace: kernel log short\n");
+    exit();
+  }
+  old = trace(TRACE_SCHED);
+  if(trace(-1) != TRACE_SCHED){
+    printf(1, "trace: mask not set\n");
+    exit();
+  }
+  sleep(2);
+  pid = getpid();
+  n = kstat(KSTAT_TRACE, recs, sizeof(recs)) / sizeof(recs[0]);
+  trace(old);
+  for(i = 0; i < n; i++)
+    if(recs[i].ev == TR_SWITCH && recs[i].a == (uint)pid)
+      break;
+  if(i == n){
+    printf(1, "trace: no switch to pid %d in %d events\n", pid, n);
+    exit();
+  }
+  printf(1, "trace ok\n");
+}
+
+// A busy loop in user space shows up in the profile.
+void
+proftest(void)
+{
+  static struct profsample s[NCPU*NPROF];
+  int i, n, old, t;
+
+  printf(1, "prof test\n");
+  old = prof(PROF_PC);
+  if(prof(-1) != PROF_PC){
+    printf(1, "prof: mode not set\n");
+    exit();
+  }
+  for(t = uptime(); uptime() < t + 3; )
+    ;
+  prof(old);
+  n = kstat(KSTAT_PROF, s, sizeof(s)) / sizeof(s[0]);
+  for(i = 0; i < n; i++)
+    if(s[i].user && s[i].pc[0] >= 0x40000000 && s[i].pc[0] < 0x80000000)
+      break;
+  if(i == n){
+    printf(1, "prof: no user sample in %d\n", n);
+    exit();
+  }
+  printf(1, "prof ok\n");
+}
+
+// getrusage() sees user time, page faults and disk writes charged,
+// and no process that is not there.
+void
+rusagetest(void)
+{
+  struct rusage a, b;
+  char *p;
+  int fd, t;
+
+  printf(1, "rusage test\n");
+  if(getrusage(0, &a) < 0 || getrusage(-1, &b) == 0){
+    printf(1, "rusage: getrusage wrong\n");
+    exit();
+  }
+  for(t = uptime(); uptime() < t + 3; )
+    ;
+  if((p = sbrk(2*4096)) == (char*)-1){
+    printf(1, "rusage: sbrk failed\n");
+    exit();
+  }
+  p[0] = p[4096] = 1;
+  if((fd = open("rusage", O_CREATE|O_RDWR)) < 0 ||
+     write(fd, "x", 1) != 1 || fsync(fd) < 0){
+    printf(1, "rusage: write failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("rusage");
+  sbrk(-2*4096);
+  if(getrusage(getpid(), &b) < 0 || b.utime == a.utime ||
+     b.faults < a.faults + 2 || b.oublock == a.oublock){
+    printf(1, "rusage: utime %d->%d stime %d->%d faults %d->%d "
+           "oublock %d->%d\n", a.utime, b.utime, a.stime, b.stime,
+           a.faults, b.faults, a.oublock, b.oublock);
+    exit();
+  }
+  printf(1, "rusage ok\n");
+}
+
+// A vfork() child borrows the memory and stack of its parent until
+// it exits or execs, and the parent goes on after either.
+void
+vforktest(void)
+{
+  static char *argv[] = { "echo", 0 };
+  int pid;
+
+  printf(1, "vfork test\n");
+  if((pid = vfork()) < 0){
+    printf(1, "vfork: vfork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    getpid();
+    _exit();
+  }
+  if(wait() != pid){
+    printf(1, "vfork: wait for exited child wrong\n");
+    exit();
+  }
+  if((pid = vfork()) == 0){
+    _exec(argv[0], argv);
+    _exit();
+  }
+  if(pid < 0 || wait() != pid){
+    printf(1, "vfork: wait for exec'd child wrong\n");
+    exit();
+  }
+  printf(1, "vfork ok\n");
+}
+
+// printf() output to a file is buffered, written once across a
+// fork, and all there after close().
+void
+printftest(void)
+{
+  char buf[32];
+  int fd, pid, n;
+
+  printf(1, "printf test\n");
+  fd = open("printf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "printf: create failed\n");
+    exit();
+  }
+  printf(fd, "a%db", 1);
+  if((pid = fork()) < 0){
+    printf(1, "printf: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    printf(fd, "c");
+    exit();
+  }
+  wait();
+  printf(fd, "%s", "d");
+  close(fd);
+  fd = open("printf", 0);
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  unlink("printf");
+  buf[n < 0 ? 0 : n] = 0;
+  if(strcmp(buf, "a1bcd") != 0){
+    printf(1, "printf: wrote %d bytes\n", n);
+    exit();
+  }
+  printf(1, "printf ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 static void
 preempt(void)
@@ -1170,7 +1850,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // the 50 is NINODE_MIN
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1271,21 +1951,21 @@ sbrktest(void)
     exit();
   wait();
 
-  // can one allocate the full 640K?
+  // can one allocate a few megabytes?
   a = sbrk(0);
-  amt = (640 * 1024) - (uint)a;
+  amt = 4 * 1024 * 1024;
   p = sbrk(amt);
   if(p != a){
-    printf(stdout, "sbrk test failed 640K test, p %x a %x\n", p, a);
+    printf(stdout, "sbrk test failed 4M test, p %x a %x\n", p, a);
     exit();
   }
-  lastaddr = (char*)(640 * 1024 - 1);
+  lastaddr = a + amt - 1;
   *lastaddr = 99;
 
-  // is one forbidden from allocating more than 640K?
-  c = sbrk(4096);
+  // is one forbidden from allocating past USERTOP?
+  c = sbrk(USERTOP - (uint)sbrk(0) + 4096);
   if(c != (char*)0xffffffff){
-    printf(stdout, "sbrk allocated more than 640K, c %x\n", c);
+    printf(stdout, "sbrk allocated past USERTOP, c %x\n", c);
     exit();
   }
 
@@ -1315,9 +1995,9 @@ sbrktest(void)
     exit();
   }
 
-  c = sbrk(4096);
+  c = sbrk(USERTOP - (uint)sbrk(0) + 4096);
   if(c != (char*)0xffffffff){
-    printf(stdout, "sbrk was able to re-allocate beyond 640K, c %x\n", c);
+    printf(stdout, "sbrk was able to re-allocate past USERTOP, c %x\n", c);
     exit();
   }
 
@@ -1346,8 +2026,11 @@ sbrktest(void)
   }
   for(i = 0; i < (int)(sizeof(pids)/sizeof(pids[0])); i++){
     if((pids[i] = fork()) == 0){
-      // allocate the full 640K
-      sbrk((640 * 1024) - (uint)sbrk(0));
+      // allocate and touch 640K
+      a = sbrk(640 * 1024);
+      if(a != (char*)0xffffffff)
+        for(c = a; c < a + 640 * 1024; c += 4096)
+          *c = 1;
       write(fds[1], "x", 1);
       // sit around until killed
       for(;;) sleep(1000);
@@ -1375,6 +2058,154 @@ sbrktest(void)
   printf(stdout, "sbrk test OK\n");
 }
 
+// a heap grown by megabytes gets pages only where touched, before
+// and after fork, and a system call writing to a page never touched
+// fills it in rather than failing
+static void
+lazysbrktest(void)
+{
+  char *a, *oldbrk;
+  int fds[2], pid, ppid, i;
+  uint amt;
+
+  printf(stdout, "lazy sbrk test\n");
+  oldbrk = sbrk(0);
+  amt = 8 * 1024 * 1024;
+  a = sbrk(amt);
+  if(a == (char*)0xffffffff || pipe(fds) != 0){
+    printf(stdout, "lazy sbrk test setup failed\n");
+    exit();
+  }
+  a[0] = 1;
+  a[3*1024*1024 + 123] = 2;
+  a[amt - 1] = 3;
+  write(fds[1], "lazy", 4);
+  ppid = getpid();
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "lazy sbrk test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[0] != 1 || a[3*1024*1024 + 123] != 2 || a[amt - 1] != 3){
+      printf(stdout, "lazy sbrk test child lost touched pages\n");
+      kill(ppid);
+      exit();
+    }
+    for(i = 1; i < 8; i++){
+      if(a[i*1024*1024 + 4096] != 0){
+        printf(stdout, "lazy sbrk test page not zero\n");
+        kill(ppid);
+        exit();
+      }
+      a[i*1024*1024 + 4096] = i;
+    }
+    // a page neither process has touched
+    if(read(fds[0], a + 6*1024*1024, 4) != 4 ||
+       a[6*1024*1024] != 'l' || a[6*1024*1024 + 3] != 'y'){
+      printf(stdout, "lazy sbrk test read into untouched page failed\n");
+      kill(ppid);
+      exit();
+    }
+    exit();
+  }
+  wait();
+  for(i = 1; i < 8; i++){
+    if(a[i*1024*1024 + 4096] != 0){
+      printf(stdout, "lazy sbrk test parent sees child's page %d\n", i);
+      exit();
+    }
+  }
+  write(fds[1], "page", 4);
+  if(read(fds[0], a + 5*1024*1024 + 8192, 4) != 4 ||
+     a[5*1024*1024 + 8192] != 'p' || a[6*1024*1024] != 0){
+    printf(stdout, "lazy sbrk test parent read failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(stdout, "lazy sbrk test OK\n");
+}
+
+// after fork, parent and child each write the same copy-on-write
+// heap and stack pages, and neither sees the other's writes; the
+// child also read()s into a page it shares, which the kernel must
+// copy before it writes
+static void
+cowtest(void)
+{
+  char *a, stk[512], c;
+  int fds[2], pid, ppid, i;
+
+  printf(stdout, "cow test\n");
+  a = sbrk(2*4096);
+  if(a == (char*)0xffffffff || pipe(fds) != 0){
+    printf(stdout, "cow test setup failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*4096; i++)
+    a[i] = 'p';
+  for(i = 0; i < (int)sizeof(stk); i++)
+    stk[i] = 'p';
+  ppid = getpid();
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < 4096; i++)
+      a[i] = 'c';
+    for(i = 0; i < (int)sizeof(stk); i++)
+      stk[i] = 'c';
+    // waits until the parent has written its copies
+    if(read(fds[0], a + 4096 + 100, 1) != 1 || a[4096 + 100] != 'x'){
+      printf(stdout, "cow test read into shared page failed\n");
+      kill(ppid);
+      exit();
+    }
+    for(i = 0; i < 4096; i++){
+      c = i == 100 ? 'x' : 'p';
+      if(a[i] != 'c' || a[4096 + i] != c){
+        printf(stdout, "cow test child sees byte %d as %d %d\n", i, a[i], a[4096 + i]);
+        kill(ppid);
+        exit();
+      }
+    }
+    for(i = 0; i < (int)sizeof(stk); i++){
+      if(stk[i] != 'c'){
+        printf(stdout, "cow test child stack byte %d is %d\n", i, stk[i]);
+        kill(ppid);
+        exit();
+      }
+    }
+    exit();
+  }
+  for(i = 0; i < 4096; i++)
+    a[i] = 'P';
+  for(i = 0; i < (int)sizeof(stk); i++)
+    stk[i] = 'P';
+  write(fds[1], "x", 1);
+  wait();
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < 4096; i++){
+    if(a[i] != 'P' || a[4096 + i] != 'p'){
+      printf(stdout, "cow test parent sees byte %d as %d %d\n", i, a[i], a[4096 + i]);
+      exit();
+    }
+  }
+  for(i = 0; i < (int)sizeof(stk); i++){
+    if(stk[i] != 'P'){
+      printf(stdout, "cow test parent stack byte %d is %d\n", i, stk[i]);
+      exit();
+    }
+  }
+  sbrk(-2*4096);
+  printf(stdout, "cow test OK\n");
+}
+
 static void
 validateint(int *p)
 {
@@ -1475,15 +2306,32 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazysbrktest();
+  cowtest();
   validatetest();
 
   opentest();
   writetest();
   writetest1();
+  fsynctest();
   createtest();
 
   mem();
   pipe1();
+  pipesize();
+  shmtest();
+  priotest();
+  threadtest();
+  futextest();
+  futexforktest();
+  polltest();
+  irqafftest();
+  clocktest();
+  tracetest();
+  proftest();
+  rusagetest();
+  vforktest();
+  printftest();
   preempt();
   exitwait();
 
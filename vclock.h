@@ -0,0 +1,23 @@
+// The clock page, mapped read-only at VCLOCK in every process, just
+// above user memory (USERTOP), so that reading the nanosecond clock
+// takes no system call; see timer.c.
+#define VCLOCK 0x80000000
+
+struct vclock {
+  uint64 tsc0;      // TSC at boot
+  uint hz;          // TSC cycles a second, 0 if not measured
+  uint mult;        // nanoseconds a cycle, scaled by 2^shift
+  uint shift;       // at most 32
+};
+
+// Nanoseconds since boot at TSC value tsc.  The two halves of the
+// cycle count are scaled apart so no product overflows.
+static inline uint64
+vclockns(volatile struct vclock *vc, uint64 tsc)
+{
+  uint64 d;
+
+  d = tsc - vc->tsc0;
+  return (((d & 0xFFFFFFFF) * vc->mult) >> vc->shift) +
+         (((d >> 32) * vc->mult) << (32 - vc->shift));
+}
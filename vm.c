@@ -4,19 +4,26 @@
 #include "x86.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
 #include "elf.h"
+#include "traps.h"
+#include "vclock.h"
 
 extern char data[];  // defined in data.S
 
 static pde_t *kpgdir;  // for use in scheduler()
 
-// Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
-void
-kvmalloc(void)
-{
-  kpgdir = setupkvm();
-}
+// Pages set aside for killfault(), which must work when no other
+// memory is left.  Guarded by uvmlock.
+#define NSPARE NCPU
+static char *spare[NSPARE];
+static int nspare;
+static int pse;        // map the kernel with 4MB pages
+
+// Threads share a page table, so one may fault on a page while
+// another fills it in, forks, or shrinks the memory.  Page faults,
+// copyuvm() and deallocuvm() run under uvmlock.
+static struct spinlock uvmlock;
 
 // Set up CPU's kernel segment descriptors.
 // Run once at boot time on each CPU.
@@ -40,10 +47,27 @@ seginit(void)
 
   lgdt(c->gdt, sizeof(c->gdt));
   loadgs(SEG_KCPU << 3);
+
+  // sysenter starts on a small stack of the CPU's own, whose top
+  // word is the kernel stack pointer that switchuvm() keeps there;
+  // see sysentry.
+  if(cpuidedx() & (1<<11)){
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3);
+    wrmsr(MSR_SYSENTER_ESP, (uint)&c->sysstack[SYSSTACK-1]);
+    wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+  }
   
   // Initialize cpu-local storage.
   cpu = c;
   proc = 0;
+
+  // Large memmove()s use the SSE2 registers when there are any.
+  // Every CPU must turn the instructions on before it copies.
+  if((cpuidedx() & (CPUID_FXSR|CPUID_SSE2)) == (CPUID_FXSR|CPUID_SSE2)){
+    lcr0(rcr0() & ~(CR0_EM|CR0_TS));
+    lcr4(rcr4() | CR4_OSFXSR);
+    memsse = 1;
+  }
 }
 
 // Return the address of the PTE in page table pgdir
@@ -59,10 +83,9 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
   if(*pde & PTE_P){
     pgtab = (pte_t*)PTE_ADDR(*pde);
   } else {
-    if(!create || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!create || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table 
     // entries, if necessary.
@@ -106,30 +129,58 @@ mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
 // than its memory.
 // 
 // setupkvm() and exec() set up every page table like this:
-//    0..640K           : user memory (text, data, stack, heap)
+//    0..640K           : mapped direct (low memory, boot data)
 //    640K..1M          : mapped direct (for IO space)
 //    1M..end           : mapped direct (for the kernel's text and data)
-//    end..PHYSTOP      : mapped direct (kernel heap and user pages)
+//    end..phystop      : mapped direct (kernel heap and user pages)
+//    USERBASE..USERTOP : user memory (text, data, stack, heap)
+//    VCLOCK            : the clock page, read-only to the user
 //    0xfe000000..0     : mapped direct (devices such as ioapic)
 //
 // The kernel allocates memory for its heap and for user memory
-// between kernend and the end of physical memory (PHYSTOP).
+// between kernend and the end of physical memory (phystop), which
+// kinit() finds at boot and which stays below USERBASE.
 // The virtual address space of each user program includes the kernel
-// (which is inaccessible in user mode). The user program addresses
-// range from 0 till 640KB (USERTOP), which where the I/O hole starts
-// (both in physical memory and in the kernel's virtual address
-// space).
+// (which is inaccessible in user mode).  Where the CPU has PSE, the
+// direct map uses 4MB pages wherever an aligned one fits, so it
+// needs no page tables past the first 4MB.
 static struct kmap {
   void *p;
   void *e;
   int perm;
 } kmap[] = {
-  {(void*)USERTOP,    (void*)0x100000, PTE_W},  // I/O space
+  {(void*)0,          (void*)0x100000, PTE_W},  // low memory, I/O space
   {(void*)0x100000,    data,            0    },  // kernel text, rodata
-  {data,              (void*)PHYSTOP,  PTE_W},  // kernel data, memory
+  {data,              (void*)0,        PTE_W},  // kernel data, memory
   {(void*)0xFE000000, 0,               PTE_W},  // device mappings
 };
 
+// Map the range of k direct in pgdir.  An end of 0 means the top of
+// the address space.
+static int
+kmapone(pde_t *pgdir, struct kmap *k)
+{
+  uint a, n, size;
+
+  a = (uint)k->p;
+  size = (uint)k->e - a;
+  while(size > 0){
+    if(pse && a % PTSIZE == 0 && size >= PTSIZE){
+      pgdir[PDX(a)] = a | k->perm | PTE_P | PTE_PS;
+      n = PTSIZE;
+    } else {
+      n = PTSIZE - a % PTSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)a, n, a, k->perm) < 0)
+        return -1;
+    }
+    a += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
@@ -137,27 +188,47 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kzalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->p,
-                (uint)((char*)k->e - (char*)k->p),
-                (uint)k->p, k->perm) < 0)
+    if(kmapone(pgdir, k) < 0){
+      freevm(pgdir);
       return 0;
+    }
+  // freevm() frees the page table but, above USERTOP, not the page.
+  if(mappages(pgdir, (void*)VCLOCK, PGSIZE, PADDR(clockpage), PTE_U) < 0){
+    freevm(pgdir);
+    return 0;
+  }
 
   return pgdir;
 }
 
+// Allocate one page table for the machine for the kernel address
+// space for scheduler processes.
+void
+kvmalloc(void)
+{
+  pse = (cpuidedx() & (1<<3)) != 0;
+  kmap[2].e = (void*)phystop;  // free memory ends where kinit() found
+  kpgdir = setupkvm();
+  initlock(&uvmlock, "uvm");
+  while(nspare < NSPARE && (spare[nspare] = kalloc()) != 0)
+    nspare++;
+}
+
 // Turn on paging.
 void
 vmenable(void)
 {
   uint cr0;
 
+  if(pse)
+    lcr4(rcr4() | CR4_PSE);
   switchkvm(); // load kpgdir into cr3
   cr0 = rcr0();
-  cr0 |= CR0_PG;
+  // WP makes the kernel's own writes to copy-on-write pages fault too.
+  cr0 |= CR0_PG | CR0_WP;
   lcr0(cr0);
 }
 
@@ -166,6 +237,7 @@ vmenable(void)
 void
 switchkvm(void)
 {
+  cpu->pgdir = 0;
   lcr3(PADDR(kpgdir));    // switch to the kernel page table
 }
 
@@ -178,13 +250,64 @@ switchuvm(struct proc *p)
   cpu->gdt[SEG_TSS].s = 0;
   cpu->ts.ss0 = SEG_KDATA << 3;
   cpu->ts.esp0 = (uint)proc->kstack + KSTACKSIZE;
+  cpu->sysstack[SYSSTACK-1] = cpu->ts.esp0;
   ltr(SEG_TSS << 3);
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
+  // Set before the switch, so that tlbshootdown() cannot miss the
+  // page table here once this CPU can use it.
+  cpu->pgdir = p->pgdir;
   lcr3(PADDR(p->pgdir));  // switch to new address space
   popcli();
 }
 
+// Carry out the TLB flushes other CPUs have asked this one for.
+// Called from the IPI, and from loops that wait with interrupts off.
+void
+tlbpoll(void)
+{
+  uint req;
+
+  if((req = cpu->tlbreq) == cpu->tlbdone)
+    return;
+  lcr3(rcr3());
+  cpu->tlbdone = req;
+}
+
+// Page table pgdir lost mappings or had them made read-only.  Flush
+// them from the TLB of this CPU and of every other one with pgdir
+// loaded, where a thread sharing it runs, and wait until they have,
+// so that the caller may then free or copy the pages.  A CPU that
+// waits for a lock meanwhile flushes from acquire(), so the caller
+// may hold locks.
+void
+tlbshootdown(pde_t *pgdir)
+{
+  struct cpu *c;
+  uint want[NCPU];
+  int i;
+
+  if(cpu->pgdir == pgdir)
+    lcr3(rcr3());
+  // Read the other CPUs' page tables only after the PTE writes.
+  __sync_synchronize();
+  for(i = 0; i < ncpu; i++){
+    c = &cpus[i];
+    want[i] = 0;
+    if(c == cpu || c->pgdir != pgdir)
+      continue;
+    want[i] = __sync_add_and_fetch(&c->tlbreq, 1);
+    lapicipi(c->id, T_IRQ0 + IRQ_TLB);
+  }
+  for(i = 0; i < ncpu; i++){
+    c = &cpus[i];
+    while(want[i] && (int)(c->tlbdone - want[i]) < 0){
+      tlbpoll();
+      pause();
+    }
+  }
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -194,36 +317,17 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
-  mappages(pgdir, 0, PGSIZE, PADDR(mem), PTE_W|PTE_U);
+  mem = kzalloc();
+  mappages(pgdir, (void*)USERBASE, PGSIZE, PADDR(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
+// Map page mem at page-aligned user address va of pgdir with
+// permissions perm.  Returns 0, or -1 if out of memory.
 int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
+mapuvm(pde_t *pgdir, uint va, char *mem, int perm)
 {
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint)addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    if(!(*pte & PTE_P))
-      panic("loaduvm: page not present");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, (char*)pa, offset+i, n) != (int)n)
-      return -1;
-  }
-  return 0;
+  return mappages(pgdir, (void*)va, PGSIZE, PADDR(mem), perm);
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
@@ -241,18 +345,29 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     mappages(pgdir, (char*)a, PGSIZE, PADDR(mem), PTE_W|PTE_U);
   }
   return newsz;
 }
 
+// Free the n pages in gone[], just unmapped from pgdir, once no CPU
+// can reach them through its TLB any more.
+static void
+freegone(pde_t *pgdir, char **gone, int n)
+{
+  int i;
+
+  tlbshootdown(pgdir);
+  for(i = 0; i < n; i++)
+    kfree(gone[i]);
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz. oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz. oldsz can be larger than the actual
@@ -262,26 +377,46 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   pte_t *pte;
   uint a, pa;
+  char *gone[32];
+  int n, unmapped;
 
   if(newsz >= oldsz)
     return oldsz;
 
-  a = PGROUNDUP(newsz);
+  acquire(&uvmlock);
+  n = unmapped = 0;
+  a = PGROUNDUP(newsz < USERBASE ? USERBASE : newsz);
   for(; a < oldsz; a += PGSIZE){
     pte = walkpgdir(pgdir, (char*)a, 0);
-    if(pte && (*pte & PTE_P) != 0){
+    if(pte == 0){
+      // No page table: skip the rest of its range.
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & PTE_P) != 0){
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      kfree((char*)pa);
+      // Shared pages belong to whoever mapped them in.
+      if(!(*pte & PTE_S))
+        gone[n++] = (char*)pa;
       *pte = 0;
+      unmapped = 1;
+      if(n == (int)NELEM(gone)){
+        freegone(pgdir, gone, n);
+        n = 0;
+      }
     }
   }
+  if(unmapped)
+    freegone(pgdir, gone, n);
+  release(&uvmlock);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  A page table shared by threads (see clone())
+// counts its extra users in kref, and only the last one frees it.
 void
 freevm(pde_t *pgdir)
 {
@@ -289,45 +424,238 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, USERTOP, 0);
+  if(kunshare((char*)pgdir))
+    return;
+  deallocuvm(pgdir, USERTOP, USERBASE);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P)
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS))
       kfree((char*)PTE_ADDR(pgdir[i]));
   }
   kfree((char*)pgdir);
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  The pages themselves are shared read-only
+// and marked PTE_COW in both page tables; the first write to one
+// makes cowfault() copy it.  pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+  acquire(&uvmlock);
+  for(i = USERBASE; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    // Heap pages never touched are not there yet.
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0)
+    if(*pte & PTE_S){
+      if(mappages(d, (void*)i, PGSIZE, pa, PTE_W|PTE_U|PTE_S) < 0)
+        goto bad;
+      continue;
+    }
+    if(*pte & PTE_SHM){
+      if(mappages(d, (void*)i, PGSIZE, pa, PTE_W|PTE_U|PTE_SHM) < 0)
+        goto bad;
+      kdup((char*)pa);
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    if(mappages(d, (void*)i, PGSIZE, pa, *pte & (PTE_U|PTE_COW)) < 0)
       goto bad;
+    kdup((char*)pa);
   }
+  tlbshootdown(pgdir);   // the parent's pages are read-only now
+  release(&uvmlock);
   return d;
 
 bad:
+  tlbshootdown(pgdir);
+  release(&uvmlock);
   freevm(d);
   return 0;
 }
 
+// A process touched page va of pgdir, below its size but never
+// mapped: growproc() leaves new heap pages to be filled in here.
+// Map a zeroed page there.  Returns 0 if the access can be retried,
+// -1 if the page is mapped already or memory is short.
+int
+zerofault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+  int r;
+
+  acquire(&uvmlock);
+  // Another thread may have got here first.
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    release(&uvmlock);
+    return 0;
+  }
+  r = -1;
+  if((mem = kzalloc()) != 0){
+    if(mappages(pgdir, (void*)va, PGSIZE, PADDR(mem), PTE_W|PTE_U) == 0)
+      r = 0;
+    else
+      kfree(mem);
+  }
+  release(&uvmlock);
+  return r;
+}
+
+// A write hit page va of pgdir.  If it is a copy-on-write page,
+// make it writable, copying it first unless no one else maps it.
+// Returns 0 if the write can be retried, -1 otherwise.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  acquire(&uvmlock);
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte && (*pte & (PTE_P|PTE_W)) == (PTE_P|PTE_W)){
+    // Another thread copied it first.
+    release(&uvmlock);
+    lcr3(rcr3());
+    return 0;
+  }
+  if(pte == 0 || (*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW)){
+    release(&uvmlock);
+    return -1;
+  }
+  pa = PTE_ADDR(*pte);
+  if(!kshared((char*)pa)){
+    // Threads on other CPUs still holding it read-only fault again.
+    *pte |= PTE_W;
+    *pte &= ~PTE_COW;
+    release(&uvmlock);
+    lcr3(rcr3());
+    return 0;
+  }
+  if((mem = kalloc()) == 0){
+    release(&uvmlock);
+    return -1;
+  }
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PADDR(mem) | (*pte & 0xFFF & ~PTE_COW) | PTE_W;
+  // No thread may read the old copy once another has written the new.
+  tlbshootdown(pgdir);
+  kfree((char*)pa);   // one mapping fewer
+  release(&uvmlock);
+  return 0;
+}
+
+// A system call's use of user address va of pgdir faulted, and the
+// page cannot be filled in: memory is short, the page is read-only,
+// or another thread shrank the memory under the call.  Map a zeroed
+// page there, which only the kernel can use, so that the call runs
+// to its end for a caller about to be killed.  Returns 0, or -1 if
+// not even that can be done.
+int
+killfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint old;
+  char *mem;
+
+  acquire(&uvmlock);
+  if(nspare == 0 || (pte = walkpgdir(pgdir, (void*)va, 1)) == 0){
+    release(&uvmlock);
+    return -1;
+  }
+  mem = spare[--nspare];
+  memset(mem, 0, PGSIZE);
+  old = *pte;
+  *pte = PADDR(mem) | PTE_P | PTE_W;
+  if(old & PTE_P){
+    tlbshootdown(pgdir);
+    if(!(old & PTE_S))
+      kfree((char*)PTE_ADDR(old));
+  }
+  while(nspare < NSPARE && (mem = kalloc()) != 0)
+    spare[nspare++] = mem;
+  release(&uvmlock);
+  return 0;
+}
+
+// Ready user memory [va, va+n) of pgdir for the kernel to write to:
+// copy any copy-on-write pages now, when running out of memory can
+// still fail the system call.  Pages not filled in yet are left to
+// fault.  Returns 0, or -1 if memory is short or part of the range
+// is read-only.  The caller has checked it is below the process size.
+int
+prepwrite(pde_t *pgdir, uint va, uint n)
+{
+  pte_t *pte;
+  uint a;
+
+  if(n == 0)
+    return 0;
+  for(a = (uint)PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(pgdir, (void*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P))
+      continue;
+    if((*pte & PTE_COW) && cowfault(pgdir, a) < 0)
+      return -1;
+    if((*pte & (PTE_U|PTE_W)) != (PTE_U|PTE_W))
+      return -1;
+  }
+  return 0;
+}
+
+// Map the n pages in pages[] at page-aligned user address va.
+// The pages are marked PTE_S: deallocuvm() and freevm() unmap them
+// without freeing, and fork shares them instead of copying.
+// The caller keeps ownership and must never free them.
+int
+mapshared(pde_t *pgdir, uint va, char **pages, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE, PADDR(pages[i]),
+                PTE_W|PTE_U|PTE_S) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Map the n pages of a shared memory segment at page-aligned user
+// address va.  Each mapping holds a reference to its page, which
+// deallocuvm() drops like any other, so a page lives until the
+// segment and every process that attached it are done with it.
+// Fork shares the pages instead of marking them copy-on-write.
+int
+mapshm(pde_t *pgdir, uint va, char **pages, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE, PADDR(pages[i]),
+                PTE_W|PTE_U|PTE_SHM) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+    kdup(pages[i]);
+  }
+  return 0;
+}
+
 // Map user virtual address to kernel physical address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
@@ -335,13 +663,36 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
   return (char*)PTE_ADDR(*pte);
 }
 
+// Map user address uva of pgdir to a kernel address that stays the
+// same while the page is mapped: fill in a heap page not touched yet
+// and copy a copy-on-write one first.  *shared is set if the page is
+// mapped shared, a shared memory segment or ring that other page
+// tables map too, and cleared otherwise.  Returns 0 if uva is not in
+// writable user memory.
+char*
+uva2kaw(pde_t *pgdir, char *uva, int *shared)
+{
+  pte_t *pte;
+
+  pte = walkpgdir(pgdir, uva, 0);
+  if((pte == 0 || (*pte & PTE_P) == 0) && zerofault(pgdir, (uint)uva) < 0)
+    return 0;
+  pte = walkpgdir(pgdir, uva, 0);
+  if(pte && (*pte & PTE_COW) && cowfault(pgdir, (uint)uva) < 0)
+    return 0;
+  if(pte == 0 || (*pte & (PTE_P|PTE_U|PTE_W)) != (PTE_P|PTE_U|PTE_W))
+    return 0;
+  *shared = (*pte & (PTE_S|PTE_SHM)) != 0;
+  return (char*)PTE_ADDR(*pte) + ((uint)uva & (PGSIZE-1));
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
@@ -350,10 +701,15 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
   
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writing through the kernel mapping would bypass copy-on-write.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;